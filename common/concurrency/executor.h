@@ -21,14 +21,14 @@
 
 #pragma once
 
+#include "task_queue.h"
+
 #include "../exception/win32_exception.h"
 #include "../exception/exceptions.h"
 #include "../utility/string.h"
-#include "../utility/move_on_copy.h"
 #include "../log/log.h"
 
 #include <tbb/atomic.h>
-#include <tbb/concurrent_queue.h>
 
 #include <boost/thread.hpp>
 #include <boost/optional.hpp>
@@ -83,12 +83,17 @@ enum thread_priority
 
 class executor : boost::noncopyable
 {
-	const std::string name_;
-	boost::thread thread_;
-	tbb::atomic<bool> is_running_;
+	const std::string			name_;
+	boost::thread				thread_;
+	tbb::atomic<bool>			is_running_;
+	tbb::atomic<bool>			is_sleeping_;
+	tbb::atomic<int>			space_waiters_;
+	int							idle_spins_;
+	boost::mutex				mutex_;
+	boost::condition_variable	task_cond_;
+	boost::condition_variable	space_cond_;
 	
-	typedef tbb::concurrent_bounded_queue<std::function<void()>> function_queue;
-	function_queue execution_queue_[priority_count];
+	detail::task_queue			execution_queue_[priority_count];
 
 	template<typename Func>
 	auto create_task(Func&& func) -> boost::packaged_task<decltype(func())> // noexcept
@@ -111,10 +116,14 @@ class executor : boost::noncopyable
 	}
 
 public:
+	typedef std::ptrdiff_t size_type;
 
 	explicit executor(const std::wstring& name) : name_(narrow(name)) // noexcept
 	{
-		is_running_ = true;
+		is_running_		= true;
+		is_sleeping_	= false;
+		space_waiters_	= 0;
+		idle_spins_		= 0;
 		thread_ = boost::thread(&executor::run, this);
 	}
 	
@@ -126,12 +135,12 @@ public:
 
 	void set_capacity(size_t capacity) // noexcept
 	{
-		execution_queue_[normal_priority].set_capacity(capacity);
+		execution_queue_[normal_priority].set_capacity(static_cast<size_type>(capacity));
 	}
 
 	void set_priority_class(thread_priority p)
 	{
-		begin_invoke([=]
+		post([=]
 		{
 			if(p == high_priority_class)
 				SetThreadPriority(GetCurrentThread(), HIGH_PRIORITY_CLASS);
@@ -144,17 +153,33 @@ public:
 		});
 	}
 
-	void clear()
+	void clear() // noexcept
 	{
-		std::function<void()> func;
-		while(execution_queue_[normal_priority].try_pop(func));
-		while(execution_queue_[high_priority].try_pop(func));
+		if(!is_running_) // The execution thread runs the remaining tasks once stopped.
+			return;
+
+		try
+		{
+			invoke([=]
+			{
+				execution_queue_[normal_priority].clear([=]{notify_space();});
+				execution_queue_[high_priority].clear([]{});
+			}, high_priority);
+		}
+		catch(...)
+		{
+			if(is_running_) // Stopped after the check above, nothing to clear.
+				CASPAR_LOG_CURRENT_EXCEPTION();
+		}
 	}
 
 	void stop() // noexcept
 	{
-		is_running_ = false;
-		execution_queue_[normal_priority].try_push([]{}); // Wake the execution thread.
+		is_running_.fetch_and_store(false);
+
+		boost::mutex::scoped_lock lock(mutex_); // Wake the execution thread and any producers waiting for capacity.
+		task_cond_.notify_all();
+		space_cond_.notify_all();
 	}
 
 	void wait() // noexcept
@@ -168,34 +193,21 @@ public:
 			thread_.join();
 	}
 
+	// Enqueues func without creating a future. Exceptions thrown by func are logged.
+	template<typename Func>
+	void post(Func&& func, task_priority priority = normal_priority)
+	{
+		push(std::forward<Func>(func), priority);
+	}
+
 	template<typename Func>
 	auto begin_invoke(Func&& func, task_priority priority = normal_priority) -> boost::unique_future<decltype(func())> // noexcept
 	{
-		if(!is_running_)
-			BOOST_THROW_EXCEPTION(invalid_operation() << msg_info("executor not running."));
+		auto task = create_task(std::forward<Func>(func));
 
-		// Create a move on copy adaptor to avoid copying the functor into the queue, tbb::concurrent_queue does not support move semantics.
-		auto task_adaptor = make_move_on_copy(create_task(func));
+		auto future = task.get_future();
 
-		auto future = task_adaptor.value.get_future();
-
-		execution_queue_[priority].push([=]
-		{
-			try
-			{
-				task_adaptor.value();
-			}
-			catch(boost::task_already_started&)
-			{
-			}
-			catch(...)
-			{
-				CASPAR_LOG_CURRENT_EXCEPTION();
-			}
-		});
-
-		if(priority != normal_priority)
-			execution_queue_[normal_priority].push(nullptr);
+		push(std::move(task), priority);
 
 		return std::move(future);
 	}
@@ -214,65 +226,132 @@ public:
 		if(boost::this_thread::get_id() != thread_.get_id())  // Only yield when calling from execution thread.
 			return;
 
-		std::function<void()> func;
-		while(execution_queue_[high_priority].try_pop(func))
-		{
-			if(func)
-				func();
-		}
+		while(execute_one(high_priority));
 	}
 
-	function_queue::size_type capacity() const /*noexcept*/ { return execution_queue_[normal_priority].capacity();	}
-	function_queue::size_type size() const /*noexcept*/ { return execution_queue_[normal_priority].size();	}
-	bool empty() const /*noexcept*/	{ return execution_queue_[normal_priority].empty();	}
+	size_type capacity() const /*noexcept*/ { return execution_queue_[normal_priority].capacity();	}
+	size_type size() const /*noexcept*/ { return execution_queue_[normal_priority].size();	}
+	bool empty() const /*noexcept*/	{ return size() == 0;	}
 	bool is_running() const /*noexcept*/ { return is_running_; }	
 
 private:
-	
-	void execute() // noexcept
+
+	template<typename Func>
+	void push(Func&& func, task_priority priority)
 	{
-		std::function<void()> func;
-		execution_queue_[normal_priority].pop(func);	
+		if(!is_running_)
+			BOOST_THROW_EXCEPTION(invalid_operation() << msg_info("executor not running."));
+
+		auto& queue = execution_queue_[priority];
+
+		while(!queue.try_push(std::forward<Func>(func))) // func is only consumed once the push succeeds.
+		{
+			boost::mutex::scoped_lock lock(mutex_);
 
-		yield();
+			++space_waiters_;
+			while(queue.full() && is_running_)
+				space_cond_.wait(lock);
+			--space_waiters_;
 
-		if(func)
-			func();
+			if(!is_running_)
+				BOOST_THROW_EXCEPTION(invalid_operation() << msg_info("executor not running."));
+		}
+
+		if(is_sleeping_) // try_push is a full fence, see wait_for_task.
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			task_cond_.notify_one();
+		}
 	}
 
-	void execute_rest(task_priority priority) // noexcept
+	void notify_space()
 	{
-		std::function<void()> func;
+		if(space_waiters_ > 0)
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			space_cond_.notify_all();
+		}
+	}
 
-		while (execution_queue_[priority].try_pop(func))
-			if (func)
-				func();
+	bool has_tasks() const
+	{
+		return execution_queue_[high_priority].size() > 0 || execution_queue_[normal_priority].size() > 0;
 	}
 
-	void run() // noexcept
+	void wait_for_task()
 	{
-		win32_exception::ensure_handler_installed_for_thread(name_.c_str());
-		while(is_running_)
+		if(has_tasks())
+			return;
+
+		boost::mutex::scoped_lock lock(mutex_);
+
+		is_sleeping_.fetch_and_store(true); // Full fence before checking the queues, pairs with push.
+		while(!has_tasks() && is_running_)
+			task_cond_.wait(lock);
+		is_sleeping_ = false;
+	}
+
+	bool execute_one(task_priority priority) // noexcept
+	{
+		try
 		{
-			try
-			{
-				execute();
-			}
-			catch(...)
-			{
-				CASPAR_LOG_CURRENT_EXCEPTION();
-			}
+			if(priority == normal_priority)
+				return execution_queue_[priority].try_run([=]{notify_space();});
+			else
+				return execution_queue_[priority].try_run([]{});
 		}
-		try
+		catch(boost::task_already_started&)
 		{
-			execute_rest(high_priority);
-			execute_rest(normal_priority);
 		}
-		catch (...)
+		catch(...)
 		{
 			CASPAR_LOG_CURRENT_EXCEPTION();
 		}
+
+		return true;
+	}
+
+	void execute() // noexcept
+	{
+		wait_for_task();
+
+		bool executed = false;
+		while(execute_one(high_priority))
+			executed = true;
+
+		if(execute_one(normal_priority) || executed)
+			idle_spins_ = 0;
+		else
+			back_off();
+	}
+
+	// A task has been counted but its producer has not yet published it, spins briefly and then
+	// gives up the time slice rather than busy looping until the producer is scheduled again.
+	void back_off() // noexcept
+	{
+		if(++idle_spins_ <= 16)
+		{
+			for(int n = 0; n < idle_spins_; ++n)
+				YieldProcessor();
+		}
+		else
+			boost::this_thread::yield();
+	}
+
+	void execute_rest(task_priority priority) // noexcept
+	{
+		while(execute_one(priority));
+	}
+
+	void run() // noexcept
+	{
+		win32_exception::ensure_handler_installed_for_thread(name_.c_str());
+		while(is_running_)
+			execute();
+
+		execute_rest(high_priority);
+		execute_rest(normal_priority);
 	}
 };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,355 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+#pragma once
+
+#include <tbb/atomic.h>
+
+#include <boost/aligned_storage.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/type_traits.hpp>
+
+#include <cstddef>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+namespace caspar { namespace detail {
+
+// Type erased nullary functor. Functors that fit storage_size are stored inline,
+// larger ones are allocated on the heap.
+class task : boost::noncopyable
+{
+public:
+	static const std::size_t storage_size = 48;
+
+private:
+	boost::aligned_storage<storage_size, 8>	storage_;
+	void									(*invoke_)(void*);
+	void									(*destroy_)(void*);
+
+	template<typename T>
+	struct local_ops
+	{
+		static void invoke(void* p)		{ (*static_cast<T*>(p))(); }
+		static void destroy(void* p)	{ static_cast<T*>(p)->~T(); }
+	};
+
+	template<typename T>
+	struct heap_ops
+	{
+		static void invoke(void* p)		{ (**static_cast<T**>(p))(); }
+		static void destroy(void* p)	{ delete *static_cast<T**>(p); }
+	};
+
+	template<typename T, typename Func>
+	void emplace(Func&& func, boost::true_type /* is_local */)
+	{
+		new(storage_.address()) T(std::forward<Func>(func));
+		invoke_  = &local_ops<T>::invoke;
+		destroy_ = &local_ops<T>::destroy;
+	}
+
+	template<typename T, typename Func>
+	void emplace(Func&& func, boost::false_type /* is_local */)
+	{
+		*static_cast<T**>(storage_.address()) = new T(std::forward<Func>(func));
+		invoke_  = &heap_ops<T>::invoke;
+		destroy_ = &heap_ops<T>::destroy;
+	}
+
+public:
+	task()
+		: invoke_(nullptr)
+		, destroy_(nullptr)
+	{
+	}
+
+	template<typename Func>
+	explicit task(Func&& func)
+		: invoke_(nullptr)
+		, destroy_(nullptr)
+	{
+		assign(std::forward<Func>(func));
+	}
+
+	~task()
+	{
+		reset();
+	}
+
+	template<typename Func>
+	void assign(Func&& func)
+	{
+		typedef typename std::decay<Func>::type func_type;
+		typedef boost::integral_constant<bool, sizeof(func_type) <= storage_size && boost::alignment_of<func_type>::value <= 8> is_local;
+
+		reset();
+		emplace<func_type>(std::forward<Func>(func), is_local());
+	}
+
+	void reset()
+	{
+		if(!destroy_)
+			return;
+
+		auto destroy = destroy_;
+		invoke_  = nullptr;
+		destroy_ = nullptr;
+		destroy(storage_.address());
+	}
+
+	void operator()()
+	{
+		if(invoke_)
+			invoke_(storage_.address());
+	}
+
+	bool empty() const
+	{
+		return invoke_ == nullptr;
+	}
+};
+
+// Bounded multi-producer single-consumer task queue. Tasks are constructed in place in a
+// fixed ring of slots, the ring only spills over into a heap allocated list when it is full,
+// which keeps the queue unbounded unless a capacity is set.
+class task_queue : boost::noncopyable
+{
+	struct cell
+	{
+		tbb::atomic<std::size_t>	sequence;
+		task						value;
+	};
+
+	const std::size_t							mask_;
+	boost::scoped_array<cell>					cells_;
+	tbb::atomic<std::size_t>					enqueue_pos_;
+	char										padding_[64];
+	std::size_t									dequeue_pos_;
+	tbb::atomic<std::ptrdiff_t>					size_;
+	tbb::atomic<std::ptrdiff_t>					capacity_;
+
+	boost::mutex								overflow_mutex_;
+	std::deque<std::unique_ptr<task>>			overflow_;
+	tbb::atomic<std::size_t>					overflow_size_;
+
+	static std::size_t round_up_pow2(std::size_t value)
+	{
+		std::size_t result = 2;
+		while(result < value)
+			result <<= 1;
+		return result;
+	}
+
+public:
+	explicit task_queue(std::size_t ring_size = 256)
+		: mask_(round_up_pow2(ring_size) - 1)
+		, cells_(new cell[mask_ + 1])
+		, dequeue_pos_(0)
+	{
+		for(std::size_t n = 0; n <= mask_; ++n)
+			cells_[n].sequence = n;
+
+		enqueue_pos_	= 0;
+		size_			= 0;
+		capacity_		= std::numeric_limits<std::ptrdiff_t>::max();
+		overflow_size_	= 0;
+	}
+
+	// Returns false if the queue is at capacity, func is left untouched in that case.
+	template<typename Func>
+	bool try_push(Func&& func)
+	{
+		for(std::ptrdiff_t size = size_; ; )
+		{
+			if(size >= capacity_)
+				return false;
+
+			const auto prev = size_.compare_and_swap(size + 1, size);
+			if(prev == size)
+				break;
+
+			size = prev;
+		}
+
+		// Once tasks have spilled over all producers use the overflow list until the consumer has drained it,
+		// which preserves the order of tasks from the same producer.
+		if(overflow_size_ == 0 && try_push_ring(std::forward<Func>(func)))
+			return true;
+
+		try
+		{
+			std::unique_ptr<task> overflow_task(new task(std::forward<Func>(func))); // func has not been moved from, try_push_ring only consumes it on success.
+
+			boost::mutex::scoped_lock lock(overflow_mutex_);
+			overflow_.push_back(std::move(overflow_task));
+			++overflow_size_;
+		}
+		catch(...)
+		{
+			--size_;
+			throw;
+		}
+
+		return true;
+	}
+
+	// Consumer only. Runs the oldest task and returns true, or returns false if there is nothing to run.
+	// Also returns false while size() counts a task whose producer has not yet published it.
+	// on_claim is called once the task has been removed from the queue but before it is run.
+	template<typename Func>
+	bool try_run(const Func& on_claim)
+	{
+		return try_consume(on_claim, true);
+	}
+
+	// Consumer only. Destroys all pending tasks without running them.
+	template<typename Func>
+	void clear(const Func& on_claim)
+	{
+		while(try_consume(on_claim, false));
+	}
+
+	void set_capacity(std::ptrdiff_t capacity)
+	{
+		capacity_ = capacity;
+	}
+
+	std::ptrdiff_t capacity() const
+	{
+		return capacity_;
+	}
+
+	std::ptrdiff_t size() const
+	{
+		return size_;
+	}
+
+	bool full() const
+	{
+		return size_ >= capacity_;
+	}
+
+private:
+	template<typename Func>
+	bool try_push_ring(Func&& func)
+	{
+		std::size_t pos = enqueue_pos_;
+		for(;;)
+		{
+			cell& c = cells_[pos & mask_];
+
+			const auto dif = static_cast<std::ptrdiff_t>(c.sequence) - static_cast<std::ptrdiff_t>(pos);
+			if(dif == 0)
+			{
+				const auto prev = enqueue_pos_.compare_and_swap(pos + 1, pos);
+				if(prev == pos)
+				{
+					try
+					{
+						c.value.assign(std::forward<Func>(func));
+					}
+					catch(...)
+					{
+						c.sequence = pos + 1; // Publish the empty slot, the consumer releases the reservation.
+						throw;
+					}
+					c.sequence = pos + 1;
+					return true;
+				}
+				pos = prev;
+			}
+			else if(dif < 0)
+				return false;
+			else
+				pos = enqueue_pos_;
+		}
+	}
+
+	template<typename Func>
+	bool try_consume(const Func& on_claim, bool run)
+	{
+		const std::size_t pos = dequeue_pos_;
+		cell& c = cells_[pos & mask_];
+
+		if(c.sequence == pos + 1)
+		{
+			// The slot is claimed before running so that tasks which yield continue with the next task,
+			// it is not handed back to producers until the task has finished.
+			struct scoped_release : boost::noncopyable
+			{
+				cell&				c;
+				const std::size_t	sequence;
+
+				scoped_release(cell& c, std::size_t sequence)
+					: c(c)
+					, sequence(sequence)
+				{
+				}
+
+				~scoped_release()
+				{
+					c.value.reset();
+					c.sequence = sequence;
+				}
+			} release(c, pos + mask_ + 1);
+
+			dequeue_pos_ = pos + 1;
+			--size_;
+			on_claim();
+
+			if(run)
+				c.value();
+
+			return true;
+		}
+
+		// Spilled over tasks are newer than anything in the ring, only take them once the ring is empty.
+		if(overflow_size_ == 0 || enqueue_pos_ != pos)
+			return false;
+
+		std::unique_ptr<task> overflow_task;
+		{
+			boost::mutex::scoped_lock lock(overflow_mutex_);
+			if(overflow_.empty())
+				return false;
+
+			overflow_task = std::move(overflow_.front());
+			overflow_.pop_front();
+			--overflow_size_;
+		}
+
+		--size_;
+		on_claim();
+
+		if(run)
+			(*overflow_task)();
+
+		return true;
+	}
+};
+
+}}
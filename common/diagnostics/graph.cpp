@@ -22,6 +22,7 @@
 #include "../stdafx.h"
 
 #include "graph.h"
+#include "metrics.h"
 
 #pragma warning (disable : 4244)
 
@@ -32,6 +33,7 @@
 #include <SFML/Graphics.hpp>
 
 #include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/optional.hpp>
 #include <boost/circular_buffer.hpp>
 #include <boost/range/algorithm_ext/erase.hpp>
@@ -41,8 +43,10 @@
 #include <tbb/spin_mutex.h>
 
 #include <array>
+#include <list>
 #include <numeric>
 #include <tuple>
+#include <vector>
 
 namespace caspar { namespace diagnostics {
 		
@@ -210,6 +214,9 @@ class line : public drawable
 	tbb::atomic<float>	tick_data_;
 	tbb::atomic<bool>	tick_tag_;
 	tbb::atomic<int>	color_;
+
+	histogram			values_;
+	tbb::atomic<std::uint32_t> tags_;
 public:
 	line(uint32_t res = 1200)
 		: line_data_(res)
@@ -217,6 +224,7 @@ public:
 		tick_data_	= -1.0f;
 		color_		= 0xFFFFFFFF;
 		tick_tag_	= false;
+		tags_		= 0;
 
 		line_data_.push_back(std::make_pair(-1.0f, false));
 	}
@@ -224,11 +232,29 @@ public:
 	void set_value(float value)
 	{
 		tick_data_ = value;
+
+		if(is_metrics_enabled())
+			values_.record(value);
 	}
 	
 	void set_tag()
 	{
 		tick_tag_ = true;
+
+		if(is_metrics_enabled())
+			++tags_;
+	}
+
+	void sample(metric_sample& sample, histogram_snapshot& snapshot)
+	{
+		values_.take(snapshot);
+
+		sample.count	= snapshot.count;
+		sample.tags		= tags_.fetch_and_store(0);
+		sample.last		= tick_data_;
+		sample.p50		= snapshot.percentile(0.5);
+		sample.p99		= snapshot.percentile(0.99);
+		sample.max		= snapshot.max;
 	}
 		
 	void set_color(int color)
@@ -273,17 +299,40 @@ public:
 	}
 };
 
-struct graph::impl : public drawable
+struct metrics_source
+{
+	virtual ~metrics_source(){}
+	virtual int id() const = 0;
+	virtual std::string name() const = 0;
+	virtual void collect(std::vector<metric_sample>& samples, histogram_snapshot& snapshot, const std::string& name) = 0;
+};
+
+struct graph::impl : public drawable, public metrics_source
 {
 	tbb::concurrent_unordered_map<std::string, diagnostics::line> lines_;
 
-	tbb::spin_mutex mutex_;
+	const int id_;
+	mutable tbb::spin_mutex mutex_;
 	std::wstring text_;
+	std::string name_;
 	bool auto_reset_;
 
+	static int next_id()
+	{
+		static tbb::atomic<int> id;
+		return ++id;
+	}
+
 	impl()
-		: auto_reset_(false)
+		: id_(next_id())
+		, name_("graph")
+		, auto_reset_(false)
+	{
+	}
+
+	int id() const
 	{
+		return id_;
 	}
 		
 	void set_text(const std::wstring& value)
@@ -295,6 +344,21 @@ struct graph::impl : public drawable
 		});
 	}
 
+	void set_name(const std::string& name)
+	{
+		auto temp = name;
+		lock(mutex_, [&]
+		{
+			name_ = std::move(temp);
+		});
+	}
+
+	std::string name() const
+	{
+		tbb::spin_mutex::scoped_lock lock(mutex_);
+		return name_;
+	}
+
 	void set_value(const std::string& name, double value)
 	{
 		lines_[name].set_value(value);
@@ -317,6 +381,20 @@ struct graph::impl : public drawable
 			auto_reset_ = true;
 		});
 	}
+
+	void collect(std::vector<metric_sample>& samples, histogram_snapshot& snapshot, const std::string& name)
+	{
+		for(auto it = lines_.begin(); it != lines_.end(); ++it)
+		{
+			metric_sample sample;
+			sample.graph	= name;
+			sample.series	= it->first;
+			it->second.sample(sample, snapshot);
+
+			if(sample.last > -0.5 || sample.count > 0 || sample.tags > 0) // Lines which have only been given a color have no data.
+				samples.push_back(sample);
+		}
+	}
 		
 private:
 	void render(sf::RenderTarget& target)
@@ -406,16 +484,63 @@ graph::graph() : impl_(new impl())
 }
 
 void graph::set_text(const std::wstring& value){impl_->set_text(value);}
+void graph::set_name(const std::string& name){impl_->set_name(name);}
 void graph::set_value(const std::string& name, double value){impl_->set_value(name, value);}
 void graph::set_color(const std::string& name, int color){impl_->set_color(name, color);}
 void graph::set_tag(const std::string& name){impl_->set_tag(name);}
 void graph::auto_reset(){impl_->auto_reset();}
 
+namespace {
+
+tbb::spin_mutex								g_graphs_mutex;
+std::list<std::weak_ptr<metrics_source>>	g_graphs;
+
+}
+
 void register_graph(const safe_ptr<graph>& graph)
 {
+	{
+		tbb::spin_mutex::scoped_lock lock(g_graphs_mutex);
+		g_graphs.push_back(graph->impl_);
+	}
+
 	context::register_drawable(graph->impl_);
 }
 
+namespace detail {
+
+void collect_graph_metrics(std::vector<metric_sample>& samples)
+{
+	std::vector<std::shared_ptr<metrics_source>> graphs;
+
+	{
+		tbb::spin_mutex::scoped_lock lock(g_graphs_mutex);
+
+		for(auto it = g_graphs.begin(); it != g_graphs.end();)
+		{
+			auto graph = it->lock();
+
+			if(graph)
+			{
+				graphs.push_back(graph);
+				++it;
+			}
+			else
+				it = g_graphs.erase(it);
+		}
+	}
+
+	histogram_snapshot snapshot;
+
+	BOOST_FOREACH(auto& graph, graphs)
+	{
+		// The id a graph was created with keeps its label when other graphs with the same name come and go.
+		graph->collect(samples, snapshot, graph->name() + "-" + boost::lexical_cast<std::string>(graph->id()));
+	}
+}
+
+}
+
 void show_graphs(bool value)
 {
 	context::show(value);
@@ -37,6 +37,7 @@ class graph
 public:
 	graph();
 	void set_text(const std::wstring& value);
+	void set_name(const std::string& name); // Identifies the graph in the exported metrics, unlike the displayed text it should not change.
 	void set_value(const std::string& name, double value);
 	void set_color(const std::string& name, int color);
 	void set_tag(const std::string& name);
@@ -0,0 +1,476 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+#include "../stdafx.h"
+
+#include "metrics.h"
+
+#include "../log/log.h"
+#include "../exception/win32_exception.h"
+#include "../utility/string.h"
+
+#include <boost/asio.hpp>
+#include <boost/foreach.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <tbb/spin_mutex.h>
+
+#include <algorithm>
+#include <fstream>
+#include <list>
+#include <sstream>
+
+namespace caspar { namespace diagnostics {
+
+namespace {
+
+const double MICRO_UNITS = 1000000.0;
+
+tbb::atomic<bool> g_is_enabled;
+
+}
+
+histogram_snapshot::histogram_snapshot()
+	: count(0)
+	, max(0.0)
+	, buckets(histogram::bucket_count, 0)
+{
+}
+
+double histogram_snapshot::percentile(double fraction) const
+{
+	if(count == 0)
+		return 0.0;
+
+	const std::uint64_t rank = static_cast<std::uint64_t>(fraction * static_cast<double>(count - 1));
+
+	std::uint64_t seen = 0;
+	for(int n = 0; n < histogram::bucket_count; ++n)
+	{
+		seen += buckets[n];
+
+		if(seen > rank)
+			return std::min(max, histogram::bucket_value(n));
+	}
+
+	return max;
+}
+
+histogram::histogram()
+{
+	for(int n = 0; n < bucket_count; ++n)
+		buckets_[n] = 0;
+
+	max_ = 0;
+}
+
+histogram::histogram(const histogram& other)
+{
+	for(int n = 0; n < bucket_count; ++n)
+		buckets_[n] = other.buckets_[n];
+
+	max_ = other.max_;
+}
+
+int histogram::bucket_index(std::uint64_t value)
+{
+	if(value < 8)
+		return static_cast<int>(value);
+
+	int msb = 63;
+	while(!(value & (static_cast<std::uint64_t>(1) << msb)))
+		--msb;
+
+	const int sub_bucket = static_cast<int>((value >> (msb - 3)) & 7);
+
+	return (msb - 2) * 8 + sub_bucket;
+}
+
+double histogram::bucket_value(int index)
+{
+	if(index < 8)
+		return static_cast<double>(index) / MICRO_UNITS;
+
+	const int msb			= index / 8 + 2;
+	const int sub_bucket	= index % 8;
+	const double lower		= static_cast<double>((static_cast<std::uint64_t>(8 + sub_bucket)) << (msb - 3));
+	const double width		= static_cast<double>(static_cast<std::uint64_t>(1) << (msb - 3));
+
+	return (lower + width * 0.5) / MICRO_UNITS;
+}
+
+void histogram::record(double value)
+{
+	const std::uint64_t micro_value = value <= 0.0 ? 0 : static_cast<std::uint64_t>(std::min(value, 1.0e12) * MICRO_UNITS + 0.5);
+
+	++buckets_[bucket_index(micro_value)];
+
+	std::uint64_t current = max_;
+	while(micro_value > current)
+	{
+		const std::uint64_t previous = max_.compare_and_swap(micro_value, current);
+
+		if(previous == current)
+			break;
+
+		current = previous;
+	}
+}
+
+void histogram::take(histogram_snapshot& snapshot)
+{
+	snapshot.count = 0;
+
+	for(int n = 0; n < bucket_count; ++n)
+	{
+		snapshot.buckets[n] = buckets_[n].fetch_and_store(0);
+		snapshot.count += snapshot.buckets[n];
+	}
+
+	snapshot.max = static_cast<double>(max_.fetch_and_store(0)) / MICRO_UNITS;
+}
+
+namespace {
+
+// Periodically collects the aggregated values of all registered graphs and hands them to the exporters.
+class sampler : boost::noncopyable
+{
+	tbb::spin_mutex												mutex_;
+	std::list<std::shared_ptr<metrics_exporter>>				exporters_;
+	tbb::atomic<int>											interval_;
+
+	boost::mutex												wait_mutex_;
+	boost::condition_variable									wait_cond_;
+	bool														is_running_;
+	boost::thread												thread_;
+public:
+	static sampler& get_instance()
+	{
+		static sampler instance;
+		return instance;
+	}
+
+	std::shared_ptr<void> add(const safe_ptr<metrics_exporter>& exporter)
+	{
+		std::shared_ptr<metrics_exporter> entry = exporter;
+
+		{
+			tbb::spin_mutex::scoped_lock lock(mutex_);
+			exporters_.push_back(entry);
+			g_is_enabled = true;
+		}
+
+		{
+			boost::lock_guard<boost::mutex> lock(wait_mutex_);
+
+			if(!thread_.joinable())
+				thread_ = boost::thread([this] { run(); });
+		}
+
+		return std::shared_ptr<void>(nullptr, [this, entry](void*)
+		{
+			tbb::spin_mutex::scoped_lock lock(mutex_);
+			exporters_.remove(entry);
+			g_is_enabled = !exporters_.empty();
+		});
+	}
+
+	void set_interval(int milliseconds)
+	{
+		interval_ = std::max(10, milliseconds);
+	}
+private:
+	sampler()
+		: is_running_(true)
+	{
+		interval_ = 1000;
+	}
+
+	~sampler()
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(wait_mutex_);
+			is_running_ = false;
+			wait_cond_.notify_one();
+		}
+
+		if(thread_.joinable())
+			thread_.join();
+	}
+
+	void run()
+	{
+		win32_exception::ensure_handler_installed_for_thread("diagnostics-metrics-thread");
+
+		std::vector<metric_sample> samples;
+		std::vector<std::shared_ptr<metrics_exporter>> exporters;
+
+		while(true)
+		{
+			{
+				boost::unique_lock<boost::mutex> lock(wait_mutex_);
+
+				if(is_running_)
+					wait_cond_.timed_wait(lock, boost::posix_time::milliseconds(interval_));
+
+				if(!is_running_)
+					return;
+			}
+
+			{
+				tbb::spin_mutex::scoped_lock lock(mutex_);
+				exporters.assign(exporters_.begin(), exporters_.end());
+			}
+
+			if(exporters.empty())
+				continue;
+
+			try
+			{
+				samples.clear();
+				detail::collect_graph_metrics(samples);
+
+				BOOST_FOREACH(auto& exporter, exporters)
+					exporter->export_samples(samples);
+			}
+			catch(...)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+			}
+
+			exporters.clear();
+		}
+	}
+};
+
+class file_exporter : public metrics_exporter
+{
+	std::ofstream file_;
+public:
+	explicit file_exporter(const std::wstring& filename)
+		: file_(filename.c_str(), std::ios::out | std::ios::app)
+	{
+		if(!file_.is_open())
+			CASPAR_LOG(warning) << L"Failed to open metrics file " << filename;
+	}
+
+	virtual void export_samples(const std::vector<metric_sample>& samples)
+	{
+		if(!file_.is_open())
+			return;
+
+		const std::string timestamp = boost::posix_time::to_iso_extended_string(boost::posix_time::microsec_clock::local_time());
+
+		BOOST_FOREACH(auto& sample, samples)
+		{
+			file_
+				<< timestamp << "\t" << sample.graph << "\t" << sample.series
+				<< "\tcount=" << sample.count
+				<< "\ttags=" << sample.tags
+				<< "\tlast=" << sample.last
+				<< "\tp50=" << sample.p50
+				<< "\tp99=" << sample.p99
+				<< "\tmax=" << sample.max
+				<< "\n";
+		}
+
+		file_.flush();
+	}
+};
+
+std::string escape_label(const std::string& value)
+{
+	std::string result;
+	result.reserve(value.size());
+
+	BOOST_FOREACH(char c, value)
+	{
+		if(c == '\\' || c == '"')
+			result += '\\';
+
+		if(c == '\n')
+			result += "\\n";
+		else
+			result += c;
+	}
+
+	return result;
+}
+
+// Serves the latest samples in the Prometheus text exposition format to any HTTP request.
+class prometheus_exporter : public metrics_exporter
+{
+	struct connection : std::enable_shared_from_this<connection>
+	{
+		boost::asio::ip::tcp::socket	socket_;
+		boost::asio::streambuf			request_;
+		std::string						response_;
+
+		explicit connection(boost::asio::io_service& service)
+			: socket_(service)
+		{
+		}
+
+		void start(const std::string& body)
+		{
+			std::stringstream response;
+			response
+				<< "HTTP/1.0 200 OK\r\n"
+				<< "Content-Type: text/plain; version=0.0.4\r\n"
+				<< "Content-Length: " << body.size() << "\r\n"
+				<< "Connection: close\r\n\r\n"
+				<< body;
+			response_ = response.str();
+
+			auto self = shared_from_this();
+			boost::asio::async_read_until(socket_, request_, "\r\n\r\n", [self](const boost::system::error_code& ec, std::size_t)
+			{
+				if(ec)
+					return;
+
+				boost::asio::async_write(self->socket_, boost::asio::buffer(self->response_), [self](const boost::system::error_code&, std::size_t)
+				{
+					boost::system::error_code ignored;
+					self->socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+				});
+			});
+		}
+	};
+
+	struct state
+	{
+		std::shared_ptr<boost::asio::io_service>	service;
+		boost::asio::ip::tcp::acceptor				acceptor;
+		tbb::spin_mutex								mutex;
+		std::string									body;
+
+		state(const std::shared_ptr<boost::asio::io_service>& service, unsigned short port)
+			: service(service)
+			, acceptor(*service, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port))
+		{
+		}
+	};
+
+	std::shared_ptr<state> state_;
+public:
+	prometheus_exporter(const std::shared_ptr<boost::asio::io_service>& service, unsigned short port)
+		: state_(std::make_shared<state>(service, port))
+	{
+		accept(state_);
+	}
+
+	~prometheus_exporter()
+	{
+		auto state = state_;
+		state_->service->post([state]
+		{
+			boost::system::error_code ignored;
+			state->acceptor.close(ignored);
+		});
+	}
+
+	virtual void export_samples(const std::vector<metric_sample>& samples)
+	{
+		std::stringstream body;
+
+		body << "# TYPE casparcg_graph_value summary\n";
+		BOOST_FOREACH(auto& sample, samples)
+		{
+			const std::string labels = "graph=\"" + escape_label(sample.graph) + "\",series=\"" + escape_label(sample.series) + "\"";
+
+			body << "casparcg_graph_value{" << labels << ",quantile=\"0.5\"} " << sample.p50 << "\n";
+			body << "casparcg_graph_value{" << labels << ",quantile=\"0.99\"} " << sample.p99 << "\n";
+			body << "casparcg_graph_value{" << labels << ",quantile=\"1\"} " << sample.max << "\n";
+			body << "casparcg_graph_value_count{" << labels << "} " << sample.count << "\n";
+		}
+
+		body << "# TYPE casparcg_graph_last gauge\n";
+		BOOST_FOREACH(auto& sample, samples)
+			body << "casparcg_graph_last{graph=\"" << escape_label(sample.graph) << "\",series=\"" << escape_label(sample.series) << "\"} " << sample.last << "\n";
+
+		body << "# TYPE casparcg_graph_tags gauge\n";
+		BOOST_FOREACH(auto& sample, samples)
+			body << "casparcg_graph_tags{graph=\"" << escape_label(sample.graph) << "\",series=\"" << escape_label(sample.series) << "\"} " << sample.tags << "\n";
+
+		auto text = body.str();
+
+		tbb::spin_mutex::scoped_lock lock(state_->mutex);
+		state_->body.swap(text);
+	}
+private:
+	static void accept(const std::shared_ptr<state>& state)
+	{
+		auto conn = std::make_shared<connection>(*state->service);
+		std::weak_ptr<prometheus_exporter::state> weak_state = state;
+
+		state->acceptor.async_accept(conn->socket_, [weak_state, conn](const boost::system::error_code& ec)
+		{
+			auto state = weak_state.lock();
+
+			if(!state || ec == boost::asio::error::operation_aborted)
+				return;
+
+			if(!ec)
+			{
+				std::string body;
+				{
+					tbb::spin_mutex::scoped_lock lock(state->mutex);
+					body = state->body;
+				}
+
+				conn->start(body);
+			}
+
+			accept(state);
+		});
+	}
+};
+
+}
+
+std::shared_ptr<void> register_metrics_exporter(const safe_ptr<metrics_exporter>& exporter)
+{
+	return sampler::get_instance().add(exporter);
+}
+
+void set_metrics_interval(int milliseconds)
+{
+	sampler::get_instance().set_interval(milliseconds);
+}
+
+bool is_metrics_enabled()
+{
+	return g_is_enabled;
+}
+
+safe_ptr<metrics_exporter> create_file_metrics_exporter(const std::wstring& filename)
+{
+	return make_safe<file_exporter>(filename);
+}
+
+safe_ptr<metrics_exporter> create_prometheus_metrics_exporter(const std::shared_ptr<boost::asio::io_service>& service, unsigned short port)
+{
+	return make_safe<prometheus_exporter>(service, port);
+}
+
+}}
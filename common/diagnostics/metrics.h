@@ -0,0 +1,106 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+#pragma once
+
+#include "../memory/safe_ptr.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <tbb/atomic.h>
+
+namespace boost { namespace asio {
+	class io_service;
+}}
+
+namespace caspar { namespace diagnostics {
+
+struct histogram_snapshot
+{
+	std::uint64_t	count;
+	double			max;
+	std::vector<std::uint32_t> buckets;
+
+	histogram_snapshot();
+	double percentile(double fraction) const;
+};
+
+// Lock-free histogram with logarithmic buckets, 8 sub-buckets per power of two.
+// Values are recorded with microunit resolution and a relative error below 12.5%.
+class histogram
+{
+public:
+	enum { bucket_count = 512 };
+
+	histogram();
+	histogram(const histogram& other);
+
+	void record(double value);
+	void take(histogram_snapshot& snapshot); // Moves the recorded values to the snapshot.
+
+	static int bucket_index(std::uint64_t value);
+	static double bucket_value(int index);
+private:
+	histogram& operator=(const histogram&);
+
+	tbb::atomic<std::uint32_t>	buckets_[bucket_count];
+	tbb::atomic<std::uint64_t>	max_;
+};
+
+struct metric_sample
+{
+	std::string		graph;	// graph::set_name followed by the id the graph was created with.
+	std::string		series;
+	std::uint64_t	count;
+	std::uint32_t	tags;
+	double			last;
+	double			p50;
+	double			p99;
+	double			max;
+};
+
+class metrics_exporter
+{
+public:
+	virtual ~metrics_exporter() {}
+	virtual void export_samples(const std::vector<metric_sample>& samples) = 0;
+};
+
+// The values passed to graph::set_value and the tags passed to graph::set_tag
+// are only aggregated while at least one exporter is registered. The exporter
+// is unregistered when the returned token is released.
+std::shared_ptr<void> register_metrics_exporter(const safe_ptr<metrics_exporter>& exporter);
+void set_metrics_interval(int milliseconds);
+bool is_metrics_enabled();
+
+safe_ptr<metrics_exporter> create_file_metrics_exporter(const std::wstring& filename);
+safe_ptr<metrics_exporter> create_prometheus_metrics_exporter(const std::shared_ptr<boost::asio::io_service>& service, unsigned short port);
+
+namespace detail {
+
+void collect_graph_metrics(std::vector<metric_sample>& samples); // Implemented in graph.cpp.
+
+}
+
+}}
@@ -0,0 +1,202 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Helge Norberg, helge.norberg@svt.se
+*/
+
+#include "../stdafx.h"
+
+#include "folder_listing.h"
+#include "filesystem_monitor.h"
+
+#include <algorithm>
+#include <map>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <tbb/atomic.h>
+
+namespace caspar {
+
+namespace {
+
+// Paths are case insensitive on Windows. Compared element by element, so that the files of a folder
+// follow the folder, as when walking it.
+struct path_iless
+{
+	bool operator()(const boost::filesystem::wpath& lhs, const boost::filesystem::wpath& rhs) const
+	{
+		return std::lexicographical_compare(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](const std::wstring& lhs, const std::wstring& rhs)
+		{
+			return boost::algorithm::ilexicographical_compare(lhs, rhs);
+		});
+	}
+};
+
+}
+
+struct folder_listing::implementation : boost::noncopyable
+{
+	const renderer									render_;
+	const removed_handler							on_removed_;
+
+	mutable boost::mutex							mutex_;
+	std::map<boost::filesystem::wpath, std::wstring, path_iless>	parts_;
+	mutable std::wstring							listing_;
+	mutable bool									is_dirty_;
+	tbb::atomic<bool>								is_ready_;
+
+	std::shared_ptr<filesystem_monitor>				monitor_; // Must be destroyed first, it calls back into the members above.
+
+	implementation(
+			filesystem_monitor_factory& monitor_factory,
+			const boost::filesystem::wpath& folder,
+			const renderer& render,
+			const removed_handler& on_removed)
+		: render_(render)
+		, on_removed_(on_removed)
+		, is_dirty_(false)
+	{
+		is_ready_ = false;
+
+		monitor_ = monitor_factory.create(
+				folder,
+				ALL,
+				true,
+				[this] (filesystem_event event, const boost::filesystem::wpath& file)
+				{
+					on_event(event, file);
+				},
+				[this] (const std::set<boost::filesystem::wpath>&)
+				{
+					is_ready_ = true;
+				});
+	}
+
+	void on_event(filesystem_event event, const boost::filesystem::wpath& file)
+	{
+		if (event == REMOVED)
+		{
+			{
+				boost::mutex::scoped_lock lock(mutex_);
+
+				if (parts_.erase(file) > 0)
+					is_dirty_ = true;
+			}
+
+			if (on_removed_)
+				on_removed_(file);
+
+			return;
+		}
+
+		// Rendering may have to open the file, do it without blocking readers of the listing.
+		auto part = render_(file);
+
+		boost::mutex::scoped_lock lock(mutex_);
+
+		if (part.empty())
+			parts_.erase(file);
+		else
+			parts_[file] = std::move(part);
+
+		is_dirty_ = true;
+	}
+
+	std::wstring str() const
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		if (is_dirty_)
+		{
+			std::size_t size = 0;
+
+			BOOST_FOREACH(auto& part, parts_)
+				size += part.second.size();
+
+			listing_.clear();
+			listing_.reserve(size);
+
+			BOOST_FOREACH(auto& part, parts_)
+				listing_ += part.second;
+
+			is_dirty_ = false;
+		}
+
+		return listing_;
+	}
+
+	bool has_file(const boost::filesystem::wpath& stem) const
+	{
+		const auto depth	= std::distance(stem.begin(), stem.end());
+		const auto name		= stem.filename();
+
+		boost::mutex::scoped_lock lock(mutex_);
+
+		// The paths in the folder of stem whose name starts with the name of stem follow it.
+		for (auto it = parts_.lower_bound(stem); it != parts_.end(); ++it)
+		{
+			const auto& file = it->first;
+
+			auto file_element = file.begin();
+			auto stem_element = stem.begin();
+
+			for (auto n = 1; n < depth; ++n, ++file_element, ++stem_element)
+			{
+				if (file_element == file.end() || !boost::algorithm::iequals(*file_element, *stem_element))
+					return false;
+			}
+
+			if (file_element == file.end() || !boost::algorithm::istarts_with(*file_element, name))
+				return false;
+
+			if (std::distance(file.begin(), file.end()) == depth && (boost::algorithm::iequals(file.filename(), name) || boost::algorithm::iequals(file.stem(), name)))
+				return true;
+		}
+
+		return false;
+	}
+};
+
+folder_listing::folder_listing(
+		filesystem_monitor_factory& monitor_factory,
+		const boost::filesystem::wpath& folder,
+		const renderer& render,
+		const removed_handler& on_removed)
+	: impl_(new implementation(monitor_factory, folder, render, on_removed))
+{
+}
+
+bool folder_listing::is_ready() const
+{
+	return impl_->is_ready_;
+}
+
+std::wstring folder_listing::str() const
+{
+	return impl_->str();
+}
+
+bool folder_listing::has_file(const boost::filesystem::wpath& stem) const
+{
+	return impl_->has_file(stem);
+}
+
+}
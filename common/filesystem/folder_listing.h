@@ -0,0 +1,103 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Helge Norberg, helge.norberg@svt.se
+*/
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "../memory/safe_ptr.h"
+
+namespace caspar {
+
+class filesystem_monitor_factory;
+
+/**
+ * A textual listing of the files in a folder, kept up to date by a
+ * filesystem_monitor instead of walking the folder each time it is requested.
+ * <p>
+ * Each file is rendered to its part of the listing once, when it is created
+ * or modified. The parts are concatenated in path order, ignoring case.
+ */
+class folder_listing : boost::noncopyable
+{
+public:
+	/**
+	 * Renders the part of the listing for a file.
+	 * <p>
+	 * Will be called from the thread of the filesystem monitor.
+	 *
+	 * @param file The file to render.
+	 *
+	 * @return The text to list for the file, empty if the file should not be
+	 *         listed.
+	 */
+	typedef std::function<std::wstring (const boost::filesystem::wpath& file)> renderer;
+
+	/**
+	 * Called when a file has been removed from the folder.
+	 */
+	typedef std::function<void (const boost::filesystem::wpath& file)> removed_handler;
+
+	/**
+	 * Constructor.
+	 *
+	 * @param monitor_factory The factory to create the filesystem monitor with.
+	 * @param folder          The folder to recursively list.
+	 * @param render          The renderer of each file.
+	 * @param on_removed      The optional handler to call when a file is
+	 *                        removed.
+	 */
+	folder_listing(
+			filesystem_monitor_factory& monitor_factory,
+			const boost::filesystem::wpath& folder,
+			const renderer& render,
+			const removed_handler& on_removed = removed_handler());
+
+	/**
+	 * @return whether the files initially available in the folder have been
+	 *         rendered. Until then the listing is incomplete.
+	 */
+	bool is_ready() const;
+
+	/**
+	 * @return the current listing. Only concatenates the rendered parts if
+	 *         something has changed since the last call.
+	 */
+	std::wstring str() const;
+
+	/**
+	 * @param stem The path of a file in the folder, with or without its
+	 *             extension.
+	 *
+	 * @return whether a listed file has the path, with any extension, ignoring
+	 *         case. Files which rendered to an empty part are not listed.
+	 */
+	bool has_file(const boost::filesystem::wpath& stem) const;
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+}
@@ -0,0 +1,550 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Helge Norberg, helge.norberg@svt.se
+*/
+
+#include "../stdafx.h"
+
+#include "notifying_filesystem_monitor.h"
+#include "polling_filesystem_monitor.h"
+
+#include <ctime>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/range/adaptor/map.hpp>
+#include <boost/range/algorithm/copy.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/thread.hpp>
+
+#include <tbb/atomic.h>
+#include <tbb/concurrent_queue.h>
+
+#include "../exception/exceptions.h"
+#include "../exception/win32_exception.h"
+#include "../log/log.h"
+
+namespace caspar {
+
+class notifying_filesystem_monitor : public filesystem_monitor
+{
+	static const std::time_t NO_LONGER_WRITING_AGE	= 3; // Assume std::time_t is expressed in seconds
+	static const DWORD PENDING_CHECK_INTERVAL		= 1000;
+	static const DWORD RETRY_INTERVAL				= 5000;
+
+	const boost::filesystem::wpath					folder_;
+	const filesystem_event							events_mask_;
+	const bool										report_already_existing_;
+	const filesystem_monitor_handler				handler_;
+	const initial_files_handler						initial_files_handler_;
+
+	std::shared_ptr<void>							directory_;
+	std::shared_ptr<void>							change_event_;
+	std::shared_ptr<void>							wake_event_;
+	OVERLAPPED										overlapped_;
+	std::vector<DWORD>								buffer_; // FILE_NOTIFY_INFORMATION records have to be DWORD aligned.
+
+	// Only accessed from the monitor thread.
+	std::map<boost::filesystem::wpath, std::time_t>	files_;
+	std::set<boost::filesystem::wpath>				pending_;
+
+	tbb::atomic<bool>								running_;
+	tbb::atomic<bool>								reemmit_all_;
+	tbb::concurrent_queue<boost::filesystem::wpath>	to_reemmit_;
+	boost::promise<void>							initial_scan_completion_;
+	boost::thread									thread_;
+public:
+	notifying_filesystem_monitor(
+			const boost::filesystem::wpath& folder_to_watch,
+			filesystem_event events_of_interest_mask,
+			bool report_already_existing,
+			const filesystem_monitor_handler& handler,
+			const initial_files_handler& initial_files_handler)
+		: folder_(folder_to_watch)
+		, events_mask_(events_of_interest_mask)
+		, report_already_existing_(report_already_existing)
+		, handler_(handler)
+		, initial_files_handler_(initial_files_handler)
+		, buffer_(64 * 1024 / sizeof(DWORD)) // Larger buffers are not supported on network shares.
+	{
+		auto directory = CreateFileW(
+				folder_.file_string().c_str(),
+				FILE_LIST_DIRECTORY,
+				FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+				nullptr,
+				OPEN_EXISTING,
+				FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+				nullptr);
+
+		if (directory == INVALID_HANDLE_VALUE)
+			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Failed to open " + narrow(folder_.file_string()) + " for change notifications."));
+
+		directory_.reset(directory, CloseHandle);
+		change_event_.reset(CreateEvent(nullptr, TRUE, FALSE, nullptr), CloseHandle);
+		wake_event_.reset(CreateEvent(nullptr, FALSE, FALSE, nullptr), CloseHandle);
+
+		running_ = true;
+		reemmit_all_ = false;
+
+		thread_ = boost::thread([this] { run(); });
+	}
+
+	virtual ~notifying_filesystem_monitor()
+	{
+		running_ = false;
+		SetEvent(wake_event_.get());
+		thread_.join();
+	}
+
+	virtual boost::unique_future<void> initial_files_processed()
+	{
+		return initial_scan_completion_.get_future();
+	}
+
+	virtual void reemmit_all()
+	{
+		reemmit_all_ = true;
+		SetEvent(wake_event_.get());
+	}
+
+	virtual void reemmit(const boost::filesystem::wpath& file)
+	{
+		to_reemmit_.push(file);
+		SetEvent(wake_event_.get());
+	}
+private:
+	void run()
+	{
+		win32_exception::ensure_handler_installed_for_thread("filesystem-monitor-thread");
+
+		// Start listening before the initial scan so that nothing changed during the scan is missed.
+		bool is_reading = begin_read();
+
+		protected_call([this] { scan(true); });
+		initial_scan_completion_.set_value();
+
+		while (running_)
+		{
+			HANDLE handles[] = { change_event_.get(), wake_event_.get() };
+			DWORD timeout = !is_reading ? RETRY_INTERVAL : pending_.empty() ? INFINITE : PENDING_CHECK_INTERVAL;
+
+			auto result = WaitForMultipleObjects(2, handles, FALSE, timeout);
+
+			if (!running_)
+				break;
+
+			if (result == WAIT_OBJECT_0)
+			{
+				DWORD bytes = 0;
+
+				if (GetOverlappedResult(directory_.get(), &overlapped_, &bytes, FALSE) && bytes > 0)
+					protected_call([=] { on_changes(bytes); });
+				else // The notifications have overflowed, rescan to find out what has changed.
+					protected_call([this] { scan(false); });
+
+				is_reading = begin_read();
+			}
+			else if (result == WAIT_TIMEOUT && !is_reading)
+			{
+				protected_call([this] { scan(false); });
+				is_reading = begin_read();
+			}
+
+			protected_call([this] { process_reemmits(); });
+			protected_call([this] { check_pending(); });
+		}
+
+		if (is_reading)
+		{
+			DWORD bytes = 0;
+			CancelIo(directory_.get());
+			GetOverlappedResult(directory_.get(), &overlapped_, &bytes, TRUE);
+		}
+	}
+
+	template<typename Func>
+	void protected_call(const Func& func)
+	{
+		try
+		{
+			func();
+		}
+		catch (...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+		}
+	}
+
+	bool begin_read()
+	{
+		ResetEvent(change_event_.get());
+		ZeroMemory(&overlapped_, sizeof(overlapped_));
+		overlapped_.hEvent = change_event_.get();
+
+		if (ReadDirectoryChangesW(
+				directory_.get(),
+				buffer_.data(),
+				static_cast<DWORD>(buffer_.size() * sizeof(DWORD)),
+				TRUE,
+				FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE,
+				nullptr,
+				&overlapped_,
+				nullptr))
+			return true;
+
+		CASPAR_LOG(warning) << L"Failed to watch " << folder_.file_string() << L" for changes. Scanning every " << RETRY_INTERVAL << L" ms.";
+		return false;
+	}
+
+	void on_changes(DWORD bytes)
+	{
+		auto data = reinterpret_cast<const char*>(buffer_.data());
+		auto end = data + bytes;
+
+		while (data < end)
+		{
+			auto info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(data);
+			auto path = folder_ / std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR));
+
+			switch (info->Action)
+			{
+			case FILE_ACTION_ADDED:
+			case FILE_ACTION_MODIFIED:
+			case FILE_ACTION_RENAMED_NEW_NAME:
+				on_added(path);
+				break;
+			case FILE_ACTION_REMOVED:
+			case FILE_ACTION_RENAMED_OLD_NAME:
+				on_removed(path);
+				break;
+			}
+
+			if (info->NextEntryOffset == 0)
+				break;
+
+			data += info->NextEntryOffset;
+		}
+	}
+
+	void on_added(const boost::filesystem::wpath& path)
+	{
+		if (!boost::filesystem::is_directory(path))
+		{
+			pending_.insert(path);
+			return;
+		}
+
+		// The contents of a directory moved into the folder are not reported individually.
+		for (boost::filesystem::wrecursive_directory_iterator iter(path), end; iter != end && running_; ++iter)
+		{
+			if (!boost::filesystem::is_directory(iter->path()))
+				pending_.insert(iter->path());
+		}
+	}
+
+	void on_removed(const boost::filesystem::wpath& path)
+	{
+		pending_.erase(path);
+
+		if (files_.find(path) != files_.end())
+		{
+			remove(path);
+			return;
+		}
+
+		// The files of a directory moved out of the folder are not reported individually.
+		std::vector<boost::filesystem::wpath> removed_files;
+
+		for (auto it = files_.upper_bound(path); it != files_.end() && is_inside(it->first, path); ++it)
+			removed_files.push_back(it->first);
+
+		BOOST_FOREACH(auto& file, removed_files)
+			remove(file);
+	}
+
+	void remove(const boost::filesystem::wpath& path)
+	{
+		pending_.erase(path);
+
+		if (files_.erase(path) > 0 && (events_mask_ & REMOVED))
+			handler_(REMOVED, path);
+	}
+
+	void process_reemmits()
+	{
+		if ((events_mask_ & MODIFIED) == 0)
+			return;
+
+		boost::filesystem::wpath file;
+
+		if (reemmit_all_.fetch_and_store(false))
+		{
+			BOOST_FOREACH(auto& known, files_)
+				handler_(MODIFIED, known.first);
+
+			while (to_reemmit_.try_pop(file));
+		}
+
+		while (to_reemmit_.try_pop(file))
+		{
+			if (files_.find(file) != files_.end() && boost::filesystem::exists(file))
+				handler_(MODIFIED, file);
+		}
+	}
+
+	void check_pending()
+	{
+		for (auto it = pending_.begin(); it != pending_.end() && running_; )
+		{
+			if (check(*it, nullptr))
+				it = pending_.erase(it);
+			else
+				++it;
+		}
+	}
+
+	void scan(bool is_initial)
+	{
+		std::set<boost::filesystem::wpath> removed_files;
+		boost::copy(
+				files_ | boost::adaptors::map_keys,
+				std::insert_iterator<decltype(removed_files)>(removed_files, removed_files.end()));
+
+		std::set<boost::filesystem::wpath> initial_files;
+
+		try
+		{
+			scan_folder(folder_, removed_files, is_initial ? &initial_files : nullptr);
+		}
+		catch (...)
+		{
+			// The listing becomes ready with the files found so far, it would otherwise never be.
+			if (is_initial)
+				initial_files_handler_(initial_files);
+			throw;
+		}
+
+		if (!running_)
+			return;
+
+		BOOST_FOREACH(auto& path, removed_files)
+			remove(path);
+
+		if (is_initial)
+			initial_files_handler_(initial_files);
+	}
+
+	// Folders which can not be listed are skipped, the files known inside them are kept until they can.
+	void scan_folder(const boost::filesystem::wpath& folder, std::set<boost::filesystem::wpath>& removed_files, std::set<boost::filesystem::wpath>* initial_files)
+	{
+		std::vector<boost::filesystem::wpath> entries;
+
+		try
+		{
+			for (boost::filesystem::wdirectory_iterator iter(folder), end; iter != end; ++iter)
+				entries.push_back(iter->path());
+		}
+		catch (...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+			CASPAR_LOG(warning) << L"Failed to scan " << folder.file_string() << L". Skipping it.";
+
+			for (auto it = removed_files.upper_bound(folder); it != removed_files.end() && is_inside(*it, folder); )
+				it = removed_files.erase(it);
+
+			return;
+		}
+
+		BOOST_FOREACH(auto& path, entries)
+		{
+			if (!running_)
+				return;
+
+			bool is_directory = false;
+
+			try
+			{
+				is_directory = boost::filesystem::is_directory(path);
+			}
+			catch (...)
+			{
+				// Checked as a file, which is retried later if it can not be read.
+			}
+
+			if (is_directory)
+			{
+				scan_folder(path, removed_files, initial_files);
+				continue;
+			}
+
+			removed_files.erase(path);
+
+			if (check(path, initial_files))
+				pending_.erase(path);
+			else
+				pending_.insert(path);
+		}
+	}
+
+	// Returns true if the current state of the file has been reported, false if it should be checked again later.
+	bool check(const boost::filesystem::wpath& path, std::set<boost::filesystem::wpath>* initial_files)
+	{
+		std::time_t current_mtime;
+
+		try
+		{
+			if (!boost::filesystem::exists(path))
+			{
+				remove(path);
+				return true;
+			}
+
+			if (boost::filesystem::is_directory(path))
+				return true;
+
+			current_mtime = boost::filesystem::last_write_time(path);
+		}
+		catch (...)
+		{
+			// Probably being removed, will be captured the next round.
+			return false;
+		}
+
+		auto previous_it = files_.find(path);
+		bool already_known = previous_it != files_.end();
+
+		if (already_known && previous_it->second == current_mtime)
+			return true;
+
+		if (std::time(nullptr) - current_mtime < NO_LONGER_WRITING_AGE || !can_read_file(path))
+			return false;
+
+		if (already_known)
+		{
+			previous_it->second = current_mtime;
+
+			if (events_mask_ & MODIFIED)
+				handler_(MODIFIED, path);
+		}
+		else
+		{
+			files_.insert(std::make_pair(path, current_mtime));
+
+			if (initial_files)
+				initial_files->insert(path);
+
+			if ((events_mask_ & CREATED) && (!initial_files || report_already_existing_))
+				handler_(CREATED, path);
+		}
+
+		return true;
+	}
+
+	static bool is_inside(const boost::filesystem::wpath& file, const boost::filesystem::wpath& folder)
+	{
+		auto file_it = file.begin();
+
+		BOOST_FOREACH(auto& element, folder)
+		{
+			if (file_it == file.end() || *file_it != element)
+				return false;
+
+			++file_it;
+		}
+
+		return file_it != file.end();
+	}
+
+	static bool can_read_file(const boost::filesystem::wpath& file)
+	{
+		boost::filesystem::wifstream stream(file);
+
+		return stream.is_open();
+	}
+};
+
+struct notifying_filesystem_monitor_factory::implementation
+{
+	polling_filesystem_monitor_factory fallback_;
+
+	implementation(
+			std::shared_ptr<boost::asio::io_service> scheduler,
+			int fallback_scan_interval_millis)
+		: fallback_(std::move(scheduler), fallback_scan_interval_millis)
+	{
+	}
+};
+
+notifying_filesystem_monitor_factory::notifying_filesystem_monitor_factory(
+		std::shared_ptr<boost::asio::io_service> scheduler,
+		int fallback_scan_interval_millis)
+	: impl_(new implementation(std::move(scheduler), fallback_scan_interval_millis))
+{
+}
+
+notifying_filesystem_monitor_factory::~notifying_filesystem_monitor_factory()
+{
+}
+
+filesystem_monitor::ptr notifying_filesystem_monitor_factory::create(
+		const boost::filesystem::wpath& folder_to_watch,
+		filesystem_event events_of_interest_mask,
+		bool report_already_existing,
+		const filesystem_monitor_handler& handler,
+		const initial_files_handler& initial_files_handler)
+{
+	// Handlers are wrapped so that a failing handler does not stop the monitor.
+	auto protected_handler = [handler] (filesystem_event event, const boost::filesystem::wpath& file)
+	{
+		try
+		{
+			handler(event, file);
+		}
+		catch (...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+		}
+	};
+
+	try
+	{
+		return make_safe<notifying_filesystem_monitor>(
+				folder_to_watch,
+				events_of_interest_mask,
+				report_already_existing,
+				protected_handler,
+				initial_files_handler);
+	}
+	catch (...)
+	{
+		CASPAR_LOG_CURRENT_EXCEPTION();
+		CASPAR_LOG(warning) << L"Falling back to polling " << folder_to_watch.file_string() << L" for changes.";
+
+		return impl_->fallback_.create(
+				folder_to_watch,
+				events_of_interest_mask,
+				report_already_existing,
+				handler,
+				initial_files_handler);
+	}
+}
+
+}
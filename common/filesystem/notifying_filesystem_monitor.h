@@ -0,0 +1,72 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Helge Norberg, helge.norberg@svt.se
+*/
+
+#pragma once
+
+#include "filesystem_monitor.h"
+
+namespace boost { namespace asio {
+	class io_service;
+}}
+
+namespace caspar {
+
+/**
+ * A filesystem monitor implementation which is notified of changes by the
+ * operating system (ReadDirectoryChangesW) instead of periodically scanning
+ * the folder. The folder is only scanned initially and when the change
+ * notifications have overflowed.
+ * <p>
+ * Like the polling implementation a file is not reported until it is no
+ * longer being written to. Files which are still being written to are checked
+ * once a second until they are.
+ * <p>
+ * Will create a dedicated thread for each monitor created. Falls back to a
+ * polling monitor for folders which can not be watched, for example on some
+ * network shares.
+ */
+class notifying_filesystem_monitor_factory : public filesystem_monitor_factory
+{
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param scheduler                     The io_service used by the polling
+	 *                                      fallback.
+	 * @param fallback_scan_interval_millis The number of milliseconds between
+	 *                                      each scan of the polling fallback.
+	 */
+	notifying_filesystem_monitor_factory(
+			std::shared_ptr<boost::asio::io_service> scheduler,
+			int fallback_scan_interval_millis = 5000);
+	virtual ~notifying_filesystem_monitor_factory();
+	virtual filesystem_monitor::ptr create(
+			const boost::filesystem::wpath& folder_to_watch,
+			filesystem_event events_of_interest_mask,
+			bool report_already_existing,
+			const filesystem_monitor_handler& handler,
+			const initial_files_handler& initial_files_handler);
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+}
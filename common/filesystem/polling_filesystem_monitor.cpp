@@ -273,6 +273,9 @@ private:
 			boost::posix_time::milliseconds(scan_interval_millis_));
 		timer_.async_wait([this](const boost::system::error_code& e)
 		{
+			if (e == boost::asio::error::operation_aborted) // The monitor is being destroyed.
+				return;
+
 			begin_scan();
 		});
 	}
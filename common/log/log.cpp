@@ -31,9 +31,10 @@
 #include "../exception/exceptions.h"
 #include "../utility/string.h"
 #include <ios>
-#include <iomanip>
+#include <fstream>
 #include <string>
 #include <ostream>
+#include <vector>
 #include <Psapi.h>
 
 #include <boost/shared_ptr.hpp>
@@ -51,140 +52,430 @@
 
 #include <boost/log/filters/attr.hpp>
 
-#include <boost/log/sinks/text_file_backend.hpp>
-
-#include <boost/log/detail/universal_path.hpp>
-
-#include <boost/log/sinks/text_file_backend.hpp>
-#include <boost/log/sinks/text_ostream_backend.hpp>
-#include <boost/log/sinks/sync_frontend.hpp>
-#include <boost/log/sinks/async_frontend.hpp>
+#include <boost/log/sinks/basic_sink_backend.hpp>
+#include <boost/log/sinks/unlocked_frontend.hpp>
 #include <boost/log/core/record.hpp>
 #include <boost/log/utility/attribute_value_extractor.hpp>
 
 #include <boost/log/utility/init/common_attributes.hpp>
 #include <boost/log/utility/empty_deleter.hpp>
 #include <boost/lambda/lambda.hpp>
-#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+#include <tbb/atomic.h>
+#include <tbb/concurrent_queue.h>
 
 namespace caspar { namespace log {
 
 using namespace boost;
 
-void append_timestamp(std::wostream& stream)
+namespace {
+
+struct log_record
 {
-	auto timestamp = boost::posix_time::microsec_clock::local_time();
-	auto date = timestamp.date();
-	auto time = timestamp.time_of_day();
-	auto milliseconds = time.fractional_seconds() / 1000; // microseconds to milliseconds
-
-	std::wstringstream buffer;
-
-	buffer
-		<< std::setfill(L'0')
-		<< L"["
-		<< std::setw(4) << date.year() << L"-" << std::setw(2) << date.month().as_number() << "-" << std::setw(2) << date.day().as_number()
-		<< L" "
-		<< std::setw(2) << time.hours() << L":" << std::setw(2) << time.minutes() << L":" << std::setw(2) << time.seconds()
-		<< L"."
-		<< std::setw(3) << milliseconds
-		<< L"] ";
-
-	stream << buffer.str();
+	FILETIME		time;
+	unsigned long	thread_id;
+	severity_level	severity;
+	std::wstring	message;
+	bool*			written; // Set by the writer once the record has been written, nullptr if nobody waits.
+};
+
+void append_number(std::wstring& line, unsigned int value, int width)
+{
+	wchar_t digits[10];
+	int count = 0;
+
+	do
+	{
+		digits[count++] = static_cast<wchar_t>(L'0' + value % 10);
+		value /= 10;
+	}
+	while(value > 0 && count < 10);
+
+	for(int n = count; n < width; ++n)
+		line += L'0';
+
+	while(count > 0)
+		line += digits[--count];
 }
 
-void my_formatter(bool print_all_characters, std::wostream& strm, boost::log::basic_record<wchar_t> const& rec)
+void append_timestamp(std::wstring& line, const SYSTEMTIME& time)
 {
-    namespace lambda = boost::lambda;
-	
-	#pragma warning(disable : 4996)
+	line += L'[';
+	append_number(line, time.wYear, 4);
+	line += L'-';
+	append_number(line, time.wMonth, 2);
+	line += L'-';
+	append_number(line, time.wDay, 2);
+	line += L' ';
+	append_number(line, time.wHour, 2);
+	line += L':';
+	append_number(line, time.wMinute, 2);
+	line += L':';
+	append_number(line, time.wSecond, 2);
+	line += L'.';
+	append_number(line, time.wMilliseconds, 3);
+	line += L"] ";
+}
+
+const wchar_t* severity_name(severity_level severity)
+{
+	switch(severity)
+	{
+	case trace:		return L"trace";
+	case debug:		return L"debug";
+	case info:		return L"info";
+	case warning:	return L"warning";
+	case error:		return L"error";
+	case fatal:		return L"fatal";
+	default:		return L"unknown";
+	}
+}
+
+void format_record(std::wstring& line, const log_record& record, const SYSTEMTIME& time)
+{
+	line.clear();
+
+	append_timestamp(line, time);
+
+	line += L'[';
+	append_number(line, record.thread_id, 1);
+	line += L"] ";
+
+	const std::wstring severity = severity_name(record.severity);
+	line += L'[';
+	line += severity;
+	line += L"] ";
+	for(int n = 0; n < 7-static_cast<int>(severity.size()); ++n)
+		line += L' ';
+
+	line += record.message;
+	line += L'\n';
+}
+
+// Formats and writes the records on a dedicated thread so that callers of
+// CASPAR_LOG never wait for the console or the disk. Records are handed over
+// through a lock-free queue and recycled to avoid allocations. When the writer
+// falls behind, records below warning severity are dropped and the number of
+// dropped records is reported once the writer has caught up. Error and fatal
+// records are written and flushed before push returns, so that the last lines
+// before a crash are not lost.
+class log_writer : boost::noncopyable
+{
+	static const int						MAX_PENDING_RECORDS = 16384;
+	static const std::size_t				MAX_RECYCLED_MESSAGE_SIZE = 4096;
+
+	tbb::concurrent_queue<log_record*>		records_;
+	tbb::concurrent_queue<log_record*>		free_records_;
+	tbb::atomic<int>						pending_;
+	tbb::atomic<int>						dropped_;
+
+	tbb::atomic<bool>						is_signalled_;
+	boost::mutex							signal_mutex_;
+	boost::condition_variable				signal_cond_;
+	tbb::atomic<bool>						is_running_;
+
+	boost::mutex							written_mutex_;
+	boost::condition_variable				written_cond_;
+
+	boost::mutex							folder_mutex_;
+	std::wstring							folder_;
+	tbb::atomic<bool>						folder_changed_;
+
+	std::ofstream							file_;
+	WORD									file_day_;
+
+	boost::thread							thread_;
+public:
+	log_writer()
+		: file_day_(0)
+	{
+		pending_		= 0;
+		dropped_		= 0;
+		is_signalled_	= false;
+		is_running_		= true;
+		folder_changed_	= false;
+
+		thread_ = boost::thread([this] { run(); });
+	}
+
+	~log_writer()
+	{
+		is_running_ = false;
+
+		{
+			boost::lock_guard<boost::mutex> lock(signal_mutex_);
+			signal_cond_.notify_one();
+		}
+
+		thread_.join();
+
+		{
+			boost::lock_guard<boost::mutex> lock(written_mutex_);
+			written_cond_.notify_all();
+		}
+
+		log_record* record;
+
+		while(free_records_.try_pop(record))
+			delete record;
+	}
+
+	void push(severity_level severity, const std::wstring& message)
+	{
+		if(++pending_ > MAX_PENDING_RECORDS && severity < warning)
+		{
+			--pending_;
+			++dropped_;
+			return;
+		}
+
+		log_record* record = nullptr;
+
+		if(!free_records_.try_pop(record))
+			record = new log_record;
+
+		::GetSystemTimeAsFileTime(&record->time);
+		record->thread_id	= ::GetCurrentThreadId();
+		record->severity	= severity;
+		record->message.assign(message);
+
+		bool written = false;
+		const bool wait = severity >= error && boost::this_thread::get_id() != thread_.get_id();
+		record->written = wait ? &written : nullptr;
+
+		records_.push(record);
+
+		if(!is_signalled_.fetch_and_store(true))
+		{
+			boost::lock_guard<boost::mutex> lock(signal_mutex_);
+			signal_cond_.notify_one();
+		}
+
+		if(wait)
+		{
+			boost::unique_lock<boost::mutex> lock(written_mutex_);
+
+			while(!written && is_running_)
+				written_cond_.wait(lock);
+		}
+	}
+
+	void set_folder(const std::wstring& folder)
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(folder_mutex_);
+			folder_ = folder;
+		}
+
+		folder_changed_ = true;
+	}
+private:
+	void run()
+	{
+		std::wstring line;
+		std::wstring console_lines;
+		std::string file_lines;
+		std::vector<log_record*> batch;
+		std::vector<bool*> waiting;
+
+		line.reserve(512);
+
+		while(true)
+		{
+			{
+				boost::unique_lock<boost::mutex> cond_lock(signal_mutex_);
+
+				while(!is_signalled_ && is_running_)
+					signal_cond_.wait(cond_lock);
+
+				is_signalled_ = false;
+			}
+
+			log_record* record;
+
+			while(records_.try_pop(record))
+				batch.push_back(record);
+
+			if(batch.empty() && !is_running_)
+				return;
+
+			console_lines.clear();
+			file_lines.clear();
+
+			BOOST_FOREACH(auto record, batch)
+			{
+				FILETIME local_time;
+				SYSTEMTIME time;
+				::FileTimeToLocalFileTime(&record->time, &local_time);
+				::FileTimeToSystemTime(&local_time, &time);
+
+				if(folder_changed_.fetch_and_store(false) || (file_.is_open() && time.wDay != file_day_))
+				{
+					write_file(file_lines);
+					file_lines.clear();
+					open_file(time);
+				}
+
+				format_record(line, *record, time);
 
-	append_timestamp(strm);
-		
-    boost::log::attributes::current_thread_id::held_type thread_id;
-    if(boost::log::extract<boost::log::attributes::current_thread_id::held_type>(L"ThreadID", rec.attribute_values(), lambda::var(thread_id) = lambda::_1))
-        strm << L"[" << thread_id << L"] ";
+				file_lines += narrow(line);
 
+				replace_nonprintable(line, L'?');
+				console_lines += line;
 
-    severity_level severity;
-    if(boost::log::extract<severity_level>(boost::log::sources::aux::severity_attribute_name<wchar_t>::get(), rec.attribute_values(), lambda::var(severity) = lambda::_1))
+				if(record->written)
+					waiting.push_back(record->written);
+
+				recycle(record);
+			}
+
+			batch.clear();
+
+			int dropped = dropped_.fetch_and_store(0);
+
+			if(dropped > 0)
+			{
+				log_record notice;
+				::GetSystemTimeAsFileTime(&notice.time);
+				notice.thread_id	= ::GetCurrentThreadId();
+				notice.severity		= warning;
+				notice.message		= L"Log writer could not keep up, dropped " + boost::lexical_cast<std::wstring>(dropped) + L" records.";
+
+				FILETIME local_time;
+				SYSTEMTIME time;
+				::FileTimeToLocalFileTime(&notice.time, &local_time);
+				::FileTimeToSystemTime(&local_time, &time);
+
+				format_record(line, notice, time);
+				file_lines += narrow(line);
+				console_lines += line;
+			}
+
+			// One write and flush per batch instead of per record.
+			std::wcout << console_lines;
+			std::wcout.flush();
+
+			write_file(file_lines);
+
+			if(!waiting.empty())
+			{
+				boost::lock_guard<boost::mutex> lock(written_mutex_);
+
+				BOOST_FOREACH(auto written, waiting)
+					*written = true;
+
+				waiting.clear();
+				written_cond_.notify_all();
+			}
+		}
+	}
+
+	void recycle(log_record* record)
+	{
+		--pending_;
+
+		if(record->message.capacity() > MAX_RECYCLED_MESSAGE_SIZE)
+			std::wstring().swap(record->message);
+
+		free_records_.push(record);
+	}
+
+	void open_file(const SYSTEMTIME& time)
 	{
-		std::stringstream ss;
-		ss << severity;
-        strm << L"[" << severity << L"] ";
-		for(int n = 0; n < 7-static_cast<int>(ss.str().size()); ++n)
-			strm << L" ";
+		std::wstring folder;
+
+		{
+			boost::lock_guard<boost::mutex> lock(folder_mutex_);
+			folder = folder_;
+		}
+
+		if(folder.empty())
+			return;
+
+		std::wstring file_name = folder + L"caspar_";
+		append_number(file_name, time.wYear, 4);
+		file_name += L'-';
+		append_number(file_name, time.wMonth, 2);
+		file_name += L'-';
+		append_number(file_name, time.wDay, 2);
+		file_name += L".log";
+
+		if(file_.is_open())
+			file_.close();
+
+		file_.clear();
+		file_.open(file_name.c_str(), std::ios::out | std::ios::app);
+
+		if(file_.is_open())
+			file_day_ = time.wDay;
+		else
+			std::wcerr << L"Failed to open log file " << file_name << std::endl;
 	}
 
-	if (print_all_characters)
+	void write_file(const std::string& lines)
+	{
+		if(lines.empty() || !file_.is_open())
+			return;
+
+		file_.write(lines.data(), lines.size());
+		file_.flush();
+	}
+};
+
+// Boost.Log backend handing the records over to the log_writer on the thread of the caller, without formatting them.
+class async_backend : public boost::log::sinks::basic_sink_backend<wchar_t, boost::log::sinks::backend_synchronization_tag>
+{
+	const std::shared_ptr<log_writer> writer_;
+public:
+	explicit async_backend(const std::shared_ptr<log_writer>& writer)
+		: writer_(writer)
 	{
-		strm << rec.message();
 	}
-	else
+
+	void consume(record_type const& rec)
 	{
-	    strm << replace_nonprintable_copy(rec.message(), L'?');
+		namespace lambda = boost::lambda;
+
+		severity_level severity = trace;
+		boost::log::extract<severity_level>(boost::log::sources::aux::severity_attribute_name<wchar_t>::get(), rec.attribute_values(), lambda::var(severity) = lambda::_1);
+
+		writer_->push(severity, rec.message());
 	}
+};
+
+std::shared_ptr<log_writer> g_writer;
+
 }
 
 namespace internal{
 	
 void init()
 {	
-	boost::log::add_common_attributes<wchar_t>();
-	typedef boost::log::aux::add_common_attributes_constants<wchar_t> traits_t;
-
-	typedef boost::log::sinks::synchronous_sink<boost::log::sinks::wtext_file_backend> file_sink_type;
-
-	typedef boost::log::sinks::asynchronous_sink<boost::log::sinks::wtext_ostream_backend> stream_sink_type;
+	typedef boost::log::sinks::unlocked_sink<async_backend> async_sink_type;
 
-	auto stream_backend = boost::make_shared<boost::log::sinks::wtext_ostream_backend>();
-	stream_backend->add_stream(boost::shared_ptr<std::wostream>(&std::wcout, boost::log::empty_deleter()));
-	stream_backend->auto_flush(true);
+	g_writer = std::make_shared<log_writer>();
 
-	auto stream_sink = boost::make_shared<stream_sink_type>(stream_backend);
-	
-//#ifdef NDEBUG
-//	stream_sink->set_filter(boost::log::filters::attr<severity_level>(boost::log::sources::aux::severity_attribute_name<wchar_t>::get()) >= debug);
-//#else
-//	stream_sink->set_filter(boost::log::filters::attr<severity_level>(boost::log::sources::aux::severity_attribute_name<wchar_t>::get()) >= debug);
-//#endif
-
-	stream_sink->locked_backend()->set_formatter(boost::bind(my_formatter, false, _1, _2));
+	auto sink = boost::make_shared<async_sink_type>(boost::make_shared<async_backend>(g_writer));
 
-	boost::log::wcore::get()->add_sink(stream_sink);
+	boost::log::wcore::get()->add_sink(sink);
 }
 
 }
 
 void add_file_sink(const std::wstring& folder)
 {	
-	boost::log::add_common_attributes<wchar_t>();
-	typedef boost::log::aux::add_common_attributes_constants<wchar_t> traits_t;
-
-	typedef boost::log::sinks::synchronous_sink<boost::log::sinks::wtext_file_backend> file_sink_type;
-
 	try
 	{
 		if(!boost::filesystem::is_directory(folder))
 			BOOST_THROW_EXCEPTION(directory_not_found());
 
-		auto file_sink = boost::make_shared<file_sink_type>(
-			boost::log::keywords::file_name = (folder + L"caspar_%Y-%m-%d.log"),
-			boost::log::keywords::time_based_rotation = boost::log::sinks::file::rotation_at_time_point(0, 0, 0),
-			boost::log::keywords::auto_flush = true,
-			boost::log::keywords::open_mode = std::ios::app
-		);
-
-		bool print_all_characters = true;
-
-		file_sink->locked_backend()->set_formatter(boost::bind(my_formatter, print_all_characters, _1, _2));
+		get_logger(); // Makes sure that the writer has been created.
 
-//#ifdef NDEBUG
-//		file_sink->set_filter(boost::log::filters::attr<severity_level>(boost::log::sources::aux::severity_attribute_name<wchar_t>::get()) >= debug);
-//#else
-//		file_sink->set_filter(boost::log::filters::attr<severity_level>(boost::log::sources::aux::severity_attribute_name<wchar_t>::get()) >= debug);
-//#endif
-		boost::log::wcore::get()->add_sink(file_sink);
+		g_writer->set_folder(folder);
 	}
 	catch(...)
 	{
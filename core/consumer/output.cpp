@@ -28,11 +28,14 @@
 #include "output.h"
 
 #include "../video_format.h"
+#include "../frame_trace.h"
 #include "../mixer/gpu/ogl_device.h"
 #include "../mixer/read_frame.h"
 #include "../mixer/audio/audio_util.h"
 
 #include <common/concurrency/executor.h>
+#include <common/concurrency/future_util.h>
+#include <common/exception/win32_exception.h>
 #include <common/utility/assert.h>
 #include <common/utility/timer.h>
 #include <common/memory/memshfl.h>
@@ -43,13 +46,214 @@
 #include <boost/range/algorithm.hpp>
 #include <boost/range/adaptors.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <boost/thread.hpp>
+
+#include <tbb/atomic.h>
+#include <tbb/concurrent_queue.h>
 
 namespace caspar { namespace core {
+
+namespace {
+
+const monitor::path_handle CONSUME_TIME_PATH("/consume_time");
+
+struct dispatch_config
+{
+	int		queue_depth;
+	int		deadline_millis; // 0 disables the deadline.
+	bool	duplicate;		 // Repeat the next frame for each dropped frame instead of skipping it.
+
+	dispatch_config()
+		: queue_depth(std::max(1, env::properties().get(L"configuration.consumer-dispatch.queue-depth", 3)))
+		, deadline_millis(std::max(0, env::properties().get(L"configuration.consumer-dispatch.deadline", 1000)))
+		, duplicate(env::properties().get(L"configuration.consumer-dispatch.overflow", L"drop") == L"duplicate")
+	{
+	}
+};
+
+// Runs a consumer without a synchronization clock on its own thread behind a
+// bounded queue, so that a slow consumer never delays the output or the
+// clocked consumers of the channel. Frames which do not fit in the queue or
+// have waited longer than the deadline are dropped.
+class consumer_dispatcher : public frame_consumer
+{
+	const safe_ptr<frame_consumer>							consumer_;
+	const dispatch_config									config_;
+
+	tbb::concurrent_bounded_queue<std::shared_ptr<read_frame>>	frames_;
+	tbb::atomic<bool>										is_running_;
+	tbb::atomic<int>										dropped_;
+	tbb::atomic<int>										missed_; // Dropped frames not yet compensated by duplicates.
+
+	video_format_desc										format_desc_;
+	channel_layout											audio_channel_layout_;
+	int														channel_index_;
+
+	const monitor::path_handle								queue_depth_path_;
+	const monitor::path_handle								dropped_path_;
+
+	boost::thread											thread_;
+public:
+	consumer_dispatcher(const safe_ptr<frame_consumer>& consumer, int index)
+		: consumer_(consumer)
+		, audio_channel_layout_(channel_layout::stereo())
+		, channel_index_(-1)
+		, queue_depth_path_("/consumer/" + boost::lexical_cast<std::string>(index) + "/queue_depth")
+		, dropped_path_("/consumer/" + boost::lexical_cast<std::string>(index) + "/dropped")
+	{
+		frames_.set_capacity(config_.queue_depth);
+		is_running_	= true;
+		dropped_	= 0;
+		missed_		= 0;
+	}
+
+	~consumer_dispatcher()
+	{
+		is_running_ = false;
+		frames_.clear();
+		frames_.try_push(nullptr);
+
+		if(thread_.joinable())
+			thread_.join();
+	}
+
+	virtual void initialize(const video_format_desc& format_desc, const channel_layout& audio_channel_layout, int channel_index) override
+	{
+		format_desc_			= format_desc;
+		audio_channel_layout_	= audio_channel_layout;
+		channel_index_			= channel_index;
+
+		consumer_->initialize(format_desc, audio_channel_layout, channel_index);
+
+		if(!thread_.joinable())
+			thread_ = boost::thread([this]{run();});
+	}
+
+	virtual boost::unique_future<bool> send(const safe_ptr<read_frame>& frame) override
+	{
+		if(!is_running_)
+			return wrap_as_future(false);
+
+		if(!frames_.try_push(frame))
+		{
+			++dropped_;
+			++missed_;
+		}
+
+		return wrap_as_future(true);
+	}
+
+	virtual int64_t presentation_frame_age_millis() const override
+	{
+		return consumer_->presentation_frame_age_millis();
+	}
+
+	virtual std::wstring print() const override
+	{
+		return consumer_->print();
+	}
+
+	virtual boost::property_tree::wptree info() const override
+	{
+		auto info = consumer_->info();
+		info.add(L"dispatch.queue-depth", frames_.size());
+		info.add(L"dispatch.dropped", static_cast<int>(dropped_));
+		return info;
+	}
+
+	virtual bool has_synchronization_clock() const override
+	{
+		return false;
+	}
+
+	virtual uint32_t buffer_depth() const override
+	{
+		// Frames can wait in the queue for up to its capacity, so they are sent that much earlier
+		// than to the other consumers to stay aligned with them.
+		return consumer_->buffer_depth() + static_cast<uint32_t>(config_.queue_depth);
+	}
+
+	virtual int index() const override
+	{
+		return consumer_->index();
+	}
+
+	void send_stats(monitor::subject& subject) const
+	{
+		subject << monitor::message(queue_depth_path_) % static_cast<std::int32_t>(std::max<std::ptrdiff_t>(0, frames_.size()));
+		subject << monitor::message(dropped_path_) % static_cast<std::int32_t>(dropped_);
+	}
+private:
+	void run()
+	{
+		win32_exception::ensure_handler_installed_for_thread("consumer-dispatch-thread");
+
+		while(is_running_)
+		{
+			std::shared_ptr<read_frame> frame;
+			frames_.pop(frame);
+
+			if(!frame)
+				break;
+
+			if(config_.deadline_millis > 0 && frame->get_age_millis() > config_.deadline_millis)
+			{
+				++dropped_;
+				++missed_;
+				continue;
+			}
+
+			int repeats = 1;
+
+			if(config_.duplicate)
+				repeats += std::min(config_.queue_depth, missed_.fetch_and_store(0));
+			else
+				missed_ = 0;
+
+			for(int n = 0; n < repeats && is_running_; ++n)
+			{
+				if(!send_to_consumer(make_safe_ptr(frame)))
+				{
+					is_running_ = false;
+					CASPAR_LOG(info) << consumer_->print() << L" Removed.";
+				}
+			}
+		}
+	}
+
+	bool send_to_consumer(const safe_ptr<read_frame>& frame)
+	{
+		try
+		{
+			return consumer_->send(frame).get();
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+		}
+
+		try
+		{
+			consumer_->initialize(format_desc_, audio_channel_layout_, channel_index_);
+			return consumer_->send(frame).get();
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+			CASPAR_LOG(error) << "Failed to recover consumer: " << consumer_->print() << L". Removing it.";
+		}
+
+		return false;
+	}
+};
+
+}
 	
 struct output::implementation
 {		
 	const int										channel_index_;
 	const safe_ptr<diagnostics::graph>				graph_;
+	const safe_ptr<frame_tracer>					tracer_;
 	monitor::subject								monitor_subject_;
 	boost::timer									consume_timer_;
 
@@ -57,6 +261,7 @@ struct output::implementation
 	const channel_layout							audio_channel_layout_;
 
 	std::map<int, safe_ptr<frame_consumer>>			consumers_;
+	std::map<int, safe_ptr<consumer_dispatcher>>	dispatchers_;
 	
 	high_prec_timer									sync_timer_;
 
@@ -66,9 +271,10 @@ struct output::implementation
 	executor										executor_;
 		
 public:
-	implementation(const safe_ptr<diagnostics::graph>& graph, const video_format_desc& format_desc, const channel_layout& audio_channel_layout, int channel_index)
+	implementation(const safe_ptr<diagnostics::graph>& graph, const safe_ptr<frame_tracer>& tracer, const video_format_desc& format_desc, const channel_layout& audio_channel_layout, int channel_index)
 		: channel_index_(channel_index)
 		, graph_(graph)
+		, tracer_(tracer)
 		, monitor_subject_("/output")
 		, format_desc_(format_desc)
 		, audio_channel_layout_(audio_channel_layout)
@@ -82,10 +288,21 @@ public:
 		remove(index);
 
 		consumer = create_consumer_cadence_guard(consumer);
+
+		std::shared_ptr<consumer_dispatcher> dispatcher;
+		if(!consumer->has_synchronization_clock())
+		{
+			dispatcher = std::make_shared<consumer_dispatcher>(consumer, index);
+			consumer = make_safe_ptr(dispatcher);
+		}
+
 		consumer->initialize(format_desc_, audio_channel_layout_, channel_index_);
+		tracer_->set_consumer_name(index, consumer->print());
 		executor_.invoke([&]
 		{
 			consumers_.insert(std::make_pair(index, consumer));
+			if(dispatcher)
+				dispatchers_.insert(std::make_pair(index, make_safe_ptr(dispatcher)));
 			CASPAR_LOG(info) << print() << L" " << consumer->print() << L" Added.";
 		}, high_priority);
 	}
@@ -107,6 +324,7 @@ public:
 			{
 				old_consumer = it->second;
 				send_to_consumers_delays_.erase(it->first);
+				dispatchers_.erase(it->first);
 				consumers_.erase(it);
 			}
 		}, high_priority);
@@ -161,6 +379,7 @@ public:
 			try
 			{
 				consume_timer_.restart();
+				const auto trace_begin = frame_tracer::now();
 
 				auto input_frame = packet.first;
 
@@ -183,6 +402,7 @@ public:
 					return;
 
 				std::map<int, boost::unique_future<bool>> send_results;
+				const auto send_begin = frame_tracer::now();
 
 				// Start invocations
 				for (auto it = consumers_.begin(); it != consumers_.end();)
@@ -225,7 +445,10 @@ public:
 					if (consumer != consumers_.end())
 						try
 						{
-							if (!result_future.get())
+							bool result = result_future.get();
+							tracer_->add_span(frame->get_frame_id(), "consumer-send", send_begin, frame_tracer::now(), result_it->first);
+
+							if (!result)
 							{
 								CASPAR_LOG(info) << print() << L" " << consumer->second->print() << L" Removed.";
 								send_to_consumers_delays_.erase(result_it->first);
@@ -255,8 +478,17 @@ public:
 						}
 				}
 						
+				for(auto it = dispatchers_.begin(); it != dispatchers_.end();)
+				{
+					if(consumers_.find(it->first) == consumers_.end())
+						it = dispatchers_.erase(it);
+					else
+						(it++)->second->send_stats(monitor_subject_);
+				}
+
+				tracer_->add_span(input_frame->get_frame_id(), "output", trace_begin, frame_tracer::now());
 				graph_->set_value("consume-time", consume_timer_.elapsed()*format_desc_.fps*0.5);
-				monitor_subject_ << monitor::message("/consume_time") % (consume_timer_.elapsed());
+				monitor_subject_ << monitor::message(CONSUME_TIME_PATH) % (consume_timer_.elapsed());
 			}
 			catch(...)
 			{
@@ -322,7 +554,7 @@ public:
 	}
 };
 
-output::output(const safe_ptr<diagnostics::graph>& graph, const video_format_desc& format_desc, const channel_layout& audio_channel_layout, int channel_index) : impl_(new implementation(graph, format_desc, audio_channel_layout, channel_index)){}
+output::output(const safe_ptr<diagnostics::graph>& graph, const safe_ptr<frame_tracer>& tracer, const video_format_desc& format_desc, const channel_layout& audio_channel_layout, int channel_index) : impl_(new implementation(graph, tracer, format_desc, audio_channel_layout, channel_index)){}
 void output::add(int index, const safe_ptr<frame_consumer>& consumer){impl_->add(index, consumer);}
 void output::add(const safe_ptr<frame_consumer>& consumer){impl_->add(consumer);}
 void output::remove(int index){impl_->remove(index);}
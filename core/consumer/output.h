@@ -33,12 +33,14 @@
 #include <boost/thread/future.hpp>
 
 namespace caspar { namespace core {
+
+class frame_tracer;
 	
 class output : public target<std::pair<safe_ptr<read_frame>, std::shared_ptr<void>>>
 			 , boost::noncopyable
 {
 public:
-	explicit output(const safe_ptr<diagnostics::graph>& graph, const video_format_desc& format_desc, const channel_layout& audio_channel_layout, int channel_index);
+	explicit output(const safe_ptr<diagnostics::graph>& graph, const safe_ptr<frame_tracer>& tracer, const video_format_desc& format_desc, const channel_layout& audio_channel_layout, int channel_index);
 
 	// target
 	
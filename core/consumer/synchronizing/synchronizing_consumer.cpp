@@ -221,6 +221,7 @@ public:
 		buffer_depth_ = *boost::max_element(depths);
 		has_synchronization_clock_ = boost::count_if(consumers, std::mem_fn(&frame_consumer::has_synchronization_clock)) > 0;
 
+		graph_->set_name("synchronizing-consumer");
 		diagnostics::register_graph(graph_);
 	}
 
@@ -0,0 +1,235 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+#include "StdAfx.h"
+
+#include "frame_trace.h"
+
+#include <common/utility/string.h>
+
+#include <boost/chrono.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <tbb/atomic.h>
+#include <tbb/spin_mutex.h>
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include <windows.h>
+
+namespace caspar { namespace core {
+
+namespace {
+
+const std::size_t SPAN_CAPACITY = 8192; // Power of two.
+
+struct span
+{
+	tbb::atomic<std::uint64_t>	sequence; // 0 while being written, otherwise the write index + 1.
+	std::uint64_t				frame_id;
+	const char*					name;
+	std::int64_t				begin;
+	std::int64_t				end;
+	unsigned long				thread_id;
+	int							consumer_index;
+
+	span()
+		: frame_id(0)
+		, name("")
+		, begin(0)
+		, end(0)
+		, thread_id(0)
+		, consumer_index(-1)
+	{
+		sequence = 0;
+	}
+
+	span(const span& other)
+		: frame_id(other.frame_id)
+		, name(other.name)
+		, begin(other.begin)
+		, end(other.end)
+		, thread_id(other.thread_id)
+		, consumer_index(other.consumer_index)
+	{
+		sequence = other.sequence;
+	}
+};
+
+std::string escape_json(const std::string& str)
+{
+	std::string result;
+	result.reserve(str.size());
+
+	BOOST_FOREACH(char c, str)
+	{
+		if(c == '"' || c == '\\')
+		{
+			result += '\\';
+			result += c;
+		}
+		else if(static_cast<unsigned char>(c) < 0x20)
+			result += ' ';
+		else
+			result += c;
+	}
+
+	return result;
+}
+
+struct frame_ticket
+{
+	const std::uint64_t	frame_id;
+
+	explicit frame_ticket(std::uint64_t frame_id)
+		: frame_id(frame_id)
+	{
+	}
+};
+
+}
+
+struct frame_tracer::implementation : boost::noncopyable
+{
+	const int						channel_index_;
+	tbb::atomic<std::uint64_t>		next_frame_id_;
+	tbb::atomic<std::uint64_t>		write_index_;
+	std::vector<span>				spans_;
+
+	mutable tbb::spin_mutex			names_mutex_;
+	std::map<int, std::wstring>		consumer_names_;
+
+	implementation(int channel_index)
+		: channel_index_(channel_index)
+		, spans_(SPAN_CAPACITY)
+	{
+		next_frame_id_	= 0;
+		write_index_	= 0;
+	}
+
+	// Lock-free, a span being overwritten while it is exported is skipped.
+	void add_span(std::uint64_t frame_id, const char* name, std::int64_t begin, std::int64_t end, int consumer_index)
+	{
+		const std::uint64_t index = write_index_++;
+		auto& span = spans_[static_cast<std::size_t>(index) & (SPAN_CAPACITY - 1)];
+
+		span.sequence		= 0;
+		span.frame_id		= frame_id;
+		span.name			= name;
+		span.begin			= begin;
+		span.end			= end;
+		span.thread_id		= ::GetCurrentThreadId();
+		span.consumer_index	= consumer_index;
+		span.sequence		= index + 1;
+	}
+
+	std::string chrome_trace_json() const
+	{
+		std::map<int, std::wstring> consumer_names;
+		{
+			tbb::spin_mutex::scoped_lock lock(names_mutex_);
+			consumer_names = consumer_names_;
+		}
+
+		const std::uint64_t end_index	= write_index_;
+		const std::uint64_t begin_index	= end_index > SPAN_CAPACITY ? end_index - SPAN_CAPACITY : 0;
+
+		std::stringstream json;
+		json << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+		bool first = true;
+		for(std::uint64_t index = begin_index; index < end_index; ++index)
+		{
+			auto& entry = spans_[static_cast<std::size_t>(index) & (SPAN_CAPACITY - 1)];
+
+			if(entry.sequence != index + 1)
+				continue;
+
+			span copy(entry);
+
+			if(entry.sequence != index + 1)
+				continue;
+
+			if(!first)
+				json << ",";
+			first = false;
+
+			json
+				<< "{\"name\":\"" << copy.name << "\""
+				<< ",\"cat\":\"frame\",\"ph\":\"X\""
+				<< ",\"ts\":" << copy.begin
+				<< ",\"dur\":" << std::max<std::int64_t>(0, copy.end - copy.begin)
+				<< ",\"pid\":" << channel_index_
+				<< ",\"tid\":" << copy.thread_id
+				<< ",\"args\":{\"frame\":" << copy.frame_id;
+
+			if(copy.consumer_index != -1)
+			{
+				auto it = consumer_names.find(copy.consumer_index);
+				json << ",\"consumer\":\"" << (it != consumer_names.end() ? escape_json(narrow(it->second)) : boost::lexical_cast<std::string>(copy.consumer_index)) << "\"";
+			}
+
+			json << "}}";
+		}
+
+		json << "]}";
+
+		return json.str();
+	}
+};
+
+frame_tracer::frame_tracer(int channel_index) : impl_(new implementation(channel_index)){}
+std::uint64_t frame_tracer::next_frame_id(){return ++impl_->next_frame_id_;}
+void frame_tracer::add_span(std::uint64_t frame_id, const char* name, std::int64_t begin, std::int64_t end, int consumer_index){impl_->add_span(frame_id, name, begin, end, consumer_index);}
+std::string frame_tracer::chrome_trace_json() const{return impl_->chrome_trace_json();}
+
+void frame_tracer::set_consumer_name(int consumer_index, const std::wstring& name)
+{
+	tbb::spin_mutex::scoped_lock lock(impl_->names_mutex_);
+	impl_->consumer_names_[consumer_index] = name;
+}
+
+std::int64_t frame_tracer::now()
+{
+	using namespace boost::chrono;
+
+	return duration_cast<microseconds>(high_resolution_clock::now().time_since_epoch()).count();
+}
+
+std::shared_ptr<void> create_frame_ticket(std::uint64_t frame_id, const std::function<void()>& on_released)
+{
+	return std::shared_ptr<frame_ticket>(new frame_ticket(frame_id), [on_released](frame_ticket* ticket)
+	{
+		delete ticket;
+		on_released();
+	});
+}
+
+std::uint64_t get_frame_id(const std::shared_ptr<void>& ticket)
+{
+	return ticket ? static_cast<const frame_ticket*>(ticket.get())->frame_id : 0;
+}
+
+}}
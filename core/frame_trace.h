@@ -0,0 +1,85 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+#pragma once
+
+#include <common/memory/safe_ptr.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace caspar { namespace core {
+
+// Records how long each frame spends in each part of the channel pipeline.
+// The stage gives every frame an id, the mixer, the read_frame and the output
+// add spans for that id to a fixed size ring which can be exported in the
+// Chrome trace event format (chrome://tracing, Perfetto).
+class frame_tracer : boost::noncopyable
+{
+public:
+	explicit frame_tracer(int channel_index);
+
+	std::uint64_t next_frame_id();
+
+	// span names must be string literals.
+	void add_span(std::uint64_t frame_id, const char* name, std::int64_t begin, std::int64_t end, int consumer_index = -1);
+	void set_consumer_name(int consumer_index, const std::wstring& name);
+
+	std::string chrome_trace_json() const;
+
+	static std::int64_t now(); // Microseconds.
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+class frame_trace_scope : boost::noncopyable
+{
+	frame_tracer* const	tracer_;
+	const std::uint64_t	frame_id_;
+	const char* const	name_;
+	const std::int64_t	begin_;
+public:
+	frame_trace_scope(frame_tracer* tracer, std::uint64_t frame_id, const char* name)
+		: tracer_(tracer)
+		, frame_id_(frame_id)
+		, name_(name)
+		, begin_(tracer ? frame_tracer::now() : 0)
+	{
+	}
+
+	~frame_trace_scope()
+	{
+		if(tracer_)
+			tracer_->add_span(frame_id_, name_, begin_, frame_tracer::now());
+	}
+};
+
+// The ticket which the stage sends along with its frames carries the id of
+// the frame. Tickets must be created with create_frame_ticket.
+std::shared_ptr<void> create_frame_ticket(std::uint64_t frame_id, const std::function<void()>& on_released);
+std::uint64_t get_frame_id(const std::shared_ptr<void>& ticket);
+
+}}
@@ -34,12 +34,20 @@
 #include <boost/range/adaptors.hpp>
 #include <boost/range/distance.hpp>
 
+#include <intrin.h>
+
 #include <map>
 #include <stack>
 #include <vector>
 
 namespace caspar { namespace core {
 
+namespace {
+
+const monitor::path_handle NB_CHANNELS_PATH("/nb_channels");
+
+}
+
 struct audio_item
 {
 	const void*			tag;
@@ -58,12 +66,151 @@ struct audio_item
 	}
 };
 
-typedef std::vector<double, tbb::cache_aligned_allocator<double>> audio_buffer_ps;
+typedef std::vector<float, tbb::cache_aligned_allocator<float>> audio_buffer_ps;
+
+// Converts count samples to float while applying a linear volume ramp. offset is the index of
+// the first sample within the frame, the gain steps by alpha for every sample frame (all channels).
+
+void scale_samples(float* dest, const int32_t* src, size_t count, size_t offset, size_t num_channels, float gain, float alpha)
+{
+	size_t n = 0;
+
+	if(alpha == 0.0f)
+	{
+		const auto g = _mm_set1_ps(gain);
+		for(; n + 4 <= count; n += 4)
+			_mm_storeu_ps(dest + n, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n))), g));
+	}
+	else if(num_channels <= 4 && 4 % num_channels == 0)
+	{
+		auto g = _mm_setr_ps(
+				gain + static_cast<float>((offset + 0) / num_channels) * alpha,
+				gain + static_cast<float>((offset + 1) / num_channels) * alpha,
+				gain + static_cast<float>((offset + 2) / num_channels) * alpha,
+				gain + static_cast<float>((offset + 3) / num_channels) * alpha);
+		const auto step = _mm_set1_ps(static_cast<float>(4 / num_channels) * alpha);
+
+		for(; n + 4 <= count; n += 4, g = _mm_add_ps(g, step))
+			_mm_storeu_ps(dest + n, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n))), g));
+	}
+	else if(num_channels % 4 == 0 && offset % 4 == 0)
+	{
+		for(; n + 4 <= count; n += 4)
+		{
+			const auto g = _mm_set1_ps(gain + static_cast<float>((offset + n) / num_channels) * alpha);
+			_mm_storeu_ps(dest + n, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n))), g));
+		}
+	}
+
+	for(; n < count; ++n)
+		dest[n] = static_cast<float>(src[n]) * (gain + static_cast<float>((offset + n) / num_channels) * alpha);
+}
+
+void add_samples(float* dest, const float* src, size_t count)
+{
+	size_t n = 0;
+	for(; n + 4 <= count; n += 4)
+		_mm_storeu_ps(dest + n, _mm_add_ps(_mm_loadu_ps(dest + n), _mm_loadu_ps(src + n)));
+	for(; n < count; ++n)
+		dest[n] += src[n];
+}
+
+void convert_samples(int32_t* dest, const float* src, size_t count)
+{
+	// 2147483520.0f is the largest float below 2^31, cvttps would otherwise wrap to INT_MIN.
+	const auto min = _mm_set1_ps(-2147483648.0f);
+	const auto max = _mm_set1_ps(2147483520.0f);
+
+	size_t n = 0;
+	for(; n + 4 <= count; n += 4)
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n), _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + n), min), max)));
+	for(; n < count; ++n)
+		dest[n] = static_cast<int32_t>(std::min(std::max(src[n], -2147483648.0f), 2147483520.0f));
+}
+
+// Fixed capacity fifo of mixed samples, only reallocates if a producer delivers far more samples than its cadence.
+
+class audio_ring
+{
+	audio_buffer_ps data_;
+	size_t			head_;
+	size_t			size_;
+public:
+	audio_ring()
+		: head_(0)
+		, size_(0)
+	{
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	void reserve(size_t capacity)
+	{
+		if(capacity <= data_.size())
+			return;
+
+		audio_buffer_ps data(capacity, 0.0f);
+		read(data.data(), size_, [](float* dest, const float* src, size_t count){std::copy(src, src + count, dest);});
+		data_.swap(data);
+		head_ = 0;
+	}
+
+	void write(const int32_t* src, size_t count, size_t num_channels, float gain, float alpha)
+	{
+		if(size_ + count > data_.size())
+		{
+			CASPAR_LOG(trace) << L"[audio_mixer] Growing stream buffer";
+			reserve((size_ + count) * 2);
+		}
+
+		const size_t tail	= (head_ + size_) % data_.size();
+		const size_t first	= std::min(count, data_.size() - tail);
+
+		scale_samples(data_.data() + tail, src, first, 0, num_channels, gain, alpha);
+		scale_samples(data_.data(), src + first, count - first, first, num_channels, gain, alpha);
+
+		size_ += count;
+	}
+
+	// Adds up to count samples to dest and removes them, returns the number of samples consumed.
+	size_t mix_into(float* dest, size_t count)
+	{
+		const size_t available = std::min(count, size_);
+		read(dest, available, add_samples);
+
+		head_  = data_.empty() ? 0 : (head_ + available) % data_.size();
+		size_ -= available;
+
+		return available;
+	}
+
+private:
+	template<typename Func>
+	void read(float* dest, size_t count, const Func& func) const
+	{
+		if(count == 0)
+			return;
+
+		const size_t first = std::min(count, data_.size() - head_);
+
+		func(dest, data_.data() + head_, first);
+		func(dest + first, data_.data(), count - first);
+	}
+};
 	
 struct audio_stream
 {
 	frame_transform prev_transform;
-	audio_buffer_ps audio_data;
+	audio_ring		audio_data;
+	bool			is_active;
+
+	audio_stream()
+		: is_active(false)
+	{
+	}
 };
 
 struct audio_mixer::implementation
@@ -72,7 +219,11 @@ struct audio_mixer::implementation
 	std::stack<core::frame_transform>	transform_stack_;
 	std::map<const void*, audio_stream>	audio_streams_;
 	std::vector<audio_item>				items_;
-	std::vector<uint32_t>					audio_cadence_;
+	std::vector<uint32_t>				audio_cadence_;
+	audio_buffer_ps						mix_buffer_;
+	std::vector<int32_t>				peaks_;
+	std::vector<monitor::path_handle>	pfs_paths_;
+	std::vector<monitor::path_handle>	dbfs_paths_;
 	video_format_desc					format_desc_;
 	channel_layout						channel_layout_;
 	float								master_volume_;
@@ -165,116 +316,125 @@ public:
 			audio_cadence_ = format_desc.audio_cadence;
 			format_desc_ = format_desc;
 			channel_layout_ = layout;
+			on_layout_changed();
 		}
 		
-		std::map<const void*, audio_stream>	next_audio_streams;
+		const uint32_t num_channels		= channel_layout_.num_channels;
+		const uint32_t frame_size		= audio_size(audio_cadence_.front());
+		const uint32_t stream_capacity	= audio_size(*boost::max_element(audio_cadence_)) * 4;
+
+		BOOST_FOREACH(auto& stream, audio_streams_ | boost::adaptors::map_values)
+			stream.is_active = false;
 
 		BOOST_FOREACH(auto& item, items_)
 		{			
-			if (next_audio_streams.find(item.tag) != next_audio_streams.end())
-				continue;
-
-			audio_buffer_ps next_audio;
-
 			auto next_transform = item.transform;
 			auto prev_transform = next_transform;
 
-			const auto it = audio_streams_.find(item.tag);
+			auto it = audio_streams_.find(item.tag);
 			if(it != audio_streams_.end())
 			{	
-				prev_transform	= it->second.prev_transform;
-				next_audio		= std::move(it->second.audio_data);
+				if(it->second.is_active) // Only the first item of each tag is mixed.
+					continue;
+
+				prev_transform = it->second.prev_transform;
 			}
 
 			if(prev_transform.volume < 0.001 && next_transform.volume < 0.001)
 				continue;
+
+			if(it == audio_streams_.end())
+			{
+				it = audio_streams_.insert(std::make_pair(item.tag, audio_stream())).first;
+				it->second.audio_data.reserve(stream_capacity);
+			}
 			
 			const double prev_volume = prev_transform.volume * previous_master_volume_;
 			const double next_volume = next_transform.volume * master_volume_;
 									
-			auto alpha = (next_volume-prev_volume)/(item.audio_data.size()/channel_layout_.num_channels);
+			auto alpha = (next_volume-prev_volume)/(item.audio_data.size()/num_channels);
 			
-			for(uint32_t n = 0; n < item.audio_data.size(); ++n)
-			{
-				auto sample_multiplier = (prev_volume + (n/channel_layout_.num_channels) * alpha);
-				next_audio.push_back(item.audio_data[n] * sample_multiplier);
-			}
-										
-			next_audio_streams[item.tag].prev_transform  = std::move(next_transform); // Store all active tags, inactive tags will be removed at the end.
-			next_audio_streams[item.tag].audio_data		 = std::move(next_audio);			
+			it->second.audio_data.write(item.audio_data.data(), item.audio_data.size(), num_channels, static_cast<float>(prev_volume), static_cast<float>(alpha));
+			it->second.prev_transform	= std::move(next_transform);
+			it->second.is_active		= true;
 		}
 
 		previous_master_volume_ = master_volume_;
 		items_.clear();
 
-		audio_streams_ = std::move(next_audio_streams);
-		
-		if(audio_streams_.empty())		
-			audio_streams_[nullptr].audio_data = audio_buffer_ps(audio_size(audio_cadence_.front()), 0.0f);
-				
-		{ // sanity check
-
-			auto nb_invalid_streams = boost::count_if(audio_streams_ | boost::adaptors::map_values, [&](const audio_stream& x)
-			{
-				return x.audio_data.size() < audio_size(audio_cadence_.front());
-			});
-
-			if(nb_invalid_streams > 0)		
-				CASPAR_LOG(trace) << "[audio_mixer] Incorrect frame audio cadence detected.";			
+		for(auto it = audio_streams_.begin(); it != audio_streams_.end();) // Remove inactive tags.
+		{
+			if(it->second.is_active)
+				++it;
+			else
+				it = audio_streams_.erase(it);
 		}
 
-		audio_buffer_ps result_ps(audio_size(audio_cadence_.front()), 0.0f);
+		mix_buffer_.resize(frame_size);
+		std::fill(mix_buffer_.begin(), mix_buffer_.end(), 0.0f);
+
+		int nb_invalid_streams = 0;
 
 		BOOST_FOREACH(auto& stream, audio_streams_ | boost::adaptors::map_values)
 		{
-			//CASPAR_LOG(debug) << stream.audio_data.size() << L" : " << result_ps.size();
-
-			if(stream.audio_data.size() < result_ps.size())
+			if(stream.audio_data.mix_into(mix_buffer_.data(), frame_size) < frame_size)
 			{
-				stream.audio_data.resize(result_ps.size(), 0.0f);
+				++nb_invalid_streams;
 				CASPAR_LOG(trace) << L"[audio_mixer] Appended zero samples";
 			}
-
-			auto out = boost::range::transform(result_ps, stream.audio_data, std::begin(result_ps), std::plus<double>());
-			stream.audio_data.erase(std::begin(stream.audio_data), std::begin(stream.audio_data) + std::distance(std::begin(result_ps), out));
 		}
+
+		if(nb_invalid_streams > 0)		
+			CASPAR_LOG(trace) << "[audio_mixer] Incorrect frame audio cadence detected.";			
 		
 		boost::range::rotate(audio_cadence_, std::begin(audio_cadence_)+1);
-		
 
-		audio_buffer result;
-		result.reserve(result_ps.size());
-		boost::range::transform(result_ps, std::back_inserter(result), [](double sample){return static_cast<int32_t>(sample);});		
+		audio_buffer result(frame_size);
+		convert_samples(result.data(), mix_buffer_.data(), frame_size);
 		
-		const int num_channels = channel_layout_.num_channels;
-		monitor_subject_ << monitor::message("/nb_channels") % num_channels;
+		monitor_subject_ << monitor::message(NB_CHANNELS_PATH) % static_cast<int>(num_channels);
 
-		auto max = std::vector<int32_t>(num_channels, std::numeric_limits<int32_t>::min());
+		std::fill(peaks_.begin(), peaks_.end(), 0);
 
 		for (uint32_t n = 0; n < result.size(); n += num_channels)
-			for (int ch = 0; ch < num_channels; ++ch)
-				max[ch] = std::max(max[ch], std::abs(result[n + ch]));
+			for (uint32_t ch = 0; ch < num_channels; ++ch)
+				peaks_[ch] = std::max(peaks_[ch], std::abs(std::max(result[n + ch], -std::numeric_limits<int32_t>::max())));
 		
 		// Makes the dBFS of silence => -dynamic range of 32bit LPCM => about -192 dBFS
 		// Otherwise it would be -infinity
 		static const auto MIN_PFS = 0.5f / static_cast<float>(std::numeric_limits<int32_t>::max());
 
-		for (int i = 0; i < num_channels; ++i)
+		for (uint32_t i = 0; i < num_channels; ++i)
 		{
-			const auto pFS  = max[i] / static_cast<float>(std::numeric_limits<int32_t>::max());
+			const auto pFS  = peaks_[i] / static_cast<float>(std::numeric_limits<int32_t>::max());
 			const auto dBFS = 20.0f * std::log10(std::max(MIN_PFS, pFS));
-			
-			auto chan_str = boost::lexical_cast<std::string>(i + 1);
 
-			monitor_subject_ << monitor::message("/" + chan_str + "/pFS") % pFS;
-			monitor_subject_ << monitor::message("/" + chan_str + "/dBFS") % dBFS;
+			monitor_subject_ << monitor::message(pfs_paths_[i]) % pFS;
+			monitor_subject_ << monitor::message(dbfs_paths_[i]) % dBFS;
 		}
 
-		graph_->set_value("volume", static_cast<double>(*boost::max_element(max)) / std::numeric_limits<int32_t>::max());
+		graph_->set_value("volume", static_cast<double>(*boost::max_element(peaks_)) / std::numeric_limits<int32_t>::max());
 
 		return result;
 	}
 
+	void on_layout_changed()
+	{
+		const int num_channels = channel_layout_.num_channels;
+
+		peaks_.assign(num_channels, 0);
+		pfs_paths_.clear();
+		dbfs_paths_.clear();
+
+		for (int i = 0; i < num_channels; ++i)
+		{
+			auto chan_str = boost::lexical_cast<std::string>(i + 1);
+
+			pfs_paths_.push_back(monitor::path_handle("/" + chan_str + "/pFS"));
+			dbfs_paths_.push_back(monitor::path_handle("/" + chan_str + "/dBFS"));
+		}
+	}
+
 	uint32_t audio_size(uint32_t num_samples) const
 	{
 		return num_samples * channel_layout_.num_channels;
@@ -33,6 +33,7 @@
 #include <gl/glew.h>
 
 #include <tbb/atomic.h>
+#include <tbb/scalable_allocator.h>
 
 namespace caspar { namespace core {
 
@@ -47,6 +48,7 @@ struct host_buffer::implementation : boost::noncopyable
 	GLenum			usage_;
 	GLenum			target_;
 	fence			fence_;
+	const bool		system_;
 
 public:
 	implementation(uint32_t size, usage_t usage) 
@@ -55,6 +57,7 @@ public:
 		, pbo_(0)
 		, target_(usage == write_only ? GL_PIXEL_UNPACK_BUFFER : GL_PIXEL_PACK_BUFFER)
 		, usage_(usage == write_only ? GL_STREAM_DRAW : GL_STREAM_READ)
+		, system_(false)
 	{
 		GL(glGenBuffers(1, &pbo_));
 		GL(glBindBuffer(target_, pbo_));
@@ -68,10 +71,28 @@ public:
 		CASPAR_LOG(trace) << "[host_buffer] [" << ++(usage_ == write_only ? g_w_total_count : g_r_total_count) << L"] allocated size:" << size_ << " usage: " << (usage == write_only ? "write_only" : "read_only");
 	}	
 
+	implementation(uint32_t size) 
+		: size_(size)
+		, data_(scalable_aligned_malloc(size, 64))
+		, pbo_(0)
+		, target_(0)
+		, usage_(0)
+		, system_(true)
+	{
+		if(!data_)
+			BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Failed to allocate buffer."));
+	}	
+
 	~implementation()
 	{
 		try
 		{
+			if(system_)
+			{
+				scalable_aligned_free(data_);
+				return;
+			}
+
 			GL(glDeleteBuffers(1, &pbo_));
 			//CASPAR_LOG(trace) << "[host_buffer] [" << --(usage_ == write_only ? g_w_total_count : g_r_total_count) << L"] deallocated size:" << size_ << " usage: " << (usage_ == write_only ? "write_only" : "read_only");
 		}
@@ -83,7 +104,7 @@ public:
 
 	void map()
 	{
-		if(data_)
+		if(data_ || system_)
 			return;
 
 		if(usage_ == write_only)			
@@ -98,12 +119,15 @@ public:
 
 	void wait(ogl_device& ogl)
 	{
+		if(system_)
+			return;
+
 		fence_.wait(ogl);
 	}
 
 	void unmap()
 	{
-		if(!data_)
+		if(!data_ || system_)
 			return;
 		
 		GL(glBindBuffer(target_, pbo_));
@@ -114,16 +138,25 @@ public:
 
 	void bind()
 	{
+		if(system_)
+			return;
+
 		GL(glBindBuffer(target_, pbo_));
 	}
 
 	void unbind()
 	{
+		if(system_)
+			return;
+
 		GL(glBindBuffer(target_, 0));
 	}
 
 	void begin_read(uint32_t width, uint32_t height, unsigned int format)
 	{
+		if(system_)
+			BOOST_THROW_EXCEPTION(invalid_operation() << msg_info("Cannot read back into a system memory buffer."));
+
 		unmap();
 		bind();
 		GL(glReadPixels(0, 0, static_cast<GLsizei>(width), static_cast<GLsizei>(height), static_cast<GLuint>(format), GL_UNSIGNED_BYTE, NULL));
@@ -133,11 +166,13 @@ public:
 
 	bool ready() const
 	{
-		return fence_.ready();
+		return system_ || fence_.ready();
 	}
 };
 
 host_buffer::host_buffer(uint32_t size, usage_t usage) : impl_(new implementation(size, usage)){}
+host_buffer::host_buffer(uint32_t size) : impl_(new implementation(size)){}
+safe_ptr<host_buffer> host_buffer::create_system_buffer(uint32_t size){return safe_ptr<host_buffer>(new host_buffer(size));}
 const void* host_buffer::data() const {return impl_->data_;}
 void* host_buffer::data() {return impl_->data_;}
 void host_buffer::map(){impl_->map();}
@@ -52,9 +52,14 @@ public:
 	void begin_read(uint32_t width, uint32_t height, unsigned int format);
 	bool ready() const;
 	void wait(ogl_device& ogl);
+
+	// Buffer backed by plain system memory instead of a pixel buffer object,
+	// always mapped. Used by the cpu image mixer, does not require a GL context.
+	static safe_ptr<host_buffer> create_system_buffer(uint32_t size);
 private:
 	friend class ogl_device;
 	host_buffer(uint32_t size, usage_t usage);
+	host_buffer(uint32_t size);
 
 	struct implementation;
 	safe_ptr<implementation> impl_;
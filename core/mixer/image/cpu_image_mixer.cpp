@@ -0,0 +1,1055 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+#include "../../stdafx.h"
+
+#include "cpu_image_mixer.h"
+
+#include "image_kernel.h"
+#include "../write_frame.h"
+#include "../gpu/host_buffer.h"
+
+#include <common/concurrency/executor.h>
+#include <common/exception/exceptions.h>
+#include <common/utility/move_on_copy.h>
+
+#include <core/producer/frame/frame_transform.h>
+#include <core/producer/frame/pixel_format.h>
+#include <core/video_format.h>
+
+#include <boost/foreach.hpp>
+#include <boost/range/algorithm_ext/erase.hpp>
+
+#include <tbb/parallel_for.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/cache_aligned_allocator.h>
+
+#include <intrin.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace boost::assign;
+
+namespace caspar { namespace core {
+
+namespace {
+
+typedef std::vector<uint8_t, tbb::cache_aligned_allocator<uint8_t>> aligned_buffer;
+
+struct surface
+{
+	uint8_t*	data;
+	int			width;
+	int			height;
+	int			stride; // bytes per pixel, 4 for bgra and 1 for keys.
+
+	uint8_t* row(int y) const
+	{
+		return data + y*width*stride;
+	}
+};
+
+struct item
+{
+	pixel_format_desc							pix_desc;
+	std::vector<std::shared_ptr<host_buffer>>	buffers;
+	frame_transform								transform;
+};
+
+typedef std::pair<blend_mode, std::vector<item>> layer;
+
+struct cpu_draw_params
+{
+	pixel_format_desc				pix_desc;
+	std::vector<const uint8_t*>		planes;
+	frame_transform					transform;
+	blend_mode						blend_mode;
+	keyer::type						keyer;
+	std::shared_ptr<surface>		background;
+	std::shared_ptr<surface>		local_key;
+	std::shared_ptr<surface>		layer_key;
+
+	cpu_draw_params()
+		: blend_mode(blend_mode::normal)
+		, keyer(keyer::linear)
+	{
+	}
+};
+
+// x*y/255 for 8 unsigned 16 bit lanes, exact for x, y <= 255.
+
+inline __m128i mul_div255(__m128i x, __m128i y)
+{
+	auto p = _mm_add_epi16(_mm_mullo_epi16(x, y), _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(p, _mm_srli_epi16(p, 8)), 8);
+}
+
+// Multiplies 4 bgra pixels by 4 per pixel factors (replicated to every byte).
+
+inline __m128i scale_epu8(__m128i px, __m128i factors)
+{
+	const auto zero = _mm_setzero_si128();
+
+	auto lo = mul_div255(_mm_unpacklo_epi8(px, zero), _mm_unpacklo_epi8(factors, zero));
+	auto hi = mul_div255(_mm_unpackhi_epi8(px, zero), _mm_unpackhi_epi8(factors, zero));
+
+	return _mm_packus_epi16(lo, hi);
+}
+
+inline __m128i broadcast_alpha(__m128i px)
+{
+	auto a = _mm_srli_epi32(px, 24);
+	a = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+	return _mm_or_si128(a, _mm_slli_epi32(a, 16));
+}
+
+inline __m128i expand_keys(const uint8_t* key)
+{
+	auto k = _mm_cvtsi32_si128(*reinterpret_cast<const int*>(key));
+	k = _mm_unpacklo_epi8(k, k);
+	return _mm_unpacklo_epi16(k, k);
+}
+
+inline uint8_t div255(int x)
+{
+	return static_cast<uint8_t>((x + 128 + ((x + 128) >> 8)) >> 8);
+}
+
+inline uint8_t to_byte(float x)
+{
+	return static_cast<uint8_t>(std::min(std::max(x, 0.0f), 1.0f)*255.0f + 0.5f);
+}
+
+// Fast path: premultiplied bgra fore, optional keys and opacity, linear or additive keyer.
+
+void blend_row_sse2(
+		uint8_t* dest,
+		const uint8_t* fore,
+		const uint8_t* local_key,
+		const uint8_t* layer_key,
+		int opacity,
+		keyer::type keyer,
+		int count)
+{
+	const auto ones		= _mm_set1_epi8(-1);
+	const auto op		= _mm_set1_epi8(static_cast<char>(opacity));
+
+	int n = 0;
+	for(; n + 4 <= count; n += 4)
+	{
+		auto src = _mm_loadu_si128(reinterpret_cast<const __m128i*>(fore + n*4));
+
+		if(local_key)
+			src = scale_epu8(src, expand_keys(local_key + n));
+		if(layer_key)
+			src = scale_epu8(src, expand_keys(layer_key + n));
+		if(opacity < 255)
+			src = scale_epu8(src, op);
+
+		auto dst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dest + n*4));
+
+		if(keyer == keyer::additive)
+			dst = _mm_adds_epu8(src, dst);
+		else
+			dst = _mm_adds_epu8(src, scale_epu8(dst, _mm_xor_si128(broadcast_alpha(src), ones)));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n*4), dst);
+	}
+
+	for(; n < count; ++n)
+	{
+		int f[4] = {fore[n*4+0], fore[n*4+1], fore[n*4+2], fore[n*4+3]};
+		int k = 255;
+		if(local_key)
+			k = div255(k*local_key[n]);
+		if(layer_key)
+			k = div255(k*layer_key[n]);
+		k = div255(k*opacity);
+
+		for(int c = 0; c < 4; ++c)
+			f[c] = div255(f[c]*k);
+
+		for(int c = 0; c < 4; ++c)
+		{
+			int back = dest[n*4+c];
+			int value = keyer == keyer::additive ? f[c] + back : f[c] + div255((255-f[3])*back);
+			dest[n*4+c] = static_cast<uint8_t>(std::min(value, 255));
+		}
+	}
+}
+
+// Blending functions, ported from shader/blending_glsl.h. Colors are in memory (bgr) order,
+// which is also what the shader operates on, so the hsl based modes give identical results.
+
+inline float blend_overlay(float base, float blend)		{ return base < 0.5f ? (2.0f * base * blend) : (1.0f - 2.0f * (1.0f - base) * (1.0f - blend)); }
+inline float blend_color_dodge(float base, float blend)	{ return blend == 1.0f ? blend : std::min(base / (1.0f - blend), 1.0f); }
+inline float blend_color_burn(float base, float blend)	{ return blend == 0.0f ? blend : std::max((1.0f - ((1.0f - base) / blend)), 0.0f); }
+inline float blend_vivid_light(float base, float blend)	{ return blend < 0.5f ? blend_color_burn(base, 2.0f * blend) : blend_color_dodge(base, 2.0f * (blend - 0.5f)); }
+inline float blend_reflect(float base, float blend)		{ return blend == 1.0f ? blend : std::min(base * base / (1.0f - blend), 1.0f); }
+
+void rgb_to_hsl(const float* c, float* hsl)
+{
+	float fmin  = std::min(std::min(c[0], c[1]), c[2]);
+	float fmax  = std::max(std::max(c[0], c[1]), c[2]);
+	float delta = fmax - fmin;
+
+	hsl[2] = (fmax + fmin) / 2.0f;
+
+	if(delta == 0.0f)
+	{
+		hsl[0] = 0.0f;
+		hsl[1] = 0.0f;
+		return;
+	}
+
+	hsl[1] = hsl[2] < 0.5f ? delta / (fmax + fmin) : delta / (2.0f - fmax - fmin);
+
+	float delta_r = (((fmax - c[0]) / 6.0f) + (delta / 2.0f)) / delta;
+	float delta_g = (((fmax - c[1]) / 6.0f) + (delta / 2.0f)) / delta;
+	float delta_b = (((fmax - c[2]) / 6.0f) + (delta / 2.0f)) / delta;
+
+	if(c[0] == fmax)
+		hsl[0] = delta_b - delta_g;
+	else if(c[1] == fmax)
+		hsl[0] = (1.0f / 3.0f) + delta_r - delta_b;
+	else
+		hsl[0] = (2.0f / 3.0f) + delta_g - delta_r;
+
+	if(hsl[0] < 0.0f)
+		hsl[0] += 1.0f;
+	else if(hsl[0] > 1.0f)
+		hsl[0] -= 1.0f;
+}
+
+float hue_to_rgb(float f1, float f2, float hue)
+{
+	if(hue < 0.0f)
+		hue += 1.0f;
+	else if(hue > 1.0f)
+		hue -= 1.0f;
+
+	if(6.0f * hue < 1.0f)
+		return f1 + (f2 - f1) * 6.0f * hue;
+	if(2.0f * hue < 1.0f)
+		return f2;
+	if(3.0f * hue < 2.0f)
+		return f1 + (f2 - f1) * ((2.0f / 3.0f) - hue) * 6.0f;
+	return f1;
+}
+
+void hsl_to_rgb(const float* hsl, float* c)
+{
+	if(hsl[1] == 0.0f)
+	{
+		c[0] = c[1] = c[2] = hsl[2];
+		return;
+	}
+
+	float f2 = hsl[2] < 0.5f ? hsl[2] * (1.0f + hsl[1]) : (hsl[2] + hsl[1]) - (hsl[1] * hsl[2]);
+	float f1 = 2.0f * hsl[2] - f2;
+
+	c[0] = hue_to_rgb(f1, f2, hsl[0] + (1.0f/3.0f));
+	c[1] = hue_to_rgb(f1, f2, hsl[0]);
+	c[2] = hue_to_rgb(f1, f2, hsl[0] - (1.0f/3.0f));
+}
+
+void blend_hsl(blend_mode::type mode, const float* back, const float* fore, float* out)
+{
+	float back_hsl[3];
+	float fore_hsl[3];
+	rgb_to_hsl(back, back_hsl);
+	rgb_to_hsl(fore, fore_hsl);
+
+	float hsl[3] = {back_hsl[0], back_hsl[1], back_hsl[2]};
+
+	switch(mode)
+	{
+	case blend_mode::contrast: // Maps to hue in the shader.
+		hsl[0] = fore_hsl[0];
+		break;
+	case blend_mode::saturation:
+		hsl[1] = fore_hsl[1];
+		break;
+	case blend_mode::color:
+		hsl[0] = fore_hsl[0];
+		hsl[1] = fore_hsl[1];
+		break;
+	case blend_mode::luminosity:
+		hsl[2] = fore_hsl[2];
+		break;
+	}
+
+	hsl_to_rgb(hsl, out);
+}
+
+void blend_color(blend_mode::type mode, const float* back, float* fore)
+{
+	switch(mode)
+	{
+	case blend_mode::contrast:
+	case blend_mode::saturation:
+	case blend_mode::color:
+	case blend_mode::luminosity:
+		{
+			float out[3];
+			blend_hsl(mode, back, fore, out);
+			std::copy(out, out+3, fore);
+			return;
+		}
+	}
+
+	for(int c = 0; c < 3; ++c)
+	{
+		const float b = back[c];
+		const float f = fore[c];
+		float r;
+
+		switch(mode)
+		{
+		case blend_mode::lighten:		r = std::max(f, b);												break;
+		case blend_mode::darken:		r = std::min(f, b);												break;
+		case blend_mode::multiply:		r = b * f;														break;
+		case blend_mode::average:		r = (b + f) / 2.0f;												break;
+		case blend_mode::linear_dodge:
+		case blend_mode::add:			r = std::min(b + f, 1.0f);										break;
+		case blend_mode::linear_burn:
+		case blend_mode::subtract:		r = std::max(b + f - 1.0f, 0.0f);								break;
+		case blend_mode::difference:	r = std::abs(b - f);											break;
+		case blend_mode::negation:		r = 1.0f - std::abs(1.0f - b - f);								break;
+		case blend_mode::exclusion:		r = b + f - 2.0f * b * f;										break;
+		case blend_mode::screen:		r = 1.0f - ((1.0f - b) * (1.0f - f));							break;
+		case blend_mode::overlay:		r = blend_overlay(b, f);										break;
+		case blend_mode::hard_light:	r = blend_overlay(f, b);										break;
+		case blend_mode::color_dodge:	r = blend_color_dodge(b, f);									break;
+		case blend_mode::color_burn:	r = blend_color_burn(b, f);										break;
+		case blend_mode::linear_light:	r = f < 0.5f ? std::max(b + 2.0f*f - 1.0f, 0.0f) : std::min(b + 2.0f*(f - 0.5f), 1.0f); break;
+		case blend_mode::vivid_light:	r = blend_vivid_light(b, f);									break;
+		case blend_mode::pin_light:		r = f < 0.5f ? std::min(b, 2.0f*f) : std::max(b, 2.0f*(f - 0.5f)); break;
+		case blend_mode::hard_mix:		r = blend_vivid_light(b, f) < 0.5f ? 0.0f : 1.0f;				break;
+		case blend_mode::reflect:		r = blend_reflect(b, f);										break;
+		case blend_mode::glow:			r = blend_reflect(f, b);										break;
+		case blend_mode::phoenix:		r = std::min(b, f) - std::max(b, f) + 1.0f;						break;
+		default:						r = f; // normal, soft_light (disabled in the shader) and mix.
+		}
+
+		fore[c] = r;
+	}
+}
+
+inline float smoothstep(float edge0, float edge1, float x)
+{
+	float t = std::min(std::max((x - edge0) / (edge1 - edge0), 0.0f), 1.0f);
+	return t * t * (3.0f - 2.0f * t);
+}
+
+void chroma_key(const chroma& chroma, float* c)
+{
+	if(chroma.key != chroma::green && chroma.key != chroma::blue)
+		return;
+
+	float d = chroma.key == chroma::green
+			? (2.0f*c[1] - c[2] - c[0]) / 2.0f
+			: (2.0f*c[0] - c[2] - c[1]) / 2.0f;
+
+	float alpha = 1.0f - smoothstep(chroma.threshold, chroma.softness, d);
+	for(int n = 0; n < 4; ++n)
+		c[n] *= alpha;
+
+	float ds = smoothstep(chroma.spill, 1.0f, d/chroma.softness);
+	float gl = c[2]*0.3f + c[1]*0.59f + c[0]*0.11f;
+	for(int n = 0; n < 3; ++n)
+		c[n] = c[n] + (gl*gl - c[n])*ds;
+	c[3] = c[3] + (gl - c[3])*ds;
+}
+
+void adjust_levels(const levels& l, float* c)
+{
+	for(int n = 0; n < 3; ++n)
+	{
+		float x = std::min(std::max(c[n] - static_cast<float>(l.min_input), 0.0f) / static_cast<float>(l.max_input - l.min_input), 1.0f);
+		x = std::pow(x, 1.0f / static_cast<float>(l.gamma));
+		c[n] = static_cast<float>(l.min_output + (l.max_output - l.min_output) * x);
+	}
+}
+
+void adjust_csb(float brt, float sat, float con, float* c)
+{
+	bool demultiply_remultiply = con < 1.0f;
+
+	if(demultiply_remultiply)
+		for(int n = 0; n < 3; ++n)
+			c[n] /= c[3] + 0.0000001f;
+
+	float brt_color[3] = {c[0]*brt, c[1]*brt, c[2]*brt};
+	float intensity = brt_color[0]*0.0721f + brt_color[1]*0.7154f + brt_color[2]*0.2125f;
+
+	for(int n = 0; n < 3; ++n)
+	{
+		float sat_color = intensity + (brt_color[n] - intensity)*sat;
+		c[n] = 0.5f + (sat_color - 0.5f)*con;
+	}
+
+	if(demultiply_remultiply)
+		for(int n = 0; n < 3; ++n)
+			c[n] *= c[3] + 0.0000001f;
+}
+
+// Same matrices as ycbcra_to_rgba in the image shader, in 10 bit fixed point.
+
+struct ycbcr_coefficients
+{
+	int y_scale, cr_r, cr_g, cb_g, cb_b;
+	int y_offset, c_offset, shift;
+
+	ycbcr_coefficients(const pixel_format_desc& desc, int bits)
+	{
+		double kr = 0.299, kb = 0.114;
+		switch(get_color_space(desc))
+		{
+		case color_space::bt709:	kr = 0.2126; kb = 0.0722; break;
+		case color_space::bt2020:	kr = 0.2627; kb = 0.0593; break;
+		}
+		const double kg = 1.0 - kr - kb;
+
+		const double ys = desc.full_range ? 1.0 : 255.0/219.0;
+		const double cs = desc.full_range ? 1.0 : 255.0/224.0;
+
+		y_scale		= static_cast<int>(1024.0*ys + 0.5);
+		cr_r		= static_cast<int>(1024.0*cs*2.0*(1.0 - kr) + 0.5);
+		cr_g		= static_cast<int>(1024.0*cs*2.0*kr*(1.0 - kr)/kg + 0.5);
+		cb_g		= static_cast<int>(1024.0*cs*2.0*kb*(1.0 - kb)/kg + 0.5);
+		cb_b		= static_cast<int>(1024.0*cs*2.0*(1.0 - kb) + 0.5);
+		y_offset	= desc.full_range ? 0 : 16 << (bits - 8);
+		c_offset	= 128 << (bits - 8);
+		shift		= 10 + bits - 8;
+	}
+
+	void to_bgr(int y, int cb, int cr, uint8_t* dest) const
+	{
+		const int round = 1 << (shift - 1);
+		y  = y_scale * (y - y_offset);
+		cb = cb - c_offset;
+		cr = cr - c_offset;
+
+		dest[0] = static_cast<uint8_t>(std::min(std::max((y + cb_b*cb + round) >> shift, 0), 255));
+		dest[1] = static_cast<uint8_t>(std::min(std::max((y - cr_g*cr - cb_g*cb + round) >> shift, 0), 255));
+		dest[2] = static_cast<uint8_t>(std::min(std::max((y + cr_r*cr + round) >> shift, 0), 255));
+	}
+};
+
+// Converts one (resampled) source row into premultiplied bgra.
+
+void fetch_row(
+		const cpu_draw_params& params,
+		int sy,
+		const std::vector<int>& x_map,
+		const std::vector<int>& x_map_chroma,
+		uint8_t* dest)
+{
+	const auto& planes	= params.pix_desc.planes;
+	const int count		= static_cast<int>(x_map.size());
+	const uint8_t* src	= params.planes[0] + sy*planes[0].linesize;
+
+	switch(params.pix_desc.pix_fmt)
+	{
+	case pixel_format::bgra:
+	case pixel_format::rgba:
+	case pixel_format::argb:
+	case pixel_format::abgr:
+		{
+			auto src32	= reinterpret_cast<const uint32_t*>(src);
+			auto dest32	= reinterpret_cast<uint32_t*>(dest);
+			for(int n = 0; n < count; ++n)
+				dest32[n] = src32[x_map[n]];
+
+			if(params.pix_desc.pix_fmt == pixel_format::bgra)
+				break;
+
+			__m128i mask;
+			if(params.pix_desc.pix_fmt == pixel_format::rgba)
+				mask = _mm_set_epi8(15, 12, 13, 14, 11, 8, 9, 10, 7, 4, 5, 6, 3, 0, 1, 2);
+			else if(params.pix_desc.pix_fmt == pixel_format::argb)
+				mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+			else
+				mask = _mm_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1);
+
+			int n = 0;
+			for(; n + 4 <= count; n += 4)
+			{
+				auto px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dest + n*4));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n*4), _mm_shuffle_epi8(px, mask));
+			}
+			for(; n < count; ++n)
+			{
+				uint8_t px[4] = {dest[n*4+0], dest[n*4+1], dest[n*4+2], dest[n*4+3]};
+				for(int c = 0; c < 4; ++c)
+					dest[n*4+c] = px[reinterpret_cast<const uint8_t*>(&mask)[c]];
+			}
+			break;
+		}
+	case pixel_format::gray:
+	case pixel_format::luma:
+		{
+			const bool luma = params.pix_desc.pix_fmt == pixel_format::luma;
+			for(int n = 0; n < count; ++n)
+			{
+				int y = src[x_map[n]*planes[0].channels];
+				if(luma)
+					y = std::min(std::max((y - 16) * 255 / 219, 0), 255);
+				dest[n*4+0] = dest[n*4+1] = dest[n*4+2] = static_cast<uint8_t>(y);
+				dest[n*4+3] = 255;
+			}
+			break;
+		}
+	case pixel_format::ycbcr:
+	case pixel_format::ycbcra:
+		{
+			const ycbcr_coefficients k(params.pix_desc, 8);
+
+			const int csy		= sy * planes[1].height / planes[0].height;
+			const uint8_t* cb	= params.planes[1] + csy*planes[1].linesize;
+			const uint8_t* cr	= params.planes[2] + csy*planes[2].linesize;
+			const uint8_t* a	= params.pix_desc.pix_fmt == pixel_format::ycbcra ? params.planes[3] + sy*planes[3].linesize : nullptr;
+
+			for(int n = 0; n < count; ++n)
+			{
+				k.to_bgr(src[x_map[n]], cb[x_map_chroma[n]], cr[x_map_chroma[n]], dest + n*4);
+				dest[n*4+3] = a ? a[x_map[n]] : 255;
+			}
+			break;
+		}
+	case pixel_format::ycbcr10:
+	case pixel_format::ycbcra10:
+		{
+			const ycbcr_coefficients k(params.pix_desc, 10);
+
+			const int csy		= sy * planes[1].height / planes[0].height;
+			auto y16			= reinterpret_cast<const uint16_t*>(src);
+			auto cb16			= reinterpret_cast<const uint16_t*>(params.planes[1] + csy*planes[1].linesize);
+			auto cr16			= reinterpret_cast<const uint16_t*>(params.planes[2] + csy*planes[2].linesize);
+			auto a16			= params.pix_desc.pix_fmt == pixel_format::ycbcra10 ? reinterpret_cast<const uint16_t*>(params.planes[3] + sy*planes[3].linesize) : nullptr;
+
+			for(int n = 0; n < count; ++n)
+			{
+				k.to_bgr(y16[x_map[n]], cb16[x_map_chroma[n]], cr16[x_map_chroma[n]], dest + n*4);
+				dest[n*4+3] = a16 ? static_cast<uint8_t>((std::min<int>(a16[x_map[n]], 1023) * 255 + 511) / 1023) : 255;
+			}
+			break;
+		}
+	default:
+		std::fill(dest, dest + count*4, 0);
+	}
+}
+
+class cpu_image_kernel : boost::noncopyable
+{
+	tbb::enumerable_thread_specific<aligned_buffer> row_buffers_;
+public:
+	void draw(cpu_draw_params&& params)
+	{
+		static const double epsilon = 0.001;
+
+		if(params.planes.empty() || !params.background)
+			return;
+
+		if(params.transform.opacity < epsilon)
+			return;
+
+		if(params.transform.is_key)
+			params.blend_mode = blend_mode::normal;
+
+		const auto& bg = *params.background;
+		const double w = static_cast<double>(bg.width);
+		const double h = static_cast<double>(bg.height);
+
+		// Setup drawing area
+
+		const int y_offset = (params.transform.is_paused && params.transform.field_mode == field_mode::upper) ? 1 : 0;
+
+		const auto f_p = params.transform.fill_translation;
+		const auto f_s = params.transform.fill_scale;
+		const double fx0 = f_p[0]*w;
+		const double fx1 = (f_p[0]+f_s[0])*w;
+		const double fy0 = f_p[1]*h + y_offset;
+		const double fy1 = (f_p[1]+f_s[1])*h + y_offset;
+
+		if(std::abs(fx1 - fx0) < epsilon || std::abs(fy1 - fy0) < epsilon)
+			return;
+
+		int x0 = std::max(0, static_cast<int>(std::min(fx0, fx1) + 0.5));
+		int x1 = std::min(bg.width, static_cast<int>(std::max(fx0, fx1) + 0.5));
+		int y0 = std::max(0, static_cast<int>(std::min(fy0, fy1) + 0.5));
+		int y1 = std::min(bg.height, static_cast<int>(std::max(fy0, fy1) + 0.5));
+
+		const auto m_p = params.transform.clip_translation;
+		const auto m_s = params.transform.clip_scale;
+
+		x0 = std::max(x0, static_cast<int>(m_p[0]*w));
+		x1 = std::min(x1, static_cast<int>((m_p[0]+m_s[0])*w));
+		y0 = std::max(y0, static_cast<int>(m_p[1]*h));
+		y1 = std::min(y1, static_cast<int>((m_p[1]+m_s[1])*h));
+
+		if(x1 <= x0 || y1 <= y0)
+			return;
+
+		// Nearest neighbour source lookup
+
+		const auto& planes	= params.pix_desc.planes;
+		const int src_w		= static_cast<int>(planes.at(0).width);
+		const int src_h		= static_cast<int>(planes.at(0).height);
+		const int count		= x1 - x0;
+
+		std::vector<int> x_map(count);
+		std::vector<int> x_map_chroma;
+		for(int n = 0; n < count; ++n)
+			x_map[n] = std::min(std::max(static_cast<int>((x0 + n + 0.5 - fx0) / (fx1 - fx0) * src_w), 0), src_w-1);
+
+		if(planes.size() > 1)
+		{
+			x_map_chroma.resize(count);
+			for(int n = 0; n < count; ++n)
+				x_map_chroma[n] = x_map[n] * static_cast<int>(planes[1].width) / src_w;
+		}
+
+		// Setup image-adjustements
+
+		const bool levels =
+				params.transform.levels.min_input  > epsilon		||
+				params.transform.levels.max_input  < 1.0-epsilon	||
+				params.transform.levels.min_output > epsilon		||
+				params.transform.levels.max_output < 1.0-epsilon	||
+				std::abs(params.transform.levels.gamma - 1.0) > epsilon;
+
+		const bool csb =
+				std::abs(params.transform.brightness - 1.0) > epsilon ||
+				std::abs(params.transform.saturation - 1.0) > epsilon ||
+				std::abs(params.transform.contrast - 1.0)   > epsilon;
+
+		const bool fast_path =
+				!levels &&
+				!csb &&
+				bg.stride == 4 &&
+				params.blend_mode.mode == blend_mode::normal &&
+				params.blend_mode.chroma.key == chroma::none;
+
+		const double opacity = params.transform.is_key ? 1.0 : params.transform.opacity;
+		const auto field = params.transform.field_mode;
+
+		tbb::parallel_for(tbb::blocked_range<int>(y0, y1, 8), [&](const tbb::blocked_range<int>& r)
+		{
+			auto& row_buffer = row_buffers_.local();
+			row_buffer.resize(count*4 + 16);
+			auto fore = row_buffer.data();
+
+			for(int y = r.begin(); y < r.end(); ++y)
+			{
+				// Interlacing, same as the polygon stipple pattern of the gpu mixer.
+				if(field == field_mode::upper && (y % 2) != 0)
+					continue;
+				if(field == field_mode::lower && (y % 2) != 1)
+					continue;
+
+				const int sy = std::min(std::max(static_cast<int>((y + 0.5 - fy0) / (fy1 - fy0) * src_h), 0), src_h-1);
+				fetch_row(params, sy, x_map, x_map_chroma, fore);
+
+				const uint8_t* local_key = params.local_key ? params.local_key->row(y) + x0 : nullptr;
+				const uint8_t* layer_key = params.layer_key ? params.layer_key->row(y) + x0 : nullptr;
+
+				if(fast_path)
+					blend_row_sse2(bg.row(y) + x0*4, fore, local_key, layer_key, std::min(static_cast<int>(opacity*255.0 + 0.5), 255), params.keyer, count);
+				else
+					blend_row(params, bg.row(y) + x0*bg.stride, fore, local_key, layer_key, static_cast<float>(opacity), levels, csb, count);
+			}
+		});
+	}
+
+	void post_process(const surface& background, bool straighten_alpha)
+	{
+		if(!straighten_alpha)
+			return;
+
+		tbb::parallel_for(tbb::blocked_range<int>(0, background.height, 8), [&](const tbb::blocked_range<int>& r)
+		{
+			for(int y = r.begin(); y < r.end(); ++y)
+			{
+				auto row = background.row(y);
+				for(int n = 0; n < background.width; ++n, row += 4)
+				{
+					if(row[3] == 0 || row[3] == 255)
+						continue;
+
+					for(int c = 0; c < 3; ++c)
+						row[c] = static_cast<uint8_t>(std::min(row[c] * 255 / row[3], 255));
+				}
+			}
+		});
+	}
+
+private:
+
+	// General path, follows the order of operations in the image shader.
+
+	void blend_row(
+			const cpu_draw_params& params,
+			uint8_t* dest,
+			const uint8_t* fore,
+			const uint8_t* local_key,
+			const uint8_t* layer_key,
+			float opacity,
+			bool levels,
+			bool csb,
+			int count)
+	{
+		const float brt = static_cast<float>(params.transform.brightness);
+		const float sat = static_cast<float>(params.transform.saturation);
+		const float con = static_cast<float>(params.transform.contrast);
+		const auto mode = params.blend_mode.mode;
+
+		for(int n = 0; n < count; ++n)
+		{
+			float c[4];
+			for(int i = 0; i < 4; ++i)
+				c[i] = fore[n*4+i] / 255.0f;
+
+			chroma_key(params.blend_mode.chroma, c);
+
+			if(levels)
+				adjust_levels(params.transform.levels, c);
+			if(csb)
+				adjust_csb(brt, sat, con, c);
+
+			float k = opacity;
+			if(local_key)
+				k *= local_key[n] / 255.0f;
+			if(layer_key)
+				k *= layer_key[n] / 255.0f;
+			for(int i = 0; i < 4; ++i)
+				c[i] *= k;
+
+			if(params.background->stride == 1) // Key buffer, only the red component is kept.
+			{
+				float back = dest[n] / 255.0f;
+				dest[n] = to_byte(params.keyer == keyer::additive ? c[2] + back : c[2] + (1.0f - c[3])*back);
+				continue;
+			}
+
+			float back[4];
+			for(int i = 0; i < 4; ++i)
+				back[i] = dest[n*4+i] / 255.0f;
+
+			if(mode != blend_mode::normal)
+			{
+				float back_straight[3];
+				for(int i = 0; i < 3; ++i)
+				{
+					back_straight[i] = back[i]/(back[3]+0.0000001f);
+					c[i] = c[i]/(c[3]+0.0000001f);
+				}
+				blend_color(mode, back_straight, c);
+				for(int i = 0; i < 3; ++i)
+					c[i] *= c[3];
+			}
+
+			for(int i = 0; i < 4; ++i)
+				dest[n*4+i] = to_byte(params.keyer == keyer::additive ? c[i] + back[i] : c[i] + (1.0f - c[3])*back[i]);
+		}
+	}
+};
+
+class cpu_image_renderer
+{
+	cpu_image_kernel								kernel_;
+	std::vector<std::shared_ptr<aligned_buffer>>	pool_;
+	executor										executor_;
+public:
+	cpu_image_renderer(int channel_index)
+		: executor_(L"cpu_image_mixer[" + std::to_wstring(static_cast<uint64_t>(channel_index)) + L"]")
+	{
+	}
+
+	boost::unique_future<safe_ptr<host_buffer>> operator()(
+			std::vector<layer>&& layers,
+			const video_format_desc& format_desc,
+			bool straighten_alpha)
+	{
+		auto layers2 = make_move_on_copy(std::move(layers));
+		return executor_.begin_invoke([=]
+		{
+			return do_render(
+					std::move(layers2.value), format_desc, straighten_alpha);
+		});
+	}
+
+private:
+	safe_ptr<host_buffer> do_render(std::vector<layer>&& layers, const video_format_desc& format_desc, bool straighten_alpha)
+	{
+		auto result = host_buffer::create_system_buffer(format_desc.size);
+
+		auto draw_buffer = std::make_shared<surface>();
+		draw_buffer->data	= static_cast<uint8_t*>(result->data());
+		draw_buffer->width	= format_desc.width;
+		draw_buffer->height	= format_desc.height;
+		draw_buffer->stride	= 4;
+		clear(*draw_buffer);
+
+		if(format_desc.field_mode != field_mode::progressive)
+		{
+			auto upper = layers;
+			auto lower = std::move(layers);
+
+			BOOST_FOREACH(auto& layer, upper)
+			{
+				BOOST_FOREACH(auto& item, layer.second)
+					item.transform.field_mode = static_cast<field_mode::type>(item.transform.field_mode & field_mode::upper);
+			}
+
+			BOOST_FOREACH(auto& layer, lower)
+			{
+				BOOST_FOREACH(auto& item, layer.second)
+					item.transform.field_mode = static_cast<field_mode::type>(item.transform.field_mode & field_mode::lower);
+			}
+
+			draw(std::move(upper), draw_buffer, format_desc);
+			draw(std::move(lower), draw_buffer, format_desc);
+		}
+		else
+		{
+			draw(std::move(layers), draw_buffer, format_desc);
+		}
+
+		kernel_.post_process(*draw_buffer, straighten_alpha);
+
+		return result;
+	}
+
+	void draw(std::vector<layer>&&				layers,
+			  const std::shared_ptr<surface>&	draw_buffer,
+			  const video_format_desc&			format_desc)
+	{
+		std::shared_ptr<surface> layer_key_buffer;
+
+		BOOST_FOREACH(auto& layer, layers)
+			draw_layer(std::move(layer), draw_buffer, layer_key_buffer, format_desc);
+	}
+
+	void draw_layer(layer&&							layer,
+					const std::shared_ptr<surface>&	draw_buffer,
+					std::shared_ptr<surface>&		layer_key_buffer,
+					const video_format_desc&		format_desc)
+	{
+		boost::remove_erase_if(layer.second, [](const item& item){return item.transform.field_mode == field_mode::empty;});
+
+		if(layer.second.empty())
+			return;
+
+		std::shared_ptr<surface> local_key_buffer;
+		std::shared_ptr<surface> local_mix_buffer;
+
+		if(layer.first.mode != blend_mode::normal || layer.first.chroma.key != chroma::none)
+		{
+			auto layer_draw_buffer = create_mixer_buffer(4, format_desc);
+
+			BOOST_FOREACH(auto& item, layer.second)
+				draw_item(std::move(item), layer_draw_buffer, layer_key_buffer, local_key_buffer, local_mix_buffer, format_desc);
+
+			draw_mixer_buffer(layer_draw_buffer, std::move(local_mix_buffer), blend_mode::normal);
+			draw_mixer_buffer(draw_buffer, std::move(layer_draw_buffer), layer.first);
+		}
+		else // fast path
+		{
+			BOOST_FOREACH(auto& item, layer.second)
+				draw_item(std::move(item), draw_buffer, layer_key_buffer, local_key_buffer, local_mix_buffer, format_desc);
+
+			draw_mixer_buffer(draw_buffer, std::move(local_mix_buffer), layer.first);
+		}
+
+		layer_key_buffer = std::move(local_key_buffer);
+	}
+
+	void draw_item(item&&							item,
+				   const std::shared_ptr<surface>&	draw_buffer,
+				   std::shared_ptr<surface>&		layer_key_buffer,
+				   std::shared_ptr<surface>&		local_key_buffer,
+				   std::shared_ptr<surface>&		local_mix_buffer,
+				   const video_format_desc&			format_desc)
+	{
+		if(std::any_of(item.buffers.begin(), item.buffers.end(), [](const std::shared_ptr<host_buffer>& buffer){return !buffer || !buffer->data();}))
+		{
+			CASPAR_LOG(warning) << L"[cpu_image_mixer] Frame without system memory planes ignored, was it created by a gpu mixer?";
+			return;
+		}
+
+		cpu_draw_params draw_params;
+		draw_params.pix_desc				= std::move(item.pix_desc);
+		draw_params.transform				= std::move(item.transform);
+
+		BOOST_FOREACH(auto& buffer, item.buffers)
+			draw_params.planes.push_back(static_cast<const uint8_t*>(buffer->data()));
+
+		if(draw_params.transform.is_key)
+		{
+			local_key_buffer = local_key_buffer ? local_key_buffer : create_mixer_buffer(1, format_desc);
+
+			draw_params.background			= local_key_buffer;
+			draw_params.local_key			= nullptr;
+			draw_params.layer_key			= nullptr;
+
+			kernel_.draw(std::move(draw_params));
+		}
+		else if(draw_params.transform.is_mix)
+		{
+			local_mix_buffer = local_mix_buffer ? local_mix_buffer : create_mixer_buffer(4, format_desc);
+
+			draw_params.background			= local_mix_buffer;
+			draw_params.local_key			= std::move(local_key_buffer);
+			draw_params.layer_key			= layer_key_buffer;
+
+			draw_params.keyer				= keyer::additive;
+
+			kernel_.draw(std::move(draw_params));
+		}
+		else
+		{
+			draw_mixer_buffer(draw_buffer, std::move(local_mix_buffer), blend_mode::normal);
+
+			draw_params.background			= draw_buffer;
+			draw_params.local_key			= std::move(local_key_buffer);
+			draw_params.layer_key			= layer_key_buffer;
+
+			kernel_.draw(std::move(draw_params));
+		}
+	}
+
+	void draw_mixer_buffer(const std::shared_ptr<surface>&	draw_buffer,
+						   std::shared_ptr<surface>&&		source_buffer,
+						   blend_mode   			        blend_mode = blend_mode::normal)
+	{
+		if(!source_buffer)
+			return;
+
+		cpu_draw_params draw_params;
+		draw_params.pix_desc.pix_fmt	= pixel_format::bgra;
+		draw_params.pix_desc.planes		= list_of(pixel_format_desc::plane(source_buffer->width, source_buffer->height, 4));
+		draw_params.planes				= list_of(static_cast<const uint8_t*>(source_buffer->data));
+		draw_params.transform			= frame_transform();
+		draw_params.blend_mode			= blend_mode;
+		draw_params.background			= draw_buffer;
+
+		kernel_.draw(std::move(draw_params));
+	}
+
+	std::shared_ptr<surface> create_mixer_buffer(int stride, const video_format_desc& format_desc)
+	{
+		const size_t size = format_desc.width*format_desc.height*stride;
+
+		// Intermediate buffers are recycled, they are only referenced during do_render.
+		auto it = std::find_if(pool_.begin(), pool_.end(), [&](const std::shared_ptr<aligned_buffer>& buffer)
+		{
+			return buffer.unique() && buffer->size() == size;
+		});
+
+		std::shared_ptr<aligned_buffer> storage;
+		if(it != pool_.end())
+			storage = *it;
+		else
+		{
+			storage = std::make_shared<aligned_buffer>(size);
+			pool_.push_back(storage);
+		}
+
+		auto buffer = std::shared_ptr<surface>(new surface(), [storage](surface* s){delete s;});
+		buffer->data	= storage->data();
+		buffer->width	= format_desc.width;
+		buffer->height	= format_desc.height;
+		buffer->stride	= stride;
+		clear(*buffer);
+
+		return buffer;
+	}
+
+	void clear(const surface& buffer)
+	{
+		tbb::parallel_for(tbb::blocked_range<int>(0, buffer.height, 16), [&](const tbb::blocked_range<int>& r)
+		{
+			memset(buffer.row(r.begin()), 0, r.size()*buffer.width*buffer.stride);
+		});
+	}
+};
+
+}
+
+struct cpu_image_mixer::implementation : boost::noncopyable
+{
+	cpu_image_renderer				renderer_;
+	std::vector<frame_transform>	transform_stack_;
+	std::vector<layer>				layers_; // layer/stream/items
+public:
+	implementation(int channel_index)
+		: renderer_(channel_index)
+		, transform_stack_(1)
+	{
+	}
+
+	void begin_layer(blend_mode blend_mode)
+	{
+		layers_.push_back(std::make_pair(blend_mode, std::vector<item>()));
+	}
+
+	void begin(basic_frame& frame)
+	{
+		transform_stack_.push_back(transform_stack_.back()*frame.get_frame_transform());
+	}
+
+	void visit(write_frame& frame)
+	{
+		item item;
+		item.pix_desc	= frame.get_pixel_format_desc();
+		item.buffers	= frame.get_buffers();
+		item.transform	= transform_stack_.back();
+
+		layers_.back().second.push_back(item);
+	}
+
+	void end()
+	{
+		transform_stack_.pop_back();
+	}
+
+	void end_layer()
+	{
+	}
+
+	boost::unique_future<safe_ptr<host_buffer>> render(const video_format_desc& format_desc, bool straighten_alpha)
+	{
+		return renderer_(std::move(layers_), format_desc, straighten_alpha);
+	}
+};
+
+cpu_image_mixer::cpu_image_mixer(int channel_index) : impl_(new implementation(channel_index)){}
+void cpu_image_mixer::begin(basic_frame& frame){impl_->begin(frame);}
+void cpu_image_mixer::visit(write_frame& frame){impl_->visit(frame);}
+void cpu_image_mixer::end(){impl_->end();}
+boost::unique_future<safe_ptr<host_buffer>> cpu_image_mixer::operator()(const video_format_desc& format_desc, bool straighten_alpha){return impl_->render(format_desc, straighten_alpha);}
+void cpu_image_mixer::begin_layer(blend_mode blend_mode){impl_->begin_layer(blend_mode);}
+void cpu_image_mixer::end_layer(){impl_->end_layer();}
+
+}}
@@ -0,0 +1,52 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+#pragma once
+
+#include "image_mixer.h"
+
+#include <common/memory/safe_ptr.h>
+
+namespace caspar { namespace core {
+
+// Composites layers in system memory using SSE kernels, does not require an
+// OpenGL device. Only write_frames created without an ogl_device can be mixed.
+class cpu_image_mixer : public image_mixer
+{
+public:
+	cpu_image_mixer(int channel_index);
+
+	virtual void begin(core::basic_frame& frame) override;
+	virtual void visit(core::write_frame& frame) override;
+	virtual void end() override;
+
+	virtual void begin_layer(blend_mode blend_mode) override;
+	virtual void end_layer() override;
+
+	virtual boost::unique_future<safe_ptr<host_buffer>> operator()(
+			const video_format_desc& format_desc, bool straighten_alpha) override;
+
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+}}
@@ -110,7 +110,8 @@ struct image_kernel::implementation : boost::noncopyable
 		shader_->set("plane[3]",		texture_id::plane3);
 		shader_->set("local_key",		texture_id::local_key);
 		shader_->set("layer_key",		texture_id::layer_key);
-		shader_->set("is_hd",		 	params.pix_desc.planes.at(0).height > 700 ? 1 : 0);
+		shader_->set("color_space",		static_cast<int>(get_color_space(params.pix_desc)));
+		shader_->set("full_range",		params.pix_desc.full_range);
 		shader_->set("has_local_key",	bool(params.local_key));
 		shader_->set("has_layer_key",	bool(params.layer_key));
 		shader_->set("pixel_format",	params.pix_desc.pix_fmt);	
@@ -127,6 +127,14 @@ private:
 		return host_buffer;
 	}
 
+public:
+	std::shared_ptr<device_buffer> render_target() const
+	{
+		return transferring_buffer_;
+	}
+
+private:
+
 	void draw(std::vector<layer>&&		layers, 
 			  safe_ptr<device_buffer>&	draw_buffer, 
 			  const video_format_desc& format_desc)
@@ -243,7 +251,7 @@ private:
 	}
 };
 		
-struct image_mixer::implementation : boost::noncopyable
+struct ogl_image_mixer::implementation : boost::noncopyable
 {	
 	safe_ptr<ogl_device>			ogl_;
 	image_renderer					renderer_;
@@ -290,14 +298,20 @@ public:
 	{
 		return renderer_(std::move(layers_), format_desc, straighten_alpha);
 	}
+
+	std::shared_ptr<device_buffer> render_target() const
+	{
+		return renderer_.render_target();
+	}
 };
 
-image_mixer::image_mixer(const safe_ptr<ogl_device>& ogl) : impl_(new implementation(ogl)){}
-void image_mixer::begin(basic_frame& frame){impl_->begin(frame);}
-void image_mixer::visit(write_frame& frame){impl_->visit(frame);}
-void image_mixer::end(){impl_->end();}
-boost::unique_future<safe_ptr<host_buffer>> image_mixer::operator()(const video_format_desc& format_desc, bool straighten_alpha){return impl_->render(format_desc, straighten_alpha);}
-void image_mixer::begin_layer(blend_mode blend_mode){impl_->begin_layer(blend_mode);}
-void image_mixer::end_layer(){impl_->end_layer();}
+ogl_image_mixer::ogl_image_mixer(const safe_ptr<ogl_device>& ogl) : impl_(new implementation(ogl)){}
+void ogl_image_mixer::begin(basic_frame& frame){impl_->begin(frame);}
+void ogl_image_mixer::visit(write_frame& frame){impl_->visit(frame);}
+void ogl_image_mixer::end(){impl_->end();}
+boost::unique_future<safe_ptr<host_buffer>> ogl_image_mixer::operator()(const video_format_desc& format_desc, bool straighten_alpha){return impl_->render(format_desc, straighten_alpha);}
+std::shared_ptr<device_buffer> ogl_image_mixer::render_target() const{return impl_->render_target();}
+void ogl_image_mixer::begin_layer(blend_mode blend_mode){impl_->begin_layer(blend_mode);}
+void ogl_image_mixer::end_layer(){impl_->end_layer();}
 
 }}
\ No newline at end of file
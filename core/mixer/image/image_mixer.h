@@ -35,6 +35,7 @@ namespace caspar { namespace core {
 
 class write_frame;
 class host_buffer;
+class device_buffer;
 class ogl_device;
 struct video_format_desc;
 struct pixel_format_desc;
@@ -42,17 +43,34 @@ struct pixel_format_desc;
 class image_mixer : public core::frame_visitor, boost::noncopyable
 {
 public:
-	image_mixer(const safe_ptr<ogl_device>& ogl);
+	virtual ~image_mixer(){}
+
+	virtual void begin_layer(blend_mode blend_mode) = 0;
+	virtual void end_layer() = 0;
+		
+	virtual boost::unique_future<safe_ptr<host_buffer>> operator()(
+			const video_format_desc& format_desc, bool straighten_alpha) = 0;
+
+	// The device buffer which the last image was rendered to. Only valid once
+	// the future returned by operator() is ready, nullptr for the cpu mixer.
+	virtual std::shared_ptr<device_buffer> render_target() const { return nullptr; }
+};
+
+class ogl_image_mixer : public image_mixer
+{
+public:
+	ogl_image_mixer(const safe_ptr<ogl_device>& ogl);
 	
-	virtual void begin(core::basic_frame& frame);
-	virtual void visit(core::write_frame& frame);
-	virtual void end();
+	virtual void begin(core::basic_frame& frame) override;
+	virtual void visit(core::write_frame& frame) override;
+	virtual void end() override;
 
-	void begin_layer(blend_mode blend_mode);
-	void end_layer();
+	virtual void begin_layer(blend_mode blend_mode) override;
+	virtual void end_layer() override;
 		
-	boost::unique_future<safe_ptr<host_buffer>> operator()(
-			const video_format_desc& format_desc, bool straighten_alpha);
+	virtual boost::unique_future<safe_ptr<host_buffer>> operator()(
+			const video_format_desc& format_desc, bool straighten_alpha) override;
+	virtual std::shared_ptr<device_buffer> render_target() const override;
 		
 private:
 	struct implementation;
@@ -156,7 +156,8 @@ std::string get_fragment(bool blend_modes, bool chroma_key, bool post_processing
 	"uniform sampler2D	local_key;														\n"
 	"uniform sampler2D	layer_key;														\n"
 	"																					\n"
-	"uniform bool		is_hd;															\n"
+	"uniform int		color_space;													\n"
+	"uniform bool		full_range;														\n"
 	"uniform bool		has_local_key;													\n"
 	"uniform bool		has_layer_key;													\n"
 	"uniform int		blend_mode;														\n"
@@ -195,32 +196,32 @@ std::string get_fragment(bool blend_modes, bool chroma_key, bool post_processing
 	+
 	
 	"																					\n"
-	"vec4 ycbcra_to_rgba_sd(float Y, float Cb, float Cr, float A)						\n"
+	"vec4 ycbcra_to_rgba(float Y, float Cb, float Cr, float A)							\n"
 	"{																					\n"
-	"   vec4 rgba;																		\n"
-	"   rgba.b = (1.164*(Y*255 - 16) + 1.596*(Cr*255 - 128))/255;						\n"
-	"   rgba.g = (1.164*(Y*255 - 16) - 0.813*(Cr*255 - 128) - 0.391*(Cb*255 - 128))/255;\n"
-	"   rgba.r = (1.164*(Y*255 - 16) + 2.018*(Cb*255 - 128))/255;						\n"
-	"   rgba.a = A;																		\n"
-	"	return rgba;																	\n"	
-	"}																					\n"			
+	"	vec2 k;	// Kr, Kb																\n"
+	"	switch(color_space)																\n"
+	"	{																				\n"
+	"	case 2:  k = vec2(0.2126, 0.0722); break; // bt709								\n"
+	"	case 3:  k = vec2(0.2627, 0.0593); break; // bt2020								\n"
+	"	default: k = vec2(0.299,  0.114);  break; // bt601								\n"
+	"	}																				\n"
 	"																					\n"
-	"vec4 ycbcra_to_rgba_hd(float Y, float Cb, float Cr, float A)						\n"
-	"{																					\n"
-	"   vec4 rgba;																		\n"
-	"   rgba.b = (1.164*(Y*255 - 16) + 1.793*(Cr*255 - 128))/255;						\n"
-	"   rgba.g = (1.164*(Y*255 - 16) - 0.534*(Cr*255 - 128) - 0.213*(Cb*255 - 128))/255;\n"
-	"   rgba.r = (1.164*(Y*255 - 16) + 2.115*(Cb*255 - 128))/255;						\n"
-	"   rgba.a = A;																		\n"
-	"	return rgba;																	\n"
-	"}																					\n"			
-	"																					\n"		
-	"vec4 ycbcra_to_rgba(float y, float cb, float cr, float a)							\n"
+	"	float y  = full_range ? Y : (Y*255.0 - 16.0)/219.0;								\n"
+	"	float cb = full_range ? Cb - 128.0/255.0 : (Cb*255.0 - 128.0)/224.0;			\n"
+	"	float cr = full_range ? Cr - 128.0/255.0 : (Cr*255.0 - 128.0)/224.0;			\n"
+	"																					\n"
+	"	float r = y + 2.0*(1.0 - k.x)*cr;												\n"
+	"	float b = y + 2.0*(1.0 - k.y)*cb;												\n"
+	"	float g = (y - k.x*r - k.y*b)/(1.0 - k.x - k.y);								\n"
+	"																					\n"
+	"	return vec4(b, g, r, A);														\n"
+	"}																					\n"
+	"																					\n"
+	"// 10 bit samples are uploaded as two 8 bit channels, low byte first. Returns	\n"
+	"// the sample scaled to the 8 bit range.										\n"
+	"float sample10(sampler2D plane, vec2 st)										\n"
 	"{																					\n"
-	"	if(is_hd)																		\n"
-	"		return ycbcra_to_rgba_hd(y, cb, cr, a);										\n"
-	"	else																			\n"
-	"		return ycbcra_to_rgba_sd(y, cb, cr, a);										\n"
+	"	return dot(texture2D(plane, st).rg, vec2(255.0, 65280.0))/1020.0;				\n"
 	"}																					\n"
 	"																					\n"
 	"vec4 get_rgba_color()																\n"
@@ -257,6 +258,21 @@ std::string get_fragment(bool blend_modes, bool chroma_key, bool post_processing
 	"			vec3 y3 = texture2D(plane[0], gl_TexCoord[0].st).rrr;					\n"
 	"			return vec4((y3-0.065)/0.859, 1.0);										\n"
 	"		}																			\n"
+	"	case 8:		//ycbcr10															\n"
+	"		{																			\n"
+	"			float y  = sample10(plane[0], gl_TexCoord[0].st);						\n"
+	"			float cb = sample10(plane[1], gl_TexCoord[0].st);						\n"
+	"			float cr = sample10(plane[2], gl_TexCoord[0].st);						\n"
+	"			return ycbcra_to_rgba(y, cb, cr, 1.0);									\n"
+	"		}																			\n"
+	"	case 9:		//ycbcra10															\n"
+	"		{																			\n"
+	"			float y  = sample10(plane[0], gl_TexCoord[0].st);						\n"
+	"			float cb = sample10(plane[1], gl_TexCoord[0].st);						\n"
+	"			float cr = sample10(plane[2], gl_TexCoord[0].st);						\n"
+	"			float a  = sample10(plane[3], gl_TexCoord[0].st)*1020.0/1023.0;			\n"
+	"			return ycbcra_to_rgba(y, cb, cr, a);									\n"
+	"		}																			\n"
 	"	}																				\n"
 	"	return vec4(0.0, 0.0, 0.0, 0.0);												\n"
 	"}																					\n"
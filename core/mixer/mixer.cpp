@@ -28,6 +28,10 @@
 
 #include "audio/audio_mixer.h"
 #include "image/image_mixer.h"
+#include "image/cpu_image_mixer.h"
+#include "gpu/device_buffer.h"
+#include "gpu/host_buffer.h"
+#include "gpu/ogl_device.h"
 
 #include <common/env.h>
 #include <common/concurrency/executor.h>
@@ -46,6 +50,7 @@
 #include <core/producer/frame/pixel_format.h>
 
 #include <core/monitor/monitor.h>
+#include <core/frame_trace.h>
 
 #include <core/video_format.h>
 
@@ -57,46 +62,79 @@
 #include <tbb/spin_mutex.h>
 #include <tbb/atomic.h>
 
+#include <algorithm>
 #include <unordered_map>
 
 namespace caspar { namespace core {
+
+safe_ptr<image_mixer> create_image_mixer(const std::shared_ptr<ogl_device>& ogl, int channel_index)
+{
+	if(ogl)
+		return make_safe<ogl_image_mixer>(make_safe_ptr(ogl));
+
+	return make_safe<cpu_image_mixer>(channel_index);
+}
+
+int get_readback_depth()
+{
+	return std::max(2, env::properties().get(L"configuration.mixer.readback-depth", 3));
+}
 		
 struct mixer::implementation : boost::noncopyable
 {		
 	safe_ptr<diagnostics::graph>	graph_;
+	safe_ptr<frame_tracer>			tracer_;
 	boost::timer					mix_timer_;
 	tbb::atomic<int64_t>			current_mix_time_;
 
 	safe_ptr<mixer::target_t>		target_;
 	mutable tbb::spin_mutex			format_desc_mutex_;
 	video_format_desc				format_desc_;
-	safe_ptr<ogl_device>			ogl_;
+	std::shared_ptr<ogl_device>		ogl_;
 	channel_layout					audio_channel_layout_;
 	bool							straighten_alpha_;
 	
-	audio_mixer	audio_mixer_;
-	image_mixer image_mixer_;
+	audio_mixer					audio_mixer_;
+	safe_ptr<image_mixer>		image_mixer_;
 	
 	std::unordered_map<int, blend_mode> blend_modes_;
 			
+	const std::shared_ptr<tbb::atomic<int>>	render_target_shares_;
+
+	const int						readback_depth_;
+	tbb::atomic<int64_t>			readback_stalls_;
+	executor						readback_executor_;
 	executor executor_;
 	safe_ptr<monitor::subject>		 monitor_subject_;
 
 public:
-	implementation(const safe_ptr<diagnostics::graph>& graph, const safe_ptr<mixer::target_t>& target, const video_format_desc& format_desc, const safe_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout, const int channel_index)
+	implementation(const safe_ptr<diagnostics::graph>& graph, const safe_ptr<frame_tracer>& tracer, const safe_ptr<mixer::target_t>& target, const video_format_desc& format_desc, const std::shared_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout, const int channel_index)
 		: graph_(graph)
+		, tracer_(tracer)
 		, target_(target)
 		, format_desc_(format_desc)
 		, ogl_(ogl)
 		, audio_channel_layout_(audio_channel_layout)
 		, straighten_alpha_(false)
 		, audio_mixer_(graph_)
-		, image_mixer_(ogl)
+		, image_mixer_(create_image_mixer(ogl, channel_index))
+		, render_target_shares_(std::make_shared<tbb::atomic<int>>())
+		, readback_depth_(get_readback_depth())
+		, readback_executor_(L"mixer-readback[" + std::to_wstring(static_cast<uint64_t>(channel_index)) + L"]")
 		, executor_(L"mixer[" + std::to_wstring(static_cast<uint64_t>(channel_index)) + L"]")
 		, monitor_subject_(make_safe<monitor::subject>("/mixer"))
 	{			
 		graph_->set_color("mix-time", diagnostics::color(1.0f, 0.0f, 0.9f, 0.8));
+		graph_->set_color("readback-time", diagnostics::color(0.0f, 0.6f, 0.9f));
+		graph_->set_color("readback-stall", diagnostics::color(0.9f, 0.6f, 0.0f));
 		current_mix_time_ = 0;
+		readback_stalls_ = 0;
+		*render_target_shares_ = 0;
+
+		// Readback ring, the mixer thread issues the transfer of a frame while the readback
+		// thread maps the previous one. At most readback-depth frames are in flight, the
+		// consumers get frames which are already mapped.
+		readback_executor_.set_capacity(std::max(1, readback_depth_ - 2));
 
 		audio_mixer_.monitor_output().attach_parent(monitor_subject_);
 	}
@@ -109,30 +147,57 @@ public:
 			{
 				mix_timer_.restart();
 
+				const auto frame_id = get_frame_id(packet.second);
+				const auto visit_begin = frame_tracer::now();
+
 				auto frames = packet.first;
 				int timecode = std::numeric_limits<int>().max();
 				
 				BOOST_FOREACH(auto& frame, frames)
 				{
 					auto blend_it = blend_modes_.find(frame.first);
-					image_mixer_.begin_layer(blend_it != blend_modes_.end() ? blend_it->second : blend_mode::normal);
+					image_mixer_->begin_layer(blend_it != blend_modes_.end() ? blend_it->second : blend_mode::normal);
 													
 					frame.second->accept(audio_mixer_);					
-					frame.second->accept(image_mixer_);
+					frame.second->accept(*image_mixer_);
 					
-					image_mixer_.end_layer();
+					image_mixer_->end_layer();
 					timecode = std::min(timecode, frame.second->get_timecode());
 				}
 
-				auto image = image_mixer_(format_desc_, straighten_alpha_);
+				const auto render_begin = frame_tracer::now();
+				tracer_->add_span(frame_id, "mixer-visit", visit_begin, render_begin);
+
+				auto image = (*image_mixer_)(format_desc_, straighten_alpha_);
 				auto audio = audio_mixer_(format_desc_, audio_channel_layout_);
 				image.wait();
 
+				tracer_->add_span(frame_id, "mixer-render", render_begin, frame_tracer::now());
+
 				auto mix_time = mix_timer_.elapsed();
 				graph_->set_value("mix-time", mix_time*format_desc_.fps*0.5);
 				current_mix_time_ = static_cast<int64_t>(mix_time * 1000.0);
 
-				target_->send(std::make_pair(make_safe<read_frame>(ogl_, format_desc_.size, std::move(image.get()), std::move(audio), audio_channel_layout_, timecode), packet.second));
+				auto render_target = *render_target_shares_ > 0 ? image_mixer_->render_target() : nullptr;
+
+				safe_ptr<host_buffer> image_data = image.get();
+				auto frame = make_safe<read_frame>(ogl_, format_desc_.size, safe_ptr<host_buffer>(image_data), std::move(audio), audio_channel_layout_, timecode, tracer_, frame_id, render_target);
+
+				if(!ogl_)
+				{
+					target_->send(std::make_pair(frame, packet.second));
+					return;
+				}
+
+				const auto issued = frame_tracer::now();
+				const auto fps = format_desc_.fps;
+				const auto ticket = packet.second;
+
+				readback_executor_.post([=]
+				{
+					readback(image_data, frame_id, issued, fps);
+					target_->send(std::make_pair(frame, ticket));
+				});
 			}
 			catch(...)
 			{
@@ -140,13 +205,71 @@ public:
 			}	
 		});		
 	}
+
+	void readback(const safe_ptr<host_buffer>& image_data, std::uint64_t frame_id, int64_t issued, double fps)
+	{
+		const auto begin = frame_tracer::now();
+
+		auto mapped = ogl_->invoke([=]() -> bool
+		{
+			if(!image_data->ready())
+				return false;
+
+			image_data->map();
+			return true;
+		}, high_priority);
+
+		if(!mapped)
+		{
+			++readback_stalls_;
+			graph_->set_tag("readback-stall");
+
+			image_data->wait(*ogl_);
+			ogl_->invoke([=]{image_data->map();}, high_priority);
+		}
+
+		const auto end = frame_tracer::now();
+		tracer_->add_span(frame_id, "readback", begin, end);
+		graph_->set_value("readback-time", static_cast<double>(end - issued) / 1000000.0 * fps * 0.5);
+	}
 					
 	safe_ptr<core::write_frame> create_frame(
 			const void* tag,
 			const core::pixel_format_desc& desc,
 			const channel_layout& audio_channel_layout)
 	{		
-		return make_safe<write_frame>(ogl_, tag, desc, audio_channel_layout);
+		if(!ogl_)
+			return make_safe<write_frame>(tag, desc, audio_channel_layout);
+
+		return make_safe<write_frame>(make_safe_ptr(ogl_), tag, desc, audio_channel_layout);
+	}
+
+	std::shared_ptr<core::write_frame> create_shared_frame(const void* tag, const safe_ptr<read_frame>& source)
+	{
+		auto render_target = source->get_render_target();
+
+		if(!ogl_ || !render_target || source->get_ogl_device() != ogl_)
+			return nullptr;
+
+		core::pixel_format_desc desc;
+		desc.pix_fmt = core::pixel_format::bgra;
+		desc.planes.push_back(core::pixel_format_desc::plane(render_target->width(), render_target->height(), 4));
+
+		std::vector<safe_ptr<device_buffer>> textures;
+		textures.push_back(make_safe_ptr(render_target));
+
+		return std::make_shared<write_frame>(make_safe_ptr(ogl_), tag, desc, textures, source->get_channel_layout());
+	}
+
+	std::shared_ptr<void> share_render_targets()
+	{
+		auto shares = render_target_shares_;
+		++(*shares);
+
+		return std::shared_ptr<void>(nullptr, [shares](void*)
+		{
+			--(*shares);
+		});
 	}
 
 	blend_mode::type get_blend_mode(int index)
@@ -248,6 +371,12 @@ public:
 	{
 		boost::property_tree::wptree info;
 		info.add(L"mix-time", current_mix_time_);
+		info.add(L"image-mixer", ogl_ ? L"gpu" : L"cpu");
+		if(ogl_)
+		{
+			info.add(L"readback-depth", readback_depth_);
+			info.add(L"readback-stalls", readback_stalls_);
+		}
 
 		return wrap_as_future(std::move(info));
 	}
@@ -261,11 +390,13 @@ public:
 	}
 };
 	
-mixer::mixer(const safe_ptr<diagnostics::graph>& graph, const safe_ptr<target_t>& target, const video_format_desc& format_desc, const safe_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout, int channel_index) 
-	: impl_(new implementation(graph, target, format_desc, ogl, audio_channel_layout, channel_index)){}
+mixer::mixer(const safe_ptr<diagnostics::graph>& graph, const safe_ptr<frame_tracer>& tracer, const safe_ptr<target_t>& target, const video_format_desc& format_desc, const std::shared_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout, int channel_index) 
+	: impl_(new implementation(graph, tracer, target, format_desc, ogl, audio_channel_layout, channel_index)){}
 void mixer::send(const std::pair<std::map<int, safe_ptr<core::basic_frame>>, std::shared_ptr<void>>& frames){ impl_->send(frames);}
 core::video_format_desc mixer::get_video_format_desc() const { return impl_->get_video_format_desc(); }
 safe_ptr<core::write_frame> mixer::create_frame(const void* tag, const core::pixel_format_desc& desc, const channel_layout& audio_channel_layout){ return impl_->create_frame(tag, desc, audio_channel_layout); }		
+std::shared_ptr<core::write_frame> mixer::create_shared_frame(const void* tag, const safe_ptr<read_frame>& source){ return impl_->create_shared_frame(tag, source); }
+std::shared_ptr<void> mixer::share_render_targets(){ return impl_->share_render_targets(); }
 blend_mode::type mixer::get_blend_mode(int index) { return impl_->get_blend_mode(index); }
 void mixer::set_blend_mode(int index, blend_mode::type value){impl_->set_blend_mode(index, value);}
 chroma mixer::get_chroma(int index) { return impl_->get_chroma(index); }
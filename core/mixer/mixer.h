@@ -43,6 +43,7 @@ namespace core {
 
 class read_frame;
 class write_frame;
+class frame_tracer;
 class basic_frame;
 class ogl_device;
 struct frame_transform;
@@ -55,7 +56,7 @@ class mixer : public target<std::pair<std::map<int, safe_ptr<core::basic_frame>>
 public:	
 	typedef target<std::pair<safe_ptr<read_frame>, std::shared_ptr<void>>> target_t;
 
-	explicit mixer(const safe_ptr<diagnostics::graph>& graph, const safe_ptr<target_t>& target, const video_format_desc& format_desc, const safe_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout, const int channel_index);
+	explicit mixer(const safe_ptr<diagnostics::graph>& graph, const safe_ptr<frame_tracer>& tracer, const safe_ptr<target_t>& target, const video_format_desc& format_desc, const std::shared_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout, const int channel_index); // ogl == nullptr selects the cpu image mixer.
 		
 	// target
 
@@ -64,6 +65,12 @@ public:
 	// mixer
 
 	safe_ptr<core::write_frame> create_frame(const void* tag, const core::pixel_format_desc& desc, const channel_layout& audio_channel_layout);		
+	virtual std::shared_ptr<core::write_frame> create_shared_frame(const void* tag, const safe_ptr<read_frame>& source) override;
+
+	// While the returned token is alive the read_frames of this mixer keep the
+	// device buffer they were rendered to, so that channels on the same
+	// ogl_device can draw them without a readback and upload.
+	std::shared_ptr<void> share_render_targets();
 	
 	core::video_format_desc get_video_format_desc() const; // nothrow
 	void set_video_format_desc(const video_format_desc& format_desc);
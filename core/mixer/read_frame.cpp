@@ -23,10 +23,13 @@
 
 #include "read_frame.h"
 
+#include "gpu/device_buffer.h"
 #include "gpu/fence.h"
 #include "gpu/host_buffer.h"	
 #include "gpu/ogl_device.h"
 
+#include "../frame_trace.h"
+
 #include <tbb/mutex.h>
 
 #include <boost/chrono.hpp>
@@ -43,7 +46,7 @@ int64_t get_current_time_millis()
 																																							
 struct read_frame::implementation : boost::noncopyable
 {
-	safe_ptr<ogl_device>		ogl_;
+	std::shared_ptr<ogl_device>	ogl_; // nullptr for frames rendered by the cpu image mixer.
 	uint32_t					size_;
 	safe_ptr<host_buffer>		image_data_;
 	tbb::mutex					mutex_;
@@ -51,15 +54,21 @@ struct read_frame::implementation : boost::noncopyable
 	const channel_layout		audio_channel_layout_;
 	int64_t						created_timestamp_;
 	const int					frame_timecode_;
+	const std::shared_ptr<frame_tracer>	tracer_;
+	const std::uint64_t			frame_id_;
+	const std::shared_ptr<device_buffer>	render_target_;
 
 public:
 	implementation(
-			const safe_ptr<ogl_device>& ogl,
+			const std::shared_ptr<ogl_device>& ogl,
 			uint32_t size,
 			safe_ptr<host_buffer>&& image_data,
 			audio_buffer&& audio_data,
 			const channel_layout& audio_channel_layout,
-			const unsigned int frame_timecode
+			const unsigned int frame_timecode,
+			const std::shared_ptr<frame_tracer>& tracer,
+			std::uint64_t frame_id,
+			const std::shared_ptr<device_buffer>& render_target
 	) 
 		: ogl_(ogl)
 		, size_(size)
@@ -68,6 +77,9 @@ public:
 		, audio_channel_layout_(audio_channel_layout)
 		, created_timestamp_(get_current_time_millis())
 		, frame_timecode_(frame_timecode)
+		, tracer_(tracer)
+		, frame_id_(frame_id)
+		, render_target_(render_target)
 	{
 	}	
 	
@@ -76,8 +88,10 @@ public:
 		{
 			tbb::mutex::scoped_lock lock(mutex_);
 
-			if(!image_data_->data())
+			if(!image_data_->data()) // Frames from the mixer are already mapped by its readback thread.
 			{
+				frame_trace_scope trace(tracer_.get(), frame_id_, "readback");
+
 				image_data_.get()->wait(*ogl_);
 				ogl_->invoke([=]{image_data_.get()->map();}, high_priority);
 			}
@@ -95,13 +109,16 @@ public:
 };
 
 read_frame::read_frame(
-		const safe_ptr<ogl_device>& ogl,
+		const std::shared_ptr<ogl_device>& ogl,
 		uint32_t size,
 		safe_ptr<host_buffer>&& image_data,
 		audio_buffer&& audio_data,
 		const channel_layout& audio_channel_layout,
-		int frame_timecode)
-	: impl_(new implementation(ogl, size, std::move(image_data), std::move(audio_data), audio_channel_layout, frame_timecode))
+		int frame_timecode,
+		const std::shared_ptr<frame_tracer>& tracer,
+		std::uint64_t frame_id,
+		const std::shared_ptr<device_buffer>& render_target)
+	: impl_(new implementation(ogl, size, std::move(image_data), std::move(audio_data), audio_channel_layout, frame_timecode, tracer, frame_id, render_target))
 {
 }
 
@@ -136,11 +153,26 @@ int read_frame::get_timecode() const
 	return impl_->frame_timecode_;
 }
 
+std::uint64_t read_frame::get_frame_id() const
+{
+	return impl_ ? impl_->frame_id_ : 0;
+}
+
 const channel_layout & read_frame::get_channel_layout() const
 {
 	return impl_->audio_channel_layout_;
 }
 
+std::shared_ptr<device_buffer> read_frame::get_render_target() const
+{
+	return impl_ ? impl_->render_target_ : nullptr;
+}
+
+std::shared_ptr<ogl_device> read_frame::get_ogl_device() const
+{
+	return impl_ ? impl_->ogl_ : nullptr;
+}
+
 
 //#include <tbb/scalable_allocator.h>
 //#include <tbb/parallel_for.h>
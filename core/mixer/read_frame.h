@@ -36,19 +36,24 @@
 namespace caspar { namespace core {
 	
 class host_buffer;
+class device_buffer;
 class ogl_device;
+class frame_tracer;
 
 class read_frame : boost::noncopyable
 {
 public:
 	read_frame();
 	read_frame(
-			const safe_ptr<ogl_device>& ogl,
+			const std::shared_ptr<ogl_device>& ogl,
 			uint32_t size,
 			safe_ptr<host_buffer>&& image_data,
 			audio_buffer&& audio_data,
 			const channel_layout& audio_channel_layout,
-			int frame_timecode);
+			int frame_timecode,
+			const std::shared_ptr<frame_tracer>& tracer = nullptr,
+			std::uint64_t frame_id = 0,
+			const std::shared_ptr<device_buffer>& render_target = nullptr);
 
 	virtual const boost::iterator_range<const uint8_t*> image_data();
 	virtual const boost::iterator_range<const int32_t*> audio_data();
@@ -58,7 +63,13 @@ public:
 	virtual int64_t get_age_millis() const;
 	virtual const multichannel_view<const int32_t, boost::iterator_range<const int32_t*>::const_iterator> multichannel_view() const;
 	virtual int get_timecode() const;
+	std::uint64_t get_frame_id() const;
 	const channel_layout& get_channel_layout() const;
+
+	// The device buffer the image was rendered to, only kept by mixers which
+	// share their render targets. See mixer::share_render_targets.
+	std::shared_ptr<device_buffer> get_render_target() const;
+	std::shared_ptr<ogl_device> get_ogl_device() const;
 		
 private:
 	struct implementation;
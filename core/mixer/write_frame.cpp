@@ -77,6 +77,31 @@ struct write_frame::implementation
 
 		recorded_frame_age_ = -1;
 	}
+
+	implementation(const safe_ptr<ogl_device>& ogl, const void* tag, const core::pixel_format_desc& desc, const std::vector<safe_ptr<device_buffer>>& textures, const channel_layout& channel_layout) 
+		: ogl_(ogl)
+		, textures_(textures)
+		, desc_(desc)
+		, channel_layout_(channel_layout)
+		, tag_(tag)
+		, mode_(core::field_mode::progressive)
+	{
+		recorded_frame_age_ = -1;
+	}
+
+	implementation(const void* tag, const core::pixel_format_desc& desc, const channel_layout& channel_layout) 
+		: desc_(desc)
+		, channel_layout_(channel_layout)
+		, tag_(tag)
+		, mode_(core::field_mode::progressive)
+	{
+		std::transform(desc.planes.begin(), desc.planes.end(), std::back_inserter(buffers_), [&](const core::pixel_format_desc::plane& plane)
+		{
+			return host_buffer::create_system_buffer(plane.size);
+		});
+
+		recorded_frame_age_ = -1;
+	}
 			
 	void accept(write_frame& self, core::frame_visitor& visitor)
 	{
@@ -110,7 +135,7 @@ struct write_frame::implementation
 
 	void commit(uint32_t plane_index)
 	{
-		if(plane_index >= buffers_.size())
+		if(!ogl_ || plane_index >= buffers_.size()) // System memory frames are read directly by the mixer.
 			return;
 				
 		auto buffer = std::move(buffers_[plane_index]); // Release buffer once done.
@@ -142,6 +167,22 @@ write_frame::write_frame(
 	: impl_(new implementation(ogl, tag, desc, channel_layout))
 {
 }
+write_frame::write_frame(
+		const void* tag,
+		const core::pixel_format_desc& desc,
+		const channel_layout& channel_layout)
+	: impl_(new implementation(tag, desc, channel_layout))
+{
+}
+write_frame::write_frame(
+		const safe_ptr<ogl_device>& ogl,
+		const void* tag,
+		const core::pixel_format_desc& desc,
+		const std::vector<safe_ptr<device_buffer>>& textures,
+		const channel_layout& channel_layout)
+	: impl_(new implementation(ogl, tag, desc, textures, channel_layout))
+{
+}
 write_frame::write_frame(const write_frame& other) : impl_(new implementation(*other.impl_)){}
 write_frame::write_frame(write_frame&& other) : impl_(std::move(other.impl_)){}
 write_frame& write_frame::operator=(const write_frame& other)
@@ -168,6 +209,7 @@ multichannel_view<int32_t, audio_buffer::iterator> write_frame::get_multichannel
 	return make_multichannel_view<int32_t>(impl_->audio_data_.begin(), impl_->audio_data_.end(), impl_->channel_layout_);
 }
 const std::vector<safe_ptr<device_buffer>>& write_frame::get_textures() const{return impl_->textures_;}
+const std::vector<std::shared_ptr<host_buffer>>& write_frame::get_buffers() const{return impl_->buffers_;}
 void write_frame::commit(uint32_t plane_index){impl_->commit(plane_index);}
 void write_frame::commit(){impl_->commit();}
 void write_frame::set_type(const field_mode::type& mode){impl_->mode_ = mode;}
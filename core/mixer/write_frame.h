@@ -37,6 +37,7 @@
 namespace caspar { namespace core {
 
 class device_buffer;
+class host_buffer;
 struct frame_visitor;
 struct pixel_format_desc;
 class ogl_device;	
@@ -46,6 +47,8 @@ class write_frame : public core::basic_frame, boost::noncopyable
 public:	
 	explicit write_frame(const void* tag, const channel_layout& channel_layout);
 	explicit write_frame(const safe_ptr<ogl_device>& ogl, const void* tag, const core::pixel_format_desc& desc, const channel_layout& channel_layout);
+	explicit write_frame(const void* tag, const core::pixel_format_desc& desc, const channel_layout& channel_layout); // System memory only, for cpu_image_mixer.
+	explicit write_frame(const safe_ptr<ogl_device>& ogl, const void* tag, const core::pixel_format_desc& desc, const std::vector<safe_ptr<device_buffer>>& textures, const channel_layout& channel_layout); // Shares already rendered textures, image_data() is empty.
 
 	write_frame(const write_frame& other);
 	write_frame(write_frame&& other);
@@ -79,9 +82,11 @@ public:
 	const channel_layout& get_channel_layout() const;
 	multichannel_view<int32_t, audio_buffer::iterator> get_multichannel_view();
 private:
-	friend class image_mixer;
+	friend class ogl_image_mixer;
+	friend class cpu_image_mixer;
 	
 	const std::vector<safe_ptr<device_buffer>>& get_textures() const;
+	const std::vector<std::shared_ptr<host_buffer>>& get_buffers() const;
 
 	struct implementation;
 	safe_ptr<implementation> impl_;
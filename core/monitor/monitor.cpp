@@ -22,8 +22,47 @@
 
 #include "monitor.h"
 
+#include <set>
+
+#include <tbb/spin_mutex.h>
+
 namespace caspar { namespace core { namespace monitor {
 
+namespace {
+
+// Interned paths are never removed, the set only grows with the number of distinct paths.
+struct path_registry
+{
+	tbb::spin_mutex			mutex;
+	std::set<std::string>	paths;
+
+	const std::string* intern(const std::string& path)
+	{
+		tbb::spin_mutex::scoped_lock lock(mutex);
+
+		return &*paths.insert(path).first;
+	}
+
+	static path_registry& instance()
+	{
+		static path_registry registry;
+		return registry;
+	}
+};
+
+}
+
+path_handle::path_handle()
+	: value_(path_registry::instance().intern(""))
+{
+}
+
+path_handle::path_handle(const std::string& path)
+	: value_(path_registry::instance().intern(path))
+{
+	CASPAR_ASSERT(path.empty() || path[0] == '/');
+}
+
 /*class in_callers_thread_schedule_group : public Concurrency::ScheduleGroup
 {
 	virtual void ScheduleTask(Concurrency::TaskProc proc, void* data) override
@@ -23,9 +23,11 @@
 #include <common/memory/safe_ptr.h>
 #include <common/utility/assert.h>
 
+#include <boost/foreach.hpp>
 #include <boost/variant.hpp>
 #include <boost/chrono/duration.hpp>
 
+#include <algorithm>
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -41,49 +43,221 @@ typedef boost::variant<bool,
 					   std::wstring,
 					   std::vector<std::int8_t>> data_t;
 
+/**
+ * Handle to an interned path. Paths which are sent every frame should be
+ * created once and reused, creating a message from a handle does not allocate.
+ */
+class path_handle
+{
+public:
+	path_handle();
+	explicit path_handle(const std::string& path);
+
+	const std::string& str() const
+	{
+		return *value_;
+	}
+
+	bool operator==(const path_handle& other) const
+	{
+		return value_ == other.value_;
+	}
+
+	bool operator!=(const path_handle& other) const
+	{
+		return value_ != other.value_;
+	}
+private:
+	const std::string* value_;
+};
+
+/**
+ * Fixed capacity argument pack, avoids a heap allocation per message.
+ */
+class arguments
+{
+public:
+	static const std::size_t capacity = 8;
+
+	typedef const data_t* const_iterator;
+	typedef const_iterator iterator;
+
+	arguments()
+		: size_(0)
+	{
+	}
+
+	arguments(const arguments& other)
+		: size_(other.size_)
+	{
+		std::copy(other.begin(), other.end(), values_);
+	}
+
+	arguments& operator=(const arguments& other)
+	{
+		std::copy(other.begin(), other.end(), values_);
+		size_ = other.size_;
+		return *this;
+	}
+
+	template<typename T>
+	void push_back(T&& value)
+	{
+		CASPAR_ASSERT(size_ < capacity);
+
+		if (size_ < capacity)
+			values_[size_++] = std::forward<T>(value);
+	}
+
+	const_iterator begin() const	{ return values_; }
+	const_iterator end() const		{ return values_ + size_; }
+	std::size_t size() const		{ return size_; }
+	bool empty() const				{ return size_ == 0; }
+
+	const data_t& operator[](std::size_t index) const
+	{
+		CASPAR_ASSERT(index < size_);
+		return values_[index];
+	}
+private:
+	data_t		values_[capacity];
+	std::size_t	size_;
+};
+
+/**
+ * A monitor message. The path is kept as the segments added by each subject
+ * it passes instead of being concatenated at every level.
+ * <p>
+ * A propagated message refers to the path and the arguments of the message it
+ * was propagated from, sinks must not keep it after propagate() has returned.
+ */
 class message
 {
 public:
+	static const std::size_t max_depth = 16;
 
 	message(std::string path, std::vector<data_t> data = std::vector<data_t>())
-		: path_(std::move(path))
-		, data_ptr_(std::make_shared<std::vector<data_t>>(std::move(data)))
+		: owned_path_(std::move(path))
+		, depth_(1)
+		, data_(&arguments_)
 	{
-		CASPAR_ASSERT(path.empty() || path[0] == '/');
+		CASPAR_ASSERT(owned_path_.empty() || owned_path_[0] == '/');
+
+		segments_[0] = &owned_path_;
+
+		BOOST_FOREACH(auto& value, data)
+			arguments_.push_back(std::move(value));
 	}
-	
-	message(std::string path, safe_ptr<std::vector<data_t>> data_ptr)
-		: path_(std::move(path))
-		, data_ptr_(std::move(data_ptr))
+
+	message(const path_handle& path)
+		: depth_(1)
+		, data_(&arguments_)
 	{
-		CASPAR_ASSERT(path.empty() || path[0] == '/');
+		CASPAR_ASSERT(path.str().empty() || path.str()[0] == '/');
+
+		segments_[0] = &path.str();
 	}
 
-	const std::string& path() const
+	message(const message& other)
+		: owned_path_(other.owned_path_)
+		, depth_(other.depth_)
+		, arguments_(other.arguments_)
+		, data_(other.data_ == &other.arguments_ ? &arguments_ : other.data_)
 	{
-		return path_;
+		std::copy(other.segments_, other.segments_ + depth_, segments_);
+
+		if (other.segments_[0] == &other.owned_path_)
+			segments_[0] = &owned_path_;
 	}
 
-	const std::vector<data_t>& data() const
+	message& operator=(const message& other)
 	{
-		return *data_ptr_;
+		if (this != &other)
+		{
+			owned_path_ = other.owned_path_;
+			depth_		= other.depth_;
+			arguments_	= other.arguments_;
+			data_		= other.data_ == &other.arguments_ ? &arguments_ : other.data_;
+
+			std::copy(other.segments_, other.segments_ + depth_, segments_);
+
+			if (other.segments_[0] == &other.owned_path_)
+				segments_[0] = &owned_path_;
+		}
+
+		return *this;
+	}
+
+	std::string path() const
+	{
+		std::string result;
+		write_path(result);
+		return result;
+	}
+
+	/**
+	 * Writes the full path to destination, reusing its capacity.
+	 */
+	void write_path(std::string& destination) const
+	{
+		std::size_t size = 0;
+
+		for (std::size_t n = 0; n < depth_; ++n)
+			size += segments_[n]->size();
+
+		destination.clear();
+		destination.reserve(size);
+
+		for (std::size_t n = depth_; n > 0; --n)
+			destination += *segments_[n - 1];
+	}
+
+	const arguments& data() const
+	{
+		return *data_;
 	}
 
 	message propagate(const std::string& path) const
 	{
-		return message(path + path_, data_ptr_);
+		return message(*this, path);
 	}
 
 	template<typename T>
 	message& operator%(T&& data)
 	{
-		data_ptr_->push_back(std::forward<T>(data));
+		CASPAR_ASSERT(data_ == &arguments_);
+
+		arguments_.push_back(std::forward<T>(data));
 		return *this;
 	}
 
 private:
-	std::string						path_;
-	safe_ptr<std::vector<data_t>>	data_ptr_;
+	message(const message& inner, const std::string& path)
+		: depth_(inner.depth_)
+		, data_(inner.data_)
+	{
+		std::copy(inner.segments_, inner.segments_ + depth_, segments_);
+
+		if (path.empty())
+			return;
+
+		if (depth_ < max_depth)
+			segments_[depth_++] = &path;
+		else
+		{
+			CASPAR_ASSERT(!"monitor path too deep");
+
+			owned_path_ = path + inner.path();
+			segments_[0] = &owned_path_;
+			depth_ = 1;
+		}
+	}
+
+	std::string						owned_path_;
+	const std::string*				segments_[max_depth]; // Innermost first.
+	std::size_t						depth_;
+	arguments						arguments_;
+	const arguments*				data_;
 };
 
 struct sink
@@ -102,6 +102,12 @@ public:
 		params_original_.push_back(s);
 	}
 
+	void push_back(std::wstring&& s)
+	{
+		params_.push_back(s);
+		params_original_.push_back(std::move(s));
+	}
+
 	// Compatibility method
 	std::wstring const& at(int i) const
 	{
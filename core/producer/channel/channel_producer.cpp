@@ -26,6 +26,7 @@
 #include "../../monitor/monitor.h"
 #include "../../consumer/frame_consumer.h"
 #include "../../consumer/output.h"
+#include "../../mixer/mixer.h"
 #include "../../video_channel.h"
 
 #include "../frame/basic_frame.h"
@@ -162,6 +163,7 @@ class channel_producer : public frame_producer
 
 	const safe_ptr<frame_factory>		frame_factory_;
 	const safe_ptr<channel_consumer>	consumer_;
+	const std::shared_ptr<void>			render_target_share_;
 
 	std::queue<safe_ptr<basic_frame>>	frame_buffer_;
 	safe_ptr<basic_frame>				last_frame_;
@@ -172,6 +174,7 @@ public:
 	explicit channel_producer(const safe_ptr<frame_factory>& frame_factory, const safe_ptr<video_channel>& channel) 
 		: frame_factory_(frame_factory)
 		, consumer_(make_safe<channel_consumer>())
+		, render_target_share_(channel->mixer()->share_render_targets())
 		, last_frame_(basic_frame::empty())
 		, frame_number_(0)
 	{
@@ -201,33 +204,27 @@ public:
 		}
 
 		auto read_frame = consumer_->receive();
-		if (!read_frame || read_frame->image_data().empty())
+		if (!read_frame || read_frame->image_size() == 0)
 			return basic_frame::late();
 
 		frame_number_++;
 
-		core::pixel_format_desc desc;
 		bool double_speed = std::abs(frame_factory_->get_video_format_desc().fps / 2.0 - format_desc.fps) < 0.01;
 		bool half_speed = std::abs(format_desc.fps / 2.0 - frame_factory_->get_video_format_desc().fps) < 0.01;
 
 		if (half_speed && frame_number_ % 2 == 0) // Skip frame
 			return receive(0);
 
-		desc.pix_fmt = core::pixel_format::bgra;
-		desc.planes.push_back(core::pixel_format_desc::plane(format_desc.width, format_desc.height, 4));
-		auto frame = frame_factory_->create_frame(this, desc, read_frame->multichannel_view().channel_layout());
+		auto frame = create_frame(make_safe_ptr(read_frame), format_desc);
 
 		bool copy_audio = !double_speed && !half_speed;
 
 		if (copy_audio)
 		{
-			frame->audio_data().reserve(read_frame->audio_data().size());
-			boost::copy(read_frame->audio_data(), std::back_inserter(frame->audio_data()));
+			auto audio = read_frame->audio_data();
+			frame->audio_data().assign(audio.begin(), audio.end());
 		}
 
-		fast_memcpy(frame->image_data().begin(), read_frame->image_data().begin(), read_frame->image_data().size());
-		frame->commit();
-
 		frame_buffer_.push(frame);
 
 		if (double_speed)
@@ -236,6 +233,25 @@ public:
 		return receive(0);
 	}	
 
+	// Draws the image rendered by the source channel directly when both
+	// channels share the ogl_device, otherwise copies and uploads it.
+	safe_ptr<write_frame> create_frame(const safe_ptr<core::read_frame>& read_frame, const video_format_desc& format_desc)
+	{
+		auto shared_frame = frame_factory_->create_shared_frame(this, read_frame);
+		if (shared_frame)
+			return make_safe_ptr(shared_frame);
+
+		core::pixel_format_desc desc;
+		desc.pix_fmt = core::pixel_format::bgra;
+		desc.planes.push_back(core::pixel_format_desc::plane(format_desc.width, format_desc.height, 4));
+		auto frame = frame_factory_->create_frame(this, desc, read_frame->get_channel_layout());
+
+		fast_memcpy(frame->image_data().begin(), read_frame->image_data().begin(), read_frame->image_data().size());
+		frame->commit();
+
+		return frame;
+	}
+
 	virtual safe_ptr<basic_frame> last_frame() const override
 	{
 		return disable_audio(last_frame_); 
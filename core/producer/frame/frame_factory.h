@@ -31,6 +31,7 @@
 namespace caspar { namespace core {
 	
 class write_frame;
+class read_frame;
 struct pixel_format_desc;
 struct video_format_desc;
 		
@@ -42,6 +43,16 @@ struct frame_factory : boost::noncopyable
 			const pixel_format_desc& desc,
 			const channel_layout& audio_channel_layout = channel_layout::stereo()) = 0;	
 
+	// Creates a frame which draws the image already rendered for source without
+	// copying or uploading it. nullptr if the image is not available on the
+	// device of this factory, in which case image_data() has to be copied.
+	virtual std::shared_ptr<write_frame> create_shared_frame(
+			const void* video_stream_tag,
+			const safe_ptr<read_frame>& source)
+	{
+		return nullptr;
+	}
+
 	virtual video_format_desc get_video_format_desc() const = 0; // nothrow
 };
 
@@ -37,11 +37,24 @@ struct pixel_format
 		ycbcr,
 		ycbcra,
 		luma,
+		ycbcr10,	// Planar, 16 bit little endian samples with 10 significant bits.
+		ycbcra10,
 		count,
 		invalid
 	};
 };
 
+struct color_space
+{
+	enum type
+	{
+		unspecified = 0, // bt709 for hd, otherwise bt601.
+		bt601,
+		bt709,
+		bt2020
+	};
+};
+
 struct pixel_format_desc
 {
 	struct plane
@@ -67,10 +80,23 @@ struct pixel_format_desc
 			, channels(channels){}
 	};
 
-	pixel_format_desc() : pix_fmt(pixel_format::invalid){}
+	pixel_format_desc()
+		: pix_fmt(pixel_format::invalid)
+		, color_space(color_space::unspecified)
+		, full_range(false){}
 	
 	pixel_format::type pix_fmt;
 	std::vector<plane> planes;
+	color_space::type color_space;	// Only used by the ycbcr formats.
+	bool full_range;
 };
 
+inline color_space::type get_color_space(const pixel_format_desc& desc)
+{
+	if(desc.color_space != color_space::unspecified || desc.planes.empty())
+		return desc.color_space;
+
+	return desc.planes[0].height > 700 ? color_space::bt709 : color_space::bt601;
+}
+
 }}
\ No newline at end of file
@@ -25,10 +25,21 @@
 
 #include "frame_producer.h"
 #include "frame/basic_frame.h"
+#include "preload/preload_producer.h"
+
+#include <common/utility/string.h>
 
 #include <boost/property_tree/ptree.hpp>
 
 namespace caspar { namespace core {
+
+namespace {
+
+const monitor::path_handle PAUSED_PATH("/paused");
+const monitor::path_handle BACKGROUND_PRELOAD_STATE_PATH("/background/preload/state");
+const monitor::path_handle BACKGROUND_PRELOAD_TIME_PATH("/background/preload/time");
+
+}
 	
 struct layer::implementation
 {				
@@ -108,7 +119,14 @@ public:
 	{		
 		try
 		{
-			*monitor_subject_ << monitor::message("/paused") % is_paused_;
+			*monitor_subject_ << monitor::message(PAUSED_PATH) % is_paused_;
+
+			auto preload = get_preload_status(background_);
+			if(preload)
+			{
+				*monitor_subject_	<< monitor::message(BACKGROUND_PRELOAD_STATE_PATH) % narrow(to_string(preload->state))
+									<< monitor::message(BACKGROUND_PRELOAD_TIME_PATH) % preload->elapsed_millis;
+			}
 
 			if(is_paused_)
 			{
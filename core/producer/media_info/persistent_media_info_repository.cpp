@@ -0,0 +1,337 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+#include "../../StdAfx.h"
+
+#include "persistent_media_info_repository.h"
+
+#include <common/exception/exceptions.h>
+#include <common/log/log.h>
+#include <common/utility/string.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/foreach.hpp>
+
+#include "media_info.h"
+#include "media_info_repository.h"
+
+namespace caspar { namespace core {
+
+namespace {
+
+const char			CACHE_MAGIC[8]	= {'C', 'C', 'G', 'M', 'I', 'N', 'F', 'O'};
+const std::uint32_t	CACHE_VERSION	= 1;
+
+enum record_type
+{
+	put_record = 1,
+	remove_record
+};
+
+// Identifies the version of a file that an entry was extracted from.
+struct file_stamp
+{
+	std::int64_t size;
+	std::int64_t write_time;
+
+	file_stamp()
+		: size(-1)
+		, write_time(-1)
+	{
+	}
+
+	bool operator==(const file_stamp& other) const
+	{
+		return size == other.size && write_time == other.write_time;
+	}
+
+	bool operator!=(const file_stamp& other) const
+	{
+		return !(*this == other);
+	}
+};
+
+file_stamp get_file_stamp(const std::wstring& file)
+{
+	file_stamp stamp;
+
+	try
+	{
+		boost::filesystem::wpath path(file);
+
+		if (boost::filesystem::is_regular_file(path))
+		{
+			stamp.size			= static_cast<std::int64_t>(boost::filesystem::file_size(path));
+			stamp.write_time	= static_cast<std::int64_t>(boost::filesystem::last_write_time(path));
+		}
+	}
+	catch (...)
+	{
+	}
+
+	return stamp;
+}
+
+template<typename T>
+void write_value(std::ostream& stream, const T& value)
+{
+	stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+bool read_value(std::istream& stream, T& value)
+{
+	return stream.read(reinterpret_cast<char*>(&value), sizeof(T)).gcount() == static_cast<std::streamsize>(sizeof(T));
+}
+
+}
+
+class persistent_media_info_repository : public media_info_repository
+{
+	struct entry
+	{
+		file_stamp	stamp;
+		media_info	info;
+	};
+
+	const std::wstring						cache_file_;
+
+	boost::mutex							mutex_;
+	std::map<std::wstring, entry>			entries_;
+	std::vector<media_info_extractor>		extractors_;
+	std::ofstream							log_;
+	std::size_t								record_count_;
+public:
+	explicit persistent_media_info_repository(const std::wstring& cache_file)
+		: cache_file_(cache_file)
+		, record_count_(0)
+	{
+		bool is_complete = load();
+
+		// A missing or corrupt log is replaced by a new one with a header. Superseded records are only dropped when the log is rewritten, keep it from growing without bound.
+		if (!is_complete || record_count_ > entries_.size() * 2 + 1024)
+			compact();
+
+		log_.open(cache_file_.c_str(), std::ios::binary | std::ios::app);
+
+		if (!log_)
+			CASPAR_LOG(warning) << L"[media_info_repository] Failed to open " << cache_file_ << L". Media information will not be persisted.";
+
+		CASPAR_LOG(info) << L"[media_info_repository] Loaded " << entries_.size() << L" entries from " << cache_file_ << L".";
+	}
+
+	virtual void register_extractor(media_info_extractor extractor) override
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		extractors_.push_back(extractor);
+	}
+
+	virtual media_info get(const std::wstring& file) override
+	{
+		auto stamp = get_file_stamp(file);
+		std::vector<media_info_extractor> extractors;
+
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+
+			auto iter = entries_.find(file);
+
+			if (iter != entries_.end() && iter->second.stamp == stamp)
+				return iter->second.info;
+
+			extractors = extractors_;
+		}
+
+		// Extraction opens the file and is run without holding the lock so that several files can be scanned in parallel.
+		entry new_entry;
+		new_entry.stamp = stamp;
+
+		BOOST_FOREACH(auto& extractor, extractors)
+		{
+			if (extractor(file, new_entry.info))
+				break;
+		}
+
+		boost::mutex::scoped_lock lock(mutex_);
+
+		entries_[file] = new_entry;
+
+		if (log_)
+		{
+			write_put(log_, file, new_entry);
+			log_.flush();
+			++record_count_;
+		}
+
+		return new_entry.info;
+	}
+
+	virtual void remove(const std::wstring& file) override
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		if (entries_.erase(file) == 0 || !log_)
+			return;
+
+		write_value(log_, static_cast<std::uint8_t>(remove_record));
+		write_path(log_, file);
+		log_.flush();
+		++record_count_;
+	}
+private:
+	// Returns false if the log is missing, corrupt or truncated, entries up to the first bad record are kept.
+	bool load()
+	{
+		std::ifstream stream(cache_file_.c_str(), std::ios::binary);
+
+		if (!stream)
+			return false;
+
+		char magic[sizeof(CACHE_MAGIC)];
+		std::uint32_t version = 0;
+
+		if (stream.read(magic, sizeof(magic)).gcount() != static_cast<std::streamsize>(sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), CACHE_MAGIC) ||
+			!read_value(stream, version) || version != CACHE_VERSION)
+		{
+			CASPAR_LOG(info) << L"[media_info_repository] Ignoring incompatible cache file " << cache_file_ << L".";
+			return false;
+		}
+
+		std::string path;
+
+		for (;;)
+		{
+			std::uint8_t type = 0;
+
+			if (!read_value(stream, type))
+				return true;
+
+			if (!read_path(stream, path))
+				break;
+
+			if (type == put_record)
+			{
+				entry new_entry;
+				std::int64_t num = 0;
+				std::int64_t den = 0;
+
+				if (!read_value(stream, new_entry.stamp.size) || !read_value(stream, new_entry.stamp.write_time) ||
+					!read_value(stream, new_entry.info.duration) || !read_value(stream, num) || !read_value(stream, den) || den == 0)
+					break;
+
+				new_entry.info.time_base.assign(num, den);
+				entries_[widen(path)] = new_entry;
+			}
+			else if (type == remove_record)
+				entries_.erase(widen(path));
+			else
+				break;
+
+			++record_count_;
+		}
+
+		CASPAR_LOG(warning) << L"[media_info_repository] " << cache_file_ << L" is corrupt, keeping " << entries_.size() << L" entries.";
+		return false;
+	}
+
+	// Rewrites the log with one record per entry, the new file replaces the old one once it is complete.
+	void compact()
+	{
+		const auto temp_file = cache_file_ + L".tmp";
+
+		try
+		{
+			{
+				std::ofstream stream(temp_file.c_str(), std::ios::binary | std::ios::trunc);
+
+				write_header(stream);
+
+				BOOST_FOREACH(auto& item, entries_)
+					write_put(stream, item.first, item.second);
+
+				if (!stream.flush())
+					BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Failed to write " + narrow(temp_file)));
+			}
+
+			if (boost::filesystem::exists(boost::filesystem::wpath(cache_file_)))
+				boost::filesystem::remove(boost::filesystem::wpath(cache_file_));
+
+			boost::filesystem::rename(boost::filesystem::wpath(temp_file), boost::filesystem::wpath(cache_file_));
+			record_count_ = entries_.size();
+		}
+		catch (...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+		}
+	}
+
+	static void write_header(std::ostream& stream)
+	{
+		stream.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+		write_value(stream, CACHE_VERSION);
+	}
+
+	static void write_path(std::ostream& stream, const std::wstring& file)
+	{
+		const auto path = narrow(file);
+
+		write_value(stream, static_cast<std::uint32_t>(path.size()));
+		stream.write(path.data(), path.size());
+	}
+
+	static bool read_path(std::istream& stream, std::string& path)
+	{
+		std::uint32_t size = 0;
+
+		if (!read_value(stream, size) || size > 32768)
+			return false;
+
+		path.resize(size);
+
+		return size == 0 || stream.read(&path[0], size).gcount() == static_cast<std::streamsize>(size);
+	}
+
+	static void write_put(std::ostream& stream, const std::wstring& file, const entry& value)
+	{
+		write_value(stream, static_cast<std::uint8_t>(put_record));
+		write_path(stream, file);
+		write_value(stream, value.stamp.size);
+		write_value(stream, value.stamp.write_time);
+		write_value(stream, value.info.duration);
+		write_value(stream, value.info.time_base.numerator());
+		write_value(stream, value.info.time_base.denominator());
+	}
+};
+
+safe_ptr<struct media_info_repository> create_persistent_media_info_repository(const std::wstring& cache_file)
+{
+	return make_safe<persistent_media_info_repository>(cache_file);
+}
+
+}}
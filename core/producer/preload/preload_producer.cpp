@@ -0,0 +1,313 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+
+#include "../../stdafx.h"
+
+#include "preload_producer.h"
+
+#include "../frame/basic_frame.h"
+
+#include <common/concurrency/executor.h>
+#include <common/exception/exceptions.h>
+#include <common/log/log.h>
+#include <common/utility/string.h>
+
+#include <tbb/atomic.h>
+#include <tbb/concurrent_queue.h>
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/thread/future.hpp>
+#include <boost/timer.hpp>
+
+namespace caspar { namespace core {
+
+namespace {
+
+const monitor::path_handle PRELOAD_STATE_PATH("/preload/state");
+const monitor::path_handle PRELOAD_TIME_PATH("/preload/time");
+
+}
+
+std::wstring to_string(preload_status::state_t state)
+{
+	switch(state)
+	{
+	case preload_status::pending:	return L"pending";
+	case preload_status::ready:		return L"ready";
+	case preload_status::failed:	return L"failed";
+	default:						return L"invalid";
+	}
+}
+
+void run_on_preloader(const std::function<void()>& task)
+{
+	static auto preloaders = std::make_shared<tbb::concurrent_bounded_queue<std::shared_ptr<executor>>>();
+	static tbb::atomic<int> preloader_count;
+
+	// Idle preloaders are reused, a new one is only created when all of them are busy opening media.
+	std::shared_ptr<executor> preloader;
+	if(!preloaders->try_pop(preloader))
+	{
+		preloader.reset(new executor(L"preloader"));
+		if(++preloader_count > 16)
+			CASPAR_LOG(warning) << L"Potential preloader starvation detected.";
+		CASPAR_LOG(trace) << "Created preloader: " << preloader_count;
+	}
+
+	auto pool = preloaders;
+	preloader->post([=]
+	{
+		task();
+		pool->push(preloader);
+	});
+}
+
+struct preload_context : boost::noncopyable
+{
+	const std::function<safe_ptr<frame_producer>()>	factory;
+	boost::promise<safe_ptr<frame_producer>>		promise;
+	const boost::timer								timer;
+	tbb::atomic<int>								state;
+	tbb::atomic<int>								elapsed_millis;
+	tbb::atomic<bool>								is_cancelled;
+
+	preload_context(const std::function<safe_ptr<frame_producer>()>& factory)
+		: factory(factory)
+	{
+		state			= preload_status::pending;
+		elapsed_millis	= 0;
+		is_cancelled	= false;
+	}
+
+	void run()
+	{
+		try
+		{
+			if(is_cancelled)
+				BOOST_THROW_EXCEPTION(invalid_operation() << msg_info("Preload cancelled."));
+
+			auto producer = factory();
+
+			elapsed_millis = static_cast<int>(timer.elapsed() * 1000.0);
+			promise.set_value(producer);
+			state = preload_status::ready;
+
+			CASPAR_LOG(info) << producer->print() << L" Preloaded in " << elapsed_millis << L" ms.";
+		}
+		catch(...)
+		{
+			if(!is_cancelled)
+				CASPAR_LOG_CURRENT_EXCEPTION();
+
+			elapsed_millis = static_cast<int>(timer.elapsed() * 1000.0);
+			promise.set_exception(boost::current_exception());
+			state = preload_status::failed;
+		}
+	}
+
+	preload_status status() const
+	{
+		preload_status result;
+		result.state			= static_cast<preload_status::state_t>(static_cast<int>(state));
+		result.elapsed_millis	= result.state == preload_status::pending ? static_cast<int>(timer.elapsed() * 1000.0) : elapsed_millis;
+		return result;
+	}
+};
+
+class preload_producer : public frame_producer
+{	
+	const std::wstring								name_;
+	const std::shared_ptr<preload_context>			context_;
+	boost::shared_future<safe_ptr<frame_producer>>	future_;
+	safe_ptr<monitor::subject>						monitor_subject_;
+
+	std::shared_ptr<frame_producer>					producer_;
+	safe_ptr<frame_producer>						leading_producer_;
+public:
+	preload_producer(const std::function<safe_ptr<frame_producer>()>& factory, const std::wstring& name) 
+		: name_(name)
+		, context_(std::make_shared<preload_context>(factory))
+		, future_(context_->promise.get_future())
+		, leading_producer_(frame_producer::empty())
+	{
+		auto context = context_;
+		run_on_preloader([=]
+		{
+			context->run();
+		});
+	}
+
+	~preload_producer()
+	{
+		context_->is_cancelled = true;
+	}
+
+	void wait() const
+	{
+		future_.get();
+	}
+
+	preload_status status() const
+	{
+		return context_->status();
+	}
+
+	// frame_producer
+			
+	virtual safe_ptr<basic_frame> receive(int hints) override
+	{
+		auto status = context_->status();
+
+		*monitor_subject_	<< monitor::message(PRELOAD_STATE_PATH) % narrow(to_string(status.state))
+							<< monitor::message(PRELOAD_TIME_PATH) % status.elapsed_millis;
+
+		if(status.state == preload_status::failed)
+			return basic_frame::eof();
+
+		auto producer = get_producer();
+		if(!producer)
+			return basic_frame::late();
+
+		return producer->receive(hints);
+	}
+
+	virtual safe_ptr<basic_frame> last_frame() const override
+	{
+		auto producer = ready_producer();
+		return producer ? producer->last_frame() : leading_producer_->last_frame();
+	}
+
+	virtual std::wstring print() const override
+	{
+		auto producer = ready_producer();
+		return producer ? producer->print() : L"preload[" + name_ + L"]";
+	}
+
+	virtual boost::property_tree::wptree info() const override
+	{
+		auto producer = ready_producer();
+
+		boost::property_tree::wptree info;
+		if(producer)
+			info = producer->info();
+		else
+		{
+			info.add(L"type", L"preload-producer");
+			info.add(L"name", name_);
+		}
+
+		auto status = context_->status();
+		info.add(L"preload.state", to_string(status.state));
+		info.add(L"preload.time", status.elapsed_millis);
+		return info;
+	}
+
+	virtual boost::unique_future<std::wstring> call(const std::wstring& str) override
+	{
+		auto producer = get_producer();
+		if(!producer)
+			BOOST_THROW_EXCEPTION(invalid_operation() << msg_info("Preload not finished.") << arg_value_info(narrow(name_)));
+
+		return producer->call(str);
+	}
+
+	virtual safe_ptr<frame_producer> get_following_producer() const override
+	{
+		auto producer = ready_producer();
+		return producer ? producer->get_following_producer() : frame_producer::empty();
+	}
+
+	virtual void set_leading_producer(const safe_ptr<frame_producer>& producer) override
+	{
+		if(producer_)
+			producer_->set_leading_producer(producer);
+		else
+			leading_producer_ = producer;
+	}
+
+	virtual uint32_t nb_frames() const override
+	{
+		auto producer = ready_producer();
+		return producer ? producer->nb_frames() : std::numeric_limits<uint32_t>::max();
+	}
+
+	virtual monitor::subject& monitor_output() override
+	{
+		return *monitor_subject_;
+	}
+
+private:
+	std::shared_ptr<frame_producer> ready_producer() const
+	{
+		if(producer_)
+			return producer_;
+
+		if(!future_.is_ready() || future_.has_exception())
+			return nullptr;
+
+		return future_.get();
+	}
+
+	std::shared_ptr<frame_producer> get_producer()
+	{
+		if(producer_)
+			return producer_;
+
+		auto producer = ready_producer();
+		if(!producer)
+			return nullptr;
+
+		producer_ = producer;
+		producer_->monitor_output().attach_parent(monitor_subject_);
+
+		if(leading_producer_ != frame_producer::empty())
+		{
+			producer_->set_leading_producer(leading_producer_);
+			leading_producer_ = frame_producer::empty();
+		}
+
+		return producer_;
+	}
+};
+
+safe_ptr<frame_producer> create_preload_producer(const std::function<safe_ptr<frame_producer>()>& factory, const std::wstring& name)
+{
+	return make_safe<preload_producer>(factory, name);
+}
+
+void wait_for_preload(const safe_ptr<frame_producer>& producer)
+{
+	auto preload = dynamic_cast<const preload_producer*>(producer.get());
+	if(preload)
+		preload->wait();
+}
+
+boost::optional<preload_status> get_preload_status(const safe_ptr<frame_producer>& producer)
+{
+	auto preload = dynamic_cast<const preload_producer*>(producer.get());
+	if(!preload)
+		return boost::none;
+
+	return preload->status();
+}
+
+}}
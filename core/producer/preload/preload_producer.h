@@ -0,0 +1,60 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+
+#pragma once
+
+#include "../frame_producer.h"
+
+#include <boost/optional.hpp>
+
+#include <functional>
+#include <string>
+
+namespace caspar { namespace core {
+
+struct preload_status
+{
+	enum state_t
+	{
+		pending,
+		ready,
+		failed
+	};
+
+	state_t	state;
+	int		elapsed_millis;
+};
+
+std::wstring to_string(preload_status::state_t state);
+
+// Runs factory on a background preload thread and returns at once. Until factory has returned, the
+// producer renders late frames. If factory throws, the producer ends as if it reached end of file.
+safe_ptr<frame_producer> create_preload_producer(const std::function<safe_ptr<frame_producer>()>& factory, const std::wstring& name);
+
+// Blocks until producer has finished preloading and rethrows any exception thrown by its factory.
+// Does nothing if producer is not a preload producer.
+void wait_for_preload(const safe_ptr<frame_producer>& producer);
+
+// Returns nothing if producer is not a preload producer.
+boost::optional<preload_status> get_preload_status(const safe_ptr<frame_producer>& producer);
+
+}}
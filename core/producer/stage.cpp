@@ -30,6 +30,8 @@
 
 #include <common/concurrency/executor.h>
 
+#include <core/frame_trace.h>
+
 #include <core/producer/frame/frame_transform.h>
 #include <core/consumer/frame_consumer.h>
 #include <core/consumer/write_frame_consumer.h>
@@ -92,6 +94,7 @@ struct stage::implementation : public std::enable_shared_from_this<implementatio
 							 , boost::noncopyable
 {		
 	safe_ptr<diagnostics::graph>												 graph_;
+	safe_ptr<frame_tracer>														 tracer_;
 	safe_ptr<stage::target_t>													 target_;
 	video_format_desc															 format_desc_;
 																				 
@@ -108,8 +111,9 @@ struct stage::implementation : public std::enable_shared_from_this<implementatio
 	executor																	 executor_;
 
 public:
-	implementation(const safe_ptr<diagnostics::graph>& graph, const safe_ptr<stage::target_t>& target, const video_format_desc& format_desc, int channel_index)
+	implementation(const safe_ptr<diagnostics::graph>& graph, const safe_ptr<frame_tracer>& tracer, const safe_ptr<stage::target_t>& target, const video_format_desc& format_desc, int channel_index)
 		: graph_(graph)
+		, tracer_(tracer)
 		, format_desc_(format_desc)
 		, target_(target)
 		, monitor_subject_(make_safe<monitor::subject>("/stage"))
@@ -152,6 +156,9 @@ public:
 		{
 			produce_timer_.restart();
 
+			const auto frame_id		= tracer_->next_frame_id();
+			const auto produce_begin	= frame_tracer::now();
+
 			std::map<int, safe_ptr<basic_frame>> frames;
 		
 			for(auto it = layers_.begin(); it != layers_.end(); ++it)
@@ -201,8 +208,9 @@ public:
 					elem.second.fetch_and_tick(format_desc_.field_mode != core::field_mode::progressive ? 2 : 1);
 			
 			graph_->set_value("produce-time", produce_timer_.elapsed()*format_desc_.fps*0.5);
+			tracer_->add_span(frame_id, "stage-produce", produce_begin, frame_tracer::now());
 
-			std::shared_ptr<void> ticket(nullptr, [this, self](void*)
+			auto ticket = create_frame_ticket(frame_id, [this, self]
 			{
 				auto self2 = self.lock();
 				if(self2)				
@@ -481,8 +489,8 @@ public:
 	}
 };
 
-stage::stage(const safe_ptr<diagnostics::graph>& graph, const safe_ptr<target_t>& target, const video_format_desc& format_desc, int channel_index)
-	: impl_(new implementation(graph, target, format_desc, channel_index)){}
+stage::stage(const safe_ptr<diagnostics::graph>& graph, const safe_ptr<frame_tracer>& tracer, const safe_ptr<target_t>& target, const video_format_desc& format_desc, int channel_index)
+	: impl_(new implementation(graph, tracer, target, format_desc, channel_index)){}
 void stage::apply_transforms(const std::vector<stage::transform_tuple_t>& transforms){impl_->apply_transforms(transforms);}
 void stage::apply_transform(int index, const transform_func_t& transform, unsigned int mix_duration, const std::wstring& tween){impl_->apply_transform(index, transform, mix_duration, tween);}
 void stage::clear_transforms(int index){impl_->clear_transforms(index);}
@@ -39,6 +39,7 @@ namespace caspar { namespace core {
 
 struct video_format_desc;
 struct frame_transform;
+class frame_tracer;
 struct write_frame_consumer;
 
 class stage : boost::noncopyable
@@ -53,7 +54,7 @@ public:
 
 	// Constructors
 
-	explicit stage(const safe_ptr<diagnostics::graph>& graph, const safe_ptr<target_t>& target, const video_format_desc& format_desc, const int channel_index);
+	explicit stage(const safe_ptr<diagnostics::graph>& graph, const safe_ptr<frame_tracer>& tracer, const safe_ptr<target_t>& target, const video_format_desc& format_desc, const int channel_index);
 	
 	// Methods
 	
@@ -36,6 +36,13 @@ using namespace boost::assign;
 
 namespace caspar { namespace core {	
 
+namespace {
+
+const monitor::path_handle TRANSITION_FRAME_PATH("/transition/frame");
+const monitor::path_handle TRANSITION_TYPE_PATH("/transition/type");
+
+}
+
 struct transition_producer : public frame_producer
 {	
 	safe_ptr<monitor::subject>	monitor_subject_;
@@ -100,8 +107,8 @@ struct transition_producer : public frame_producer
 				source = source_producer_->last_frame();
 		});
 
-		*monitor_subject_ << monitor::message("/transition/frame") % static_cast<std::int32_t>(current_frame_) % static_cast<std::int32_t>(info_.duration+info_.pause)
-		                  << monitor::message("/transition/type") % [&]() -> std::string
+		*monitor_subject_ << monitor::message(TRANSITION_FRAME_PATH) % static_cast<std::int32_t>(current_frame_) % static_cast<std::int32_t>(info_.duration+info_.pause)
+		                  << monitor::message(TRANSITION_TYPE_PATH) % [&]() -> std::string
 																{
 																	switch(info_.type)
 																	{
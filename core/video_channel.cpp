@@ -24,6 +24,7 @@
 #include "video_channel.h"
 
 #include "video_format.h"
+#include "frame_trace.h"
 
 #include "consumer/output.h"
 #include "mixer/mixer.h"
@@ -46,8 +47,9 @@ struct video_channel::implementation : boost::noncopyable
 	const int								index_;
 	video_format_desc						format_desc_;
 	channel_layout							audio_channel_layout_;
-	const safe_ptr<ogl_device>				ogl_;
+	const std::shared_ptr<ogl_device>		ogl_;
 	const safe_ptr<diagnostics::graph>		graph_;
+	const safe_ptr<frame_tracer>			tracer_;
 
 	const safe_ptr<caspar::core::output>	output_;
 	const safe_ptr<caspar::core::mixer>		mixer_;
@@ -56,18 +58,20 @@ struct video_channel::implementation : boost::noncopyable
 	safe_ptr<monitor::subject>				monitor_subject_;
 	
 public:
-	implementation(video_channel& self, int index, const video_format_desc& format_desc, const safe_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout)  
+	implementation(video_channel& self, int index, const video_format_desc& format_desc, const std::shared_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout)  
 		: self_(self)
 		, index_(index)
 		, format_desc_(format_desc)
 		, ogl_(ogl)
 		, audio_channel_layout_(audio_channel_layout)
-		, output_(new caspar::core::output(graph_, format_desc, audio_channel_layout, index))
-		, mixer_(new caspar::core::mixer(graph_, output_, format_desc, ogl, audio_channel_layout, index))
-		, stage_(new caspar::core::stage(graph_, mixer_, format_desc, index))	
+		, tracer_(make_safe<frame_tracer>(index))
+		, output_(new caspar::core::output(graph_, tracer_, format_desc, audio_channel_layout, index))
+		, mixer_(new caspar::core::mixer(graph_, tracer_, output_, format_desc, ogl, audio_channel_layout, index))
+		, stage_(new caspar::core::stage(graph_, tracer_, mixer_, format_desc, index))	
 		, monitor_subject_(make_safe<monitor::subject>("/channel/" + boost::lexical_cast<std::string>(index)))
 	{
 		graph_->set_text(print());
+		graph_->set_name("channel-" + boost::lexical_cast<std::string>(index));
 		diagnostics::register_graph(graph_);
 
 
@@ -140,11 +144,12 @@ public:
 	}
 };
 
-video_channel::video_channel(int index, const video_format_desc& format_desc, const safe_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout) 
+video_channel::video_channel(int index, const video_format_desc& format_desc, const std::shared_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout) 
 	: impl_(new implementation(*this, index, format_desc, ogl, audio_channel_layout)){}
 safe_ptr<stage> video_channel::stage() { return impl_->stage_;} 
 safe_ptr<mixer> video_channel::mixer() { return impl_->mixer_;} 
 safe_ptr<output> video_channel::output() { return impl_->output_;} 
+safe_ptr<frame_tracer> video_channel::tracer() { return impl_->tracer_;} 
 const video_format_desc& video_channel::get_video_format_desc() const {return impl_->format_desc_;}
 const channel_layout& video_channel::get_channel_layuot() const { return impl_->audio_channel_layout_; }
 boost::property_tree::wptree video_channel::info() const{return impl_->info();}
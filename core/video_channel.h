@@ -35,6 +35,7 @@ namespace caspar { namespace core {
 class stage;
 class mixer;
 class output;
+class frame_tracer;
 class ogl_device;
 struct video_format_desc;
 struct channel_layout;
@@ -47,7 +48,7 @@ public:
 
 	// Constructors
 
-	explicit video_channel(int index, const video_format_desc& format_desc, const safe_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout);
+	explicit video_channel(int index, const video_format_desc& format_desc, const std::shared_ptr<ogl_device>& ogl, const channel_layout& audio_channel_layout);
 
 	// Methods
 
@@ -56,6 +57,7 @@ public:
 	safe_ptr<stage> stage();
 	safe_ptr<mixer>	mixer();
 	safe_ptr<output> output();
+	safe_ptr<frame_tracer> tracer();
 	
 	const video_format_desc& get_video_format_desc() const;
 
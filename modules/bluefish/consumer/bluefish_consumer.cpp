@@ -104,6 +104,7 @@ public:
 		graph_->set_color("sync-time", diagnostics::color(1.0f, 0.0f, 0.0f));
 		graph_->set_color("frame-time", diagnostics::color(0.5f, 1.0f, 0.2f));
 		graph_->set_text(print());
+		graph_->set_name("bluefish-consumer");
 		diagnostics::register_graph(graph_);
 			
 		//Setting output Video mode
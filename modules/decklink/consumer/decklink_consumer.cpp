@@ -116,6 +116,7 @@ public:
 		graph_->set_color("buffered-audio", diagnostics::color(0.9f, 0.9f, 0.5f));
 		graph_->set_color("buffered-video", diagnostics::color(0.2f, 0.9f, 0.9f));
 		graph_->set_text(print());
+		graph_->set_name("decklink-consumer");
 		diagnostics::register_graph(graph_);
 
 		if (FAILED(output_->SetScheduledFrameCompletionCallback(this)))
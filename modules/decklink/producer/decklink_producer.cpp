@@ -161,6 +161,7 @@ public:
 		graph_->set_color("dropped-frame", diagnostics::color(0.3f, 0.6f, 0.3f));
 		graph_->set_color("output-buffer", diagnostics::color(0.0f, 1.0f, 0.0f));
 		graph_->set_text(print());
+		graph_->set_name("decklink-producer");
 		diagnostics::register_graph(graph_);
 		
 		BOOL supportsFormatDetection = false;
@@ -52,8 +52,10 @@
 #pragma warning(pop)
 
 #include <tbb/cache_aligned_allocator.h>
+#include <tbb/mutex.h>
 #include <tbb/parallel_invoke.h>
 
+#include <boost/foreach.hpp>
 #include <boost/range/algorithm_ext.hpp>
 #include <boost/lexical_cast.hpp>
 
@@ -178,6 +180,73 @@ namespace caspar {
 			
 		};
 
+		// An additional encode of the channel at a lower resolution, e.g. a proxy
+		// next to the mezzanine file. Renditions scale the frames converted for
+		// the main output instead of converting the channel again.
+		struct rendition_params
+		{
+			std::string									file_name_;
+			int											height_;
+			std::string									video_codec_;
+			int											video_bitrate_;
+			std::string									options_;
+		};
+
+		output_params get_rendition_output_params(const output_params& main, const rendition_params& rendition)
+		{
+			return output_params(
+				rendition.file_name_,
+				main.audio_codec_,
+				rendition.video_codec_,
+				main.output_metadata_,
+				main.audio_metadata_,
+				main.video_metadata_,
+				main.audio_stream_id_,
+				main.video_stream_id_,
+				rendition.options_,
+				main.is_stream_,
+				main.is_narrow_,
+				main.audio_bitrate_,
+				rendition.video_bitrate_,
+				main.file_timecode_,
+				"",
+				main.channel_map_);
+		}
+
+		// renditions: comma separated list of height:filename, e.g. 720:proxy.mp4,360:low.mp4
+		std::vector<rendition_params> parse_renditions(const std::wstring& renditions, const std::wstring& video_codec, int video_bitrate, const std::wstring& options, bool is_stream)
+		{
+			std::vector<rendition_params> result;
+			std::vector<std::wstring> items;
+			boost::split(items, renditions, boost::is_any_of(L","), boost::token_compress_on);
+
+			BOOST_FOREACH(auto item, items)
+			{
+				boost::trim(item);
+				auto separator = item.find(L':');
+				if (item.empty())
+					continue;
+				if (separator == std::wstring::npos)
+					BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("Rendition must be given as height:filename") << arg_value_info(narrow(item)));
+
+				rendition_params rendition;
+				rendition.height_ = boost::lexical_cast<int>(item.substr(0, separator));
+				auto file_name = item.substr(separator + 1);
+				auto file_path_is_complete = is_stream || boost::filesystem2::path(narrow(file_name)).is_complete();
+				rendition.file_name_ = narrow(file_path_is_complete ? file_name : env::media_folder() + file_name);
+				rendition.video_codec_ = narrow(video_codec);
+				rendition.video_bitrate_ = video_bitrate;
+				rendition.options_ = narrow(options);
+
+				if (rendition.height_ < 2)
+					BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("Invalid rendition height") << arg_value_info(narrow(item)));
+
+				result.push_back(rendition);
+			}
+
+			return result;
+		}
+
 		AVDictionary * read_parameters(const std::string& options) {
 			AVDictionary* result = NULL;
 			LOG_ON_ERROR2(av_dict_parse_string(&result, options.c_str(), "=", ",", 0), L"Parameters unrecognized");
@@ -198,6 +267,7 @@ namespace caspar {
 			const core::video_format_desc&			channel_format_desc_;
 			const core::channel_layout&				audio_channel_layout_;
 			const int								height_;
+			const int								rendition_height_; // 0 for the main output.
 			const AVRational						channel_sample_aspect_ratio_;
 
 			const safe_ptr<diagnostics::graph>		graph_;
@@ -216,10 +286,15 @@ namespace caspar {
 			const int								scale_slice_height_;
 			
 			std::vector<SwsContextPtr>				sws_;
+			SwsContextPtr							rendition_sws_;
 
 			byte_vector								audio_bufers_[AV_NUM_DATA_POINTERS];
 			byte_vector								key_picture_buf_;
-			byte_vector								picture_buf_;
+			int										picture_size_;
+			std::shared_ptr<tbb::concurrent_queue<std::shared_ptr<byte_vector>>> picture_pool_;
+
+			tbb::mutex								write_mutex_;
+			std::vector<std::shared_ptr<ffmpeg_consumer>> renditions_;
 
 			tbb::atomic<int64_t>					out_frame_number_;
 			int64_t									out_audio_sample_number_;
@@ -237,7 +312,8 @@ namespace caspar {
 				const core::video_format_desc& channel_format_desc,
 				const core::channel_layout& audio_channel_layout,
 				const output_params& params,
-				bool key_only
+				bool key_only,
+				int rendition_height = 0
 			)
 				: encode_executor_(print())
 				, out_audio_sample_number_(0)
@@ -248,9 +324,13 @@ namespace caspar {
 				, options_(read_parameters(params.options_))
 				, audio_stream_(nullptr)
 				, video_stream_(nullptr)
-				, is_imx50_pal_(output_params_.is_mxf_ && channel_format_desc.format == core::video_format::pal)
+				, is_imx50_pal_(output_params_.is_mxf_ && channel_format_desc.format == core::video_format::pal && rendition_height == 0)
 				, scale_slices_(get_scale_slice_count(channel_format_desc_))
 				, height_(channel_format_desc.format == core::video_format::ntsc ? 480 : channel_format_desc.height)
+				, rendition_height_(rendition_height)
+				, rendition_sws_(nullptr, [](SwsContext * ctx) { sws_freeContext(ctx); })
+				, picture_size_(0)
+				, picture_pool_(std::make_shared<tbb::concurrent_queue<std::shared_ptr<byte_vector>>>())
 				, scale_slice_height_(height_ / scale_slices_)
 				, out_pixel_format_(get_pixel_format(&options_))
 				, channel_sample_aspect_ratio_(get_channel_sample_aspect_ratio(channel_format_desc.format, params.is_narrow_))
@@ -272,7 +352,12 @@ namespace caspar {
 					? output_params_.is_mxf_ ? avcodec_find_encoder_by_name("pcm_s16le") : avcodec_find_encoder_by_name("aac")
 					: avcodec_find_encoder_by_name(output_params_.audio_codec_.c_str());
 								
-				if (params.filter_.empty())
+				if (rendition_height_ > 0)
+				{
+					auto width = static_cast<int>(channel_format_desc.width * static_cast<int64_t>(rendition_height_) / height_) & ~1;
+					create_output(video_codec, audio_codec, width, rendition_height_ & ~1, out_pixel_format_, av_make_q(channel_format_desc.time_scale, channel_format_desc.duration), av_make_q(channel_format_desc.duration, channel_format_desc.time_scale), channel_sample_aspect_ratio_);
+				}
+				else if (params.filter_.empty())
 				{
 					create_output(video_codec, audio_codec, channel_format_desc.width, channel_format_desc.height, out_pixel_format_, av_make_q(channel_format_desc.time_scale, channel_format_desc.duration), av_make_q(channel_format_desc.duration, channel_format_desc.time_scale), channel_sample_aspect_ratio_);
 					create_sws();
@@ -297,6 +382,7 @@ namespace caspar {
 				graph_->set_color("frame-time", diagnostics::color(0.1f, 1.0f, 0.1f));
 				graph_->set_color("dropped-frame", diagnostics::color(1.0f, 0.1f, 0.1f));
 				graph_->set_text(print());
+				graph_->set_name("ffmpeg-consumer");
 				diagnostics::register_graph(graph_);
 
 				encode_executor_.set_capacity(16);
@@ -435,7 +521,7 @@ namespace caspar {
 				if (channel_format_desc_.format == core::video_format::ntsc && height == 486)
 					video_codec_ctx_->height = 480;
 
-				if (!video_filter_ && channel_format_desc_.field_mode != core::field_mode::progressive)
+				if (!video_filter_ && !rendition_height_ && channel_format_desc_.field_mode != core::field_mode::progressive)
 					video_codec_ctx_->flags |= (AV_CODEC_FLAG_INTERLACED_ME | AV_CODEC_FLAG_INTERLACED_DCT);
 
 				if (video_codec_ctx_->codec_id == AV_CODEC_ID_PRORES)
@@ -469,7 +555,7 @@ namespace caspar {
 				}
 				else if (video_codec_ctx_->codec_id == AV_CODEC_ID_H264)
 				{
-					video_codec_ctx_->bit_rate = (video_filter_ ? video_filter_->out_height() : height_) * 14 * 1000; // about 8Mbps for SD, 14 for HD
+					video_codec_ctx_->bit_rate = (rendition_height_ ? rendition_height_ : video_filter_ ? video_filter_->out_height() : height_) * 14 * 1000; // about 8Mbps for SD, 14 for HD
 					video_codec_ctx_->gop_size = 30;
 					video_codec_ctx_->max_b_frames = 2;
 					if (strcmp(video_codec_ctx_->codec->name, "libx264") == 0)
@@ -532,10 +618,37 @@ namespace caspar {
 				video_stream_->time_base = time_base;
 				video_stream_->avg_frame_rate = frame_rate;
 
-				picture_buf_.resize(av_image_get_buffer_size(video_codec_ctx_->pix_fmt, video_codec_ctx_->width, video_codec_ctx_->height, 16));
-				AVFrame black_frame = {0};
-				av_image_fill_arrays(black_frame.data, black_frame.linesize, picture_buf_.data(), video_codec_ctx_->pix_fmt, video_codec_ctx_->width, video_codec_ctx_->height, 16);
-				av_image_fill_black(black_frame.data, black_frame.linesize, video_codec_ctx_->pix_fmt, video_codec_ctx_->color_range, video_codec_ctx_->width, video_codec_ctx_->height);
+				picture_size_ = av_image_get_buffer_size(video_codec_ctx_->pix_fmt, video_codec_ctx_->width, video_codec_ctx_->height, 16);
+			}
+
+			// Pictures are pooled, since renditions keep using them after the
+			// next frame has been converted. New pictures are filled with black,
+			// which keeps the lines outside of the converted area black.
+			std::shared_ptr<AVFrame> alloc_picture()
+			{
+				auto pool = picture_pool_;
+				std::shared_ptr<byte_vector> buffer;
+
+				if (!pool->try_pop(buffer))
+				{
+					buffer = std::make_shared<byte_vector>(picture_size_);
+					AVFrame black_frame = {0};
+					av_image_fill_arrays(black_frame.data, black_frame.linesize, buffer->data(), video_codec_ctx_->pix_fmt, video_codec_ctx_->width, video_codec_ctx_->height, 16);
+					av_image_fill_black(black_frame.data, black_frame.linesize, video_codec_ctx_->pix_fmt, video_codec_ctx_->color_range, video_codec_ctx_->width, video_codec_ctx_->height);
+				}
+
+				std::shared_ptr<AVFrame> picture(av_frame_alloc(), [pool, buffer](AVFrame* frame)
+				{
+					av_frame_free(&frame);
+					pool->push(buffer);
+				});
+
+				av_image_fill_arrays(picture->data, picture->linesize, buffer->data(), video_codec_ctx_->pix_fmt, video_codec_ctx_->width, video_codec_ctx_->height, 16);
+				picture->width = video_codec_ctx_->width;
+				picture->height = video_codec_ctx_->height;
+				picture->format = video_codec_ctx_->pix_fmt;
+
+				return picture;
 			}
 
 			void add_audio_stream(const AVCodec * encoder, const AVOutputFormat * format)
@@ -605,9 +718,7 @@ namespace caspar {
 					av_image_fill_arrays(in_frame.data, in_frame.linesize, const_cast<uint8_t*>(frame.image_data().begin()), AV_PIX_FMT_BGRA, channel_format_desc_.width, channel_format_desc_.height, 16);
 				}
 
-				std::shared_ptr<AVFrame> out_frame(av_frame_alloc(), [](AVFrame* frame) { av_frame_free(&frame); });
-
-				av_image_fill_arrays(out_frame->data, out_frame->linesize, picture_buf_.data(), video_codec_ctx_->pix_fmt, video_codec_ctx_->width, video_codec_ctx_->height, 16);
+				auto out_frame = alloc_picture();
 
 				tbb::parallel_for(0u, scale_slices_, [&](const size_t& sws_index) 
 				{
@@ -684,6 +795,14 @@ namespace caspar {
 				video_filter_->push(av_frame);
 			}
 
+			// Audio and video are encoded in parallel, the muxer is not thread safe.
+			void write_packet(AVPacket& pkt)
+			{
+				THROW_ON_ERROR2(av_packet_make_refcounted(&pkt), "[ffmpeg_consumer]");
+				tbb::mutex::scoped_lock lock(write_mutex_);
+				THROW_ON_ERROR2(av_interleaved_write_frame(format_context_.get(), &pkt), "[ffmpeg_consumer]");
+			}
+
 			void encode_video(AVFrame* frame)
 			{
 				AVPacket pkt = { 0 };
@@ -694,11 +813,11 @@ namespace caspar {
 					return;
 				av_packet_rescale_ts(&pkt, video_codec_ctx_->time_base, video_stream_->time_base);
 				pkt.stream_index = video_stream_->index;
-				THROW_ON_ERROR2(av_packet_make_refcounted(&pkt), "[ffmpeg_consumer]");
-				THROW_ON_ERROR2(av_interleaved_write_frame(format_context_.get(), &pkt), "[ffmpeg_consumer]");
+				write_packet(pkt);
 			}
 
-			void process_video_frame(core::read_frame& frame)
+			// Returns the converted picture, nullptr for the filtered path.
+			std::shared_ptr<AVFrame> process_video_frame(core::read_frame& frame)
 			{
 				if (video_filter_) //filtered path (slow one)
 				{
@@ -709,12 +828,44 @@ namespace caspar {
 						encode_video(converted.get());
 						converted = video_filter_->poll();
 					};
+					return nullptr;
 				}
 				else // fast, multithreaded conversion
 				{
 					auto av_frame = fast_convert_video(frame);
 					encode_video(av_frame.get());
+					return av_frame;
+				}
+			}
+
+			// Renditions are progressive. Interlaced pictures are scaled from their first field only,
+			// scaling the woven frame would blend the two fields.
+			std::shared_ptr<AVFrame> scale_rendition(const AVFrame& source)
+			{
+				const bool interlaced	= channel_format_desc_.field_mode != core::field_mode::progressive;
+				const int field			= channel_format_desc_.field_mode == core::field_mode::lower ? 1 : 0;
+				const int source_height	= interlaced ? source.height / 2 : source.height;
+
+				const uint8_t* source_data[4];
+				int source_linesize[4];
+				for (int i = 0; i < 4; ++i)
+				{
+					source_data[i]		= source.data[i] && interlaced ? source.data[i] + field * source.linesize[i] : source.data[i];
+					source_linesize[i]	= interlaced ? source.linesize[i] * 2 : source.linesize[i];
 				}
+
+				rendition_sws_.reset(sws_getCachedContext(rendition_sws_.release(),
+					source.width, source_height, static_cast<AVPixelFormat>(source.format),
+					video_codec_ctx_->width, video_codec_ctx_->height, video_codec_ctx_->pix_fmt,
+					SWS_BILINEAR, nullptr, nullptr, nullptr));
+
+				if (!rendition_sws_)
+					BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Cannot initialize the rendition conversion context"));
+
+				auto out_frame = alloc_picture();
+				sws_scale(rendition_sws_.get(), source_data, source_linesize, 0, source_height, out_frame->data, out_frame->linesize);
+				out_frame->pts = out_frame_number_++;
+				return out_frame;
 			}
 
 			void create_swr()
@@ -805,8 +956,7 @@ namespace caspar {
 						return;
 					av_packet_rescale_ts(&pkt, audio_codec_ctx_->time_base, audio_stream_->time_base);
 					pkt.stream_index = audio_stream_->index;
-					THROW_ON_ERROR2(av_packet_make_refcounted(&pkt), "[ffmpeg_consumer]");
-					THROW_ON_ERROR2(av_interleaved_write_frame(format_context_.get(), &pkt), "[ffmpeg_consumer]");
+					write_packet(pkt);
 				}
 			}
 
@@ -821,10 +971,57 @@ namespace caspar {
 				encode_executor_.begin_invoke([=] {
 					frame_timer_.restart();
 
-					process_video_frame(*frame);
+					std::shared_ptr<AVFrame> converted;
 
-					if (!key_only_)
-						process_audio_frame(*frame);
+					tbb::parallel_invoke(
+						[&] { converted = process_video_frame(*frame); },
+						[&]
+						{
+							if (!key_only_)
+								process_audio_frame(*frame);
+						});
+
+					if (converted)
+					{
+						BOOST_FOREACH(auto& rendition, renditions_)
+							rendition->send_rendition(frame, converted);
+					}
+
+					graph_->set_value("frame-time", frame_timer_.elapsed()*channel_format_desc_.fps*0.5);
+					graph_->set_text(print());
+					current_encoding_delay_ = frame->get_age_millis();
+				});
+			}
+
+			void add_rendition(const std::shared_ptr<ffmpeg_consumer>& rendition)
+			{
+				if (video_filter_)
+				{
+					CASPAR_LOG(warning) << print() << L" Renditions are not supported together with a filter. Ignoring " << rendition->print();
+					return;
+				}
+
+				renditions_.push_back(rendition);
+			}
+
+			void send_rendition(const safe_ptr<core::read_frame>& frame, const std::shared_ptr<AVFrame>& converted)
+			{
+				if (!ready_for_frame())
+				{
+					mark_dropped();
+					return;
+				}
+
+				encode_executor_.begin_invoke([=] {
+					frame_timer_.restart();
+
+					tbb::parallel_invoke(
+						[&]
+						{
+							auto scaled = scale_rendition(*converted);
+							encode_video(scaled.get());
+						},
+						[&] { process_audio_frame(*frame); });
 
 					graph_->set_value("frame-time", frame_timer_.elapsed()*channel_format_desc_.fps*0.5);
 					graph_->set_text(print());
@@ -878,8 +1075,7 @@ namespace caspar {
 					return true;
 				av_packet_rescale_ts(&pkt, codec_ctx_time_base, stream->time_base);
 				pkt.stream_index = stream->index;
-				THROW_ON_ERROR2(av_packet_make_refcounted(&pkt), "[ffmpeg_consumer]");
-				THROW_ON_ERROR2(av_interleaved_write_frame(format_context_.get(), &pkt), "[ffmpeg_consumer]");
+				write_packet(pkt);
 				return false;
 			}
 					
@@ -889,6 +1085,7 @@ namespace caspar {
 		struct ffmpeg_consumer_proxy : public core::frame_consumer
 		{
 			const output_params				output_params_;
+			const std::vector<rendition_params> renditions_;
 			const int						index_;
 			const bool						separate_key_;
 			const int						tc_in_;
@@ -906,8 +1103,10 @@ namespace caspar {
 				core::recorder* const recorder = nullptr, 
 				const int tc_in = 0, 
 				const int tc_out = std::numeric_limits<int>().max(), 
-				const unsigned int frame_limit = std::numeric_limits<unsigned int>().max())
+				const unsigned int frame_limit = std::numeric_limits<unsigned int>().max(),
+				const std::vector<rendition_params>& renditions = std::vector<rendition_params>())
 				: output_params_(std::move(output_params))
+				, renditions_(renditions)
 				, separate_key_(separate_key)
 				, index_(FFMPEG_CONSUMER_BASE_INDEX + crc16(boost::to_lower_copy(output_params.file_name_)))
 				, tc_in_(tc_in)
@@ -926,6 +1125,16 @@ namespace caspar {
 					output_params_,
 					false
 				));
+				BOOST_FOREACH(auto& rendition, renditions_)
+				{
+					consumer_->add_rendition(std::make_shared<ffmpeg_consumer>(
+						format_desc,
+						audio_channel_layout,
+						get_rendition_output_params(output_params_, rendition),
+						false,
+						rendition.height_
+					));
+				}
 				if (separate_key_)
 				{
 					boost::filesystem::path fill_file(output_params_.file_name_);
@@ -1006,6 +1215,13 @@ namespace caspar {
 				info.add(L"type", L"ffmpeg_consumer");
 				info.add(L"filename", widen(output_params_.file_name_));
 				info.add(L"separate_key", separate_key_);
+				BOOST_FOREACH(auto& rendition, renditions_)
+				{
+					boost::property_tree::wptree rendition_info;
+					rendition_info.add(L"filename", widen(rendition.file_name_));
+					rendition_info.add(L"height", rendition.height_);
+					info.add_child(L"renditions.rendition", rendition_info);
+				}
 				return info;
 			}
 
@@ -1127,6 +1343,12 @@ namespace caspar {
 			auto narrow_aspect_ratio = params.get(L"NARROW", false);
 			auto filter = params.get_original(L"FILTER");
 			auto channel_map = parse_list(narrow(params.get_original(L"CHANNEL_MAP")));
+			auto renditions = parse_renditions(
+				params.get_original(L"RENDITIONS"),
+				params.get_original(L"RENDITION_VCODEC"),
+				params.get(L"RENDITION_VRATE", 0),
+				params.get_original(L"RENDITION_OPTIONS"),
+				is_stream);
 
 			output_params op(
 				file_path_is_complete ? filename : narrow(env::media_folder()) + filename,
@@ -1146,7 +1368,7 @@ namespace caspar {
 				narrow(filter),
 				channel_map
 			);
-			return make_safe<ffmpeg_consumer_proxy>(op, separate_key);
+			return make_safe<ffmpeg_consumer_proxy>(op, separate_key, nullptr, 0, std::numeric_limits<int>().max(), std::numeric_limits<unsigned int>().max(), renditions);
 		}
 
 		safe_ptr<core::frame_consumer> create_consumer(const boost::property_tree::wptree& ptree)
@@ -1165,6 +1387,12 @@ namespace caspar {
 			auto video_stream_id = ptree.get(L"video_stream_id", 0);
 			auto filter = ptree.get(L"filter", L"");
 			auto channel_map = parse_list(narrow(ptree.get(L"channel_map", L"")));
+			auto renditions = parse_renditions(
+				ptree.get(L"renditions", L""),
+				ptree.get(L"rendition-vcodec", L""),
+				ptree.get(L"rendition-vrate", 0),
+				ptree.get(L"rendition-options", L""),
+				true);
 
 			output_params op(
 				filename,
@@ -1184,7 +1412,7 @@ namespace caspar {
 				narrow(filter),
 				channel_map
 			);
-			return make_safe<ffmpeg_consumer_proxy>(op, separate_key);
+			return make_safe<ffmpeg_consumer_proxy>(op, separate_key, nullptr, 0, std::numeric_limits<int>().max(), std::numeric_limits<unsigned int>().max(), renditions);
 		}
 
 		void set_frame_limit(const safe_ptr<core::frame_consumer>& consumer, unsigned int frame_limit)
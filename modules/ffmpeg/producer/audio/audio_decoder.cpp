@@ -119,8 +119,10 @@ public:
 			while (!eof_)
 			{
 				std::shared_ptr<AVPacket> packet;
+				bool input_eof = input_.eof(); // Checked before popping, all packets have been queued once it is set.
 				input_.try_pop_audio(packet);
-				avcodec_send_packet(codec_context_.get(), packet.get());
+				if (packet || input_eof) // A null packet drains the decoder, only send it at end of file.
+					avcodec_send_packet(codec_context_.get(), packet.get());
 				auto frame = create_frame();
 				int ret = avcodec_receive_frame(codec_context_.get(), frame.get());
 				switch (ret)
@@ -146,6 +148,10 @@ public:
 				case AVERROR_EOF:
 					eof_ = true;
 					return nullptr;
+				case AVERROR(EAGAIN):
+					if (!packet && !input_eof) // Input is starved, try again on the next poll.
+						return nullptr;
+					break;
 				}
 			}
 		}
@@ -29,10 +29,12 @@
 #include "muxer/frame_muxer.h"
 #include "input/input.h"
 #include "util/util.h"
+#include "util/sws_context_cache.h"
 #include "audio/audio_decoder.h"
 #include "video/video_decoder.h"
 
 #include <common/env.h>
+#include <common/concurrency/executor.h>
 #include <common/utility/assert.h>
 #include <common/diagnostics/graph.h>
 #include <common/utility/string.h>
@@ -55,14 +57,29 @@
 #include <boost/regex.hpp>
 #include <boost/locale.hpp>
 
+#include <tbb/atomic.h>
+#include <tbb/concurrent_queue.h>
 #include <tbb/parallel_invoke.h>
 
+#include <exception>
 #include <limits>
 #include <memory>
-#include <queue>
 
 namespace caspar { namespace ffmpeg {
 
+namespace {
+
+const core::monitor::path_handle PROFILER_TIME_PATH("/profiler/time");
+const core::monitor::path_handle FILE_TIME_PATH("/file/time");
+const core::monitor::path_handle FILE_FRAME_PATH("/file/frame");
+const core::monitor::path_handle FILE_FPS_PATH("/file/fps");
+const core::monitor::path_handle FILE_PATH_PATH("/file/path");
+const core::monitor::path_handle LOOP_PATH("/loop");
+const core::monitor::path_handle UNDERFLOWS_PATH("/underflows");
+const core::monitor::path_handle DECODE_AHEAD_PATH("/decode-ahead");
+
+}
+
 std::wstring get_relative_or_original(
 		const std::wstring& filename,
 		const boost::filesystem::wpath& relative_to)
@@ -113,12 +130,20 @@ struct ffmpeg_producer : public core::frame_producer
 	const int64_t												length_;
 	const bool													alpha_mode_;
 	const std::string											filter_str_;
-	bool														loop_;
+	tbb::atomic<bool>											loop_;
 	tbb::atomic<bool>											is_eof_;
 	safe_ptr<core::basic_frame>									last_frame_;
+	tbb::atomic<uint32_t>										file_frame_number_; // Published for print, info and nb_frames which may run on other threads.
+	tbb::atomic<uint32_t>										file_nb_frames_;
 	
-	std::queue<safe_ptr<core::basic_frame>>						frame_buffer_;
-
+	tbb::concurrent_bounded_queue<safe_ptr<core::basic_frame>>	frame_buffer_;
+
+	const int													decode_ahead_;
+	tbb::atomic<int>											hints_;
+	tbb::atomic<bool>											is_decoding_ahead_;
+	std::exception_ptr											decode_ahead_exception_; // Only accessed while not decoding ahead.
+	tbb::atomic<int>											underflow_count_;
+	std::unique_ptr<executor>									decode_executor_; // Must be destroyed first, runs tasks that use the decoders.
 		
 public:
 	explicit ffmpeg_producer(const safe_ptr<core::frame_factory>& frame_factory, const std::wstring& filename, const std::wstring& filter, bool loop, uint32_t start, uint32_t length, bool alpha_mode, const std::wstring& custom_channel_order, bool field_order_inverted, bool is_stream)
@@ -126,18 +151,28 @@ public:
 		, path_relative_to_media_(get_relative_or_original(filename, env::media_folder()))
 		, frame_factory_(frame_factory)
 		, format_desc_(frame_factory->get_video_format_desc())
-		, input_(graph_, filename_)
+		, input_(graph_, filename_, format_desc_)
 		, out_fps_(boost::rational<int>(format_desc_.time_scale, format_desc_.duration))
 		, length_(frame_to_time(length))
 		, alpha_mode_(alpha_mode)
 		, last_frame_(core::basic_frame::empty())
 		, filter_str_(narrow(filter))
 		, custom_channel_order_(custom_channel_order)
-		, loop_(loop)
 		, start_time_(frame_to_time(start))
+		, decode_ahead_(std::max(0, std::min(64, env::properties().get(L"configuration.ffmpeg.decode-ahead", 0))))
 	{
+		hints_				= alpha_mode ? core::frame_producer::ALPHA_HINT : core::frame_producer::NO_HINT;
+		is_decoding_ahead_	= false;
+		loop_				= loop;
+		file_frame_number_	= 0;
+		file_nb_frames_		= std::numeric_limits<uint32_t>::max();
+		underflow_count_	= 0;
+
 		graph_->set_color("frame-time", diagnostics::color(0.1f, 1.0f, 0.1f));
 		graph_->set_color("underflow", diagnostics::color(0.6f, 0.3f, 0.9f));	
+		if (decode_ahead_ > 0)
+			graph_->set_color("decode-ahead", diagnostics::color(0.2f, 0.6f, 0.9f));
+		graph_->set_name("ffmpeg-producer");
 		diagnostics::register_graph(graph_);
 		try
 		{
@@ -172,16 +207,35 @@ public:
 
 		if(!video_decoder_ && !audio_decoder_)
 			BOOST_THROW_EXCEPTION(averror_stream_not_found() << msg_info("No streams found"));
+		file_nb_frames_ = time_to_frame(file_duration());
 		muxer_.reset(new frame_muxer(video_decoder_ ? video_decoder_->frame_rate() : boost::rational<int>(format_desc_.time_scale, format_desc_.duration),
 			video_decoder_ ? video_decoder_->time_base() : boost::rational<int>(format_desc_.duration, format_desc_.time_scale),
 			frame_factory, audio_channel_layout_, filter_str_));
+		if (video_decoder_ && env::properties().get(L"configuration.ffmpeg.direct-rendering", true))
+			video_decoder_->enable_direct_rendering(muxer_->tag(), frame_factory, audio_channel_layout_);
 		if (is_stream)
 			input_.tick();
 		else
 			if (!seek(start_time_, false))
 				CASPAR_LOG(warning) << print() << " Initial seek failed.";
-		for (int n = 0; n < 32 && frame_buffer_.size() < 2 && !is_eof_; ++n)
-			try_decode_frame(alpha_mode ? core::frame_producer::ALPHA_HINT : core::frame_producer::NO_HINT);
+		{
+			// The contexts used for the first frames are handed over to the thread which plays the producer.
+			sws_context_warm_up warm_up;
+			for (int n = 0; n < 32 && frame_buffer_.size() < 2 && !is_eof_; ++n)
+				try_decode_frame(alpha_mode ? core::frame_producer::ALPHA_HINT : core::frame_producer::NO_HINT);
+		}
+
+		if (decode_ahead_ > 0)
+		{
+			decode_executor_.reset(new executor(L"ffmpeg_producer[" + boost::filesystem::wpath(filename_).filename() + L"]"));
+			request_decode_ahead();
+		}
+	}
+
+	~ffmpeg_producer()
+	{
+		if (decode_executor_)
+			decode_executor_->clear(); // Don't decode frames that will never be used.
 	}
 
 	// frame_producer
@@ -200,30 +254,52 @@ public:
 	{		
 		frame_timer_.restart();
 				
-		for (int n = 0; n < 32 && frame_buffer_.size() < 2 && !is_eof_; ++n)
-			try_decode_frame(hints);
+		if (decode_executor_)
+		{
+			if (!is_decoding_ahead_ && decode_ahead_exception_ != nullptr)
+			{
+				auto exception = decode_ahead_exception_;
+				decode_ahead_exception_ = nullptr;
+				std::rethrow_exception(exception);
+			}
+
+			hints_ = hints;
+		}
+		else
+		{
+			for (int n = 0; n < 32 && frame_buffer_.size() < 2 && !is_eof_; ++n)
+				try_decode_frame(hints);
+		}
+
+		auto frame = core::basic_frame::late();
+		bool has_frame = frame_buffer_.try_pop(frame);
+
+		if (decode_executor_)
+		{
+			request_decode_ahead();
+			graph_->set_value("decode-ahead", static_cast<double>(frame_buffer_.size()) / static_cast<double>(decode_ahead_));
+		}
 		
 		graph_->set_value("frame-time", frame_timer_.elapsed()*format_desc_.fps*0.5);
 
-		if (frame_buffer_.empty())
+		if (!has_frame)
 		{
-			
-			if (is_eof_)
+			if (is_eof_ && !is_decoding_ahead_)
 			{
 				send_osc();
 				return last_frame();
 			}
 			else 
 			{
+				++underflow_count_;
 				graph_->set_tag("underflow");  
 				send_osc();
 				return core::basic_frame::late();     
 			}
 		}
 		
-		auto frame = frame_buffer_.front(); 
 		last_frame_ = frame;
-		frame_buffer_.pop();
+		file_frame_number_ = frame->get_timecode();
 
 		graph_->set_text(print());
 		send_osc();
@@ -231,17 +307,46 @@ public:
 		return frame;
 	}
 
+	void request_decode_ahead()
+	{
+		if (frame_buffer_.size() >= decode_ahead_ || is_decoding_ahead_.compare_and_swap(true, false))
+			return;
+
+		decode_executor_->post([this]
+		{
+			try
+			{
+				decode_ahead();
+			}
+			catch(...)
+			{
+				decode_ahead_exception_ = std::current_exception(); // Rethrown by the next receive.
+			}
+
+			is_decoding_ahead_ = false;
+		});
+	}
+
+	void decode_ahead() // decode_executor_ thread only.
+	{
+		for (int n = 0; n < 32 * decode_ahead_ && frame_buffer_.size() < decode_ahead_ && !is_eof_; ++n)
+			try_decode_frame(hints_);
+	}
+
 	void send_osc()
 	{
-		monitor_subject_	<< core::monitor::message("/profiler/time")		% frame_timer_.elapsed() % (1.0/format_desc_.fps);			
-		auto duration = file_duration();
-		monitor_subject_	<< core::monitor::message("/file/time")			% frame_to_time(last_frame_->get_timecode())
-																			% duration
-							<< core::monitor::message("/file/frame")		% static_cast<int32_t>(last_frame_->get_timecode())
-																			% static_cast<int32_t>(time_to_frame(duration))
-							<< core::monitor::message("/file/fps")			% out_fps_
-							<< core::monitor::message("/file/path")			% path_relative_to_media_
-							<< core::monitor::message("/loop")				% loop_;
+		monitor_subject_	<< core::monitor::message(PROFILER_TIME_PATH)	% frame_timer_.elapsed() % (1.0/format_desc_.fps);			
+		monitor_subject_	<< core::monitor::message(FILE_TIME_PATH)		% frame_to_time(file_frame_number_)
+																			% file_duration()
+							<< core::monitor::message(FILE_FRAME_PATH)		% static_cast<int32_t>(file_frame_number_)
+																			% static_cast<int32_t>(file_nb_frames_)
+							<< core::monitor::message(FILE_FPS_PATH)		% out_fps_
+							<< core::monitor::message(FILE_PATH_PATH)		% path_relative_to_media_
+							<< core::monitor::message(LOOP_PATH)			% static_cast<bool>(loop_)
+							<< core::monitor::message(UNDERFLOWS_PATH)		% static_cast<int>(underflow_count_);
+
+		if (decode_executor_)
+			monitor_subject_ << core::monitor::message(DECODE_AHEAD_PATH)	% static_cast<int32_t>(frame_buffer_.size()) % decode_ahead_;
 	}
 	
 	virtual uint32_t nb_frames() const override
@@ -249,7 +354,7 @@ public:
 		if(loop_) 
 			return std::numeric_limits<uint32_t>::max();
 
-		uint32_t nb_frames = time_to_frame(file_duration());
+		uint32_t nb_frames = file_nb_frames_;
 
 		if (length_ != AV_NOPTS_VALUE)
 			nb_frames = std::min(time_to_frame(length_), nb_frames);
@@ -268,6 +373,16 @@ public:
 	
 	virtual boost::unique_future<std::wstring> call(const std::wstring& param) override
 	{
+		if (decode_executor_)
+		{
+			return decode_executor_->begin_invoke([=]() -> std::wstring
+			{
+				auto result = do_call(param);
+				decode_ahead(); // Refill the buffer so that a following receive has the frame that was seeked to.
+				return result;
+			});
+		}
+
 		boost::promise<std::wstring> promise;
 		promise.set_value(do_call(param));
 		return promise.get_future();
@@ -277,7 +392,7 @@ public:
 	{
 		return L"ffmpeg[" + boost::filesystem::wpath(filename_).filename() + L"|" 
 						  + print_mode() + L"|" 
-						  + boost::lexical_cast<std::wstring>(last_frame_->get_timecode()) + L"/" + boost::lexical_cast<std::wstring>(time_to_frame(file_duration())) + L"]";
+						  + boost::lexical_cast<std::wstring>(static_cast<uint32_t>(file_frame_number_)) + L"/" + boost::lexical_cast<std::wstring>(static_cast<uint32_t>(file_nb_frames_)) + L"]";
 	}
 
 	boost::property_tree::wptree info() const override
@@ -293,11 +408,13 @@ public:
 			info.add(L"file-progressive", video_decoder_ ? video_decoder_->is_progressive() : false);
 		}
 		info.add(L"fps", static_cast<double>(out_fps_.numerator()) / out_fps_.denominator());
-		info.add(L"loop", loop_);
+		info.add(L"loop", static_cast<bool>(loop_));
 		info.add(L"nb-frames",	static_cast<int32_t>(nb_frames()));
-		info.add(L"frame-number", last_frame_->get_timecode() - time_to_frame(start_time_));
-		info.add(L"file-nb-frames", static_cast<int32_t>(time_to_frame(file_duration())));
-		info.add(L"file-frame-number", last_frame_->get_timecode());
+		info.add(L"frame-number", file_frame_number_ - time_to_frame(start_time_));
+		info.add(L"file-nb-frames", static_cast<int32_t>(file_nb_frames_));
+		info.add(L"file-frame-number", static_cast<uint32_t>(file_frame_number_));
+		info.add(L"decode-ahead", decode_ahead_);
+		info.add(L"underflows", static_cast<int>(underflow_count_));
 		return info;
 	}
 
@@ -347,8 +464,8 @@ public:
 			return false;
 		if (clear_buffer_and_muxer)
 		{
-			while (!frame_buffer_.empty())
-				frame_buffer_.pop();
+			auto frame = core::basic_frame::empty();
+			while (frame_buffer_.try_pop(frame));
 			muxer_->clear();
 		}
 		if (video_decoder_)
@@ -465,8 +582,8 @@ safe_ptr<core::frame_producer> create_producer(
 	auto filename = tokens[1];
 
 	auto filter_str = params.get(L"FILTER", L"");
-	boost::replace_all(filter_str, L"DEINTERLACE", L"YADIF=0:-1");
-	boost::replace_all(filter_str, L"DEINTERLACE_BOB", L"YADIF=1:-1");
+	boost::replace_all(filter_str, L"DEINTERLACE_BWDIF", L"DEINTERLACE=MODE=BWDIF:RATE=FIELD");
+	boost::replace_all(filter_str, L"DEINTERLACE_BOB", L"DEINTERLACE=RATE=FIELD");
 	auto custom_channel_order = params.get(L"CHANNEL_LAYOUT", L"");
 	auto field_order_inverted = params.has(L"FIELD_ORDER_INVERTED");
 	bool is_alpha = params.has(L"IS_ALPHA");
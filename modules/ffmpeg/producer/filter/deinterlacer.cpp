@@ -0,0 +1,359 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+#include "../../stdafx.h"
+
+#include "deinterlacer.h"
+#include "deinterlacer_kernels.h"
+
+#include "../../ffmpeg_error.h"
+#include "../util/util.h"
+
+#include <common/exception/exceptions.h>
+#include <common/log/log.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/foreach.hpp>
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <queue>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning (push)
+#pragma warning (disable : 4244)
+#endif
+extern "C"
+{
+	#include <libavutil/avutil.h>
+	#include <libavutil/buffer.h>
+	#include <libavutil/frame.h>
+	#include <libavutil/imgutils.h>
+	#include <libavutil/pixdesc.h>
+}
+#if defined(_MSC_VER)
+#pragma warning (pop)
+#endif
+#if defined(FF)
+#undef FF
+#endif
+
+#define FF(call) THROW_ON_ERROR2(call, "[deinterlacer]")
+
+namespace caspar { namespace ffmpeg {
+
+deinterlacer_params::deinterlacer_params()
+	: mode(deinterlace_mode::yadif)
+	, parity(deinterlace_parity::automatic)
+	, field_rate(false)
+	, spatial_check(true)
+{
+}
+
+bool parse_deinterlacer(const std::string& filter, deinterlacer_params& params)
+{
+	const auto name_end = filter.find('=');
+	if(boost::trim_copy(filter.substr(0, name_end)) != "deinterlace")
+		return false;
+
+	deinterlacer_params result;
+
+	if(name_end != std::string::npos)
+	{
+		std::vector<std::string> options;
+		boost::split(options, filter.substr(name_end + 1), boost::is_any_of(":"));
+
+		BOOST_FOREACH(auto& option, options)
+		{
+			const auto value_begin	= option.find('=');
+			const auto key			= value_begin == std::string::npos ? std::string("mode") : boost::trim_copy(option.substr(0, value_begin));
+			const auto value		= boost::trim_copy(value_begin == std::string::npos ? option : option.substr(value_begin + 1));
+
+			if(key == "mode" && (value == "yadif" || value == "bwdif"))
+				result.mode = value == "yadif" ? deinterlace_mode::yadif : deinterlace_mode::bwdif;
+			else if(key == "rate" && (value == "frame" || value == "field"))
+				result.field_rate = value == "field";
+			else if(key == "parity" && value == "auto")
+				result.parity = deinterlace_parity::automatic;
+			else if(key == "parity" && value == "tff")
+				result.parity = deinterlace_parity::tff;
+			else if(key == "parity" && value == "bff")
+				result.parity = deinterlace_parity::bff;
+			else if(key == "parity" && value == "detect")
+				result.parity = deinterlace_parity::detect;
+			else if(key == "spatial" && (value == "0" || value == "1"))
+				result.spatial_check = value == "1";
+			else
+				CASPAR_LOG(warning) << L"[deinterlacer] Ignoring invalid option: " << option.c_str();
+		}
+	}
+
+	params = result;
+	return true;
+}
+
+std::string get_libavfilter_deinterlacer(const deinterlacer_params& params)
+{
+	const char* parity = params.parity == deinterlace_parity::tff ? "tff" : params.parity == deinterlace_parity::bff ? "bff" : "auto";
+
+	if(params.mode == deinterlace_mode::bwdif)
+		return (boost::format("bwdif=mode=%1%:parity=%2%") % (params.field_rate ? 1 : 0) % parity).str();
+
+	return (boost::format("yadif=mode=%1%:parity=%2%") % ((params.field_rate ? 1 : 0) | (params.spatial_check ? 0 : 2)) % parity).str();
+}
+
+struct deinterlacer::implementation : boost::noncopyable
+{
+	const deinterlacer_params							params_;
+
+	std::shared_ptr<AVFrame>							prev_;
+	std::shared_ptr<AVFrame>							cur_;
+	std::shared_ptr<AVFrame>							next_;
+	std::queue<std::shared_ptr<AVFrame>>				output_;
+	int													parity_votes_;
+
+	int													pool_format_;
+	int													pool_width_;
+	int													pool_height_;
+	int													pool_linesizes_[4];
+	std::vector<std::shared_ptr<AVBufferPool>>			pools_;
+
+	implementation(const deinterlacer_params& params)
+		: params_(params)
+		, parity_votes_(0)
+		, pool_format_(AV_PIX_FMT_NONE)
+		, pool_width_(0)
+		, pool_height_(0)
+	{
+	}
+
+	void push(const std::shared_ptr<AVFrame>& frame)
+	{
+		prev_ = cur_;
+		cur_  = next_;
+		next_ = frame;
+
+		// The first frame is its own previous frame.
+		if(!cur_)
+			cur_ = next_;
+
+		if(!prev_)
+			return;
+
+		const int tff = is_top_field_first() ? 1 : 0;
+
+		output_.push(filter(tff ^ 1, tff, false));
+
+		if(params_.field_rate)
+			output_.push(filter(tff, tff, true));
+	}
+
+	std::shared_ptr<AVFrame> poll()
+	{
+		if(output_.empty())
+			return nullptr;
+
+		auto frame = output_.front();
+		output_.pop();
+		return frame;
+	}
+
+	void clear()
+	{
+		prev_.reset();
+		cur_.reset();
+		next_.reset();
+		output_ = std::queue<std::shared_ptr<AVFrame>>();
+		parity_votes_ = 0;
+	}
+
+	bool is_top_field_first()
+	{
+		switch(params_.parity)
+		{
+		case deinterlace_parity::tff:		return true;
+		case deinterlace_parity::bff:		return false;
+		case deinterlace_parity::detect:	return detect_top_field_first();
+		default:							return !cur_->interlaced_frame || cur_->top_field_first;
+		}
+	}
+
+	// Fields next to each other in time are more alike than fields a frame apart. For top field
+	// first the top field of the current frame follows the bottom field of the previous frame.
+	bool detect_top_field_first()
+	{
+		const auto desc	= av_pix_fmt_desc_get(static_cast<AVPixelFormat>(cur_->format));
+		const bool is16	= desc->comp[0].depth > 8;
+		const int w		= cur_->width;
+		const int h		= cur_->height;
+
+		auto sample = [is16](const uint8_t* line, int x)
+		{
+			return is16 ? reinterpret_cast<const uint16_t*>(line)[x] : line[x];
+		};
+
+		int64_t tff_score = 0;
+		int64_t bff_score = 0;
+
+		if(prev_ != cur_)
+		{
+			for(int y = 0; y + 1 < h; y += 8)
+			{
+				const uint8_t* cur_top		= cur_->data[0]  + y*cur_->linesize[0];
+				const uint8_t* cur_bottom	= cur_top + cur_->linesize[0];
+				const uint8_t* prev_top		= prev_->data[0] + y*prev_->linesize[0];
+				const uint8_t* prev_bottom	= prev_top + prev_->linesize[0];
+
+				for(int x = 0; x < w; ++x)
+				{
+					tff_score += std::abs(sample(cur_top, x)	- sample(prev_bottom, x));
+					bff_score += std::abs(sample(cur_bottom, x)	- sample(prev_top, x));
+				}
+			}
+		}
+
+		if(tff_score * 5 < bff_score * 4)
+			parity_votes_ = std::min(parity_votes_ + 1, 8);
+		else if(bff_score * 5 < tff_score * 4)
+			parity_votes_ = std::max(parity_votes_ - 1, -8);
+
+		if(parity_votes_ == 0)
+			return !cur_->interlaced_frame || cur_->top_field_first;
+
+		return parity_votes_ > 0;
+	}
+
+	std::shared_ptr<AVFrame> filter(int parity, int tff, bool is_second)
+	{
+		auto frame = alloc_frame(*cur_);
+
+		FF(av_frame_copy_props(frame.get(), cur_.get()));
+		av_buffer_unref(&frame->opaque_ref);
+		frame->interlaced_frame = 0;
+
+		// The time base is halved, as libavfilter does.
+		if(!is_second)
+			frame->pts = cur_->pts != AV_NOPTS_VALUE ? cur_->pts * 2 : AV_NOPTS_VALUE;
+		else
+			frame->pts = cur_->pts != AV_NOPTS_VALUE && next_->pts != AV_NOPTS_VALUE ? cur_->pts + next_->pts : AV_NOPTS_VALUE;
+
+		const auto desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(cur_->format));
+
+		for(int n = 0; n < av_pix_fmt_count_planes(static_cast<AVPixelFormat>(cur_->format)); ++n)
+		{
+			detail::plane_args args;
+			args.prev			= prev_->data[n];
+			args.cur			= cur_->data[n];
+			args.next			= next_->data[n];
+			args.dst			= frame->data[n];
+			args.src_linesize	= cur_->linesize[n];
+			args.dst_linesize	= frame->linesize[n];
+			args.width			= n == 1 || n == 2 ? -((-cur_->width)  >> desc->log2_chroma_w) : cur_->width;
+			args.height			= n == 1 || n == 2 ? -((-cur_->height) >> desc->log2_chroma_h) : cur_->height;
+			args.depth			= desc->comp[n].depth;
+
+			if(prev_->linesize[n] != args.src_linesize || next_->linesize[n] != args.src_linesize)
+				BOOST_THROW_EXCEPTION(invalid_argument() << msg_info("[deinterlacer] Frames with different line sizes."));
+
+			const bool bwdif = params_.mode == deinterlace_mode::bwdif;
+
+			if(args.depth > 8)
+				detail::filter_plane<uint16_t>(args, bwdif, params_.spatial_check, parity, tff);
+			else
+				detail::filter_plane<uint8_t>(args, bwdif, params_.spatial_check, parity, tff);
+		}
+
+		return frame;
+	}
+
+	// Output frames are taken from pools since each frame would otherwise be a new, page faulting, allocation.
+	std::shared_ptr<AVFrame> alloc_frame(const AVFrame& source)
+	{
+		if(pool_format_ != source.format || pool_width_ != source.width || pool_height_ != source.height)
+		{
+			pools_.clear();
+
+			const auto pix_fmt = static_cast<AVPixelFormat>(source.format);
+			FF(av_image_fill_linesizes(pool_linesizes_, pix_fmt, FFALIGN(source.width, 32)));
+
+			const auto desc = av_pix_fmt_desc_get(pix_fmt);
+			for(int n = 0; n < av_pix_fmt_count_planes(pix_fmt); ++n)
+			{
+				pool_linesizes_[n]	= FFALIGN(pool_linesizes_[n], 32);
+				const int height	= n == 1 || n == 2 ? -((-source.height) >> desc->log2_chroma_h) : source.height;
+				pools_.push_back(std::shared_ptr<AVBufferPool>(av_buffer_pool_init(pool_linesizes_[n] * height + 32, nullptr), [](AVBufferPool* p)
+				{
+					av_buffer_pool_uninit(&p);
+				}));
+			}
+
+			pool_format_	= source.format;
+			pool_width_		= source.width;
+			pool_height_	= source.height;
+		}
+
+		auto frame = create_frame();
+		frame->format	= source.format;
+		frame->width	= source.width;
+		frame->height	= source.height;
+
+		for(int n = 0; n < static_cast<int>(pools_.size()); ++n)
+		{
+			frame->buf[n] = av_buffer_pool_get(pools_[n].get());
+			if(!frame->buf[n])
+				BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("[deinterlacer] Failed to allocate frame."));
+
+			frame->data[n]		= frame->buf[n]->data;
+			frame->linesize[n]	= pool_linesizes_[n];
+		}
+		frame->extended_data = frame->data;
+
+		return frame;
+	}
+};
+
+deinterlacer::deinterlacer(const deinterlacer_params& params) : impl_(new implementation(params)){}
+void deinterlacer::push(const std::shared_ptr<AVFrame>& frame){impl_->push(frame);}
+std::shared_ptr<AVFrame> deinterlacer::poll(){return impl_->poll();}
+void deinterlacer::clear(){impl_->clear();}
+
+bool deinterlacer::is_supported(AVPixelFormat pix_fmt)
+{
+	const auto desc = av_pix_fmt_desc_get(pix_fmt);
+	if(!desc || !(desc->flags & AV_PIX_FMT_FLAG_PLANAR) || (desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BE)))
+		return false;
+
+	if(av_pix_fmt_count_planes(pix_fmt) != desc->nb_components)
+		return false;
+
+	for(int n = 0; n < desc->nb_components; ++n)
+	{
+		const int df = (desc->comp[n].depth + 7) / 8;
+		if(desc->comp[n].plane != n || desc->comp[n].shift != 0 || desc->comp[n].step != df || df > 2)
+			return false;
+	}
+
+	return true;
+}
+
+}}
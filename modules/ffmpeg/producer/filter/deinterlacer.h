@@ -0,0 +1,91 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+#pragma once
+
+#include <common/memory/safe_ptr.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <memory>
+#include <string>
+
+struct AVFrame;
+enum AVPixelFormat;
+
+namespace caspar { namespace ffmpeg {
+
+struct deinterlace_mode
+{
+	enum type
+	{
+		yadif = 0,
+		bwdif
+	};
+};
+
+struct deinterlace_parity
+{
+	enum type
+	{
+		automatic = 0,	// From the frame flags, top field first if the frame is not flagged.
+		tff,
+		bff,
+		detect			// Measured from the fields, for material with missing or wrong flags.
+	};
+};
+
+struct deinterlacer_params
+{
+	deinterlace_mode::type		mode;
+	deinterlace_parity::type	parity;
+	bool						field_rate;		// One frame per field instead of one per frame.
+	bool						spatial_check;	// yadif only.
+
+	deinterlacer_params();
+};
+
+// Parses a "deinterlace[=option=value[:option=value...]]" filter with the options
+// mode=yadif|bwdif, rate=frame|field, parity=auto|tff|bff|detect and spatial=0|1.
+// Returns false if the filter is not a deinterlace filter.
+bool parse_deinterlacer(const std::string& filter, deinterlacer_params& params);
+
+// The equivalent libavfilter filter, used where the deinterlacer can not run.
+std::string get_libavfilter_deinterlacer(const deinterlacer_params& params);
+
+// yadif and bwdif, producing the same output as the libavfilter filters. Planes
+// are split into slices which are filtered in parallel.
+class deinterlacer : boost::noncopyable
+{
+public:
+	explicit deinterlacer(const deinterlacer_params& params);
+
+	static bool is_supported(AVPixelFormat pix_fmt);
+
+	void push(const std::shared_ptr<AVFrame>& frame);
+	std::shared_ptr<AVFrame> poll();
+	void clear();
+private:
+	struct implementation;
+	safe_ptr<implementation> impl_;
+};
+
+}}
@@ -0,0 +1,347 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+#pragma once
+
+#include <tbb/parallel_for.h>
+
+#include <intrin.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// The line and plane kernels of the deinterlacer, in a header of their own so that
+// test/deinterlacer can check them against the libavfilter reference.
+
+namespace caspar { namespace ffmpeg { namespace detail {
+
+// Rows filtered by each task, the prev, cur, next and destination rows of a slice should fit in l2.
+const int SLICE_BYTES = 256 * 1024;
+
+struct line_refs
+{
+	int prefs;	// Offsets in samples to the lines below and above.
+	int mrefs;
+	int parity;	// 1 if the lines of the field to keep are in cur, 0 if they are in prev and next.
+};
+
+// yadif, following vf_yadif.c.
+
+template<typename T>
+void yadif_line_c(T* dst, const T* prev, const T* cur, const T* next, int begin, int end, int w, const line_refs& refs, bool spatial_check)
+{
+	const T* prev2 = refs.parity ? prev : cur;
+	const T* next2 = refs.parity ? cur  : next;
+	const int prefs = refs.prefs;
+	const int mrefs = refs.mrefs;
+
+	for(int x = begin; x < end; ++x)
+	{
+		const int c = cur[x + mrefs];
+		const int d = (prev2[x] + next2[x]) >> 1;
+		const int e = cur[x + prefs];
+		const int temporal_diff0 = std::abs(prev2[x] - next2[x]);
+		const int temporal_diff1 = (std::abs(prev[x + mrefs] - c) + std::abs(prev[x + prefs] - e)) >> 1;
+		const int temporal_diff2 = (std::abs(next[x + mrefs] - c) + std::abs(next[x + prefs] - e)) >> 1;
+		int diff = std::max(std::max(temporal_diff0 >> 1, temporal_diff1), temporal_diff2);
+		int spatial_pred = (c + e) >> 1;
+
+		if(x >= 3 && x < w - 3)
+		{
+			int spatial_score = std::abs(cur[x + mrefs - 1] - cur[x + prefs - 1]) + std::abs(c - e) + std::abs(cur[x + mrefs + 1] - cur[x + prefs + 1]) - 1;
+
+			for(int dir = -1; dir <= 1; dir += 2)
+			{
+				for(int j = dir; j == dir || j == 2*dir; j += dir)
+				{
+					const int score = std::abs(cur[x + mrefs - 1 + j] - cur[x + prefs - 1 - j])
+									+ std::abs(cur[x + mrefs     + j] - cur[x + prefs     - j])
+									+ std::abs(cur[x + mrefs + 1 + j] - cur[x + prefs + 1 - j]);
+					if(score >= spatial_score)
+						break;
+
+					spatial_score	= score;
+					spatial_pred	= (cur[x + mrefs + j] + cur[x + prefs - j]) >> 1;
+				}
+			}
+		}
+
+		if(spatial_check)
+		{
+			const int b = (prev2[x + 2*mrefs] + next2[x + 2*mrefs]) >> 1;
+			const int f = (prev2[x + 2*prefs] + next2[x + 2*prefs]) >> 1;
+			const int max = std::max(std::max(d - e, d - c), std::min(b - c, f - e));
+			const int min = std::min(std::min(d - e, d - c), std::max(b - c, f - e));
+
+			diff = std::max(std::max(diff, min), -max);
+		}
+
+		if(spatial_pred > d + diff)
+			spatial_pred = d + diff;
+		else if(spatial_pred < d - diff)
+			spatial_pred = d - diff;
+
+		dst[x] = static_cast<T>(spatial_pred);
+	}
+}
+
+inline __m128i load8(const uint8_t* src)
+{
+	return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)), _mm_setzero_si128());
+}
+
+inline __m128i abs_diff16(__m128i a, __m128i b)
+{
+	const auto diff = _mm_sub_epi16(a, b);
+	return _mm_max_epi16(diff, _mm_sub_epi16(_mm_setzero_si128(), diff));
+}
+
+inline __m128i select16(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// Same as yadif_line_c for 8 bit samples, 8 samples at a time. x must be within [3, w - 3).
+inline void yadif_line_sse2(uint8_t* dst, const uint8_t* prev, const uint8_t* cur, const uint8_t* next, int begin, int end, int w, const line_refs& refs, bool spatial_check)
+{
+	const uint8_t* prev2 = refs.parity ? prev : cur;
+	const uint8_t* next2 = refs.parity ? cur  : next;
+	const int prefs = refs.prefs;
+	const int mrefs = refs.mrefs;
+
+	int x = begin;
+	for(; x + 8 <= end; x += 8)
+	{
+		__m128i above[7];
+		__m128i below[7];
+		for(int n = 0; n < 7; ++n)
+		{
+			above[n] = load8(cur + x + mrefs + n - 3);
+			below[n] = load8(cur + x + prefs + n - 3);
+		}
+
+		const auto c  = above[3];
+		const auto e  = below[3];
+		const auto p2 = load8(prev2 + x);
+		const auto n2 = load8(next2 + x);
+		const auto d  = _mm_srli_epi16(_mm_add_epi16(p2, n2), 1);
+
+		const auto temporal_diff0 = abs_diff16(p2, n2);
+		const auto temporal_diff1 = _mm_srli_epi16(_mm_add_epi16(abs_diff16(load8(prev + x + mrefs), c), abs_diff16(load8(prev + x + prefs), e)), 1);
+		const auto temporal_diff2 = _mm_srli_epi16(_mm_add_epi16(abs_diff16(load8(next + x + mrefs), c), abs_diff16(load8(next + x + prefs), e)), 1);
+		auto diff = _mm_max_epi16(_mm_max_epi16(_mm_srli_epi16(temporal_diff0, 1), temporal_diff1), temporal_diff2);
+
+		auto spatial_pred	= _mm_srli_epi16(_mm_add_epi16(c, e), 1);
+		auto spatial_score	= _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(abs_diff16(above[2], below[2]), abs_diff16(c, e)), abs_diff16(above[4], below[4])), _mm_set1_epi16(1));
+
+		for(int dir = -1; dir <= 1; dir += 2)
+		{
+			auto improved = _mm_cmpeq_epi16(c, c);
+			for(int j = dir; j == dir || j == 2*dir; j += dir)
+			{
+				const auto score = _mm_add_epi16(_mm_add_epi16(
+					abs_diff16(above[3 + j - 1], below[3 - j - 1]),
+					abs_diff16(above[3 + j],     below[3 - j])),
+					abs_diff16(above[3 + j + 1], below[3 - j + 1]));
+
+				improved		= _mm_and_si128(improved, _mm_cmplt_epi16(score, spatial_score));
+				spatial_score	= select16(improved, score, spatial_score);
+				spatial_pred	= select16(improved, _mm_srli_epi16(_mm_add_epi16(above[3 + j], below[3 - j]), 1), spatial_pred);
+			}
+		}
+
+		if(spatial_check)
+		{
+			const auto b	= _mm_srli_epi16(_mm_add_epi16(load8(prev2 + x + 2*mrefs), load8(next2 + x + 2*mrefs)), 1);
+			const auto f	= _mm_srli_epi16(_mm_add_epi16(load8(prev2 + x + 2*prefs), load8(next2 + x + 2*prefs)), 1);
+			const auto dc	= _mm_sub_epi16(d, c);
+			const auto de	= _mm_sub_epi16(d, e);
+			const auto bc	= _mm_sub_epi16(b, c);
+			const auto fe	= _mm_sub_epi16(f, e);
+			const auto max	= _mm_max_epi16(_mm_max_epi16(de, dc), _mm_min_epi16(bc, fe));
+			const auto min	= _mm_min_epi16(_mm_min_epi16(de, dc), _mm_max_epi16(bc, fe));
+
+			diff = _mm_max_epi16(_mm_max_epi16(diff, min), _mm_sub_epi16(_mm_setzero_si128(), max));
+		}
+
+		spatial_pred = _mm_min_epi16(_mm_max_epi16(spatial_pred, _mm_sub_epi16(d, diff)), _mm_add_epi16(d, diff));
+
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(spatial_pred, spatial_pred));
+	}
+
+	yadif_line_c(dst, prev, cur, next, x, end, w, refs, spatial_check);
+}
+
+template<typename T>
+void yadif_line(T* dst, const T* prev, const T* cur, const T* next, int w, const line_refs& refs, bool spatial_check)
+{
+	yadif_line_c(dst, prev, cur, next, 0, w, w, refs, spatial_check);
+}
+
+inline void yadif_line(uint8_t* dst, const uint8_t* prev, const uint8_t* cur, const uint8_t* next, int w, const line_refs& refs, bool spatial_check)
+{
+	yadif_line_c(dst, prev, cur, next, 0, std::min(3, w), w, refs, spatial_check);
+	if(w > 6)
+		yadif_line_sse2(dst, prev, cur, next, 3, w - 3, w, refs, spatial_check);
+	yadif_line_c(dst, prev, cur, next, std::max(3, w - 3), w, w, refs, spatial_check);
+}
+
+// bwdif, following vf_bwdif.c.
+
+const int coef_lf[2] = {4309, 213};
+const int coef_hf[3] = {5570, 3801, 1016};
+const int coef_sp[2] = {5077, 981};
+
+// Lines closer than 4 lines to the top or bottom are edge lines, these only use the closest lines.
+template<typename T>
+void bwdif_line(T* dst, const T* prev, const T* cur, const T* next, int w, const line_refs& refs, int refs1, bool is_edge, bool spatial_check, int clip_max)
+{
+	const T* prev2 = refs.parity ? prev : cur;
+	const T* next2 = refs.parity ? cur  : next;
+	const int prefs  = refs.prefs;
+	const int mrefs  = refs.mrefs;
+	const int prefs2 = 2*refs1;
+	const int mrefs2 = -2*refs1;
+	const int prefs3 = 3*refs1;
+	const int mrefs3 = -3*refs1;
+	const int prefs4 = 4*refs1;
+	const int mrefs4 = -4*refs1;
+
+	for(int x = 0; x < w; ++x)
+	{
+		const int c = cur[x + mrefs];
+		const int d = (prev2[x] + next2[x]) >> 1;
+		const int e = cur[x + prefs];
+		const int temporal_diff0 = std::abs(prev2[x] - next2[x]);
+		const int temporal_diff1 = (std::abs(prev[x + mrefs] - c) + std::abs(prev[x + prefs] - e)) >> 1;
+		const int temporal_diff2 = (std::abs(next[x + mrefs] - c) + std::abs(next[x + prefs] - e)) >> 1;
+		int diff = std::max(std::max(temporal_diff0 >> 1, temporal_diff1), temporal_diff2);
+
+		if(!diff)
+		{
+			dst[x] = static_cast<T>(d);
+			continue;
+		}
+
+		if(spatial_check)
+		{
+			const int b  = ((prev2[x + mrefs2] + next2[x + mrefs2]) >> 1) - c;
+			const int f  = ((prev2[x + prefs2] + next2[x + prefs2]) >> 1) - e;
+			const int dc = d - c;
+			const int de = d - e;
+			const int max = std::max(std::max(de, dc), std::min(b, f));
+			const int min = std::min(std::min(de, dc), std::max(b, f));
+
+			diff = std::max(std::max(diff, min), -max);
+		}
+
+		int interpol;
+		if(is_edge)
+			interpol = (c + e) >> 1;
+		else if(std::abs(c - e) > temporal_diff0)
+		{
+			interpol = (((coef_hf[0] * (prev2[x] + next2[x])
+				- coef_hf[1] * (prev2[x + mrefs2] + next2[x + mrefs2] + prev2[x + prefs2] + next2[x + prefs2])
+				+ coef_hf[2] * (prev2[x + mrefs4] + next2[x + mrefs4] + prev2[x + prefs4] + next2[x + prefs4])) >> 2)
+				+ coef_lf[0] * (c + e) - coef_lf[1] * (cur[x + mrefs3] + cur[x + prefs3])) >> 13;
+		}
+		else
+			interpol = (coef_sp[0] * (c + e) - coef_sp[1] * (cur[x + mrefs3] + cur[x + prefs3])) >> 13;
+
+		if(interpol > d + diff)
+			interpol = d + diff;
+		else if(interpol < d - diff)
+			interpol = d - diff;
+
+		dst[x] = static_cast<T>(std::min(std::max(interpol, 0), clip_max));
+	}
+}
+
+struct plane_args
+{
+	const uint8_t*	prev;
+	const uint8_t*	cur;
+	const uint8_t*	next;
+	uint8_t*		dst;
+	int				src_linesize;
+	int				dst_linesize;
+	int				width;
+	int				height;
+	int				depth;
+};
+
+template<typename T>
+void filter_plane(const plane_args& args, bool bwdif, bool spatial_check, int parity, int tff)
+{
+	const int refs		= args.src_linesize / static_cast<int>(sizeof(T));
+	const int bytes		= args.width * static_cast<int>(sizeof(T));
+	const int h			= args.height;
+	const int grain		= std::max(8, SLICE_BYTES / std::max(1, 4 * args.src_linesize));
+	const int clip_max	= (1 << args.depth) - 1;
+	const int df		= static_cast<int>(sizeof(T));
+
+	tbb::parallel_for(tbb::blocked_range<int>(0, h, grain), [&](const tbb::blocked_range<int>& r)
+	{
+		for(int y = r.begin(); y < r.end(); ++y)
+		{
+			auto dst = args.dst + y*args.dst_linesize;
+			auto cur = args.cur + y*args.src_linesize;
+
+			if(!((y ^ parity) & 1))
+			{
+				std::memcpy(dst, cur, bytes);
+				continue;
+			}
+
+			auto prev = args.prev + y*args.src_linesize;
+			auto next = args.next + y*args.src_linesize;
+
+			line_refs line;
+			line.parity = parity ^ tff;
+
+			if(!bwdif)
+			{
+				line.prefs = y + 1 < h ? refs : -refs;
+				line.mrefs = y ? -refs : refs;
+
+				const bool check = spatial_check && y != 1 && y + 2 != h;
+
+				yadif_line(reinterpret_cast<T*>(dst), reinterpret_cast<const T*>(prev), reinterpret_cast<const T*>(cur), reinterpret_cast<const T*>(next), args.width, line, check);
+			}
+			else
+			{
+				// The edge line offsets compare y with the sample size, as libavfilter does.
+				const bool is_edge = y < 4 || y + 5 > h;
+				line.prefs = is_edge ? ((y + df) < h ? refs : -refs) : refs;
+				line.mrefs = is_edge ? (y > df - 1 ? -refs : refs) : -refs;
+
+				const bool check = !is_edge || !(y < 2 || y + 3 > h);
+
+				bwdif_line(reinterpret_cast<T*>(dst), reinterpret_cast<const T*>(prev), reinterpret_cast<const T*>(cur), reinterpret_cast<const T*>(next), args.width, line, refs, is_edge, check, clip_max);
+			}
+		}
+	});
+}
+
+
+}}}
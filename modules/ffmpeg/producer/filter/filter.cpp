@@ -23,7 +23,7 @@
 
 #include "filter.h"
 
-//#include "parallel_yadif.h"
+#include "deinterlacer.h"
 
 #include "../../ffmpeg_error.h"
 #include "../util/util.h"
@@ -66,6 +66,47 @@ extern "C"
 
 namespace caspar { namespace ffmpeg {
 
+namespace {
+
+// Splits a filter chain at the commas which are not quoted, escaped or within brackets.
+std::vector<std::string> split_filters(const std::string& filtergraph)
+{
+	std::vector<std::string> filters;
+	std::string current;
+	bool escaped	= false;
+	bool quoted		= false;
+	int brackets	= 0;
+
+	BOOST_FOREACH(char c, filtergraph)
+	{
+		if(escaped)
+			escaped = false;
+		else if(c == '\\')
+			escaped = true;
+		else if(c == '\'')
+			quoted = !quoted;
+		else if(!quoted && c == '[')
+			++brackets;
+		else if(!quoted && c == ']')
+			--brackets;
+		else if(!quoted && brackets == 0 && c == ',')
+		{
+			filters.push_back(current);
+			current.clear();
+			continue;
+		}
+
+		current += c;
+	}
+
+	if(!current.empty())
+		filters.push_back(current);
+
+	return filters;
+}
+
+}
+
 struct filter::implementation
 {
 	std::string						filtergraph_;
@@ -81,6 +122,9 @@ struct filter::implementation
 	const AVRational		in_sample_aspect_ratio_;
 	std::queue<std::shared_ptr<AVFrame>>	fast_path_;
 	std::shared_ptr<AVFrame> last_frame_;
+	std::shared_ptr<deinterlacer>	deinterlacer_;
+	AVRational						graph_time_base_;
+	AVRational						graph_frame_rate_;
 
 	implementation(
 		int in_width,
@@ -100,10 +144,18 @@ struct filter::implementation
 		, in_frame_rate_(in_frame_rate)
 		, in_sample_aspect_ratio_(in_sample_aspect_ratio)
 		, out_pix_fmts_(out_pix_fmts)
+		, graph_time_base_(in_time_base)
+		, graph_frame_rate_(in_frame_rate)
 	{
 		if(out_pix_fmts_.empty())
 		{
 			out_pix_fmts_ = boost::assign::list_of
+				(AV_PIX_FMT_YUVA444P10)
+				(AV_PIX_FMT_YUVA422P10)
+				(AV_PIX_FMT_YUVA420P10)
+				(AV_PIX_FMT_YUV444P10)
+				(AV_PIX_FMT_YUV422P10)
+				(AV_PIX_FMT_YUV420P10)
 				(AV_PIX_FMT_YUVA420P)
 				(AV_PIX_FMT_YUV444P)
 				(AV_PIX_FMT_YUV422P)
@@ -117,8 +169,39 @@ struct filter::implementation
 		}		
 		out_pix_fmts_.push_back(AV_PIX_FMT_NONE);
 
+		configure_deinterlacer();
 		configure_filtergraph();
 	}
+
+	// A deinterlace filter first in the chain is run by the deinterlacer, the rest of the chain
+	// by libavfilter. Other deinterlace filters are replaced by their libavfilter equivalents.
+	void configure_deinterlacer()
+	{
+		auto filters = split_filters(filtergraph_);
+		if(filters.empty())
+			return;
+
+		deinterlacer_params params;
+		if(parse_deinterlacer(filters.front(), params) && deinterlacer::is_supported(in_pix_format_))
+		{
+			deinterlacer_.reset(new deinterlacer(params));
+			filters.erase(filters.begin());
+
+			graph_time_base_ = av_mul_q(in_time_base_, av_make_q(1, 2));
+			if(params.field_rate)
+				graph_frame_rate_ = av_mul_q(in_frame_rate_, av_make_q(2, 1));
+
+			CASPAR_LOG(trace) << L"Deinterlacer configured: " << (params.mode == deinterlace_mode::bwdif ? L"bwdif" : L"yadif") << (params.field_rate ? L" field rate" : L" frame rate");
+		}
+
+		BOOST_FOREACH(auto& element, filters)
+		{
+			if(parse_deinterlacer(element, params))
+				element = get_libavfilter_deinterlacer(params);
+		}
+
+		filtergraph_ = boost::join(filters, ",");
+	}
 	void configure_filtergraph()
 	{
 		if (filtergraph_.empty())
@@ -137,7 +220,7 @@ struct filter::implementation
 		const auto vsrc_options = (boost::format("video_size=%1%x%2%:pix_fmt=%3%:time_base=%4%/%5%:pixel_aspect=%6%/%7%")
 			% in_width_ % in_height_
 			% in_pix_format_
-			% in_time_base_.num % in_time_base_.den
+			% graph_time_base_.num % graph_time_base_.den
 			% in_sample_aspect_ratio_.num % in_sample_aspect_ratio_.den).str();
 
 		AVFilterContext* filt_vsrc = nullptr;			
@@ -251,11 +334,41 @@ struct filter::implementation
 		return filtergraph_.empty();
 	}
 
+	bool is_passthrough() const
+	{
+		return fast_path() && !deinterlacer_;
+	}
+
 	void push(const std::shared_ptr<AVFrame>& frame)
 	{	
 		if (frame->format == AV_PIX_FMT_NONE)
 			return;
 		last_frame_ = frame;
+		push_filtered(frame);
+	}
+
+	void flush()
+	{
+		if (!last_frame_ || is_passthrough())
+			return;
+		push_filtered(last_frame_);
+	}
+
+	void push_filtered(const std::shared_ptr<AVFrame>& frame)
+	{
+		if (!deinterlacer_)
+		{
+			push_graph(frame);
+			return;
+		}
+
+		deinterlacer_->push(frame);
+		for (auto deinterlaced = deinterlacer_->poll(); deinterlaced; deinterlaced = deinterlacer_->poll())
+			push_graph(deinterlaced);
+	}
+
+	void push_graph(const std::shared_ptr<AVFrame>& frame)
+	{
 		if (fast_path())
 			fast_path_.push(frame);
 		else
@@ -264,15 +377,6 @@ struct filter::implementation
 				frame.get(), AV_BUFFERSRC_FLAG_KEEP_REF));
 	}
 
-	void flush()
-	{
-		if (!last_frame_ || fast_path())
-			return;
-		FF(av_buffersrc_add_frame_flags(
-			video_graph_in_,
-			last_frame_.get(), AV_BUFFERSRC_FLAG_KEEP_REF));
-	}
-
 	std::shared_ptr<AVFrame> poll()
 	{
 		if (fast_path())
@@ -302,6 +406,8 @@ struct filter::implementation
 	void clear()
 	{
 		last_frame_.reset();
+		if (deinterlacer_)
+			deinterlacer_->clear();
 		configure_filtergraph();
 	}
 
@@ -328,7 +434,7 @@ struct filter::implementation
 	AVRational out_frame_rate()
 	{
 		if (fast_path())
-			return in_frame_rate_;
+			return graph_frame_rate_;
 		AVRational frame_rate = av_buffersink_get_frame_rate(video_graph_out_);
 		if (frame_rate.num != 0)
 			return frame_rate;
@@ -337,7 +443,7 @@ struct filter::implementation
 
 	AVRational out_time_base()
 	{
-		return fast_path() ? in_time_base_ : av_buffersink_get_time_base(video_graph_out_);
+		return fast_path() ? graph_time_base_ : av_buffersink_get_time_base(video_graph_out_);
 	}
 
 	AVRational out_sample_aspect_ratio()
@@ -381,6 +487,7 @@ std::shared_ptr<AVFrame>& filter::last_input_frame() const { return impl_->last_
 void filter::clear() { impl_->clear(); }
 void filter::flush() { impl_->flush(); }
 bool filter::is_frame_format_changed(const std::shared_ptr<AVFrame>& frame) { return impl_->is_frame_format_changed(frame);}
+bool filter::is_passthrough() const { return impl_->is_passthrough(); }
 int filter::out_width() { return impl_->out_width(); }
 int filter::out_height() { return impl_->out_height(); }
 AVPixelFormat filter::out_pixel_format() { return impl_->out_pixel_format(); }
@@ -62,6 +62,7 @@ public:
 	std::shared_ptr<AVFrame>& last_input_frame() const;
 	void clear();
 	bool is_frame_format_changed(const std::shared_ptr<AVFrame>& frame);
+	bool is_passthrough() const;
 	int out_width();
 	int out_height();
 	AVPixelFormat out_pixel_format();
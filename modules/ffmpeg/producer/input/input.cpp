@@ -37,16 +37,18 @@
 #include <common/exception/exceptions.h>
 #include <common/exception/win32_exception.h>
 
-#include <tbb/concurrent_queue.h>
 #include <tbb/atomic.h>
 #include <tbb/recursive_mutex.h>
 
+#include <boost/foreach.hpp>
 #include <boost/rational.hpp>
 #include <boost/range/algorithm.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/thread.hpp>
 
+#include <deque>
+
 #if defined(_MSC_VER)
 #pragma warning (push)
 #pragma warning (disable : 4244)
@@ -61,10 +63,117 @@ extern "C"
 #pragma warning (pop)
 #endif
 
-static const size_t MAX_BUFFER_COUNT    = 500;
-static const size_t MIN_BUFFER_COUNT    = 50;
+// Packet queues are limited by size in bytes, sized from the stream bit rate. Reading stops once a queue
+// reaches its high watermark and resumes when all of them have drained below their low watermarks, or
+// when one of them is empty.
+static const size_t MIN_LOW_WATERMARK			= 64 * 1024;
+static const size_t MIN_HIGH_WATERMARK			= 256 * 1024;
+static const size_t HARD_LIMIT_FACTOR			= 8;
+static const int	ESTIMATE_PACKETS			= 50;	// Packets measured when neither the stream nor the container has a bit rate.
+static const size_t DEFAULT_VIDEO_BYTES_PER_SEC	= 4 * 1024 * 1024;
+static const size_t DEFAULT_AUDIO_BYTES_PER_SEC	= 256 * 1024;
 
 namespace caspar { namespace ffmpeg {
+
+class packet_queue : boost::noncopyable
+{
+	boost::mutex							mutex_;
+	boost::condition_variable				cond_;
+	std::deque<std::shared_ptr<AVPacket>>	packets_;
+	tbb::atomic<size_t>						bytes_;
+	tbb::atomic<size_t>						low_watermark_;
+	tbb::atomic<size_t>						high_watermark_;
+	bool									is_starved_;
+	double									packets_per_second_;	// Non zero while the rate is estimated.
+	int64_t									estimate_bytes_;
+	int										estimate_packets_;
+public:
+	packet_queue()
+		: is_starved_(false)
+		, packets_per_second_(0.0)
+		, estimate_bytes_(0)
+		, estimate_packets_(0)
+	{
+		bytes_			= 0;
+		low_watermark_	= MIN_LOW_WATERMARK;
+		high_watermark_	= MIN_HIGH_WATERMARK;
+	}
+
+	void set_bytes_per_second(size_t bytes_per_second)
+	{
+		low_watermark_	= std::max(MIN_LOW_WATERMARK, bytes_per_second / 2);
+		high_watermark_	= std::max(MIN_HIGH_WATERMARK, bytes_per_second * 2);
+	}
+
+	// Uses default_bytes_per_second until the first ESTIMATE_PACKETS packets have been pushed, then their
+	// average size times packets_per_second.
+	void estimate_bytes_per_second(double packets_per_second, size_t default_bytes_per_second)
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		set_bytes_per_second(default_bytes_per_second);
+		packets_per_second_	= packets_per_second;
+		estimate_bytes_		= 0;
+		estimate_packets_	= 0;
+	}
+
+	void push(const std::shared_ptr<AVPacket>& packet)
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		packets_.push_back(packet);
+		bytes_ += packet->size;
+		is_starved_ = false;
+		if(packets_per_second_ > 0.0)
+		{
+			estimate_bytes_ += packet->size;
+			if(++estimate_packets_ == ESTIMATE_PACKETS)
+			{
+				set_bytes_per_second(static_cast<size_t>(static_cast<double>(estimate_bytes_) / estimate_packets_ * packets_per_second_));
+				packets_per_second_ = 0.0;
+			}
+		}
+		cond_.notify_one();
+	}
+
+	// Waits at most timeout for a packet. Once a pop has timed out the following pops return at once
+	// until a packet has been pushed, so that a starved input delays the decoder at most once.
+	bool try_pop(std::shared_ptr<AVPacket>& packet, const boost::posix_time::time_duration& timeout, const tbb::atomic<bool>& is_eof)
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		if(packets_.empty() && !is_starved_ && !is_eof)
+		{
+			if(!cond_.timed_wait(lock, timeout, [&]{return !packets_.empty() || is_eof;}))
+				is_starved_ = true;
+		}
+
+		if(packets_.empty())
+			return false;
+
+		packet = packets_.front();
+		packets_.pop_front();
+		bytes_ -= packet->size;
+		return true;
+	}
+
+	void clear()
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		packets_.clear();
+		bytes_ = 0;
+		is_starved_ = false;
+	}
+
+	void wake()
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		cond_.notify_all();
+	}
+
+	size_t bytes() const			{ return bytes_; }
+	size_t low_watermark() const	{ return low_watermark_; }
+	size_t high_watermark() const	{ return high_watermark_; }
+	double fill() const				{ return (static_cast<double>(bytes_) + 0.001) / high_watermark_; }
+};
 		
 struct input::implementation : boost::noncopyable
 {		
@@ -73,30 +182,35 @@ struct input::implementation : boost::noncopyable
 	const safe_ptr<AVFormatContext>								format_context_; // Destroy this last
 			
 	const std::wstring											filename_;
+	const boost::posix_time::time_duration						pop_timeout_;
 	tbb::atomic<bool>											is_eof_;
+	tbb::atomic<bool>											is_reading_;
+	mutable tbb::atomic<bool>									is_full_; // Set once a queue reaches its high watermark.
 	tbb::atomic<int>											video_stream_index_;
 	tbb::atomic<int>											audio_stream_index_;
-	tbb::concurrent_bounded_queue<std::shared_ptr<AVPacket>>	audio_buffer_;
-	tbb::concurrent_bounded_queue<std::shared_ptr<AVPacket>>	video_buffer_;
+	packet_queue												audio_buffer_;
+	packet_queue												video_buffer_;
 	executor													executor_;
 
 
 	
 	explicit implementation(const safe_ptr<diagnostics::graph> graph, 
-		const std::wstring& filename
+		const std::wstring& filename,
+		const core::video_format_desc& format_desc
 		)
 		: graph_(graph)
 		, filename_(filename)
 		, format_context_(open_input(filename))
+		, pop_timeout_(boost::posix_time::microseconds(static_cast<int64_t>(250000.0 / format_desc.fps))) // A quarter of a frame.
 		, executor_(print())
 	{
 		is_eof_			= false;
-		video_buffer_.set_capacity(MAX_BUFFER_COUNT);
-		audio_buffer_.set_capacity(MAX_BUFFER_COUNT);
+		is_reading_		= false;
+		is_full_		= false;
 		video_stream_index_ = -1;
 		audio_stream_index_ = -1;
-		graph_->set_color("audio-buffer-count", diagnostics::color(0.7f, 0.4f, 0.4f));
-		graph_->set_color("video-buffer-count", diagnostics::color(1.0f, 1.0f, 0.0f));
+		graph_->set_color("audio-buffer", diagnostics::color(0.7f, 0.4f, 0.4f));
+		graph_->set_color("video-buffer", diagnostics::color(1.0f, 1.0f, 0.0f));
 	}
 
 	safe_ptr<AVCodecContext> open_audio_codec(AVStream** stream)
@@ -104,6 +218,8 @@ struct input::implementation : boost::noncopyable
 		AVCodec* decoder;
 		int index = THROW_ON_ERROR2(av_find_best_stream(format_context_.get(), AVMEDIA_TYPE_AUDIO, -1, -1, &decoder, 0), print());
 		THROW_ON_ERROR2(avcodec_open2(format_context_->streams[index]->codec, decoder, NULL), print());
+		const auto codec = format_context_->streams[index]->codec;
+		set_bytes_per_second(audio_buffer_, codec->bit_rate, codec->frame_size > 0 ? static_cast<double>(codec->sample_rate) / codec->frame_size : 0.0, DEFAULT_AUDIO_BYTES_PER_SEC);
 		audio_stream_index_ = index;
 		*stream = format_context_->streams[index];
 		return safe_ptr<AVCodecContext>(format_context_->streams[index]->codec, avcodec_close);
@@ -119,49 +235,38 @@ struct input::implementation : boost::noncopyable
 			format_context_->streams[index]->codec->thread_count = 1;
 			THROW_ON_ERROR2(avcodec_open2(format_context_->streams[index]->codec, decoder, NULL), print());
 		}
+		// The container's bit rate includes the other streams, the video stream is most of it.
+		const auto video_stream = format_context_->streams[index];
+		const auto bit_rate = video_stream->codec->bit_rate > 0 ? video_stream->codec->bit_rate : format_context_->bit_rate;
+		set_bytes_per_second(video_buffer_, bit_rate, video_stream->r_frame_rate.den > 0 ? av_q2d(video_stream->r_frame_rate) : 0.0, DEFAULT_VIDEO_BYTES_PER_SEC);
 		video_stream_index_ = index;
 		*stream = format_context_->streams[index]; 
 		return safe_ptr<AVCodecContext>(format_context_->streams[index]->codec, avcodec_close);
 	}
 
+	// The default is only used when there is neither a bit rate nor a packet rate to estimate one from.
+	static void set_bytes_per_second(packet_queue& queue, int64_t bit_rate, double packets_per_second, size_t default_bytes_per_second)
+	{
+		if(bit_rate > 0)
+			queue.set_bytes_per_second(static_cast<size_t>(bit_rate / 8));
+		else if(packets_per_second > 0.0)
+			queue.estimate_bytes_per_second(packets_per_second, default_bytes_per_second);
+		else
+			queue.set_bytes_per_second(default_bytes_per_second);
+	}
+
 	void try_pop_audio(std::shared_ptr<AVPacket>& packet)
 	{	
-		bool result = false;
-		for (int i = 0; i < 32 && !result; ++i)
-		{
-			result = audio_buffer_.try_pop(packet);
-			if (!result)
-				if (is_eof_)
-					return;
-				else
-				{
-					boost::this_thread::sleep(boost::posix_time::milliseconds(10));
-					result = audio_buffer_.try_pop(packet);
-				}
-		}
-		if(result)
+		if(audio_buffer_.try_pop(packet, pop_timeout_, is_eof_))
 			tick();
-		graph_->set_value("audio-buffer-count", (static_cast<double>(audio_buffer_.size())+0.001)/MAX_BUFFER_COUNT);
+		graph_->set_value("audio-buffer", audio_buffer_.fill());
 	}
 
 	void try_pop_video(std::shared_ptr<AVPacket>& packet)
 	{
-		bool result = false;
-		for (int i = 0; i < 32 && !result; ++i)
-		{
-			result = video_buffer_.try_pop(packet);
-			if (!result)
-				if (is_eof_)
-					return;
-				else
-				{
-					boost::this_thread::sleep(boost::posix_time::milliseconds(10));
-					result = video_buffer_.try_pop(packet);
-				}
-		}
-		if(result)
+		if(video_buffer_.try_pop(packet, pop_timeout_, is_eof_))
 			tick();
-		graph_->set_value("video-buffer-count", (static_cast<double>(video_buffer_.size()) + 0.001)/MAX_BUFFER_COUNT);
+		graph_->set_value("video-buffer", video_buffer_.fill());
 	}
 
 	std::wstring print() const
@@ -169,10 +274,32 @@ struct input::implementation : boost::noncopyable
 		return L"ffmpeg_input[" + filename_ + L")]";
 	}
 	
-	bool full() const
+	bool should_read() const
 	{
-		return (audio_stream_index_ == -1 || audio_buffer_.size() > MIN_BUFFER_COUNT)
-			&& (video_stream_index_ == -1 || video_buffer_.size() > MIN_BUFFER_COUNT);
+		bool is_any_empty = false;
+		bool is_all_below_low = true;
+		bool is_all_below_high = true;
+
+		const packet_queue* queues[] = {video_stream_index_ != -1 ? &video_buffer_ : nullptr, audio_stream_index_ != -1 ? &audio_buffer_ : nullptr};
+		BOOST_FOREACH(auto queue, queues)
+		{
+			if(!queue)
+				continue;
+
+			if(queue->bytes() >= queue->high_watermark() * HARD_LIMIT_FACTOR) // Back-pressure, badly interleaved files will starve the other stream.
+				return false;
+
+			is_any_empty		|= queue->bytes() == 0;
+			is_all_below_low	&= queue->bytes() < queue->low_watermark();
+			is_all_below_high	&= queue->bytes() < queue->high_watermark();
+		}
+
+		if(!is_all_below_high)
+			is_full_ = true;
+		else if(is_all_below_low)
+			is_full_ = false;
+
+		return is_any_empty || !is_full_;
 	}
 
 	bool is_eof() const
@@ -182,54 +309,58 @@ struct input::implementation : boost::noncopyable
 
 	void tick()
 	{	
-		if(is_eof_)
+		if(is_eof_ || !should_read() || is_reading_.compare_and_swap(true, false))
 			return;
-		executor_.begin_invoke([this]
+
+		executor_.post([this]
 		{			
-			while (!is_eof_ && !full())
+			while (!is_eof_ && should_read())
 			{
 				try
 				{
-					auto packet = create_packet();
-					auto ret = av_read_frame(format_context_.get(), packet.get()); 
-					is_eof_ = ret == AVERROR(EIO) || ret == AVERROR_EOF;
-					if (is_eof_)
-						CASPAR_LOG(trace) << print() << " Reached EOF.";
-					else
-					{
-						THROW_ON_ERROR(ret, "av_read_frame", print());
-						if (packet->stream_index == video_stream_index_ && packet->size > 0)
-						{
-							THROW_ON_ERROR2(av_dup_packet(packet.get()), print());
-							if (!video_buffer_.try_push(packet))
-							{
-								video_buffer_.clear();
-								video_buffer_.push(packet);
-								CASPAR_LOG(warning) << print() << " Video packet queue cleared due to overflow.";
-							}
-							graph_->set_value("video-buffer-count", (static_cast<double>(video_buffer_.size()) + 0.001) / MAX_BUFFER_COUNT);
-						}
-						if (packet->stream_index == audio_stream_index_ && packet->size > 0)
-						{
-							THROW_ON_ERROR2(av_dup_packet(packet.get()), print());
-							if (!audio_buffer_.try_push(packet))
-							{
-								audio_buffer_.clear();
-								audio_buffer_.push(packet);
-								CASPAR_LOG(warning) << print() << " Audio packet queue cleared due to overflow.";
-							}
-							graph_->set_value("audio-buffer-count", (static_cast<double>(audio_buffer_.size()) + 0.001) / MAX_BUFFER_COUNT);
-						}
-					}
+					read_packet();
 				}
 				catch (...)
 				{
 					CASPAR_LOG_CURRENT_EXCEPTION();
 				}
 			}
+
+			is_reading_ = false;
+
+			if (!is_eof_ && should_read()) // A queue may have been drained after the last check.
+				tick();
 		});
 	}	
 
+	void read_packet()
+	{
+		auto packet = create_packet();
+		auto ret = av_read_frame(format_context_.get(), packet.get()); 
+		if (ret == AVERROR(EIO) || ret == AVERROR_EOF)
+		{
+			CASPAR_LOG(trace) << print() << " Reached EOF.";
+			is_eof_ = true;
+			video_buffer_.wake();
+			audio_buffer_.wake();
+			return;
+		}
+
+		THROW_ON_ERROR(ret, "av_read_frame", print());
+		if (packet->stream_index == video_stream_index_ && packet->size > 0)
+		{
+			THROW_ON_ERROR2(av_dup_packet(packet.get()), print());
+			video_buffer_.push(packet);
+			graph_->set_value("video-buffer", video_buffer_.fill());
+		}
+		if (packet->stream_index == audio_stream_index_ && packet->size > 0)
+		{
+			THROW_ON_ERROR2(av_dup_packet(packet.get()), print());
+			audio_buffer_.push(packet);
+			graph_->set_value("audio-buffer", audio_buffer_.fill());
+		}
+	}
+
 	safe_ptr<AVFormatContext> open_input(const std::wstring resource_name)
 	{
 		AVFormatContext* weak_context = nullptr;
@@ -246,8 +377,8 @@ struct input::implementation : boost::noncopyable
 			audio_buffer_.clear();
 			video_buffer_.clear();
 			LOG_ON_ERROR2(avformat_flush(format_context_.get()), "FFMpeg input avformat_flush");
-			graph_->set_value("audio-buffer-count", (static_cast<double>(audio_buffer_.size()) + 0.001) / MAX_BUFFER_COUNT);
-			graph_->set_value("video-buffer-count", (static_cast<double>(video_buffer_.size()) + 0.001) / MAX_BUFFER_COUNT);
+			graph_->set_value("audio-buffer", audio_buffer_.fill());
+			graph_->set_value("video-buffer", video_buffer_.fill());
 			CASPAR_LOG(trace) << print() << " Seeking: " << target_time / 1000 << " ms";
 			is_eof_ = false;
 			int ret = av_seek_frame(format_context_.get(), -1, target_time - AV_TIME_BASE, AVSEEK_FLAG_BACKWARD);
@@ -259,8 +390,8 @@ struct input::implementation : boost::noncopyable
 	}
 };
 
-input::input(const safe_ptr<diagnostics::graph> graph, const std::wstring& filename)
-	: impl_(new implementation(graph, filename)){}
+input::input(const safe_ptr<diagnostics::graph> graph, const std::wstring& filename, const core::video_format_desc& format_desc)
+	: impl_(new implementation(graph, filename, format_desc)){}
 bool input::eof() const { return impl_->is_eof(); }
 void input::try_pop_audio(std::shared_ptr<AVPacket>& packet) { impl_->try_pop_audio(packet); }
 void input::try_pop_video(std::shared_ptr<AVPacket>& packet) { impl_->try_pop_video(packet); }
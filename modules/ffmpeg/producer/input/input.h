@@ -39,6 +39,12 @@ namespace diagnostics {
 
 class graph;
 
+}
+
+namespace core {
+
+struct video_format_desc;
+
 }
 	 
 namespace ffmpeg {
@@ -46,7 +52,7 @@ namespace ffmpeg {
 class input
 {
 public:
-	explicit input(const safe_ptr<diagnostics::graph> graph, const std::wstring& filename);
+	explicit input(const safe_ptr<diagnostics::graph> graph, const std::wstring& filename, const core::video_format_desc& format_desc);
 	safe_ptr<AVCodecContext> open_audio_codec(AVStream** stream);
 	safe_ptr<AVCodecContext> open_video_codec(AVStream** stream);
 
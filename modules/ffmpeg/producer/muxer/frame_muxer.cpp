@@ -22,6 +22,7 @@
 #include "../../StdAfx.h"
 
 #include "frame_muxer.h"
+#include "sample_fifo.h"
 
 #include "../filter/filter.h"
 #include "../util/util.h"
@@ -53,6 +54,7 @@ extern "C"
 #pragma warning (pop)
 #endif
 
+#include <boost/circular_buffer.hpp>
 #include <boost/foreach.hpp>
 #include <boost/range/algorithm_ext/push_back.hpp>
 #include <boost/algorithm/string/predicate.hpp>
@@ -66,11 +68,24 @@ using namespace caspar::core;
 
 namespace caspar { namespace ffmpeg {
 
+namespace {
+
+const size_t MAX_BUFFERED_FRAMES = 32;
+
+typedef boost::circular_buffer<safe_ptr<write_frame>> video_stream;
+
+video_stream create_video_stream()
+{
+	return video_stream(MAX_BUFFERED_FRAMES * 2);
+}
+
+}
+
 struct frame_muxer::implementation : boost::noncopyable
 {	
-	std::queue<std::queue<safe_ptr<write_frame>>>	video_streams_;
-	std::queue<core::audio_buffer>					audio_streams_;
-	std::queue<safe_ptr<basic_frame>>				frame_buffer_;
+	std::queue<video_stream>						video_streams_;
+	std::queue<sample_fifo>							audio_streams_;
+	boost::circular_buffer<safe_ptr<basic_frame>>	frame_buffer_;
 	const boost::rational<int>						in_fps_;
 	const boost::rational<int>						in_timebase_;
 	const video_format_desc							format_desc_;
@@ -103,9 +118,10 @@ struct frame_muxer::implementation : boost::noncopyable
 		, filter_str_(filter_str)
 		, force_deinterlacing_(false)
 		, audio_channel_layout_(audio_channel_layout)
+		, frame_buffer_(2)
 	{
-		video_streams_.push(std::queue<safe_ptr<write_frame>>());
-		audio_streams_.push(core::audio_buffer());
+		video_streams_.push(create_video_stream());
+		audio_streams_.push(sample_fifo());
 		// Note: Uses 1 step rotated cadence for 1001 modes (1602, 1602, 1601, 1602, 1601)
 		// This cadence fills the audio mixer most optimally.
 		boost::range::rotate(audio_cadence_, std::end(audio_cadence_)-1);
@@ -127,12 +143,12 @@ struct frame_muxer::implementation : boost::noncopyable
 				
 		if (video_frame == flush_video())
 		{	
-			video_streams_.push(std::queue<safe_ptr<write_frame>>());
+			video_streams_.push(create_video_stream());
 			CASPAR_LOG(trace) << "Muxer::push flush video";
 		}
 		else if(video_frame == empty_video())
 		{
-			video_streams_.back().push(make_safe<core::write_frame>(this, audio_channel_layout_));
+			video_streams_.back().push_back(make_safe<core::write_frame>(this, audio_channel_layout_));
 		}
 		else
 		{
@@ -159,11 +175,11 @@ struct frame_muxer::implementation : boost::noncopyable
 			{
 				if(video_frame->format == AV_PIX_FMT_GRAY8 && video_frame->format == CASPAR_PIX_FMT_LUMA)
 					av_frame->format = video_frame->format;
-				video_streams_.back().push(make_write_frame(this, av_frame, frame_factory_, hints, audio_channel_layout_));
+				video_streams_.back().push_back(make_write_frame(this, av_frame, frame_factory_, hints, audio_channel_layout_, filter_->is_passthrough()));
 			}
 		}
 
-		if(video_streams_.back().size() > 32)
+		if(video_streams_.back().size() > MAX_BUFFERED_FRAMES)
 			BOOST_THROW_EXCEPTION(invalid_operation() << source_info("frame_muxer") << msg_info("video-stream overflow. This can be caused by incorrect frame-rate. Check clip meta-data."));
 	}
 
@@ -174,18 +190,18 @@ struct frame_muxer::implementation : boost::noncopyable
 
 		if(audio == flush_audio())
 		{
-			audio_streams_.push(core::audio_buffer());
+			audio_streams_.push(sample_fifo());
 		}
 		else if(audio == empty_audio())
 		{
-			boost::range::push_back(audio_streams_.back(), core::audio_buffer(audio_cadence_.front() * audio_channel_layout_.num_channels, 0));
+			audio_streams_.back().push_silence(audio_cadence_.front() * audio_channel_layout_.num_channels);
 		}
 		else
 		{
-			boost::range::push_back(audio_streams_.back(), *audio);
+			audio_streams_.back().push(audio->begin(), audio->end());
 		}
 
-		if(audio_streams_.back().size() > 32*audio_cadence_.front() * audio_channel_layout_.num_channels)
+		if(audio_streams_.back().size() > MAX_BUFFERED_FRAMES*audio_cadence_.front() * audio_channel_layout_.num_channels)
 			BOOST_THROW_EXCEPTION(invalid_operation() << source_info("frame_muxer") << msg_info("audio-stream overflow. This can be caused by incorrect frame-rate. Check clip meta-data."));
 	}
 	
@@ -214,7 +230,7 @@ struct frame_muxer::implementation : boost::noncopyable
 		if (!frame_buffer_.empty())
 		{
 			auto frame = frame_buffer_.front();
-			frame_buffer_.pop();
+			frame_buffer_.pop_front();
 			return frame;
 		}
 
@@ -231,31 +247,23 @@ struct frame_muxer::implementation : boost::noncopyable
 			return nullptr;
 
 		auto frame1 = pop_video();
-		frame1->audio_data() = pop_audio();
-		frame_buffer_.push(frame1);
+		pop_audio(frame1->audio_data());
+		frame_buffer_.push_back(frame1);
 		return frame_buffer_.empty() ? nullptr : poll();
 	}
 	
 	safe_ptr<core::write_frame> pop_video()
 	{
 		auto frame = video_streams_.front().front();
-		video_streams_.front().pop();		
+		video_streams_.front().pop_front();		
 		return frame;
 	}
 
-	core::audio_buffer pop_audio()
+	void pop_audio(core::audio_buffer& samples)
 	{
-		CASPAR_VERIFY(audio_streams_.front().size() >= audio_cadence_.front() * audio_channel_layout_.num_channels);
-
-		auto begin = audio_streams_.front().begin();
-		auto end   = begin + (audio_cadence_.front() * audio_channel_layout_.num_channels);
-
-		core::audio_buffer samples(begin, end);
-		audio_streams_.front().erase(begin, end);
+		audio_streams_.front().pop(audio_cadence_.front() * audio_channel_layout_.num_channels, samples);
 		
 		boost::range::rotate(audio_cadence_, std::begin(audio_cadence_)+1);
-
-		return samples;
 	}
 				
 	void update_filter(const std::shared_ptr<AVFrame>& frame, bool force_deinterlace)
@@ -272,7 +280,7 @@ struct frame_muxer::implementation : boost::noncopyable
 		}
 
 		if (force_deinterlace)
-			filter_str = append_filter(filter_str, "yadif");
+			filter_str = append_filter(filter_str, "deinterlace");
 
 		if (filter_str_.empty())
 		{
@@ -282,7 +290,7 @@ struct frame_muxer::implementation : boost::noncopyable
 			{
 				if (frame_mode != field_mode::progressive)
 				{
-					filter_str = append_filter(filter_str, "bwdif");
+					filter_str = append_filter(filter_str, "deinterlace=mode=bwdif:rate=field");
 					filtered_fps *= 2;
 				}
 				filter_str = append_filter(filter_str, (boost::format("scale=w=%1%:h=%2%") % format_desc_.width % format_desc_.height).str());
@@ -307,10 +315,10 @@ struct frame_muxer::implementation : boost::noncopyable
 				else if (frame_mode != field_mode::progressive && format_desc_.field_mode == field_mode::progressive)
 				{
 					if (format_fps == filtered_fps || format_fps * 2 == filtered_fps)
-						filter_str = append_filter(filter_str, "yadif");
+						filter_str = append_filter(filter_str, "deinterlace");
 					else
 					{
-						filter_str = append_filter(filter_str, "yadif=mode=1");
+						filter_str = append_filter(filter_str, "deinterlace=rate=field");
 						filtered_fps *= 2;
 					}
 				}
@@ -319,10 +327,10 @@ struct frame_muxer::implementation : boost::noncopyable
 				if (frame_mode != field_mode::progressive && format_desc_.field_mode == field_mode::progressive)
 				{
 					if (format_fps == filtered_fps || format_fps * 2 == filtered_fps)
-						filter_str = append_filter(filter_str, "yadif");
+						filter_str = append_filter(filter_str, "deinterlace");
 					else
 					{
-						filter_str = append_filter(filter_str, "yadif=mode=1");
+						filter_str = append_filter(filter_str, "deinterlace=rate=field");
 						filtered_fps *= 2;
 					}
 				}
@@ -349,17 +357,15 @@ struct frame_muxer::implementation : boost::noncopyable
 	
 	void clear()
 	{
-		while(!video_streams_.empty())
+		while(video_streams_.size() > 1)
 			video_streams_.pop();
-		audio_streams_.back().clear();
-		while (!audio_streams_.empty())
-			audio_streams_.pop();	
-		while(!frame_buffer_.empty())
-			frame_buffer_.pop();
+		video_streams_.front().clear();
+		while(audio_streams_.size() > 1)
+			audio_streams_.pop();
+		audio_streams_.front().clear();
+		frame_buffer_.clear();
 		if (filter_)
 			filter_->clear();
-		video_streams_.push(std::queue<safe_ptr<write_frame>>());
-		audio_streams_.push(core::audio_buffer());
 	}
 
 	void flush()
@@ -370,7 +376,7 @@ struct frame_muxer::implementation : boost::noncopyable
 		{
 			if (frame->format == AV_PIX_FMT_GRAY8 && frame->format == CASPAR_PIX_FMT_LUMA)
 				av_frame->format = frame->format;
-			video_streams_.back().push(make_write_frame(this, av_frame, frame_factory_, 0, audio_channel_layout_));
+			video_streams_.back().push_back(make_write_frame(this, av_frame, frame_factory_, 0, audio_channel_layout_));
 		}
 		push(empty_audio());
 	}
@@ -390,5 +396,6 @@ void frame_muxer::clear(){return impl_->clear();}
 std::shared_ptr<basic_frame> frame_muxer::poll(){return impl_->poll();}
 bool frame_muxer::video_ready() const{return impl_->video_ready();}
 bool frame_muxer::audio_ready() const{return impl_->audio_ready();}
+const void* frame_muxer::tag() const{return impl_.get();}
 
 }}
\ No newline at end of file
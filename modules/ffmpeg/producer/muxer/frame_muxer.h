@@ -62,6 +62,8 @@ public:
 
 	bool video_ready() const;
 	bool audio_ready() const;
+
+	const void* tag() const; // Tag of the write_frames created by the muxer.
 	
 	std::shared_ptr<core::basic_frame> poll();
 
@@ -0,0 +1,97 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+#pragma once
+
+#include <common/utility/assert.h>
+
+#include <core/mixer/audio/audio_mixer.h>
+
+namespace caspar { namespace ffmpeg {
+
+// Audio samples of one stream. Samples are consumed by advancing a read
+// offset, the remainder is moved to the front only once more than half of
+// the buffer has been consumed. The buffer keeps its capacity when cleared.
+//
+// In a header of its own so that test/frame_muxer can measure it.
+class sample_fifo
+{
+	core::audio_buffer	samples_;
+	size_t				offset_;
+public:
+	sample_fifo()
+		: offset_(0)
+	{
+	}
+
+	size_t size() const
+	{
+		return samples_.size() - offset_;
+	}
+
+	bool empty() const
+	{
+		return size() == 0;
+	}
+
+	template<typename It>
+	void push(It begin, It end)
+	{
+		compact();
+		samples_.insert(samples_.end(), begin, end);
+	}
+
+	void push_silence(size_t count)
+	{
+		compact();
+		samples_.resize(samples_.size() + count, 0);
+	}
+
+	// Copies into dest, which only allocates if dest has less capacity than count.
+	void pop(size_t count, core::audio_buffer& dest)
+	{
+		CASPAR_VERIFY(size() >= count);
+
+		auto begin = samples_.begin() + offset_;
+		dest.assign(begin, begin + count);
+		offset_ += count;
+
+		if(offset_ == samples_.size())
+			clear();
+	}
+
+	void clear()
+	{
+		samples_.clear();
+		offset_ = 0;
+	}
+private:
+	void compact()
+	{
+		if(offset_ == 0 || offset_ < samples_.size() / 2)
+			return;
+
+		samples_.erase(samples_.begin(), samples_.begin() + offset_);
+		offset_ = 0;
+	}
+};
+
+}}
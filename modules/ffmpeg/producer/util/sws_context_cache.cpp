@@ -0,0 +1,299 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+#include "../../stdafx.h"
+
+#include "sws_context_cache.h"
+
+#include <common/diagnostics/graph.h>
+#include <common/env.h>
+#include <common/exception/exceptions.h>
+#include <common/log/log.h>
+
+#include <boost/thread/tss.hpp>
+
+#include <tbb/atomic.h>
+#include <tbb/mutex.h>
+
+#include <algorithm>
+#include <list>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning (push)
+#pragma warning (disable : 4244)
+#endif
+extern "C"
+{
+	#include <libswscale/swscale.h>
+}
+#if defined(_MSC_VER)
+#pragma warning (pop)
+#endif
+
+namespace caspar { namespace ffmpeg {
+
+sws_context_key::sws_context_key(int src_width, int src_height, AVPixelFormat src_format, int dst_width, int dst_height, AVPixelFormat dst_format, int flags)
+	: src_width(src_width)
+	, src_height(src_height)
+	, src_format(src_format)
+	, dst_width(dst_width)
+	, dst_height(dst_height)
+	, dst_format(dst_format)
+	, flags(flags)
+{
+}
+
+bool sws_context_key::operator==(const sws_context_key& other) const
+{
+	return src_width	== other.src_width
+		&& src_height	== other.src_height
+		&& src_format	== other.src_format
+		&& dst_width	== other.dst_width
+		&& dst_height	== other.dst_height
+		&& dst_format	== other.dst_format
+		&& flags		== other.flags;
+}
+
+namespace {
+
+struct cache_entry
+{
+	sws_context_key				key;
+	std::shared_ptr<SwsContext>	context;
+
+	cache_entry(const sws_context_key& key, const std::shared_ptr<SwsContext>& context)
+		: key(key)
+		, context(context)
+	{
+	}
+};
+
+tbb::atomic<std::uint64_t>	g_hits;
+tbb::atomic<std::uint64_t>	g_warm_hits;
+tbb::atomic<std::uint64_t>	g_misses;
+tbb::atomic<std::uint64_t>	g_evictions;
+tbb::atomic<int>			g_contexts;
+
+tbb::mutex									g_mutex;
+std::shared_ptr<diagnostics::graph>			g_graph;	// Declared before g_shared, which frees contexts when it is destroyed.
+std::list<cache_entry>						g_shared;	// Most recently used first.
+std::size_t									g_shared_capacity;
+
+const std::uint64_t							HITS_PER_UPDATE = 256;
+
+std::size_t get_cache_size()
+{
+	return static_cast<std::size_t>(std::max(1, env::properties().get(L"configuration.ffmpeg.sws-cache-size", 8)));
+}
+
+void set_values() // Called with g_mutex held.
+{
+	if(!g_graph)
+		return;
+
+	const double lookups = static_cast<double>(g_hits + g_warm_hits + g_misses);
+
+	g_graph->set_value("contexts", std::min(1.0, g_contexts / 64.0));
+	g_graph->set_value("hit-ratio", lookups > 0.0 ? static_cast<double>(g_hits + g_warm_hits) / lookups : 1.0);
+}
+
+void update_values()
+{
+	tbb::mutex::scoped_lock lock(g_mutex);
+	set_values();
+}
+
+void set_tag(const std::string& tag) // Slow paths only.
+{
+	tbb::mutex::scoped_lock lock(g_mutex);
+
+	if(!g_graph)
+	{
+		g_graph.reset(new diagnostics::graph());
+		g_graph->set_text(L"sws-context-cache");
+		g_graph->set_name("sws-context-cache");
+		g_graph->set_color("contexts", diagnostics::color(0.8f, 0.8f, 0.1f));
+		g_graph->set_color("hit-ratio", diagnostics::color(0.3f, 0.6f, 1.0f));
+		g_graph->set_color("miss", diagnostics::color(0.9f, 0.3f, 0.3f));
+		g_graph->set_color("warm-hit", diagnostics::color(0.3f, 0.9f, 0.3f));
+		g_graph->set_color("evict", diagnostics::color(0.6f, 0.3f, 0.9f));
+		diagnostics::register_graph(make_safe_ptr(g_graph));
+	}
+
+	g_graph->set_tag(tag);
+	set_values();
+}
+
+std::shared_ptr<SwsContext> create_context(const sws_context_key& key)
+{
+	auto context = sws_getContext(key.src_width, key.src_height, key.src_format, key.dst_width, key.dst_height, key.dst_format, key.flags, nullptr, nullptr, nullptr);
+	if(!context)
+	{
+		BOOST_THROW_EXCEPTION(operation_failed() << msg_info("Could not create software scaling context.") <<
+								boost::errinfo_api_function("sws_getContext"));
+	}
+
+	++g_contexts;
+	++g_misses;
+	set_tag("miss");
+
+	CASPAR_LOG(trace) << L"Created new SWS context w=" << key.src_width << L", h=" << key.src_height << ", input pix_fmt=" << key.src_format << L", output pix_fmt=" << key.dst_format;
+
+	return std::shared_ptr<SwsContext>(context, [](SwsContext* context)
+	{
+		sws_freeContext(context);
+		--g_contexts;
+		update_values();
+	});
+}
+
+std::shared_ptr<SwsContext> take_shared(const sws_context_key& key)
+{
+	tbb::mutex::scoped_lock lock(g_mutex);
+
+	auto it = std::find_if(g_shared.begin(), g_shared.end(), [&](const cache_entry& entry){return entry.key == key;});
+	if(it == g_shared.end())
+		return nullptr;
+
+	auto context = it->context;
+	g_shared.erase(it);
+	return context;
+}
+
+void put_shared(const sws_context_key& key, const std::shared_ptr<SwsContext>& context)
+{
+	std::shared_ptr<SwsContext> evicted; // Freed outside of the lock.
+
+	{
+		tbb::mutex::scoped_lock lock(g_mutex);
+
+		if(g_shared_capacity == 0)
+			g_shared_capacity = get_cache_size();
+
+		g_shared.push_front(cache_entry(key, context));
+		if(g_shared.size() > g_shared_capacity)
+		{
+			evicted = g_shared.back().context;
+			g_shared.pop_back();
+		}
+	}
+
+	if(evicted)
+	{
+		++g_evictions;
+		set_tag("evict");
+	}
+}
+
+struct thread_cache
+{
+	const std::size_t			capacity;
+	std::vector<cache_entry>	entries; // Most recently used first.
+	int							warm_up_depth;
+
+	thread_cache()
+		: capacity(get_cache_size())
+		, warm_up_depth(0)
+	{
+	}
+};
+
+boost::thread_specific_ptr<thread_cache> g_thread_cache;
+
+thread_cache& get_thread_cache()
+{
+	if(!g_thread_cache.get())
+		g_thread_cache.reset(new thread_cache());
+	return *g_thread_cache;
+}
+
+}
+
+std::shared_ptr<SwsContext> get_sws_context(const sws_context_key& key)
+{
+	auto& cache = get_thread_cache();
+
+	if(cache.warm_up_depth > 0)
+	{
+		auto context = take_shared(key);
+		if(context)
+			++g_hits;
+		else
+			context = create_context(key);
+
+		return std::shared_ptr<SwsContext>(context.get(), [key, context](SwsContext*)
+		{
+			put_shared(key, context);
+		});
+	}
+
+	auto it = std::find_if(cache.entries.begin(), cache.entries.end(), [&](const cache_entry& entry){return entry.key == key;});
+	if(it != cache.entries.end())
+	{
+		std::rotate(cache.entries.begin(), it, it + 1);
+		if(++g_hits % HITS_PER_UPDATE == 0)
+			update_values();
+		return cache.entries.front().context;
+	}
+
+	auto context = take_shared(key);
+	if(context)
+	{
+		++g_warm_hits;
+		set_tag("warm-hit");
+	}
+	else
+		context = create_context(key);
+
+	cache.entries.insert(cache.entries.begin(), cache_entry(key, context));
+	if(cache.entries.size() > cache.capacity)
+	{
+		cache.entries.pop_back();
+		++g_evictions;
+		set_tag("evict");
+	}
+
+	return context;
+}
+
+sws_context_warm_up::sws_context_warm_up()
+{
+	++get_thread_cache().warm_up_depth;
+}
+
+sws_context_warm_up::~sws_context_warm_up()
+{
+	--get_thread_cache().warm_up_depth;
+}
+
+sws_context_cache_stats get_sws_context_cache_stats()
+{
+	sws_context_cache_stats stats;
+	stats.hits		= g_hits;
+	stats.warm_hits	= g_warm_hits;
+	stats.misses	= g_misses;
+	stats.evictions	= g_evictions;
+	stats.contexts	= g_contexts;
+	return stats;
+}
+
+}}
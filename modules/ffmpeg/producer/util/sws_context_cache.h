@@ -0,0 +1,76 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include <cstdint>
+#include <memory>
+
+struct SwsContext;
+enum AVPixelFormat;
+
+namespace caspar { namespace ffmpeg {
+
+struct sws_context_key
+{
+	int				src_width;
+	int				src_height;
+	AVPixelFormat	src_format;
+	int				dst_width;
+	int				dst_height;
+	AVPixelFormat	dst_format;
+	int				flags;
+
+	sws_context_key(int src_width, int src_height, AVPixelFormat src_format, int dst_width, int dst_height, AVPixelFormat dst_format, int flags);
+
+	bool operator==(const sws_context_key& other) const;
+};
+
+// Returns a scaling context from the calling thread's cache, creating it if it is not cached.
+// The context must only be used by the calling thread. Each thread keeps the most recently used
+// contexts, configuration.ffmpeg.sws-cache-size of them, and frees them when it exits.
+std::shared_ptr<SwsContext> get_sws_context(const sws_context_key& key);
+
+// While in scope, the contexts used by the calling thread are returned to a cache shared by all
+// threads. Producers decode their first frames while they are loaded, this lets the thread
+// which plays the producer take over the contexts instead of creating them on its first frame.
+class sws_context_warm_up : boost::noncopyable
+{
+public:
+	sws_context_warm_up();
+	~sws_context_warm_up();
+};
+
+struct sws_context_cache_stats
+{
+	std::uint64_t	hits;
+	std::uint64_t	warm_hits;	// Contexts taken from the shared cache.
+	std::uint64_t	misses;
+	std::uint64_t	evictions;
+	int				contexts;	// Currently allocated.
+};
+
+// Reported by INFO SYSTEM, the sws-context-cache diagnostics graph shows the hit ratio and the allocated contexts.
+sws_context_cache_stats get_sws_context_cache_stats();
+
+}}
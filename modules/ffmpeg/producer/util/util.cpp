@@ -24,11 +24,11 @@
 #include "util.h"
 
 #include "flv.h"
+#include "sws_context_cache.h"
 
 #include "../../ffmpeg_error.h"
 
-#include <tbb/concurrent_unordered_map.h>
-#include <tbb/concurrent_queue.h>
+#include <tbb/atomic.h>
 
 #include <core/producer/frame/frame_transform.h>
 #include <core/producer/frame/frame_factory.h>
@@ -123,6 +123,15 @@ core::pixel_format::type get_pixel_format(AVPixelFormat pix_fmt)
 	case AV_PIX_FMT_YUV411P:		return core::pixel_format::ycbcr;
 	case AV_PIX_FMT_YUV410P:		return core::pixel_format::ycbcr;
 	case AV_PIX_FMT_YUVA420P:		return core::pixel_format::ycbcra;
+	case AV_PIX_FMT_YUVJ444P:		return core::pixel_format::ycbcr;
+	case AV_PIX_FMT_YUVJ422P:		return core::pixel_format::ycbcr;
+	case AV_PIX_FMT_YUVJ420P:		return core::pixel_format::ycbcr;
+	case AV_PIX_FMT_YUV444P10:		return core::pixel_format::ycbcr10;
+	case AV_PIX_FMT_YUV422P10:		return core::pixel_format::ycbcr10;
+	case AV_PIX_FMT_YUV420P10:		return core::pixel_format::ycbcr10;
+	case AV_PIX_FMT_YUVA444P10:		return core::pixel_format::ycbcra10;
+	case AV_PIX_FMT_YUVA422P10:		return core::pixel_format::ycbcra10;
+	case AV_PIX_FMT_YUVA420P10:		return core::pixel_format::ycbcra10;
 	default:					return core::pixel_format::invalid;
 	}
 }
@@ -165,14 +174,51 @@ core::pixel_format_desc get_pixel_format_desc(AVPixelFormat pix_fmt, size_t widt
 
 			if(desc.pix_fmt == core::pixel_format::ycbcra)						
 				desc.planes.push_back(core::pixel_format_desc::plane(dummy_pict.linesize[3], height, 1));	
+
+			desc.full_range = pix_fmt == AV_PIX_FMT_YUVJ444P || pix_fmt == AV_PIX_FMT_YUVJ422P || pix_fmt == AV_PIX_FMT_YUVJ420P;
 			return desc;
 		}		
+	case core::pixel_format::ycbcr10:
+	case core::pixel_format::ycbcra10:
+		{
+			// 16 bit samples, uploaded as two 8 bit channels.
+			size_t size2 = dummy_pict.data[2] - dummy_pict.data[1];
+			size_t h2 = size2/dummy_pict.linesize[1];			
+
+			desc.planes.push_back(core::pixel_format_desc::plane(dummy_pict.linesize[0]/2, height, 2));
+			desc.planes.push_back(core::pixel_format_desc::plane(dummy_pict.linesize[1]/2, h2, 2));
+			desc.planes.push_back(core::pixel_format_desc::plane(dummy_pict.linesize[2]/2, h2, 2));
+
+			if(desc.pix_fmt == core::pixel_format::ycbcra10)						
+				desc.planes.push_back(core::pixel_format_desc::plane(dummy_pict.linesize[3]/2, height, 2));	
+			return desc;
+		}
 	default:		
 		desc.pix_fmt = core::pixel_format::invalid;
 		return desc;
 	}
 }
 
+namespace {
+
+void set_color_space(core::pixel_format_desc& desc, AVColorSpace color_space, AVColorRange color_range)
+{
+	switch(color_space)
+	{
+	case AVCOL_SPC_BT709:		desc.color_space = core::color_space::bt709;	break;
+	case AVCOL_SPC_BT470BG:
+	case AVCOL_SPC_SMPTE170M:	desc.color_space = core::color_space::bt601;	break;
+	case AVCOL_SPC_BT2020_NCL:
+	case AVCOL_SPC_BT2020_CL:	desc.color_space = core::color_space::bt2020;	break;
+	default:					break;
+	}
+
+	if(color_range == AVCOL_RANGE_JPEG)
+		desc.full_range = true;
+}
+
+}
+
 int make_alpha_format(int format)
 {
 	switch(get_pixel_format(static_cast<AVPixelFormat>(format)))
@@ -185,10 +231,204 @@ int make_alpha_format(int format)
 	}
 }
 
-safe_ptr<core::write_frame> make_write_frame(const void* tag, const safe_ptr<AVFrame>& decoded_frame, const safe_ptr<core::frame_factory>& frame_factory, int hints, const core::channel_layout& audio_channel_layout)
+struct direct_render_context : boost::noncopyable
+{
+	const void*							tag;
+	const safe_ptr<core::frame_factory>	frame_factory;
+	const core::channel_layout			audio_channel_layout;
+
+	direct_render_context(const void* tag, const safe_ptr<core::frame_factory>& frame_factory, const core::channel_layout& audio_channel_layout)
+		: tag(tag)
+		, frame_factory(frame_factory)
+		, audio_channel_layout(audio_channel_layout)
+	{
+	}
+};
+
+namespace {
+
+// Owned by the opaque_ref and the plane buffers of a decoded frame.
+struct direct_frame : boost::noncopyable
+{
+	const safe_ptr<core::write_frame>	frame;
+	std::vector<uint8_t*>				planes;
+	tbb::atomic<bool>					is_committed;
+
+	explicit direct_frame(const safe_ptr<core::write_frame>& frame)
+		: frame(frame)
+	{
+		for(int n = 0; n < static_cast<int>(frame->get_pixel_format_desc().planes.size()); ++n)
+			planes.push_back(frame->image_data(n).begin());
+		is_committed = false;
+	}
+};
+
+void free_direct_frame(void*, uint8_t* data)
+{
+	delete reinterpret_cast<direct_frame*>(data);
+}
+
+void free_direct_plane(void* opaque, uint8_t*)
+{
+	auto owner = static_cast<AVBufferRef*>(opaque);
+	av_buffer_unref(&owner);
+}
+
+// Returns the layout of a write_frame which the codec can decode into, pix_fmt is invalid if the codec
+// alignment requirements do not match the tightly packed planes the mixer expects.
+core::pixel_format_desc get_direct_pixel_format_desc(AVCodecContext& codec_context, const AVFrame& frame)
+{
+	const auto pix_fmt	= static_cast<AVPixelFormat>(frame.format);
+	auto desc			= get_pixel_format_desc(pix_fmt, codec_context.width, codec_context.height);
+
+	if(desc.pix_fmt == core::pixel_format::invalid)
+		return desc;
+
+	set_color_space(desc, codec_context.colorspace, codec_context.color_range);
+
+	// The codec writes whole macroblocks, the buffers need to cover the aligned dimensions.
+	int width	= std::max(frame.width, codec_context.width);
+	int height	= std::max(frame.height, codec_context.height);
+	int linesize_align[AV_NUM_DATA_POINTERS];
+	avcodec_align_dimensions2(&codec_context, &width, &height, linesize_align);
+
+	int aligned_linesizes[4];
+	if(av_image_fill_linesizes(aligned_linesizes, pix_fmt, width) < 0)
+	{
+		desc.pix_fmt = core::pixel_format::invalid;
+		return desc;
+	}
+
+	const auto pix_desc = av_pix_fmt_desc_get(pix_fmt);
+
+	for(int n = 0; n < static_cast<int>(desc.planes.size()); ++n)
+	{
+		auto& plane = desc.planes[n];
+
+		if(aligned_linesizes[n] > static_cast<int>(plane.linesize) || plane.linesize % linesize_align[n] != 0)
+		{
+			desc.pix_fmt = core::pixel_format::invalid;
+			return desc;
+		}
+
+		const int plane_height = n == 1 || n == 2 ? -((-height) >> pix_desc->log2_chroma_h) : height;
+
+		// Some of the simd code in ffmpeg reads past the end of the planes.
+		plane.size = std::max(plane.size, plane.linesize * static_cast<uint32_t>(plane_height) + 64);
+	}
+
+	return desc;
+}
+
+int get_direct_buffer(AVCodecContext* codec_context, AVFrame* frame, int flags)
+{
+	auto context = static_cast<direct_render_context*>(codec_context->opaque);
+
+	// Frames the codec keeps as references would be read after they have been committed.
+	if(!context || (flags & AV_GET_BUFFER_FLAG_REF))
+		return avcodec_default_get_buffer2(codec_context, frame, flags);
+
+	AVBufferRef* owner = nullptr;
+
+	try
+	{
+		const auto desc = get_direct_pixel_format_desc(*codec_context, *frame);
+		if(desc.pix_fmt == core::pixel_format::invalid)
+			return avcodec_default_get_buffer2(codec_context, frame, flags);
+
+		auto direct = new direct_frame(context->frame_factory->create_frame(context->tag, desc, context->audio_channel_layout));
+
+		owner = av_buffer_create(reinterpret_cast<uint8_t*>(direct), sizeof(direct_frame), free_direct_frame, nullptr, 0);
+		if(!owner)
+		{
+			delete direct;
+			return AVERROR(ENOMEM);
+		}
+
+		for(int n = 0; n < static_cast<int>(desc.planes.size()); ++n)
+		{
+			auto plane_owner = av_buffer_ref(owner);
+			frame->buf[n] = plane_owner ? av_buffer_create(direct->planes[n], desc.planes[n].size, free_direct_plane, plane_owner, 0) : nullptr;
+			if(!frame->buf[n])
+			{
+				av_buffer_unref(&plane_owner);
+				BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Failed to allocate direct frame buffer."));
+			}
+
+			frame->data[n]		= direct->planes[n];
+			frame->linesize[n]	= desc.planes[n].linesize;
+		}
+
+		frame->extended_data	= frame->data;
+		frame->opaque_ref		= owner;
+
+		return 0;
+	}
+	catch(...)
+	{
+		CASPAR_LOG_CURRENT_EXCEPTION();
+
+		for(int n = 0; n < AV_NUM_DATA_POINTERS; ++n)
+		{
+			av_buffer_unref(&frame->buf[n]);
+			frame->data[n]		= nullptr;
+			frame->linesize[n]	= 0;
+		}
+		av_buffer_unref(&owner);
+
+		return AVERROR(ENOMEM);
+	}
+}
+
+std::shared_ptr<core::write_frame> claim_direct_frame(const void* tag, const AVFrame& decoded_frame, const core::pixel_format_desc& desc)
+{
+	if(!decoded_frame.opaque_ref || decoded_frame.opaque_ref->size != sizeof(direct_frame))
+		return nullptr;
+
+	auto direct			= reinterpret_cast<direct_frame*>(decoded_frame.opaque_ref->data);
+	auto& frame_desc	= direct->frame->get_pixel_format_desc();
+
+	if(direct->frame->tag() != tag || frame_desc.pix_fmt != desc.pix_fmt || frame_desc.planes.size() != desc.planes.size())
+		return nullptr;
+
+	if(frame_desc.color_space != desc.color_space || frame_desc.full_range != desc.full_range)
+		return nullptr;
+
+	for(int n = 0; n < static_cast<int>(desc.planes.size()); ++n)
+	{
+		if(decoded_frame.data[n] != direct->planes[n] ||
+		   decoded_frame.linesize[n] != static_cast<int>(desc.planes[n].linesize) ||
+		   frame_desc.planes[n].linesize != desc.planes[n].linesize ||
+		   frame_desc.planes[n].height != desc.planes[n].height)
+			return nullptr;
+	}
+
+	if(!direct->is_committed.fetch_and_store(true))
+		direct->frame->commit();
+
+	return direct->frame;
+}
+
+}
+
+std::shared_ptr<direct_render_context> enable_direct_rendering(AVCodecContext& codec_context, const void* tag, const safe_ptr<core::frame_factory>& frame_factory, const core::channel_layout& audio_channel_layout)
+{
+	// Inter frame codecs keep reading their reference frames after they have been handed out.
+	const auto codec_desc = avcodec_descriptor_get(codec_context.codec_id);
+	if(!codec_context.codec || !(codec_context.codec->capabilities & AV_CODEC_CAP_DR1) || !codec_desc || !(codec_desc->props & AV_CODEC_PROP_INTRA_ONLY))
+		return nullptr;
+
+	auto context = std::make_shared<direct_render_context>(tag, frame_factory, audio_channel_layout);
+
+	codec_context.opaque				= context.get();
+	codec_context.get_buffer2			= get_direct_buffer;
+	codec_context.thread_safe_callbacks	= 1;
+
+	return context;
+}
+
+safe_ptr<core::write_frame> make_write_frame(const void* tag, const safe_ptr<AVFrame>& decoded_frame, const safe_ptr<core::frame_factory>& frame_factory, int hints, const core::channel_layout& audio_channel_layout, bool is_passthrough)
 {			
-	static tbb::concurrent_unordered_map<int64_t, tbb::concurrent_queue<std::shared_ptr<SwsContext>>> sws_contexts_;
-	
 	if(decoded_frame->width < 1 || decoded_frame->height < 1)
 		return make_safe<core::write_frame>(tag, audio_channel_layout);
 
@@ -199,9 +439,19 @@ safe_ptr<core::write_frame> make_write_frame(const void* tag, const safe_ptr<AVF
 	if(hints & core::frame_producer::ALPHA_HINT)
 		desc = get_pixel_format_desc(static_cast<AVPixelFormat>(make_alpha_format(decoded_frame->format)), width, height);
 
+	set_color_space(desc, decoded_frame->colorspace, decoded_frame->color_range);
+
 	std::shared_ptr<core::write_frame> write;
 
-	if(desc.pix_fmt == core::pixel_format::invalid)
+	if(is_passthrough && desc.pix_fmt != core::pixel_format::invalid)
+		write = claim_direct_frame(tag, *decoded_frame, desc);
+
+	if(write)
+	{
+		write->set_type(get_mode(*decoded_frame));
+		write->set_timecode(decoded_frame->display_picture_number);
+	}
+	else if(desc.pix_fmt == core::pixel_format::invalid)
 	{
 		auto pix_fmt = static_cast<AVPixelFormat>(decoded_frame->format);
 		auto target_pix_fmt = AV_PIX_FMT_BGRA;
@@ -212,42 +462,25 @@ safe_ptr<core::write_frame> make_write_frame(const void* tag, const safe_ptr<AVF
 			target_pix_fmt = AV_PIX_FMT_YUV422P;
 		else if(pix_fmt == AV_PIX_FMT_UYYVYY411)
 			target_pix_fmt = AV_PIX_FMT_YUV411P;
-		else if(pix_fmt == AV_PIX_FMT_YUV420P10)
-			target_pix_fmt = AV_PIX_FMT_YUV420P;
-		else if(pix_fmt == AV_PIX_FMT_YUV422P10)
-			target_pix_fmt = AV_PIX_FMT_YUV422P;
-		else if(pix_fmt == AV_PIX_FMT_YUV444P10)
-			target_pix_fmt = AV_PIX_FMT_YUV444P;
+		else if(pix_fmt == AV_PIX_FMT_YUV420P12 || pix_fmt == AV_PIX_FMT_YUV420P16)
+			target_pix_fmt = AV_PIX_FMT_YUV420P10;
+		else if(pix_fmt == AV_PIX_FMT_YUV422P12 || pix_fmt == AV_PIX_FMT_YUV422P16)
+			target_pix_fmt = AV_PIX_FMT_YUV422P10;
+		else if(pix_fmt == AV_PIX_FMT_YUV444P12 || pix_fmt == AV_PIX_FMT_YUV444P16)
+			target_pix_fmt = AV_PIX_FMT_YUV444P10;
 		
 		auto target_desc = get_pixel_format_desc(static_cast<AVPixelFormat>(target_pix_fmt), width, height);
+		if(target_pix_fmt != AV_PIX_FMT_BGRA)
+			set_color_space(target_desc, decoded_frame->colorspace, decoded_frame->color_range);
 
 		write = frame_factory->create_frame(tag, target_desc, audio_channel_layout);
 		write->set_type(get_mode(*decoded_frame));
 		write->set_timecode(decoded_frame->display_picture_number);
 
-		std::shared_ptr<SwsContext> sws_context;
-
 		//CASPAR_LOG(warning) << "Hardware accelerated color transform not supported.";
-		
-		int64_t key = ((static_cast<int64_t>(width)			 << 32) & 0xFFFF00000000) | 
-					  ((static_cast<int64_t>(height)		 << 16) & 0xFFFF0000) | 
-					  ((static_cast<int64_t>(pix_fmt)		 <<  8) & 0xFF00) | 
-					  ((static_cast<int64_t>(target_pix_fmt) <<  0) & 0xFF);
-			
-		auto& pool = sws_contexts_[key];
-						
-		if(!pool.try_pop(sws_context))
-		{
-			sws_context.reset(sws_getContext(width, height, static_cast<AVPixelFormat>(pix_fmt), width, height, target_pix_fmt, SWS_FAST_BILINEAR, nullptr, nullptr, NULL), sws_freeContext);
-			CASPAR_LOG(trace) << L"Created new SWS context w=" << width << L", h=" << height << ", input pix_fmt=" << pix_fmt << L", output pix_fmt=" << target_pix_fmt;
-		}
-			
-		if(!sws_context)
-		{
-			BOOST_THROW_EXCEPTION(operation_failed() << msg_info("Could not create software scaling context.") << 
-									boost::errinfo_api_function("sws_getContext"));
-		}	
-		
+
+		auto sws_context = get_sws_context(sws_context_key(width, height, pix_fmt, width, height, target_pix_fmt, SWS_FAST_BILINEAR));
+
 		std::shared_ptr<AVFrame> av_frame = create_frame();
 		if(target_pix_fmt == AV_PIX_FMT_BGRA)
 		{
@@ -266,7 +499,6 @@ safe_ptr<core::write_frame> make_write_frame(const void* tag, const safe_ptr<AVF
 		}
 
 		sws_scale(sws_context.get(), decoded_frame->data, decoded_frame->linesize, 0, height, av_frame->data, av_frame->linesize);	
-		pool.push(sws_context);
 
 		write->commit();		
 	}
@@ -68,7 +68,16 @@ static const int CASPAR_PIX_FMT_LUMA = 10; // Just hijack some unual pixel forma
 
 core::field_mode::type		get_mode(const AVFrame& frame);
 int							make_alpha_format(int format); // NOTE: Be careful about CASPAR_PIX_FMT_LUMA, change it to PIX_FMT_GRAY8 if you want to use the frame inside some ffmpeg function.
-safe_ptr<core::write_frame> make_write_frame(const void* tag, const safe_ptr<AVFrame>& decoded_frame, const safe_ptr<core::frame_factory>& frame_factory, int hints, const core::channel_layout& audio_channel_layout);
+
+// Frames decoded into write_frames by enable_direct_rendering are handed out without copying if is_passthrough is set,
+// i.e. if the frame has not been through a filter which might still read it after the write_frame has been committed.
+safe_ptr<core::write_frame> make_write_frame(const void* tag, const safe_ptr<AVFrame>& decoded_frame, const safe_ptr<core::frame_factory>& frame_factory, int hints, const core::channel_layout& audio_channel_layout, bool is_passthrough = false);
+
+struct direct_render_context;
+
+// Makes the codec decode into the host buffers of write_frames created by frame_factory. Only intra-only codecs are supported
+// since the buffers are unmapped once committed. Returns nullptr if not supported, the context must outlive the codec context.
+std::shared_ptr<direct_render_context> enable_direct_rendering(AVCodecContext& codec_context, const void* tag, const safe_ptr<core::frame_factory>& frame_factory, const core::channel_layout& audio_channel_layout);
 
 safe_ptr<AVPacket> create_packet();
 std::shared_ptr<AVFrame> create_frame();
@@ -54,13 +54,14 @@ namespace caspar { namespace ffmpeg {
 struct video_decoder::implementation : boost::noncopyable
 {
 	input 									input_;
+	std::shared_ptr<direct_render_context>	direct_render_context_; // Must outlive codec_context_.
 	const safe_ptr<AVCodecContext>			codec_context_;
 	const AVCodec*							codec_;
 	AVStream*								stream_;
 	const int64_t							duration_;
 	const size_t							width_;
 	const size_t							height_;
-	bool									is_progressive_;
+	tbb::atomic<bool>						is_progressive_; // Read by the producer's print and info.
 	const int64_t							stream_start_pts_;
 	tbb::atomic<int64_t>					seek_pts_;
 	tbb::atomic<bool>						invert_field_order_;
@@ -77,6 +78,7 @@ public:
 		, duration_(calc_duration(stream_))
 	{
 		invert_field_order_ = invert_field_order;
+		is_progressive_ = true;
 		eof_ = false;
 		time_ = AV_NOPTS_VALUE;
 		seek_pts_ = 0;
@@ -96,8 +98,10 @@ public:
 		while (!eof_)
 		{
 			std::shared_ptr<AVPacket> packet;
+			bool input_eof = input_.eof(); // Checked before popping, all packets have been queued once it is set.
 			input_.try_pop_video(packet);
-			avcodec_send_packet(codec_context_.get(), packet.get());
+			if (packet || input_eof) // A null packet drains the decoder, only send it at end of file.
+				avcodec_send_packet(codec_context_.get(), packet.get());
 			std::shared_ptr<AVFrame> decoded_frame = create_frame();
 			int ret = avcodec_receive_frame(codec_context_.get(), decoded_frame.get());
 			switch (ret)
@@ -123,6 +127,8 @@ public:
 				eof_ = true;
 				break;
 			case AVERROR(EAGAIN):
+				if (!packet && !input_eof) // Input is starved, try again on the next poll.
+					return nullptr;
 				break;
 			case AVERROR(EINVAL):
 				BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("codec not opened"));
@@ -132,6 +138,14 @@ public:
 		return nullptr;
 	}
 
+	void enable_direct_rendering(const void* tag, const safe_ptr<core::frame_factory>& frame_factory, const core::channel_layout& audio_channel_layout)
+	{
+		direct_render_context_ = ffmpeg::enable_direct_rendering(*codec_context_, tag, frame_factory, audio_channel_layout);
+
+		if(direct_render_context_)
+			CASPAR_LOG(debug) << print() << L" Decoding directly into host buffers.";
+	}
+
 	void seek(int64_t time)
 	{
 		avcodec_flush_buffers(codec_context_.get());
@@ -171,6 +185,7 @@ bool	video_decoder::is_progressive() const{return impl_->is_progressive_;}
 std::wstring video_decoder::print() const{return impl_->print();}
 void video_decoder::seek(int64_t time) { impl_->seek(time);}
 void video_decoder::invert_field_order(bool invert) {impl_-> invert_field_order(invert);}
+void video_decoder::enable_direct_rendering(const void* tag, const safe_ptr<core::frame_factory>& frame_factory, const core::channel_layout& audio_channel_layout) {impl_->enable_direct_rendering(tag, frame_factory, audio_channel_layout);}
 boost::rational<int> video_decoder::frame_rate() const { return impl_->frame_rate(); };
 boost::rational<int> video_decoder::time_base() const { return impl_->time_base(); };
 int64_t video_decoder::time() const { return impl_->time_; }
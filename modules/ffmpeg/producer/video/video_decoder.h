@@ -34,6 +34,7 @@ namespace caspar {
 
 namespace core {
 	struct frame_factory;
+	struct channel_layout;
 	class write_frame;
 }
 
@@ -52,6 +53,7 @@ public:
 	std::wstring print()	const;
 	void seek(int64_t time);
 	void invert_field_order(bool invert);
+	void enable_direct_rendering(const void* tag, const safe_ptr<core::frame_factory>& frame_factory, const core::channel_layout& audio_channel_layout);
 	boost::rational<int> frame_rate() const;
 	boost::rational<int> time_base() const;
 	int64_t time() const;
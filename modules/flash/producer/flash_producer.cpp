@@ -387,6 +387,7 @@ public:
 		graph_->set_color("late-frame", diagnostics::color(0.6f, 0.3f, 0.9f));
 		graph_->set_color("buffered", diagnostics::color(0.8f, 0.3f, 0.2f));
 		graph_->set_text(print());
+		graph_->set_name("flash-producer");
 		diagnostics::register_graph(graph_);
 		
 		has_renderer_ = false;
@@ -148,6 +148,7 @@ namespace caspar {
 				graph_->set_color("dropped-frame", diagnostics::color(1.0f, 0.1f, 0.1f));
 				if (!is_alpha)
 					graph_->set_color("frame-convert-time", diagnostics::color(0.8f, 0.6f, 0.9f));
+				graph_->set_name("ndi-consumer");
 				diagnostics::register_graph(graph_);
 			}
 
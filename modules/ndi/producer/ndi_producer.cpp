@@ -161,6 +161,7 @@ public:
 		graph_->set_color("output-buffer", diagnostics::color(0.0f, 1.0f, 0.0f));
 		graph_->set_color("audio-sync-buffer", diagnostics::color(0.3f, 0.3f, 1.0f));
 		graph_->set_text(print());
+		graph_->set_name("ndi-producer");
 		diagnostics::register_graph(graph_);
 		executor_.begin_invoke([this]() { receiver_proc(); });
 		CASPAR_LOG(info) << print() << L" successfully initialized.";
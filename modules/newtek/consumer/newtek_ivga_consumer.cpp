@@ -68,6 +68,7 @@ public:
 		graph_->set_text(print());
 		graph_->set_color("frame-time", diagnostics::color(0.5f, 1.0f, 0.2f));
 		graph_->set_color("tick-time", diagnostics::color(0.0f, 0.6f, 0.9f));
+		graph_->set_name("newtek-ivga-consumer");
 		diagnostics::register_graph(graph_);
 	}
 	
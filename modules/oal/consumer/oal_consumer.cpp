@@ -76,6 +76,7 @@ public:
 	{
 		graph_->set_color("tick-time", diagnostics::color(0.0f, 0.6f, 0.9f));	
 		graph_->set_color("dropped-frame", diagnostics::color(0.3f, 0.6f, 0.3f));
+		graph_->set_name("oal-consumer");
 		diagnostics::register_graph(graph_);
 
 		is_running_ = true;
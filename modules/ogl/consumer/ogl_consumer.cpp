@@ -172,6 +172,7 @@ public:
 		graph_->set_color("dropped-frame", diagnostics::color(0.3f, 0.6f, 0.3f));
 
 		graph_->set_text(print());
+		graph_->set_name("ogl-consumer");
 		diagnostics::register_graph(graph_);
 									
 		DISPLAY_DEVICE d_device = {sizeof(d_device), 0};			
@@ -33,6 +33,8 @@
 
 namespace caspar { namespace protocol { namespace amcp {
 
+	struct media_catalog;
+
 	class AMCPCommand
 	{
 		AMCPCommand(const AMCPCommand&);
@@ -48,6 +50,7 @@ namespace caspar { namespace protocol { namespace amcp {
 		void SendReply();
 
 		void AddParameter(const std::wstring& param){_parameters.push_back(param);}
+		void AddParameter(std::wstring&& param){_parameters.push_back(std::move(param));}
 
 		void SetParameters(const core::parameters& p) {
 			_parameters = p;
@@ -68,12 +71,18 @@ namespace caspar { namespace protocol { namespace amcp {
 		void SetMediaInfoRepo(const safe_ptr<core::media_info_repository>& media_info_repo) {media_info_repo_ = media_info_repo;}
 		std::shared_ptr<core::media_info_repository> GetMediaInfoRepo() { return media_info_repo_; }
 
+		void SetMediaCatalog(const std::shared_ptr<media_catalog>& catalog) {media_catalog_ = catalog;}
+		std::shared_ptr<media_catalog> GetMediaCatalog() { return media_catalog_; }
+
 		void SetChannelIndex(unsigned int channelIndex){channelIndex_ = channelIndex;}
 		unsigned int GetChannelIndex(){return channelIndex_;}
 
 		void SetLayerIntex(int layerIndex){layerIndex_ = layerIndex;}
 		int GetLayerIndex(int defaultValue = 0) const{return layerIndex_ != -1 ? layerIndex_ : defaultValue;}
 
+		// The layers of the channel which the command affects, commands for the same layers are executed in order.
+		virtual std::vector<int> GetLayerIndices(int defaultValue) {return std::vector<int>(1, GetLayerIndex(defaultValue));}
+
 		virtual void Clear();
 
 		virtual std::wstring print() const = 0;
@@ -91,6 +100,7 @@ namespace caspar { namespace protocol { namespace amcp {
 		std::vector<safe_ptr<core::video_channel>> channels_;
 		std::vector<safe_ptr<core::recorder>> recorders_;
 		std::shared_ptr<core::media_info_repository> media_info_repo_;
+		std::shared_ptr<media_catalog> media_catalog_;
 		std::wstring replyString_;
 	};
 
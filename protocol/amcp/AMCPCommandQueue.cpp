@@ -23,64 +23,299 @@
 
 #include "AMCPCommandQueue.h"
 
+#include <common/diagnostics/graph.h>
+#include <common/utility/string.h>
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <list>
+#include <vector>
+
+#include <boost/algorithm/string/replace.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include <boost/timer.hpp>
+
+#include <tbb/concurrent_queue.h>
+#include <tbb/mutex.h>
+
 namespace caspar { namespace protocol { namespace amcp {
-	
-AMCPCommandQueue::AMCPCommandQueue() 
-	: executor_(L"AMCPCommandQueue")
+
+namespace {
+
+const int			WHOLE_CHANNEL			= std::numeric_limits<int>::min();
+const std::size_t	MAX_PENDING_COMMANDS	= 512;
+
+void execute(const AMCPCommandPtr& pCurrentCommand)
 {
+	try
+	{
+		try
+		{
+			if(pCurrentCommand->Execute()) 
+				CASPAR_LOG(debug) << "Executed command: " << pCurrentCommand->print();
+			else 
+				CASPAR_LOG(warning) << "Failed to execute command: " << pCurrentCommand->print();
+		}
+		catch(...)
+		{
+			CASPAR_LOG_CURRENT_EXCEPTION();
+			CASPAR_LOG(error) << "Failed to execute command:" << pCurrentCommand->print();
+			pCurrentCommand->SetReplyString(L"500 FAILED\r\n");
+		}
+				
+		pCurrentCommand->SendReply();
+			
+		CASPAR_LOG(trace) << "Ready for a new command";
+	}
+	catch(...)
+	{
+		CASPAR_LOG_CURRENT_EXCEPTION();
+	}
 }
 
-AMCPCommandQueue::~AMCPCommandQueue() 
-{
 }
 
-void AMCPCommandQueue::AddCommand(AMCPCommandPtr pCurrentCommand)
+class AMCPCommandQueue::thread_pool : boost::noncopyable
 {
-	if(!pCurrentCommand)
-		return;
+	tbb::concurrent_bounded_queue<std::function<void ()>>	tasks_;
+	boost::thread_group										threads_;
+	const int												thread_count_;
+
+	boost::mutex											mutex_;
+	boost::condition_variable								drained_cond_;
+	int														pending_; // Posted tasks which have not finished.
+	bool													is_stopping_;
+public:
+	explicit thread_pool(int threads)
+		: thread_count_(std::max(1, threads))
+		, pending_(0)
+		, is_stopping_(false)
+	{
+		for(int n = 0; n < thread_count_; ++n)
+			threads_.create_thread([this] { run(); });
+	}
 
-	if(executor_.size() > 64)
+	~thread_pool()
 	{
+		// Running tasks post the commands they unblock, so the sentinels are only pushed once nothing
+		// is pending, and posting is closed under the same lock so that nothing can follow them.
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			while(pending_ > 0)
+				drained_cond_.wait(lock);
+			is_stopping_ = true;
+		}
+
+		for(int n = 0; n < thread_count_; ++n)
+			tasks_.push(std::function<void ()>());
+
+		threads_.join_all();
+	}
+
+	void post(const std::function<void ()>& task)
+	{
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			if(is_stopping_)
+			{
+				CASPAR_LOG(warning) << "AMCP command thread pool is stopping, task dropped.";
+				return;
+			}
+			++pending_;
+		}
+
 		try
 		{
-			CASPAR_LOG(error) << "AMCP Command Queue Overflow.";
-			CASPAR_LOG(error) << "Failed to execute command:" << pCurrentCommand->print();
-			pCurrentCommand->SetReplyString(L"500 FAILED\r\n");
-			pCurrentCommand->SendReply();
+			tasks_.push(task);
 		}
 		catch(...)
 		{
-			CASPAR_LOG_CURRENT_EXCEPTION();
+			finish_task();
+			throw;
 		}
 	}
-	
-	executor_.begin_invoke([=]
+private:
+	void run()
 	{
-		try
+		win32_exception::ensure_handler_installed_for_thread("amcp-command-thread");
+
+		while(true)
 		{
+			std::function<void ()> task;
+			tasks_.pop(task);
+
+			if(!task)
+				return;
+
 			try
 			{
-				if(pCurrentCommand->Execute()) 
-					CASPAR_LOG(debug) << "Executed command: " << pCurrentCommand->print();
-				else 
-					CASPAR_LOG(warning) << "Failed to execute command: " << pCurrentCommand->print();
+				task();
 			}
 			catch(...)
 			{
 				CASPAR_LOG_CURRENT_EXCEPTION();
-				CASPAR_LOG(error) << "Failed to execute command:" << pCurrentCommand->print();
-				pCurrentCommand->SetReplyString(L"500 FAILED\r\n");
 			}
-				
-			pCurrentCommand->SendReply();
-			
-			CASPAR_LOG(trace) << "Ready for a new command";
+
+			task = std::function<void ()>(); // Releases what the task holds before the pool may be destroyed.
+			finish_task();
 		}
-		catch(...)
+	}
+
+	void finish_task()
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		if(--pending_ == 0)
+			drained_cond_.notify_all();
+	}
+};
+
+struct AMCPCommandQueue::implementation : public std::enable_shared_from_this<AMCPCommandQueue::implementation>
+{
+	struct entry
+	{
+		AMCPCommandPtr		command;
+		std::vector<int>	layers; // WHOLE_CHANNEL for commands which affect the whole channel.
+		bool				is_running;
+		boost::timer		queued_timer;
+
+		entry(const AMCPCommandPtr& command, const std::vector<int>& layers)
+			: command(command)
+			, layers(layers)
+			, is_running(false)
 		{
-			CASPAR_LOG_CURRENT_EXCEPTION();
 		}
-	});
+
+		bool is_whole_channel() const
+		{
+			return std::find(layers.begin(), layers.end(), WHOLE_CHANNEL) != layers.end();
+		}
+	};
+
+	const std::wstring				name_;
+	thread_pool&					pool_; // Outlives the queue, its threads are joined before pending tasks are destroyed.
+	const safe_ptr<diagnostics::graph>	graph_;
+
+	tbb::mutex						mutex_;
+	std::list<entry>				entries_; // In the order they were added, removed when executed.
+	std::vector<int>				busy_layers_;
+	double							latency_;
+
+	implementation(const std::wstring& name, thread_pool& pool)
+		: name_(name)
+		, pool_(pool)
+		, latency_(0.0)
+	{
+		graph_->set_color("queue-depth", diagnostics::color(0.3f, 0.6f, 1.0f));
+		graph_->set_color("latency", diagnostics::color(1.0f, 0.6f, 0.1f));
+		graph_->set_text(name_);
+		graph_->set_name(boost::replace_all_copy(narrow(name_), " ", "-"));
+		diagnostics::register_graph(graph_);
+	}
+
+	void add(const AMCPCommandPtr& command)
+	{
+		tbb::mutex::scoped_lock lock(mutex_);
+
+		if(entries_.size() >= MAX_PENDING_COMMANDS)
+		{
+			graph_->set_tag("overflow");
+
+			try
+			{
+				CASPAR_LOG(error) << "AMCP Command Queue Overflow.";
+				CASPAR_LOG(error) << "Failed to execute command:" << command->print();
+				command->SetReplyString(L"500 FAILED\r\n");
+				command->SendReply();
+			}
+			catch(...)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+			}
+
+			return;
+		}
+
+		entries_.push_back(entry(command, command->NeedChannel() ? command->GetLayerIndices(WHOLE_CHANNEL) : std::vector<int>(1, WHOLE_CHANNEL)));
+
+		schedule();
+		update_graph();
+	}
+
+	// Starts every command which does not have to wait for an earlier command. Called with the lock held.
+	void schedule()
+	{
+		busy_layers_.clear();
+
+		for(auto it = entries_.begin(); it != entries_.end(); ++it)
+		{
+			if(it->is_whole_channel())
+			{
+				if(it == entries_.begin() && !it->is_running)
+					start(it);
+
+				break;
+			}
+
+			// A command which affects several layers waits for all of them and holds all of them back.
+			bool is_blocked = std::find_first_of(it->layers.begin(), it->layers.end(), busy_layers_.begin(), busy_layers_.end()) != it->layers.end();
+
+			if(!is_blocked && !it->is_running)
+				start(it);
+
+			busy_layers_.insert(busy_layers_.end(), it->layers.begin(), it->layers.end());
+		}
+	}
+
+	void start(std::list<entry>::iterator it)
+	{
+		it->is_running	= true;
+		latency_		= it->queued_timer.elapsed();
+
+		auto self = shared_from_this();
+		pool_.post([self, it]
+		{
+			execute(it->command);
+			self->on_executed(it);
+		});
+	}
+
+	void on_executed(std::list<entry>::iterator it)
+	{
+		tbb::mutex::scoped_lock lock(mutex_);
+
+		entries_.erase(it);
+
+		schedule();
+		update_graph();
+	}
+
+	void update_graph()
+	{
+		graph_->set_value("queue-depth", static_cast<double>(entries_.size()) / MAX_PENDING_COMMANDS);
+		graph_->set_value("latency", std::min(1.0, latency_));
+		graph_->set_text(name_ + L" | pending " + boost::lexical_cast<std::wstring>(entries_.size()) + L" | latency " + boost::lexical_cast<std::wstring>(static_cast<int>(latency_ * 1000.0)) + L" ms");
+	}
+};
+
+AMCPCommandQueue::AMCPCommandQueue(const std::wstring& name, int threads) 
+	: pool_(make_safe<thread_pool>(threads))
+	, impl_(std::make_shared<implementation>(name, *pool_))
+{
+}
+
+AMCPCommandQueue::~AMCPCommandQueue() 
+{
+}
+
+void AMCPCommandQueue::AddCommand(AMCPCommandPtr pCurrentCommand)
+{
+	if(!pCurrentCommand)
+		return;
+
+	impl_->add(pCurrentCommand);
 }
 
-}}}
\ No newline at end of file
+}}}
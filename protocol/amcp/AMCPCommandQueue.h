@@ -23,24 +23,31 @@
 
 #include "AMCPCommand.h"
 
-#include <common/concurrency/executor.h>
+#include <common/memory/safe_ptr.h>
 
-#include <tbb\mutex.h>
+#include <string>
 
 namespace caspar { namespace protocol { namespace amcp {
 
+// Commands for different layers of a channel are executed in parallel on the queue's own threads, so commands which
+// block on one channel do not hold up the other channels. Commands for the same layer, commands which affect several
+// layers and commands without a layer which affect the whole channel, are executed in the order they were added.
 class AMCPCommandQueue
 {
 	AMCPCommandQueue(const AMCPCommandQueue&);
 	AMCPCommandQueue& operator=(const AMCPCommandQueue&);
 public:
-	AMCPCommandQueue();
+	AMCPCommandQueue(const std::wstring& name, int threads);
 	~AMCPCommandQueue();
 
 	void AddCommand(AMCPCommandPtr pCommand);
 
 private:
-	executor			executor_;
+	class thread_pool;
+	safe_ptr<thread_pool> pool_; // Joined after the pending commands have been executed, impl_ is kept alive by them.
+
+	struct implementation;
+	std::shared_ptr<implementation> impl_;
 };
 typedef std::tr1::shared_ptr<AMCPCommandQueue> AMCPCommandQueuePtr;
 
@@ -29,6 +29,7 @@
 #include "AMCPProtocolStrategy.h"
 
 #include <common/env.h>
+#include <common/filesystem/folder_listing.h>
 
 #include <common/log/log.h>
 #include <common/diagnostics/graph.h>
@@ -40,9 +41,11 @@
 
 #include <core/producer/frame_producer.h>
 #include <core/video_format.h>
+#include <core/frame_trace.h>
 #include <core/producer/transition/transition_producer.h>
 #include <core/producer/channel/channel_producer.h>
 #include <core/producer/layer/layer_producer.h>
+#include <core/producer/preload/preload_producer.h>
 #include <core/producer/frame/frame_transform.h>
 #include <core/producer/stage.h>
 #include <core/producer/layer.h>
@@ -60,12 +63,14 @@
 #include <modules/flash/producer/flash_producer.h>
 #include <modules/flash/producer/cg_producer.h>
 #include <modules/ffmpeg/producer/util/util.h>
+#include <modules/ffmpeg/producer/util/sws_context_cache.h>
 #include <modules/image/image.h>
 #include <modules/ogl/ogl.h>
 
 #include <algorithm>
 #include <locale>
 #include <fstream>
+#include <map>
 #include <memory>
 #include <cctype>
 #include <io.h>
@@ -84,7 +89,7 @@
 #include <boost/archive/iterators/insert_linebreaks.hpp>
 #include <boost/archive/iterators/transform_width.hpp>
 
-#include <tbb/concurrent_unordered_map.h>
+#include <tbb/spin_mutex.h>
 
 /* Return codes
 
@@ -255,8 +260,11 @@ std::wstring MediaInfo(const boost::filesystem::wpath& path, const std::shared_p
 	return L"";
 }
 
-std::wstring ListMedia(const std::shared_ptr<core::media_info_repository>& media_info_repo)
+std::wstring ListMedia(const std::shared_ptr<core::media_info_repository>& media_info_repo, const std::shared_ptr<amcp::media_catalog>& catalog)
 {		
+	if(catalog && catalog->media->is_ready())
+		return catalog->media->str();
+
 	std::wstringstream replyString;
 	for (boost::filesystem::wrecursive_directory_iterator itr(env::media_folder()), end; itr != end; ++itr)	
 		replyString << MediaInfo(itr->path(), media_info_repo);
@@ -264,42 +272,99 @@ std::wstring ListMedia(const std::shared_ptr<core::media_info_repository>& media
 	return boost::to_upper_copy(replyString.str());
 }
 
-std::wstring ListTemplates() 
+std::wstring TemplateInfo(const boost::filesystem::wpath& path)
+{
+	if(boost::filesystem::is_regular_file(path) && (path.extension() == L".ft" || path.extension() == L".ct"))
+	{
+		auto relativePath = boost::filesystem::wpath(path.file_string().substr(env::template_folder().size()-1, path.file_string().size()));
+
+		auto writeTimeStr = boost::posix_time::to_iso_string(boost::posix_time::from_time_t(boost::filesystem::last_write_time(path)));
+		writeTimeStr.erase(std::remove_if(writeTimeStr.begin(), writeTimeStr.end(), [](char c){ return std::isdigit(c) == 0;}), writeTimeStr.end());
+		auto writeTimeWStr = std::wstring(writeTimeStr.begin(), writeTimeStr.end());
+
+		auto sizeStr = boost::lexical_cast<std::string>(boost::filesystem::file_size(path));
+		sizeStr.erase(std::remove_if(sizeStr.begin(), sizeStr.end(), [](char c){ return std::isdigit(c) == 0;}), sizeStr.end());
+
+		auto sizeWStr = std::wstring(sizeStr.begin(), sizeStr.end());
+
+		std::wstring dir = relativePath.parent_path().external_directory_string();
+		std::wstring file = boost::to_upper_copy(relativePath.filename());
+		relativePath = boost::filesystem::wpath(dir + L"/" + file);
+					
+		auto str = relativePath.replace_extension(TEXT("")).external_file_string();
+		boost::trim_if(str, boost::is_any_of("\\/"));
+
+		return std::wstring()
+				+ L"\""	+ str
+				+ L"\" "	+ sizeWStr
+				+ L" "		+ writeTimeWStr
+				+ L"\r\n";
+	}
+	return L"";
+}
+
+std::wstring ListTemplates(const std::shared_ptr<amcp::media_catalog>& catalog) 
 {
+	if(catalog && catalog->templates->is_ready())
+		return catalog->templates->str();
+
 	std::wstringstream replyString;
 
 	for (boost::filesystem::wrecursive_directory_iterator itr(env::template_folder()), end; itr != end; ++itr)
-	{		
-		if(boost::filesystem::is_regular_file(itr->path()) && (itr->path().extension() == L".ft" || itr->path().extension() == L".ct"))
-		{
-			auto relativePath = boost::filesystem::wpath(itr->path().file_string().substr(env::template_folder().size()-1, itr->path().file_string().size()));
+		replyString << TemplateInfo(itr->path());
 
-			auto writeTimeStr = boost::posix_time::to_iso_string(boost::posix_time::from_time_t(boost::filesystem::last_write_time(itr->path())));
-			writeTimeStr.erase(std::remove_if(writeTimeStr.begin(), writeTimeStr.end(), [](char c){ return std::isdigit(c) == 0;}), writeTimeStr.end());
-			auto writeTimeWStr = std::wstring(writeTimeStr.begin(), writeTimeStr.end());
+	return replyString.str();
+}
 
-			auto sizeStr = boost::lexical_cast<std::string>(boost::filesystem::file_size(itr->path()));
-			sizeStr.erase(std::remove_if(sizeStr.begin(), sizeStr.end(), [](char c){ return std::isdigit(c) == 0;}), sizeStr.end());
+std::wstring DataInfo(const boost::filesystem::wpath& path)
+{
+	if(!boost::filesystem::is_regular_file(path) || !boost::iequals(path.extension(), L".ftd"))
+		return L"";
+	
+	auto relativePath = boost::filesystem::wpath(path.file_string().substr(env::data_folder().size()-1, path.file_string().size()));
+	
+	auto str = relativePath.replace_extension(TEXT("")).external_file_string();
+	if(str[0] == '\\' || str[0] == '/')
+		str = std::wstring(str.begin() + 1, str.end());
 
-			auto sizeWStr = std::wstring(sizeStr.begin(), sizeStr.end());
+	return str + L"\r\n";
+}
 
-			std::wstring dir = relativePath.parent_path().external_directory_string();
-			std::wstring file = boost::to_upper_copy(relativePath.filename());
-			relativePath = boost::filesystem::wpath(dir + L"/" + file);
-						
-			auto str = relativePath.replace_extension(TEXT("")).external_file_string();
-			boost::trim_if(str, boost::is_any_of("\\/"));
+std::wstring ListData(const std::shared_ptr<amcp::media_catalog>& catalog) 
+{
+	if(catalog && catalog->data->is_ready())
+		return catalog->data->str();
+
+	std::wstringstream replyString;
+
+	for (boost::filesystem::wrecursive_directory_iterator itr(env::data_folder()), end; itr != end; ++itr)
+		replyString << DataInfo(itr->path());
 
-			replyString << TEXT("\"") << str
-						<< TEXT("\" ") << sizeWStr
-						<< TEXT(" ") << writeTimeWStr
-						<< TEXT("\r\n");		
-		}
-	}
 	return replyString.str();
 }
 
 namespace amcp {
+
+safe_ptr<media_catalog> create_media_catalog(filesystem_monitor_factory& monitor_factory, const safe_ptr<core::media_info_repository>& media_info_repo)
+{
+	auto catalog = make_safe<media_catalog>();
+
+	catalog->media = make_safe<folder_listing>(
+			monitor_factory, 
+			env::media_folder(), 
+			[=](const boost::filesystem::wpath& file)
+			{
+				return boost::to_upper_copy(MediaInfo(file, media_info_repo));
+			},
+			[=](const boost::filesystem::wpath& file)
+			{
+				media_info_repo->remove(file.file_string());
+			});
+	catalog->templates	= make_safe<folder_listing>(monitor_factory, env::template_folder(), TemplateInfo);
+	catalog->data		= make_safe<folder_listing>(monitor_factory, env::data_folder(), DataInfo);
+
+	return catalog;
+}
 	
 AMCPCommand::AMCPCommand() : channelIndex_(0), layerIndex_(-1)
 {}
@@ -340,6 +405,50 @@ bool DiagnosticsCommand::DoExecute()
 	}
 }
 
+// TRACE <channel> [FILE <filename>]
+// Replies with, or writes to the log folder, the latest frame spans of the
+// channel in the Chrome trace event format.
+bool TraceCommand::DoExecute()
+{	
+	try
+	{
+		auto json = GetChannel()->tracer()->chrome_trace_json();
+
+		if(_parameters.size() >= 2 && _parameters[0] == L"FILE")
+		{
+			auto filename = boost::filesystem::wpath(_parameters[1]).filename();
+
+			if(filename.empty())
+			{
+				SetReplyString(TEXT("403 TRACE ERROR\r\n"));
+				return false;
+			}
+
+			boost::filesystem::ofstream file(boost::filesystem::wpath(env::log_folder()) / filename, std::ios::out | std::ios::binary);
+			file.write(json.data(), json.size());
+
+			if(!file)
+			{
+				SetReplyString(TEXT("502 TRACE FAILED\r\n"));
+				return false;
+			}
+
+			SetReplyString(TEXT("202 TRACE OK\r\n"));
+			return true;
+		}
+
+		SetReplyString(TEXT("201 TRACE OK\r\n") + widen(json) + TEXT("\r\n"));
+
+		return true;
+	}
+	catch(...)
+	{
+		CASPAR_LOG_CURRENT_EXCEPTION();
+		SetReplyString(TEXT("502 TRACE FAILED\r\n"));
+		return false;
+	}
+}
+
 bool ChannelGridCommand::DoExecute()
 {
 	int index = 1;
@@ -435,8 +544,94 @@ bool CallCommand::DoExecute()
 	}
 }
 
-// UGLY HACK
-tbb::concurrent_unordered_map<int, std::vector<stage::transform_tuple_t>> deferred_transforms;
+// Mixer transforms waiting for MIXER COMMIT, per client and channel. A transaction
+// only defers the commands of the client which began it and is discarded when the
+// client disconnects. Commands for different layers are executed concurrently so
+// access has to be serialized.
+class deferred_transforms_store
+{
+	struct pending
+	{
+		bool									in_transaction;
+		std::vector<stage::transform_tuple_t>	transforms;
+
+		pending() : in_transaction(false) {}
+	};
+
+	typedef std::map<std::weak_ptr<IO::ClientInfo>, std::map<int, pending>, std::owner_less<std::weak_ptr<IO::ClientInfo>>> clients_t;
+
+	tbb::spin_mutex	mutex_;
+	clients_t		clients_;
+
+	void purge_dead_clients()
+	{
+		for (auto it = clients_.begin(); it != clients_.end();)
+		{
+			if (it->first.expired())
+				it = clients_.erase(it);
+			else
+				++it;
+		}
+	}
+public:
+	void begin(const IO::ClientInfoPtr& client, int channel)
+	{
+		if (!client)
+			return;
+
+		tbb::spin_mutex::scoped_lock lock(mutex_);
+		purge_dead_clients();
+		clients_[client][channel].in_transaction = true;
+	}
+
+	bool in_transaction(const IO::ClientInfoPtr& client, int channel)
+	{
+		if (!client)
+			return false;
+
+		tbb::spin_mutex::scoped_lock lock(mutex_);
+		auto client_it = clients_.find(client);
+		if (client_it == clients_.end())
+			return false;
+
+		auto it = client_it->second.find(channel);
+		return it != client_it->second.end() && it->second.in_transaction;
+	}
+
+	void defer(const IO::ClientInfoPtr& client, int channel, const std::vector<stage::transform_tuple_t>& transforms)
+	{
+		if (!client)
+			return;
+
+		tbb::spin_mutex::scoped_lock lock(mutex_);
+		auto& deferred = clients_[client][channel].transforms;
+		deferred.insert(deferred.end(), transforms.begin(), transforms.end());
+	}
+
+	std::vector<stage::transform_tuple_t> commit(const IO::ClientInfoPtr& client, int channel)
+	{
+		std::vector<stage::transform_tuple_t> transforms;
+
+		if (!client)
+			return transforms;
+
+		tbb::spin_mutex::scoped_lock lock(mutex_);
+		auto client_it = clients_.find(client);
+		if (client_it == clients_.end())
+			return transforms;
+
+		auto it = client_it->second.find(channel);
+		if (it == client_it->second.end())
+			return transforms;
+
+		transforms.swap(it->second.transforms);
+		client_it->second.erase(it);
+		if (client_it->second.empty())
+			clients_.erase(client_it);
+
+		return transforms;
+	}
+} deferred_transforms;
 
 core::frame_transform MixerCommand::get_current_transform()
 {
@@ -452,6 +647,8 @@ bool MixerCommand::DoExecute()
 		bool defer = _parameters.back() == L"DEFER";
 		if(defer)
 			_parameters.pop_back();
+		else
+			defer = deferred_transforms.in_transaction(GetClientInfo(), GetChannelIndex());
 
 		std::vector<stage::transform_tuple_t> transforms;
 
@@ -753,9 +950,14 @@ bool MixerCommand::DoExecute()
 				GetChannel()->mixer()->clear_blend_mode(layer);
 			}
 		}
+		else if(_parameters[0] == L"BEGIN")
+		{
+			deferred_transforms.begin(GetClientInfo(), GetChannelIndex());
+		}
 		else if(_parameters[0] == L"COMMIT")
 		{
-			transforms = std::move(deferred_transforms[GetChannelIndex()]);
+			transforms = deferred_transforms.commit(GetClientInfo(), GetChannelIndex());
+			defer = false;
 		}
 		else
 		{
@@ -763,12 +965,9 @@ bool MixerCommand::DoExecute()
 			return false;
 		}
 
-		if(defer)
-		{
-			auto& defer_tranforms = deferred_transforms[GetChannelIndex()];
-			defer_tranforms.insert(defer_tranforms.end(), transforms.begin(), transforms.end());
-		}
-		else
+		if(defer && GetClientInfo()) // Without a client there is nobody to commit.
+			deferred_transforms.defer(GetClientInfo(), GetChannelIndex(), transforms);
+		else if(!transforms.empty())
 			GetChannel()->stage()->apply_transforms(transforms);
 	
 		SetReplyString(TEXT("202 MIXER OK\r\n"));
@@ -789,6 +988,31 @@ bool MixerCommand::DoExecute()
 	}
 }
 
+std::vector<int> SwapCommand::GetLayerIndices(int defaultValue)
+{
+	auto layers = AMCPCommand::GetLayerIndices(defaultValue);
+
+	if(GetLayerIndex(-1) == -1 || _parameters.empty())
+		return layers;
+
+	// Swapping with another layer of the same channel has to wait for the commands of both layers.
+	// The layers of other channels are not known to this queue.
+	try
+	{
+		std::vector<std::wstring> strs;
+		boost::split(strs, _parameters[0], boost::is_any_of("-"));
+
+		if(boost::lexical_cast<int>(strs.at(0)) - 1 == static_cast<int>(GetChannelIndex()))
+			layers.push_back(boost::lexical_cast<int>(strs.at(1)));
+	}
+	catch(...)
+	{
+		return std::vector<int>(1, defaultValue); // Fails when executed, run it on its own.
+	}
+
+	return layers;
+}
+
 bool SwapCommand::DoExecute()
 {	
 	//Perform loading of the clip
@@ -1058,6 +1282,24 @@ bool LoadCommand::DoExecute()
 //		return L"";
 //	};
 
+// Whether LOADBG can open the producer on a preload thread. Only streams and media files which
+// exist are deferred, everything else is created at once so that missing media is replied with 404.
+// Media files are looked up in the CLS listing, the media folder is only probed until it is ready.
+bool can_defer_producer(const std::wstring& protocol, const std::wstring& name, const std::shared_ptr<media_catalog>& catalog)
+{
+	if (!protocol.empty())
+		return true;
+
+	if (boost::filesystem::wpath(name).is_complete())
+		return boost::filesystem::is_regular_file(name);
+
+	if (catalog && catalog->media && catalog->media->is_ready())
+		return catalog->media->has_file(boost::filesystem::wpath(env::media_folder()) / name);
+
+	auto filename = env::media_folder() + L"\\" + name;
+	return boost::filesystem::is_regular_file(filename) || !ffmpeg::probe_stem(filename).empty();
+}
+
 bool LoadbgCommand::DoExecute()
 {
 	transition_info transitionInfo;
@@ -1113,16 +1355,31 @@ bool LoadbgCommand::DoExecute()
 		{
 			pFP = RouteCommand::TryCreateProducer(*this, _parameters.at_original(0));
 		}
-		if (pFP == frame_producer::empty())
+
+		auto field_mode = GetChannel()->get_video_format_desc().field_mode;
+
+		auto pFP2 = frame_producer::empty();
+		if (pFP != frame_producer::empty())
 		{
-			pFP = create_producer(GetChannel()->mixer(), _parameters);
+			pFP2 = create_transition_producer(field_mode, pFP, transitionInfo);
+		}
+		else if (!can_defer_producer(uri_tokens[0], uri_tokens[1], GetMediaCatalog()))
+		{
+			pFP2 = create_transition_producer(field_mode, create_producer(GetChannel()->mixer(), _parameters), transitionInfo);
+		}
+		else
+		{
+			// Opening media may block on storage, create the producer on a preload thread so that the command queue is not stalled.
+			auto frame_factory	= GetChannel()->mixer();
+			auto parameters		= _parameters;
+			pFP2 = create_preload_producer([=]() -> safe_ptr<core::frame_producer>
+			{
+				return create_transition_producer(field_mode, create_producer(frame_factory, parameters), transitionInfo);
+			}, _parameters.get_original_string());
 		}
-		if(pFP == frame_producer::empty())
-			BOOST_THROW_EXCEPTION(file_not_found() << msg_info(_parameters.size() > 0 ? narrow(_parameters[0]) : ""));
 
 		bool auto_play = std::find(_parameters.begin(), _parameters.end(), L"AUTO") != _parameters.end();
 
-		auto pFP2 = create_transition_producer(GetChannel()->get_video_format_desc().field_mode, pFP, transitionInfo);
 		GetChannel()->stage()->load(GetLayerIndex(), pFP2, false, auto_play ? transitionInfo.duration : -1); // TODO: LOOP
 	
 		SetReplyString(TEXT("202 LOADBG OK\r\n"));
@@ -1176,6 +1433,8 @@ bool PlayCommand::DoExecute()
 				throw std::exception();
 		}
 
+		wait_for_preload(GetChannel()->stage()->background(GetLayerIndex()).get());
+
 		GetChannel()->stage()->play(GetLayerIndex());
 		
 		SetReplyString(TEXT("202 PLAY OK\r\n"));
@@ -1684,24 +1943,7 @@ bool DataCommand::DoExecuteList()
 {
 	std::wstringstream replyString;
 	replyString << TEXT("200 DATA LIST OK\r\n");
-
-	for (boost::filesystem::wrecursive_directory_iterator itr(env::data_folder()), end; itr != end; ++itr)
-	{			
-		if(boost::filesystem::is_regular_file(itr->path()))
-		{
-			if(!boost::iequals(itr->path().extension(), L".ftd"))
-				continue;
-			
-			auto relativePath = boost::filesystem::wpath(itr->path().file_string().substr(env::data_folder().size()-1, itr->path().file_string().size()));
-			
-			auto str = relativePath.replace_extension(TEXT("")).external_file_string();
-			if(str[0] == '\\' || str[0] == '/')
-				str = std::wstring(str.begin() + 1, str.end());
-
-			replyString << str << TEXT("\r\n"); 	
-		}
-	}
-	
+	replyString << ListData(GetMediaCatalog());
 	replyString << TEXT("\r\n");
 
 	SetReplyString(boost::to_upper_copy(replyString.str()));
@@ -1890,6 +2132,13 @@ bool InfoCommand::DoExecute()
 			info.add(L"system.caspar.ffmpeg.avfilter",			caspar::ffmpeg::get_avfilter_version());
 			info.add(L"system.caspar.ffmpeg.avutil",			caspar::ffmpeg::get_avutil_version());
 			info.add(L"system.caspar.ffmpeg.swscale",			caspar::ffmpeg::get_swscale_version());
+
+			auto sws_cache = caspar::ffmpeg::get_sws_context_cache_stats();
+			info.add(L"system.caspar.ffmpeg.sws-cache.hits",		sws_cache.hits);
+			info.add(L"system.caspar.ffmpeg.sws-cache.warm-hits",	sws_cache.warm_hits);
+			info.add(L"system.caspar.ffmpeg.sws-cache.misses",		sws_cache.misses);
+			info.add(L"system.caspar.ffmpeg.sws-cache.evictions",	sws_cache.evictions);
+			info.add(L"system.caspar.ffmpeg.sws-cache.contexts",	sws_cache.contexts);
 									
 			boost::property_tree::write_xml(replyString, info, w);
 		}
@@ -2014,7 +2263,7 @@ bool ClsCommand::DoExecute()
 	*/
 	std::wstringstream replyString;
 	replyString << TEXT("200 CLS OK\r\n");
-	replyString << ListMedia(GetMediaInfoRepo());
+	replyString << ListMedia(GetMediaInfoRepo(), GetMediaCatalog());
 	replyString << TEXT("\r\n");
 	SetReplyString(boost::to_upper_copy(replyString.str()));
 	return true;
@@ -2025,7 +2274,7 @@ bool TlsCommand::DoExecute()
 	std::wstringstream replyString;
 	replyString << TEXT("200 TLS OK\r\n");
 
-	replyString << ListTemplates();
+	replyString << ListTemplates(GetMediaCatalog());
 	replyString << TEXT("\r\n");
 
 	SetReplyString(replyString.str());
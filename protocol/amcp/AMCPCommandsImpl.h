@@ -27,6 +27,9 @@
 
 namespace caspar {
 
+class folder_listing;
+class filesystem_monitor_factory;
+
 namespace core {
 	struct frame_transform;
 	struct frame_producer;
@@ -38,6 +41,16 @@ std::wstring ListMedia();
 std::wstring ListTemplates();
 
 namespace amcp {
+
+// The listings returned by CLS, TLS and DATA LIST. Until a listing is ready the folder is walked for each request.
+struct media_catalog
+{
+	std::shared_ptr<folder_listing> media;
+	std::shared_ptr<folder_listing> templates;
+	std::shared_ptr<folder_listing> data;
+};
+
+safe_ptr<media_catalog> create_media_catalog(filesystem_monitor_factory& monitor_factory, const safe_ptr<core::media_info_repository>& media_info_repo);
 	
 class ChannelGridCommand : public AMCPCommandBase<false, 0>
 {
@@ -51,6 +64,12 @@ class DiagnosticsCommand : public AMCPCommandBase<false, 0>
 	bool DoExecute();
 };
 
+class TraceCommand : public AMCPCommandBase<true, 0>
+{
+	std::wstring print() const { return L"TraceCommand";}
+	bool DoExecute();
+};
+
 class CallCommand : public AMCPCommandBase<true, 1>
 {
 	std::wstring print() const { return L"CallCommand";}
@@ -89,6 +108,7 @@ class RemoveCommand : public AMCPCommandBase<true, 0>
 class SwapCommand : public AMCPCommandBase<true, 1>
 {
 	std::wstring print() const { return L"SwapCommand";}
+	std::vector<int> GetLayerIndices(int defaultValue);
 	bool DoExecute();
 };
 
@@ -27,6 +27,8 @@
 #include "../util/AsyncEventServer.h"
 #include "AMCPCommandsImpl.h"
 
+#include <common/env.h>
+
 #include <stdio.h>
 #include <crtdbg.h>
 #include <string.h>
@@ -48,6 +50,12 @@ using IO::ClientInfoPtr;
 
 const std::wstring AMCPProtocolStrategy::MessageDelimiter = TEXT("\r\n");
 
+template<typename T>
+AMCPCommandPtr CreateCommand()
+{
+	return std::make_shared<T>();
+}
+
 inline std::shared_ptr<core::video_channel> GetChannelSafe(unsigned int index, const std::vector<safe_ptr<core::video_channel>>& channels)
 {
 	return index < channels.size() ? std::shared_ptr<core::video_channel>(channels[index]) : nullptr;
@@ -56,13 +64,16 @@ inline std::shared_ptr<core::video_channel> GetChannelSafe(unsigned int index, c
 AMCPProtocolStrategy::AMCPProtocolStrategy(
 		const std::vector<safe_ptr<core::video_channel>>& channels,
 		const std::vector<safe_ptr<core::recorder>>& recorders,
-		const safe_ptr<core::media_info_repository>& media_info_repo
+		const safe_ptr<core::media_info_repository>& media_info_repo,
+		const std::shared_ptr<media_catalog>& catalog
 )
 	: channels_(channels)
 	, recorders_(recorders)
 	, media_info_repo_(media_info_repo)
+	, media_catalog_(catalog)
+	, commandThreads_(env::properties().get(L"configuration.amcp.command-threads", 4))
 {
-	AMCPCommandQueuePtr pGeneralCommandQueue(new AMCPCommandQueue());
+	AMCPCommandQueuePtr pGeneralCommandQueue(new AMCPCommandQueue(L"amcp general", commandThreads_));
 	commandQueues_.push_back(pGeneralCommandQueue);
 
 
@@ -70,15 +81,39 @@ AMCPProtocolStrategy::AMCPProtocolStrategy(
 	unsigned int index = -1;
 	//Create a commandpump for each video_channel
 	while((pChannel = GetChannelSafe(++index, channels_)) != 0) {
-		AMCPCommandQueuePtr pChannelCommandQueue(new AMCPCommandQueue());
-		std::wstring title = TEXT("video_channel ");
-
-		//HACK: Perform real conversion from int to string
-		TCHAR num = TEXT('1')+static_cast<TCHAR>(index);
-		title += num;
+		std::wstring title = L"amcp video_channel " + boost::lexical_cast<std::wstring>(index + 1);
+		AMCPCommandQueuePtr pChannelCommandQueue(new AMCPCommandQueue(title, commandThreads_));
 		
 		commandQueues_.push_back(pChannelCommandQueue);
 	}
+
+	commandFactories_[L"MIXER"]			= &CreateCommand<MixerCommand>;
+	commandFactories_[L"DIAG"]			= &CreateCommand<DiagnosticsCommand>;
+	commandFactories_[L"TRACE"]			= &CreateCommand<TraceCommand>;
+	commandFactories_[L"CHANNEL_GRID"]	= &CreateCommand<ChannelGridCommand>;
+	commandFactories_[L"CALL"]			= &CreateCommand<CallCommand>;
+	commandFactories_[L"SWAP"]			= &CreateCommand<SwapCommand>;
+	commandFactories_[L"ROUTE"]			= &CreateCommand<RouteCommand>;
+	commandFactories_[L"LOAD"]			= &CreateCommand<LoadCommand>;
+	commandFactories_[L"LOADBG"]		= &CreateCommand<LoadbgCommand>;
+	commandFactories_[L"ADD"]			= &CreateCommand<AddCommand>;
+	commandFactories_[L"REMOVE"]		= &CreateCommand<RemoveCommand>;
+	commandFactories_[L"PAUSE"]			= &CreateCommand<PauseCommand>;
+	commandFactories_[L"PLAY"]			= &CreateCommand<PlayCommand>;
+	commandFactories_[L"STOP"]			= &CreateCommand<StopCommand>;
+	commandFactories_[L"CLEAR"]			= &CreateCommand<ClearCommand>;
+	commandFactories_[L"PRINT"]			= &CreateCommand<PrintCommand>;
+	commandFactories_[L"LOG"]			= &CreateCommand<LogCommand>;
+	commandFactories_[L"CG"]			= &CreateCommand<CGCommand>;
+	commandFactories_[L"DATA"]			= &CreateCommand<DataCommand>;
+	commandFactories_[L"CAPTURE"]		= &CreateCommand<CaptureCommand>;
+	commandFactories_[L"RECORDER"]		= &CreateCommand<RecorderCommand>;
+	commandFactories_[L"CINF"]			= &CreateCommand<CinfCommand>;
+	commandFactories_[L"INFO"]			= [this] () -> AMCPCommandPtr { return std::make_shared<InfoCommand>(channels_, recorders_); };
+	commandFactories_[L"CLS"]			= &CreateCommand<ClsCommand>;
+	commandFactories_[L"TLS"]			= &CreateCommand<TlsCommand>;
+	commandFactories_[L"VERSION"]		= &CreateCommand<VersionCommand>;
+	commandFactories_[L"BYE"]			= &CreateCommand<ByeCommand>;
 }
 
 AMCPProtocolStrategy::~AMCPProtocolStrategy() {
@@ -86,53 +121,62 @@ AMCPProtocolStrategy::~AMCPProtocolStrategy() {
 
 void AMCPProtocolStrategy::Parse(const TCHAR* pData, int charCount, ClientInfoPtr pClientInfo)
 {
-	size_t pos;
-	size_t oldLength = pClientInfo->currentMessage_.length();
+	auto& buffer = pClientInfo->currentMessage_;
 
-	if(pClientInfo->currentMessage_.capacity() < (oldLength + charCount))
-		pClientInfo->currentMessage_.reserve(oldLength + 8192 * 4);
+	if(buffer.empty())
+	{
+		// Complete messages are processed straight from the received data, only an incomplete message at the end is buffered.
+		auto consumed = ProcessMessages(pData, pData + charCount, 0, pClientInfo);
+		buffer.append(pData + consumed, charCount - consumed);
+		return;
+	}
 
-	pClientInfo->currentMessage_.append(pData, charCount);
+	// The delimiter may have been split between the buffered data and the received data.
+	std::size_t searchOffset = buffer.size() > MessageDelimiter.size()-1 ? buffer.size() - (MessageDelimiter.size()-1) : 0;
+	buffer.append(pData, charCount);
 
-	while(true) {
-		pos = pClientInfo->currentMessage_.find(MessageDelimiter, (oldLength>(MessageDelimiter.size()-1)) ? oldLength-(MessageDelimiter.size()-1) : 0);
-		if(pos != std::wstring::npos)
-		{
-			std::wstring message = pClientInfo->currentMessage_.substr(0,pos);
+	auto consumed = ProcessMessages(buffer.data(), buffer.data() + buffer.size(), searchOffset, pClientInfo);
+	buffer.erase(0, consumed);
+}
 
-			//This is where a complete message gets taken care of
-			if(message.length() > 0) {
-				ProcessMessage(message, pClientInfo);
-			}
+// Processes each complete message in [begin, end) in place. Returns the number of characters consumed.
+std::size_t AMCPProtocolStrategy::ProcessMessages(const wchar_t* begin, const wchar_t* end, std::size_t searchOffset, ClientInfoPtr& pClientInfo)
+{
+	std::size_t consumed = 0;
+	const wchar_t* searchFrom = begin + searchOffset;
 
-			std::size_t nextStartPos = pos + MessageDelimiter.length();
-			if(nextStartPos < pClientInfo->currentMessage_.length())
-				pClientInfo->currentMessage_ = pClientInfo->currentMessage_.substr(nextStartPos);
-			else {
-				pClientInfo->currentMessage_.clear();
-				break;
-			}
-		}
-		else
-		{
+	while(true)
+	{
+		auto pos = std::search(searchFrom, end, MessageDelimiter.begin(), MessageDelimiter.end());
+		if(pos == end)
 			break;
-		}
+
+		//This is where a complete message gets taken care of
+		if(pos != begin + consumed)
+			ProcessMessage(begin + consumed, pos, pClientInfo);
+
+		consumed = (pos - begin) + MessageDelimiter.size();
+		searchFrom = begin + consumed;
 	}
+
+	return consumed;
 }
 
-void AMCPProtocolStrategy::ProcessMessage(const std::wstring& message, ClientInfoPtr& pClientInfo)
+void AMCPProtocolStrategy::ProcessMessage(const wchar_t* begin, const wchar_t* end, ClientInfoPtr& pClientInfo)
 {	
-	if(message.length() < 512)
-		CASPAR_LOG(info) << L"Received message from " << pClientInfo->print() << ": " << message << L"\\r\\n";
+	const std::size_t length = end - begin;
+
+	if(length < 512)
+		CASPAR_LOG(info) << L"Received message from " << pClientInfo->print() << ": " << std::wstring(begin, end) << L"\\r\\n";
 	else
-		CASPAR_LOG(info) << L"Received long message from " << pClientInfo->print() << ": " << message.substr(0, 510) << " [...]\\r\\n";
+		CASPAR_LOG(info) << L"Received long message from " << pClientInfo->print() << ": " << std::wstring(begin, begin + 510) << " [...]\\r\\n";
 	
 	bool bError = true;
 	MessageParserState state = New;
 
 	AMCPCommandPtr pCommand;
 
-	pCommand = InterpretCommandString(message, &state);
+	pCommand = InterpretCommandString(begin, end, &state);
 
 	if(pCommand != 0) {
 		pCommand->SetClientInfo(pClientInfo);	
@@ -147,7 +191,7 @@ void AMCPProtocolStrategy::ProcessMessage(const std::wstring& message, ClientInf
 		switch(state)
 		{
 		case GetCommand:
-			answer << TEXT("400 ERROR\r\n") + message << "\r\n";
+			answer << TEXT("400 ERROR\r\n") << std::wstring(begin, end) << "\r\n";
 			break;
 		case GetChannel:
 			answer << TEXT("401 ERROR\r\n");
@@ -163,7 +207,7 @@ void AMCPProtocolStrategy::ProcessMessage(const std::wstring& message, ClientInf
 	}
 }
 
-AMCPCommandPtr AMCPProtocolStrategy::InterpretCommandString(const std::wstring& message, MessageParserState* pOutState)
+AMCPCommandPtr AMCPProtocolStrategy::InterpretCommandString(const wchar_t* begin, const wchar_t* end, MessageParserState* pOutState)
 {
 	std::vector<std::wstring> tokens;
 	unsigned int currentToken = 0;
@@ -172,7 +216,7 @@ AMCPCommandPtr AMCPProtocolStrategy::InterpretCommandString(const std::wstring&
 	AMCPCommandPtr pCommand;
 	MessageParserState state = New;
 
-	std::size_t tokensInMessage = TokenizeMessage(message, &tokens);
+	std::size_t tokensInMessage = TokenizeMessage(begin, end, &tokens);
 
 	//parse the message one token at the time
 	while(currentToken < tokensInMessage)
@@ -202,6 +246,7 @@ AMCPCommandPtr AMCPProtocolStrategy::InterpretCommandString(const std::wstring&
 				pCommand->SetChannels(channels_);
 				pCommand->SetRecorders(recorders_);
 				pCommand->SetMediaInfoRepo(media_info_repo_);
+				pCommand->SetMediaCatalog(media_catalog_);
 				//Set scheduling
 				if(commandSwitch.size() > 0) {
 					transform(commandSwitch.begin(), commandSwitch.end(), commandSwitch.begin(), toupper);
@@ -221,7 +266,7 @@ AMCPCommandPtr AMCPProtocolStrategy::InterpretCommandString(const std::wstring&
 				int parameterCount=0;
 				while(currentToken<tokensInMessage)
 				{
-					pCommand->AddParameter(tokens[currentToken++]);
+					pCommand->AddParameter(std::move(tokens[currentToken++]));
 					++parameterCount;
 				}
 
@@ -308,56 +353,41 @@ AMCPCommandPtr AMCPProtocolStrategy::CommandFactory(const std::wstring& str)
 {
 	std::wstring s = str;
 	transform(s.begin(), s.end(), s.begin(), toupper);
-	
-	if	   (s == TEXT("MIXER"))			return std::make_shared<MixerCommand>();
-	else if(s == TEXT("DIAG"))			return std::make_shared<DiagnosticsCommand>();
-	else if(s == TEXT("CHANNEL_GRID"))	return std::make_shared<ChannelGridCommand>();
-	else if(s == TEXT("CALL"))			return std::make_shared<CallCommand>();
-	else if(s == TEXT("SWAP"))			return std::make_shared<SwapCommand>();
-	else if(s == TEXT("ROUTE"))			return std::make_shared<RouteCommand>();
-	else if(s == TEXT("LOAD"))			return std::make_shared<LoadCommand>();
-	else if(s == TEXT("LOADBG"))		return std::make_shared<LoadbgCommand>();
-	else if(s == TEXT("ADD"))			return std::make_shared<AddCommand>();
-	else if(s == TEXT("REMOVE"))		return std::make_shared<RemoveCommand>();
-	else if(s == TEXT("PAUSE"))			return std::make_shared<PauseCommand>();
-	else if(s == TEXT("PLAY"))			return std::make_shared<PlayCommand>();
-	else if(s == TEXT("STOP"))			return std::make_shared<StopCommand>();
-	else if(s == TEXT("CLEAR"))			return std::make_shared<ClearCommand>();
-	else if(s == TEXT("PRINT"))			return std::make_shared<PrintCommand>();
-	else if(s == TEXT("LOG"))			return std::make_shared<LogCommand>();
-	else if(s == TEXT("CG"))			return std::make_shared<CGCommand>();
-	else if(s == TEXT("DATA"))			return std::make_shared<DataCommand>();
-	else if(s == TEXT("CAPTURE"))		return std::make_shared<CaptureCommand>();
-	else if(s == TEXT("RECORDER"))		return std::make_shared<RecorderCommand>();
-	else if(s == TEXT("CINF"))			return std::make_shared<CinfCommand>();
-	else if(s == TEXT("INFO"))			return std::make_shared<InfoCommand>(channels_, recorders_);
-	else if(s == TEXT("CLS"))			return std::make_shared<ClsCommand>();
-	else if(s == TEXT("TLS"))			return std::make_shared<TlsCommand>();
-	else if(s == TEXT("VERSION"))		return std::make_shared<VersionCommand>();
-	else if(s == TEXT("BYE"))			return std::make_shared<ByeCommand>();
-	//else if(s == TEXT("MONITOR"))
-	//{
-	//	result = AMCPCommandPtr(new MonitorCommand());
-	//}
-	return nullptr;
+
+	auto it = commandFactories_.find(s);
+
+	return it != commandFactories_.end() ? it->second() : nullptr;
 }
 
-std::size_t AMCPProtocolStrategy::TokenizeMessage(const std::wstring& message, std::vector<std::wstring>* pTokenVector)
+std::size_t AMCPProtocolStrategy::TokenizeMessage(const wchar_t* begin, const wchar_t* end, std::vector<std::wstring>* pTokenVector)
 {
 	//split on whitespace but keep strings within quotationmarks
 	//treat \ as the start of an escape-sequence: the following char will indicate what to actually put in the string
+	//characters between the special ones are appended in runs, large payloads are copied once
 
 	std::wstring currentToken;
+	bool inQuote = false;
+	const wchar_t* run = begin;
 
-	char inQuote = 0;
-	bool getSpecialCode = false;
-
-	for(unsigned int charIndex=0; charIndex<message.size(); ++charIndex)
+	for(const wchar_t* it = begin; it != end; ++it)
 	{
-		if(getSpecialCode)
+		const wchar_t c = *it;
+
+		if(c != TEXT('\\') && c != TEXT('\"') && (c != TEXT(' ') || inQuote))
+			continue;
+
+		currentToken.append(run, it);
+
+		if(c == TEXT('\\'))
 		{
+			if(++it == end)
+			{
+				run = end;
+				break;
+			}
+
 			//insert code-handling here
-			switch(message[charIndex])
+			switch(*it)
 			{
 			case TEXT('\\'):
 				currentToken += TEXT("\\");
@@ -371,46 +401,27 @@ std::size_t AMCPProtocolStrategy::TokenizeMessage(const std::wstring& message, s
 			default:
 				break;
 			};
-			getSpecialCode = false;
-			continue;
-		}
 
-		if(message[charIndex]==TEXT('\\'))
-		{
-			getSpecialCode = true;
+			run = it + 1;
 			continue;
 		}
 
-		if(message[charIndex]==' ' && inQuote==false)
-		{
-			if(currentToken.size()>0)
-			{
-				pTokenVector->push_back(currentToken);
-				currentToken.clear();
-			}
-			continue;
-		}
+		if(c == TEXT('\"'))
+			inQuote = !inQuote;
 
-		if(message[charIndex]==TEXT('\"'))
+		if(!currentToken.empty())
 		{
-			inQuote ^= 1;
-
-			if(currentToken.size()>0)
-			{
-				pTokenVector->push_back(currentToken);
-				currentToken.clear();
-			}
-			continue;
+			pTokenVector->push_back(std::move(currentToken));
+			currentToken.clear();
 		}
 
-		currentToken += message[charIndex];
+		run = it + 1;
 	}
 
-	if(currentToken.size()>0)
-	{
-		pTokenVector->push_back(currentToken);
-		currentToken.clear();
-	}
+	currentToken.append(run, end);
+
+	if(!currentToken.empty())
+		pTokenVector->push_back(std::move(currentToken));
 
 	return pTokenVector->size();
 }
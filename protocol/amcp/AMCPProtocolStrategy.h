@@ -29,6 +29,9 @@
 #include "AMCPCommand.h"
 #include "AMCPCommandQueue.h"
 
+#include <functional>
+#include <unordered_map>
+
 #include <boost/noncopyable.hpp>
 #include <boost/thread/future.hpp>
 
@@ -52,7 +55,8 @@ public:
 	AMCPProtocolStrategy(
 			const std::vector<safe_ptr<core::video_channel>>& channels,
 			const std::vector<safe_ptr<core::recorder>>& recorders,
-			const safe_ptr<core::media_info_repository>& media_info_repo
+			const safe_ptr<core::media_info_repository>& media_info_repo,
+			const std::shared_ptr<media_catalog>& catalog = nullptr
 		);
 	virtual ~AMCPProtocolStrategy();
 
@@ -61,13 +65,17 @@ public:
 		return CP_UTF8;
 	}
 
-	AMCPCommandPtr InterpretCommandString(const std::wstring& str, MessageParserState* pOutState=0);
+	AMCPCommandPtr InterpretCommandString(const std::wstring& str, MessageParserState* pOutState=0) {
+		return InterpretCommandString(str.data(), str.data() + str.size(), pOutState);
+	}
+	AMCPCommandPtr InterpretCommandString(const wchar_t* begin, const wchar_t* end, MessageParserState* pOutState=0);
 
 private:
 	friend class AMCPCommand;
 
-	void ProcessMessage(const std::wstring& message, IO::ClientInfoPtr& pClientInfo);
-	std::size_t TokenizeMessage(const std::wstring& message, std::vector<std::wstring>* pTokenVector);
+	std::size_t ProcessMessages(const wchar_t* begin, const wchar_t* end, std::size_t searchOffset, IO::ClientInfoPtr& pClientInfo);
+	void ProcessMessage(const wchar_t* begin, const wchar_t* end, IO::ClientInfoPtr& pClientInfo);
+	std::size_t TokenizeMessage(const wchar_t* begin, const wchar_t* end, std::vector<std::wstring>* pTokenVector);
 	AMCPCommandPtr CommandFactory(const std::wstring& str);
 
 	bool QueueCommand(AMCPCommandPtr);
@@ -75,7 +83,10 @@ private:
 	std::vector<safe_ptr<core::video_channel>> channels_;
 	std::vector<safe_ptr<core::recorder>> recorders_;
 	safe_ptr<core::media_info_repository> media_info_repo_;
+	std::shared_ptr<media_catalog> media_catalog_;
+	const int commandThreads_;
 	std::vector<AMCPCommandQueuePtr> commandQueues_;
+	std::unordered_map<std::wstring, std::function<AMCPCommandPtr ()>> commandFactories_;
 	static const std::wstring MessageDelimiter;
 };
 
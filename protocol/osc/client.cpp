@@ -33,6 +33,7 @@
 
 #include <core/monitor/monitor.h>
 
+#include <cstring>
 #include <functional>
 #include <vector>
 #include <unordered_map>
@@ -42,6 +43,8 @@
 #include <boost/bind.hpp>
 #include <boost/thread.hpp>
 
+#include <tbb/atomic.h>
+#include <tbb/concurrent_queue.h>
 #include <tbb/spin_mutex.h>
 #include <tbb/cache_aligned_allocator.h>
 
@@ -85,12 +88,13 @@ struct param_visitor : public boost::static_visitor<void>
 	void operator()(const std::vector<int8_t>& value)	{o << ::osc::Blob(value.data(), static_cast<unsigned long>(value.size()));}
 };
 
-void write_osc_event(byte_vector& destination, const core::monitor::message& e)
+// Serialized on the stack, destination only grows to the size of the largest message written to it.
+void write_osc_event(byte_vector& destination, const std::string& path, const core::monitor::message& e)
 {		
-	destination.resize(4096);
+	char buffer[4096];
 
-	::osc::OutboundPacketStream o(reinterpret_cast<char*>(destination.data()), static_cast<unsigned long>(destination.size()));
-	o << ::osc::BeginMessage(e.path().c_str());
+	::osc::OutboundPacketStream o(buffer, static_cast<unsigned long>(sizeof(buffer)));
+	o << ::osc::BeginMessage(path.c_str());
 				
 	param_visitor<decltype(o)> param_visitor(o);
 	BOOST_FOREACH(const auto& data, e.data())
@@ -99,6 +103,7 @@ void write_osc_event(byte_vector& destination, const core::monitor::message& e)
 	o << ::osc::EndMessage;
 		
 	destination.resize(o.Size());
+	std::memcpy(destination.data(), buffer, o.Size());
 }
 
 byte_vector write_osc_bundle_start()
@@ -127,6 +132,19 @@ void write_osc_bundle_element_start(byte_vector& destination, const byte_vector&
 #endif
 }
 
+// A serialized message. Recycled through a free list so that neither the path
+// nor the packet buffer has to be allocated again once the set of paths is known.
+struct pending_message
+{
+	std::string	path;
+	byte_vector	bytes;
+};
+
+// Updates waiting for the sender thread. A frame of 8 channels with 20 layers
+// is about 2000 updates, beyond this the sender has fallen behind and further
+// updates are dropped instead of queued.
+const int MAX_PENDING_UPDATES = 16384;
+
 struct client::impl : public std::enable_shared_from_this<client::impl>, core::monitor::sink
 {
 	std::shared_ptr<boost::asio::io_service>		service_;
@@ -134,9 +152,13 @@ struct client::impl : public std::enable_shared_from_this<client::impl>, core::m
 	tbb::spin_mutex									endpoints_mutex_;
 	std::map<udp::endpoint, int>					reference_counts_by_endpoint_;
 
-	std::unordered_map<std::string, byte_vector>	updates_;
-	boost::mutex									updates_mutex_;								
-	boost::condition_variable						updates_cond_;
+	tbb::concurrent_queue<pending_message*>			updates_;
+	tbb::concurrent_queue<pending_message*>			free_updates_;
+	tbb::atomic<int>								pending_updates_;
+	tbb::atomic<bool>								is_dropping_;
+	tbb::atomic<bool>								is_signalled_;
+	boost::mutex									signal_mutex_;								
+	boost::condition_variable						signal_cond_;
 
 	tbb::atomic<bool>								is_running_;
 
@@ -146,17 +168,33 @@ public:
 	impl(std::shared_ptr<boost::asio::io_service> service)
 		: service_(std::move(service))
 		, socket_(*service_, udp::v4())
-		, thread_(boost::bind(&impl::run, this))
 	{
+		pending_updates_	= 0;
+		is_dropping_		= false;
+		is_signalled_		= false;
+		is_running_			= true;
+
+		thread_ = boost::thread(boost::bind(&impl::run, this));
 	}
 
 	~impl()
 	{
 		is_running_ = false;
 
-		updates_cond_.notify_one();
+		{
+			boost::lock_guard<boost::mutex> lock(signal_mutex_);
+			signal_cond_.notify_one();
+		}
 
 		thread_.join();
+
+		pending_message* pending;
+
+		while (updates_.try_pop(pending))
+			delete pending;
+
+		while (free_updates_.try_pop(pending))
+			delete pending;
 	}
 
 	std::shared_ptr<void> get_subscription_token(
@@ -187,21 +225,44 @@ public:
 		});
 	}
 private:
+	// Called from the channel threads. Serializes the message without taking a lock, the sender thread is only woken once per batch.
 	void propagate(const core::monitor::message& msg)
 	{
-		boost::lock_guard<boost::mutex> lock(updates_mutex_);
+		if (pending_updates_.fetch_and_increment() >= MAX_PENDING_UPDATES)
+		{
+			--pending_updates_;
+
+			if (!is_dropping_.fetch_and_store(true))
+				CASPAR_LOG(warning) << L"[osc] Sender is behind, dropping updates.";
+
+			return;
+		}
+
+		pending_message* pending = nullptr;
+
+		if (!free_updates_.try_pop(pending))
+			pending = new pending_message;
 
 		try 
 		{
-			write_osc_event(updates_[msg.path()], msg);
+			msg.write_path(pending->path);
+			write_osc_event(pending->bytes, pending->path, msg);
 		}
 		catch(...)
 		{
 			CASPAR_LOG_CURRENT_EXCEPTION();
-			updates_.erase(msg.path());
+			free_updates_.push(pending);
+			--pending_updates_;
+			return;
 		}
 
-		updates_cond_.notify_one();
+		updates_.push(pending);
+
+		if (!is_signalled_.fetch_and_store(true))
+		{
+			boost::lock_guard<boost::mutex> lock(signal_mutex_);
+			signal_cond_.notify_one();
+		}
 	}
 
 	template<typename T>
@@ -219,29 +280,48 @@ private:
 		// http://stackoverflow.com/questions/14993000/the-most-reliable-and-efficient-udp-packet-size
 		const int SAFE_DATAGRAM_SIZE = 508;
 
+		// The latest update of each path, entries are kept between batches so that known paths are not allocated again.
+		std::unordered_map<std::string, pending_message*> latest_by_path;
+		std::vector<pending_message**> batch;
+
 		try
 		{
-			is_running_ = true;
-
-			std::unordered_map<std::string, byte_vector> updates;
 			std::vector<udp::endpoint> destinations;
 			const byte_vector bundle_header = write_osc_bundle_start();
 			std::vector<byte_vector> element_headers;
+			std::vector<boost::asio::const_buffers_1> buffers;
 
 			while (is_running_)
 			{		
-				updates.clear();
 				destinations.clear();
 
 				{			
-					boost::unique_lock<boost::mutex> cond_lock(updates_mutex_);
+					boost::unique_lock<boost::mutex> cond_lock(signal_mutex_);
 
-					if (updates_.empty())
-						updates_cond_.wait(cond_lock);
+					while (!is_signalled_ && is_running_)
+						signal_cond_.wait(cond_lock);
 
-					std::swap(updates, updates_);
+					is_signalled_ = false;
 				}
 
+				pending_message* pending;
+
+				while (updates_.try_pop(pending))
+				{
+					--pending_updates_;
+
+					auto& latest = latest_by_path[pending->path];
+
+					if (latest)
+						free_updates_.push(latest);
+					else
+						batch.push_back(&latest);
+
+					latest = pending;
+				}
+
+				is_dropping_ = false;
+
 				{
 					tbb::spin_mutex::scoped_lock lock(endpoints_mutex_);
 
@@ -249,47 +329,63 @@ private:
 						destinations.push_back(endpoint.first);
 				}
 
-				if (destinations.empty())
-					continue;
+				if (!destinations.empty())
+				{
+					buffers.clear();
+					element_headers.resize(
+							std::max(element_headers.size(), batch.size()));
 
-				std::vector<boost::asio::const_buffers_1> buffers;
-				element_headers.resize(
-						std::max(element_headers.size(), updates.size()));
+					int i = 0;
+					int datagram_size = bundle_header.size();
+					buffers.push_back(boost::asio::buffer(bundle_header));
 
-				int i = 0;
-				int datagram_size = bundle_header.size();
-				buffers.push_back(boost::asio::buffer(bundle_header));
+					BOOST_FOREACH(auto slot, batch)
+					{
+						const auto& bytes = (*slot)->bytes;
 
-				BOOST_FOREACH(const auto& slot, updates)
-				{
-					write_osc_bundle_element_start(element_headers[i], slot.second);
-					const auto& headers = element_headers;
+						write_osc_bundle_element_start(element_headers[i], bytes);
+						const auto& headers = element_headers;
 
-					auto size_of_element = headers[i].size() + slot.second.size();
+						auto size_of_element = headers[i].size() + bytes.size();
 	
-					if (datagram_size + size_of_element >= SAFE_DATAGRAM_SIZE)
-					{
-						do_send(buffers, destinations);
-						buffers.clear();
-						buffers.push_back(boost::asio::buffer(bundle_header));
-						datagram_size = bundle_header.size();
+						if (datagram_size + size_of_element >= SAFE_DATAGRAM_SIZE)
+						{
+							do_send(buffers, destinations);
+							buffers.clear();
+							buffers.push_back(boost::asio::buffer(bundle_header));
+							datagram_size = bundle_header.size();
+						}
+
+						buffers.push_back(boost::asio::buffer(headers[i]));
+						buffers.push_back(boost::asio::buffer(bytes));
+
+						datagram_size += size_of_element;
+						++i;
 					}
+			
+					if (buffers.size() > 1)
+						do_send(buffers, destinations);
+				}
 
-					buffers.push_back(boost::asio::buffer(headers[i]));
-					buffers.push_back(boost::asio::buffer(slot.second));
-
-					datagram_size += size_of_element;
-					++i;
+				BOOST_FOREACH(auto slot, batch)
+				{
+					free_updates_.push(*slot);
+					*slot = nullptr;
 				}
-			
-				if (!buffers.empty())
-					do_send(buffers, destinations);
+
+				batch.clear();
 			}
 		}
 		catch (...)
 		{
 			CASPAR_LOG_CURRENT_EXCEPTION();
 		}
+
+		BOOST_FOREACH(auto& latest, latest_by_path)
+		{
+			if (latest.second)
+				free_updates_.push(latest.second);
+		}
 	}
 };
 
@@ -19,617 +19,587 @@
 * Author: Nicklas P Andersson
 */
 
- 
-// AsyncEventServer.cpp: implementation of the AsyncEventServer class.
-//
-//////////////////////////////////////////////////////////////////////
-
 #include "../stdafx.h"
 
 #include "AsyncEventServer.h"
-#include "SocketInfo.h"
 
 #include <common/log/log.h>
+#include <common/exception/win32_exception.h>
+
+#include <array>
+#include <set>
 #include <string>
-#include <algorithm>
+#include <vector>
+
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/asio.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 
-#if defined(_MSC_VER)
-#pragma warning (push, 1) // TODO: Legacy code, just disable warnings, will replace with boost::asio in future
-#endif
+#include <tbb/mutex.h>
+#include <tbb/spin_mutex.h>
 
-namespace caspar { namespace IO {
-	
-#define CASPAR_MAXIMUM_SOCKET_CLIENTS	(MAXIMUM_WAIT_OBJECTS-1)	
-
-long AsyncEventServer::instanceCount_ = 0;
-//////////////////////////////
-// AsyncEventServer constructor
-// PARAMS: port(TCP-port the server should listen to)
-// COMMENT: Initializes the WinSock2 library
-AsyncEventServer::AsyncEventServer(const safe_ptr<IProtocolStrategy>& pProtocol, int port) : port_(port), pProtocolStrategy_(pProtocol)
-{
-	if(instanceCount_ == 0) {
-		WSADATA wsaData;
-		if(WSAStartup(MAKEWORD(2,2), &wsaData) != NO_ERROR)
-			throw std::exception("Error initializing WinSock2");
-		else {
-			CASPAR_LOG(info) << "WinSock2 Initialized.";
-		}
-	}
+using boost::asio::ip::tcp;
 
-	InterlockedIncrement(&instanceCount_);
-}
+namespace caspar { namespace IO {
 
-/////////////////////////////
-// AsyncEventServer destructor
-AsyncEventServer::~AsyncEventServer() {
-	Stop();
+namespace {
 
-	InterlockedDecrement(&instanceCount_);
-	if(instanceCount_ == 0)
-		WSACleanup();
-}
+const unsigned int UTF8_CODEPAGE = 65001;
+const wchar_t REPLACEMENT_CHARACTER = 0xFFFD;
 
-void AsyncEventServer::SetClientDisconnectHandler(ClientDisconnectEvent handler) {
-	socketInfoCollection_.onSocketInfoRemoved = handler;
+void append_code_point(std::wstring& destination, unsigned int code_point)
+{
+	if (code_point > 0x10FFFF || (code_point >= 0xD800 && code_point < 0xE000))
+		destination.push_back(REPLACEMENT_CHARACTER);
+	else if (code_point > 0xFFFF && sizeof(wchar_t) == 2)
+	{
+		code_point -= 0x10000;
+		destination.push_back(static_cast<wchar_t>(0xD800 + (code_point >> 10)));
+		destination.push_back(static_cast<wchar_t>(0xDC00 + (code_point & 0x3FF)));
+	}
+	else
+		destination.push_back(static_cast<wchar_t>(code_point));
 }
 
-void AsyncEventServer::add_lifecycle_factory(const lifecycle_factory_t& factory)
+// Decodes received data. Protocols use either UTF-8 or ISO 8859-1. A UTF-8 sequence split between two reads is kept in pending until the rest arrives.
+void decode(unsigned int codepage, std::string& pending, const char* data, std::size_t size, std::wstring& destination)
 {
-	tbb::mutex::scoped_lock lock(mutex_);
+	destination.clear();
 
-	lifecycle_factories_.push_back(factory);
-}
+	if (codepage != UTF8_CODEPAGE)
+	{
+		destination.reserve(size);
 
-//////////////////////////////
-// AsyncEventServer::Start
-// RETURNS: true at successful startup
-bool AsyncEventServer::Start() {
-	if(listenThread_.IsRunning())
-		return false;
+		for (std::size_t n = 0; n < size; ++n)
+			destination.push_back(static_cast<unsigned char>(data[n]));
 
-	socketInfoCollection_.Clear();
-
-	sockaddr_in sockAddr;
-	ZeroMemory(&sockAddr, sizeof(sockAddr));
-	sockAddr.sin_family = AF_INET;
-	sockAddr.sin_addr.s_addr = INADDR_ANY;
-	sockAddr.sin_port = htons(port_);
-	
-	SOCKET listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if(listenSocket == INVALID_SOCKET) {
-		CASPAR_LOG(error) << "Failed to create listenSocket";
-		return false;
+		return;
 	}
-	
-	pListenSocketInfo_ = SocketInfoPtr(new SocketInfo(listenSocket, this));
 
-	if(WSAEventSelect(pListenSocketInfo_->socket_, pListenSocketInfo_->event_, FD_ACCEPT|FD_CLOSE) == SOCKET_ERROR) {
-		CASPAR_LOG(error) << "Failed to enter EventSelect-mode for listenSocket";
-		return false;
-	}
+	pending.append(data, size);
 
-	if(bind(pListenSocketInfo_->socket_, (sockaddr*)&sockAddr, sizeof(sockAddr)) == SOCKET_ERROR) {
-		CASPAR_LOG(error) << "Failed to bind listenSocket";
-		return false;
-	}
+	const auto bytes	= reinterpret_cast<const unsigned char*>(pending.data());
+	const auto end		= pending.size();
+	std::size_t n		= 0;
 
-	if(listen(pListenSocketInfo_->socket_, SOMAXCONN) == SOCKET_ERROR) {
-		CASPAR_LOG(error) << "Failed to listen";
-		return false;
-	}
+	destination.reserve(end);
 
-	socketInfoCollection_.AddSocketInfo(pListenSocketInfo_);
+	while (n < end)
+	{
+		const unsigned int lead = bytes[n];
+		const std::size_t length =
+				lead < 0x80				? 1 :
+				(lead & 0xE0) == 0xC0	? 2 :
+				(lead & 0xF0) == 0xE0	? 3 :
+				(lead & 0xF8) == 0xF0	? 4 : 0;
+
+		if (length == 1)
+		{
+			destination.push_back(static_cast<wchar_t>(lead));
+			++n;
+			continue;
+		}
 
-	//start thread: the entrypoint is Run(EVENT stopEvent)
-	if(!listenThread_.Start(this)) {
-		CASPAR_LOG(error) << "Failed to create ListenThread";
-		return false;
+		if (length == 0)
+		{
+			destination.push_back(REPLACEMENT_CHARACTER);
+			++n;
+			continue;
+		}
+
+		if (n + length > end)
+			break;
+
+		unsigned int code_point = lead & (0xFF >> (length + 1));
+		bool is_valid = true;
+
+		for (std::size_t i = 1; i < length && is_valid; ++i)
+		{
+			const unsigned int next = bytes[n + i];
+
+			is_valid = (next & 0xC0) == 0x80;
+			code_point = (code_point << 6) | (next & 0x3F);
+		}
+
+		if (is_valid)
+		{
+			append_code_point(destination, code_point);
+			n += length;
+		}
+		else
+		{
+			destination.push_back(REPLACEMENT_CHARACTER);
+			++n;
+		}
 	}
 
-	CASPAR_LOG(info) << "Listener successfully initialized";
-	return true;
+	pending.erase(0, n);
 }
 
-void AsyncEventServer::Run(HANDLE stopEvent)
+void encode(unsigned int codepage, const std::wstring& data, std::string& destination)
 {
-	WSANETWORKEVENTS networkEvents;
+	destination.clear();
+	destination.reserve(data.size());
 
-	HANDLE waitHandlesCopy[MAXIMUM_WAIT_OBJECTS];
-	waitHandlesCopy[0] = stopEvent;
-
-	while(true)	{
-		//Update local copy of the array of wait-handles if nessecery
-		if(socketInfoCollection_.IsDirty()) {
-			socketInfoCollection_.CopyCollectionToArray(&(waitHandlesCopy[1]), CASPAR_MAXIMUM_SOCKET_CLIENTS);
-			socketInfoCollection_.ClearDirty();
-		}
+	for (std::size_t n = 0; n < data.size(); ++n)
+	{
+		unsigned int code_point = data[n];
 
-		DWORD waitResult = WSAWaitForMultipleEvents(std::min<DWORD>(static_cast<DWORD>(socketInfoCollection_.Size()+1), MAXIMUM_WAIT_OBJECTS), waitHandlesCopy, FALSE, 1500, FALSE);
-		if(waitResult == WAIT_TIMEOUT)
+		if (codepage != UTF8_CODEPAGE)
+		{
+			destination.push_back(code_point < 0x100 ? static_cast<char>(code_point) : '?');
 			continue;
-		else if(waitResult == WAIT_FAILED)
-			break;
-		else {
-			DWORD eventIndex = waitResult - WAIT_OBJECT_0;
-
-			HANDLE waitEvent = waitHandlesCopy[eventIndex];
-			SocketInfoPtr pSocketInfo;
-
-			if(eventIndex == 0)	//stopEvent
-				break;
-			else if(socketInfoCollection_.FindSocketInfo(waitEvent, pSocketInfo)) {
-				WSAEnumNetworkEvents(pSocketInfo->socket_, waitEvent, &networkEvents);
-
-				if(networkEvents.lNetworkEvents & FD_ACCEPT) {
-					if(networkEvents.iErrorCode[FD_ACCEPT_BIT] == 0)
-						OnAccept(pSocketInfo);
-					else {
-						CASPAR_LOG(debug) << "OnAccept (ErrorCode: " << networkEvents.iErrorCode[FD_ACCEPT_BIT] << TEXT(")");
-						OnError(waitEvent, networkEvents.iErrorCode[FD_ACCEPT_BIT]);
-					}
-				}
-
-				if(networkEvents.lNetworkEvents & FD_CLOSE) {
-					if(networkEvents.iErrorCode[FD_CLOSE_BIT] == 0)
-						OnClose(pSocketInfo);
-					else {
-						CASPAR_LOG(debug) << "OnClose (ErrorCode: " << networkEvents.iErrorCode[FD_CLOSE_BIT] << TEXT(")");
-						OnError(waitEvent, networkEvents.iErrorCode[FD_CLOSE_BIT]);
-					}
-					continue;
-				}
+		}
 
-				if(networkEvents.lNetworkEvents & FD_READ) {
-					if(networkEvents.iErrorCode[FD_READ_BIT] == 0)
-						OnRead(pSocketInfo);
-					else {
-						CASPAR_LOG(debug) << "OnRead (ErrorCode: " << networkEvents.iErrorCode[FD_READ_BIT] << TEXT(")");
-						OnError(waitEvent, networkEvents.iErrorCode[FD_READ_BIT]);
-					}
-				}
+		if (sizeof(wchar_t) == 2 && code_point >= 0xD800 && code_point < 0xDC00 && n + 1 < data.size() &&
+			data[n + 1] >= 0xDC00 && data[n + 1] < 0xE000)
+		{
+			code_point = 0x10000 + ((code_point - 0xD800) << 10) + (data[n + 1] - 0xDC00);
+			++n;
+		}
 
-				if(networkEvents.lNetworkEvents & FD_WRITE) {
-					if(networkEvents.iErrorCode[FD_WRITE_BIT] == 0)
-						OnWrite(pSocketInfo);
-					else {
-						CASPAR_LOG(debug) << "OnWrite (ErrorCode: " << networkEvents.iErrorCode[FD_WRITE_BIT] << TEXT(")");
-						OnError(waitEvent, networkEvents.iErrorCode[FD_WRITE_BIT]);
-					}
-				}
-			}
-			else {
-				//Could not find the waitHandle in the SocketInfoCollection.
-				//It must have been removed during the last call to WSAWaitForMultipleEvents
-			}
+		if (code_point < 0x80)
+			destination.push_back(static_cast<char>(code_point));
+		else if (code_point < 0x800)
+		{
+			destination.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+			destination.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+		}
+		else if (code_point < 0x10000)
+		{
+			destination.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+			destination.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+			destination.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+		}
+		else
+		{
+			destination.push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+			destination.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+			destination.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+			destination.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
 		}
 	}
 }
 
-bool AsyncEventServer::OnUnhandledException(const std::exception& ex) throw() {
-	bool bDoRestart = true;
+}
 
-	try 
+struct AsyncEventServer::implementation
+{
+	class connection;
+
+	const int										port_;
+	const int										io_thread_count_;
+
+	boost::asio::io_service							service_;
+	std::unique_ptr<boost::asio::io_service::work>	work_;
+	boost::thread_group								threads_;
+	tcp::acceptor									acceptor_;
+	boost::asio::io_service::strand					parse_strand_;
+
+	tbb::spin_mutex									protocol_mutex_;
+	safe_ptr<IProtocolStrategy>						protocol_;
+
+	tbb::mutex										mutex_;
+	std::vector<lifecycle_factory_t>				lifecycle_factories_;
+	ClientDisconnectEvent							disconnect_handler_;
+	std::set<std::shared_ptr<connection>>			connections_;
+
+	implementation(const safe_ptr<IProtocolStrategy>& protocol, int port, int io_threads)
+		: port_(port)
+		, io_thread_count_(std::max(1, io_threads))
+		, acceptor_(service_)
+		, parse_strand_(service_)
+		, protocol_(protocol)
 	{
-		CASPAR_LOG(fatal) << "UNHANDLED EXCEPTION in TCPServers listeningthread. Message: " << ex.what();
 	}
-	catch(...)
+
+	~implementation()
 	{
-		bDoRestart = false;
+		stop();
 	}
 
-	return bDoRestart;
-}
+	safe_ptr<IProtocolStrategy> protocol()
+	{
+		tbb::spin_mutex::scoped_lock lock(protocol_mutex_);
+		return protocol_;
+	}
 
-///////////////////////////////
-// AsyncEventServer:Stop
-// COMMENT: Shuts down
-void AsyncEventServer::Stop()
+	bool start();
+	void stop();
+	void accept();
+	void on_closed(const std::shared_ptr<connection>& conn);
+};
+
+class AsyncEventServer::implementation::connection : public ClientInfo, public std::enable_shared_from_this<connection>
 {
-	//TODO: initiate shutdown on all clients connected
-//	for(int i=0; i < _totalActiveSockets; ++i) {
-//		shutdown(_pSocketInfo[i]->_socket, SD_SEND);
-//	}
+	AsyncEventServer::implementation&		server_;
+	tcp::socket								socket_;
+	boost::asio::io_service::strand			strand_;
+	std::wstring							host_;
+	unsigned int							codepage_;
+
+	std::array<char, 8192>					read_buffer_;
+	std::string								pending_bytes_;
+	std::wstring							decoded_;
+
+	std::vector<std::string>				send_queue_;
+	std::vector<std::string>				sending_;
+	std::vector<boost::asio::const_buffer>	send_buffers_;
+	bool									is_closing_;
+	bool									is_closed_;
+
+	std::vector<std::shared_ptr<void>>		lifecycle_bound_items_;
+public:
+	connection(AsyncEventServer::implementation& server)
+		: server_(server)
+		, socket_(server.service_)
+		, strand_(server.service_)
+		, codepage_(UTF8_CODEPAGE)
+		, is_closing_(false)
+		, is_closed_(false)
+	{
+	}
 
-	if(!listenThread_.Stop()) {
-		CASPAR_LOG(warning) << "Wait for listenThread timed out.";
+	tcp::socket& socket()
+	{
+		return socket_;
 	}
 
-	socketInfoCollection_.Clear();
-}
+	void start(const std::wstring& host, unsigned int codepage, const std::vector<std::shared_ptr<void>>& lifecycle_bound_items)
+	{
+		host_					= host;
+		codepage_				= codepage;
+		lifecycle_bound_items_	= lifecycle_bound_items;
 
-////////////////////////////////////////////////////////////////////
-//
-// MESSAGE HANDLERS   
-//
-////////////////////////////////////////////////////////////////////
-
-
-//////////////////////////////
-// AsyncEventServer::OnAccept
-// PARAMS: ...
-// COMMENT: Called when a new client connects
-bool AsyncEventServer::OnAccept(SocketInfoPtr& pSI) {
-	sockaddr_in	clientAddr;
-	int addrSize = sizeof(clientAddr);
-	SOCKET clientSocket = WSAAccept(pSI->socket_, (sockaddr*)&clientAddr, &addrSize, NULL, NULL);
-	if(clientSocket == INVALID_SOCKET) {
-		LogSocketError(TEXT("Accept"));
-		return false;
+		auto self = shared_from_this();
+		strand_.dispatch([self] { self->read(); });
 	}
 
-	SocketInfoPtr pClientSocket(new SocketInfo(clientSocket, this));
+	// Called with the I/O threads stopped.
+	void close()
+	{
+		boost::system::error_code ec;
+		socket_.close(ec);
+		is_closed_ = true;
+	}
 
-	try
-	{ // !!!!!!!!!!!!
-		if(socketInfoCollection_.Size() >= 50) 
+	virtual void Send(const std::wstring& data) override
+	{
+		if (data.empty())
+			return;
+
+		auto bytes = std::make_shared<std::string>();
+		encode(codepage_, data, *bytes);
+
+		if (bytes->size() < 512)
 		{
-			HANDLE handle = nullptr;
-			{
-				tbb::mutex::scoped_lock lock(socketInfoCollection_.mutex_);				
-				handle = *(socketInfoCollection_.waitEvents_.begin()+0);
-				if(handle == pListenSocketInfo_->event_)
-					handle = *(socketInfoCollection_.waitEvents_.begin()+1);
-			}
-			socketInfoCollection_.RemoveSocketInfo(handle);
-			CASPAR_LOG(error) << " Too many connections. Removed last used connection.";
+			auto message = data;
+			boost::replace_all(message, L"\n", L"\\n");
+			boost::replace_all(message, L"\r", L"\\r");
+			CASPAR_LOG(info) << L"Sent message to " << host_ << L": " << message;
 		}
-	}catch(...){}
+		else
+			CASPAR_LOG(info) << L"Sent more than 512 bytes to " << host_;
 
-	//Determine if we can handle one more client
-	if(socketInfoCollection_.Size() >= CASPAR_MAXIMUM_SOCKET_CLIENTS) {
-		CASPAR_LOG(error) << "Could not accept ) << too many connections).";
-		return true;
-	}
+		auto self = shared_from_this();
+		strand_.post([self, bytes]
+		{
+			if (self->is_closed_)
+				return;
 
-	if(WSAEventSelect(pClientSocket->socket_, pClientSocket->event_, FD_READ | FD_WRITE | FD_CLOSE) == SOCKET_ERROR) {
-		LogSocketError(TEXT("Accept (failed create event for new client)"));
-		return false;
+			self->send_queue_.push_back(std::string());
+			self->send_queue_.back().swap(*bytes);
+			self->write();
+		});
 	}
 
-	TCHAR addressBuffer[32];
-	auto ipv4_address = inet_ntoa(clientAddr.sin_addr);
-	MultiByteToWideChar(CP_ACP, 0, ipv4_address, -1, addressBuffer, 32);
-	pClientSocket->host_ = addressBuffer;
+	virtual void Disconnect() override
+	{
+		auto self = shared_from_this();
+		strand_.post([self]
+		{
+			self->is_closing_ = true;
+			self->write();
+		});
+	}
 
+	virtual std::wstring print() const override
 	{
-		tbb::mutex::scoped_lock lock(mutex_);
+		return host_;
+	}
+private:
+	void read()
+	{
+		auto self = shared_from_this();
+		socket_.async_read_some(boost::asio::buffer(read_buffer_), strand_.wrap([self] (const boost::system::error_code& ec, std::size_t bytes)
+		{
+			self->on_read(ec, bytes);
+		}));
+	}
 
-		BOOST_FOREACH(auto& lifecycle_factory, lifecycle_factories_)
+	void on_read(const boost::system::error_code& ec, std::size_t bytes)
+	{
+		if (ec)
 		{
-			auto lifecycle_bound = lifecycle_factory(ipv4_address);
+			if (ec == boost::asio::error::eof || ec == boost::asio::error::connection_reset)
+				CASPAR_LOG(info) << L"Client " << host_ << L" disconnected";
+			else if (ec != boost::asio::error::operation_aborted)
+				CASPAR_LOG(info) << L"Client " << host_ << L" was disconnected, Errorcode " << ec.value();
 
-			pClientSocket->bind_to_lifecycle(lifecycle_bound);
+			close_and_notify();
+			return;
 		}
-	}
-
-	socketInfoCollection_.AddSocketInfo(pClientSocket);
 
-	CASPAR_LOG(info) << "Accepted connection from " << pClientSocket->host_.c_str() << " " << socketInfoCollection_.Size();
+		decode(codepage_, pending_bytes_, read_buffer_.data(), bytes, decoded_);
 
-	return true;
-}
+		if (!decoded_.empty())
+		{
+			auto self = shared_from_this();
+			auto data = std::make_shared<std::wstring>();
+			data->swap(decoded_);
 
-bool ConvertMultiByteToWideChar(UINT codePage, char* pSource, int sourceLength, std::vector<wchar_t>& wideBuffer, int& countLeftovers)
-{
-	if(codePage == CP_UTF8) {
-		countLeftovers = 0;
-		//check from the end of pSource for ev. uncompleted UTF-8 byte sequence
-		if(pSource[sourceLength-1] & 0x80) {
-			//The last byte is part of a multibyte sequence. If the sequence is not complete, we need to save the partial sequence
-			int bytesToCheck = std::min(4, sourceLength);	//a sequence contains a maximum of 4 bytes
-			int currentLeftoverIndex = sourceLength-1;
-			for(; bytesToCheck > 0; --bytesToCheck, --currentLeftoverIndex) {
-				++countLeftovers;
-				if(pSource[currentLeftoverIndex] & 0x80) {
-					if(pSource[currentLeftoverIndex] & 0x40) { //The two high-bits are set, this is the "header"
-						int expectedSequenceLength = 2;
-						if(pSource[currentLeftoverIndex] & 0x20)
-							++expectedSequenceLength;
-						if(pSource[currentLeftoverIndex] & 0x10)
-							++expectedSequenceLength;
-
-						if(countLeftovers < expectedSequenceLength) {
-							//The sequence is incomplete. Leave the leftovers to be interpreted with the next call
-							break;
-						}
-						//The sequence is complete, there are no leftovers. 
-						//...OR...
-						//error. Let the conversion-function take the hit.
-						countLeftovers = 0;
-						break;
-					}
+			// Protocol strategies are not thread safe, all clients are parsed on the same strand.
+			server_.parse_strand_.post([self, data]
+			{
+				try
+				{
+					self->server_.protocol()->Parse(data->c_str(), static_cast<int>(data->size()), self);
 				}
-				else {
-					//error. Let the conversion-function take the hit.
-					countLeftovers = 0;
-					break;
+				catch (...)
+				{
+					CASPAR_LOG_CURRENT_EXCEPTION();
 				}
-			}
-			if(countLeftovers == 4) {
-				//error. Let the conversion-function take the hit.
-				countLeftovers = 0;
-			}
+			});
 		}
-	}
 
-	int charsWritten = 0;
-	int sourceBytesToProcess = sourceLength-countLeftovers;
-	int wideBufferCapacity = MultiByteToWideChar(codePage, 0, pSource, sourceBytesToProcess, NULL, NULL);
-	if(wideBufferCapacity > 0) 
-	{
-		wideBuffer.resize(wideBufferCapacity);
-		charsWritten = MultiByteToWideChar(codePage, 0, pSource, sourceBytesToProcess, &wideBuffer[0], wideBuffer.size());
-	}
-	//copy the leftovers to the front of the buffer
-	if(countLeftovers > 0) {
-		memcpy(pSource, &(pSource[sourceBytesToProcess]), countLeftovers);
+		read();
 	}
 
-	wideBuffer.resize(charsWritten);
-	return (charsWritten > 0);
-}
+	// Sends everything queued so far with a single gathering write.
+	void write()
+	{
+		if (!sending_.empty() || is_closed_)
+			return;
 
-//////////////////////////////
-// AsyncEventServer::OnRead
-// PARAMS: ...
-// COMMENT: Called then something arrives on the socket that has to be read
-bool AsyncEventServer::OnRead(SocketInfoPtr& pSI) {
-	int recvResult = SOCKET_ERROR;
-	
-	try
-	{ // !!!!!!!!!!!!
-		if(pSI)
+		if (send_queue_.empty())
 		{
-			tbb::mutex::scoped_lock lock(socketInfoCollection_.mutex_);
-			auto it = std::find(socketInfoCollection_.waitEvents_.begin(), socketInfoCollection_.waitEvents_.end(), pSI->event_);
-			if(it != socketInfoCollection_.waitEvents_.end())
+			if (is_closing_)
 			{
-				auto handle = *it;
-				socketInfoCollection_.waitEvents_.erase(it);
-				socketInfoCollection_.waitEvents_.push_back(handle);
+				boost::system::error_code ec;
+				socket_.shutdown(tcp::socket::shutdown_send, ec);
 			}
+
+			return;
 		}
-	}catch(...){}
 
-	int maxRecvLength = sizeof(pSI->recvBuffer_)-pSI->recvLeftoverOffset_;
-	recvResult = recv(pSI->socket_, pSI->recvBuffer_+pSI->recvLeftoverOffset_, maxRecvLength, 0);
-	while(recvResult != SOCKET_ERROR) {
-		if(recvResult == 0) {
-			CASPAR_LOG(info) << "Client " << pSI->host_.c_str() << TEXT(" disconnected");
+		sending_.swap(send_queue_);
+		send_buffers_.clear();
 
-			socketInfoCollection_.RemoveSocketInfo(pSI);
-			return true;
-		}
+		BOOST_FOREACH(auto& bytes, sending_)
+			send_buffers_.push_back(boost::asio::buffer(bytes));
 
-		//Convert to widechar
-		if(ConvertMultiByteToWideChar(pProtocolStrategy_->GetCodepage(), pSI->recvBuffer_, recvResult + pSI->recvLeftoverOffset_, pSI->wideRecvBuffer_, pSI->recvLeftoverOffset_))		
-			pProtocolStrategy_->Parse(&pSI->wideRecvBuffer_[0], pSI->wideRecvBuffer_.size(), pSI);		
-		else			
-			CASPAR_LOG(error) << "Read from " << pSI->host_.c_str() << TEXT(" failed, could not convert command to UNICODE");
-			
-		maxRecvLength = sizeof(pSI->recvBuffer_)-pSI->recvLeftoverOffset_;
-		recvResult = recv(pSI->socket_, pSI->recvBuffer_+pSI->recvLeftoverOffset_, maxRecvLength, 0);
+		auto self = shared_from_this();
+		boost::asio::async_write(socket_, send_buffers_, strand_.wrap([self] (const boost::system::error_code& ec, std::size_t)
+		{
+			self->on_written(ec);
+		}));
 	}
-			
-	if(recvResult == SOCKET_ERROR) {
-		int errorCode = WSAGetLastError();
-		if(errorCode == WSAEWOULDBLOCK)
-			return true;
-		else {
-			LogSocketError(TEXT("Read"), errorCode);
-			OnError(pSI->event_, errorCode);
+
+	void on_written(const boost::system::error_code& ec)
+	{
+		sending_.clear();
+
+		if (ec)
+		{
+			if (ec != boost::asio::error::operation_aborted)
+				CASPAR_LOG(error) << L"Failed to Send Errorcode: " << ec.value();
+
+			close_and_notify();
+			return;
 		}
+
+		write();
 	}
 
-	return false;
-}
+	void close_and_notify()
+	{
+		if (is_closed_)
+			return;
 
-//////////////////////////////
-// AsyncEventServer::OnWrite
-// PARAMS: ...
-// COMMENT: Called when the socket is ready to send more data
-void AsyncEventServer::OnWrite(SocketInfoPtr& pSI) {		
-	DoSend(*pSI);	
-}
+		boost::system::error_code ec;
+		socket_.close(ec);
+		is_closed_ = true;
+		send_queue_.clear();
+
+		server_.on_closed(shared_from_this());
+	}
+};
 
-bool ConvertWideCharToMultiByte(UINT codePage, const std::wstring& wideString, std::vector<char>& destBuffer)
+bool AsyncEventServer::implementation::start()
 {
-	int bytesWritten = 0;
-	int multibyteBufferCapacity = WideCharToMultiByte(codePage, 0, wideString.c_str(), static_cast<int>(wideString.length()), 0, 0, NULL, NULL);
-	if(multibyteBufferCapacity > 0) 
+	if (work_)
+		return false;
+
+	try
 	{
-		destBuffer.resize(multibyteBufferCapacity);
-		bytesWritten = WideCharToMultiByte(codePage, 0, wideString.c_str(), static_cast<int>(wideString.length()), &destBuffer[0], destBuffer.size(), NULL, NULL);
+		acceptor_.open(tcp::v4());
+		acceptor_.set_option(tcp::acceptor::reuse_address(true));
+		acceptor_.bind(tcp::endpoint(tcp::v4(), static_cast<unsigned short>(port_)));
+		acceptor_.listen();
 	}
-	destBuffer.resize(bytesWritten);
-	return (bytesWritten > 0);
-}
+	catch (...)
+	{
+		CASPAR_LOG_CURRENT_EXCEPTION();
+		CASPAR_LOG(error) << L"Failed to listen on port " << port_;
 
-void AsyncEventServer::DoSend(SocketInfo& socketInfo) {
-	//Locks the socketInfo-object so that no one else tampers with the sendqueue at the same time
-	tbb::mutex::scoped_lock lock(socketInfo.mutex_);
+		boost::system::error_code ec;
+		acceptor_.close(ec);
+		return false;
+	}
 
-	while(!socketInfo.sendQueue_.empty() || socketInfo.currentlySending_.size() > 0) {
-		if(socketInfo.currentlySending_.size() == 0) {
-			//Read the next string in the queue and convert to UTF-8
-			if(!ConvertWideCharToMultiByte(pProtocolStrategy_->GetCodepage(), socketInfo.sendQueue_.front(), socketInfo.currentlySending_))
-			{
-				CASPAR_LOG(error) << "Send to " << socketInfo.host_.c_str() << TEXT(" failed, could not convert response to UTF-8");
-			}
-			socketInfo.currentlySendingOffset_ = 0;
-		}
+	service_.reset();
+	work_.reset(new boost::asio::io_service::work(service_));
 
-		if(socketInfo.currentlySending_.size() > 0) {
-			int bytesToSend = static_cast<int>(socketInfo.currentlySending_.size()-socketInfo.currentlySendingOffset_);
-			int sentBytes = send(socketInfo.socket_, &socketInfo.currentlySending_[0] + socketInfo.currentlySendingOffset_, bytesToSend, 0);
-			if(sentBytes == SOCKET_ERROR) {
-				int errorCode = WSAGetLastError();
-				if(errorCode == WSAEWOULDBLOCK) {
-					CASPAR_LOG(debug) << "Send to " << socketInfo.host_.c_str() << TEXT(" would block, sending later");
-					break;
-				}
-				else {
-					LogSocketError(TEXT("Send"), errorCode);
-					OnError(socketInfo.event_, errorCode);
+	for (int n = 0; n < io_thread_count_; ++n)
+	{
+		threads_.create_thread([this]
+		{
+			win32_exception::ensure_handler_installed_for_thread("tcp-server-thread");
 
-					socketInfo.currentlySending_.resize(0);
-					socketInfo.currentlySendingOffset_ = 0;
-					socketInfo.sendQueue_.pop();
+			for (;;)
+			{
+				try
+				{
+					service_.run();
 					break;
 				}
-			}
-			else {
-				if(sentBytes == bytesToSend) {
-					
-					if(sentBytes < 512)
-					{
-						boost::replace_all(socketInfo.sendQueue_.front(), L"\n", L"\\n");
-						boost::replace_all(socketInfo.sendQueue_.front(), L"\r", L"\\r");
-						CASPAR_LOG(info) << L"Sent message to " << socketInfo.host_.c_str() << L": " << socketInfo.sendQueue_.front().c_str();
-					}
-					else
-						CASPAR_LOG(info) << "Sent more than 512 bytes to " << socketInfo.host_.c_str();
-
-					socketInfo.currentlySending_.resize(0);
-					socketInfo.currentlySendingOffset_ = 0;
-					socketInfo.sendQueue_.pop();
-				}
-				else {
-					socketInfo.currentlySendingOffset_ += sentBytes;
-					CASPAR_LOG(info) << "Sent partial message to " << socketInfo.host_.c_str();
+				catch (...)
+				{
+					CASPAR_LOG_CURRENT_EXCEPTION();
 				}
 			}
-		}
-		else
-			socketInfo.sendQueue_.pop();
+		});
 	}
-}
 
-//////////////////////////////
-// AsyncEventServer::OnClose
-// PARAMS: ...
-// COMMENT: Called when a client disconnects / is disconnected
-void AsyncEventServer::OnClose(SocketInfoPtr& pSI) {
-	CASPAR_LOG(info) << "Client " << pSI->host_.c_str() << TEXT(" was disconnected");
+	service_.post([this] { accept(); });
 
-	socketInfoCollection_.RemoveSocketInfo(pSI);
+	CASPAR_LOG(info) << L"Listener successfully initialized on port " << port_ << L" with " << io_thread_count_ << L" I/O threads";
+	return true;
 }
 
-//////////////////////////////
-// AsyncEventServer::OnError
-// PARAMS: ...
-// COMMENT: Called when an errorcode is recieved
-void AsyncEventServer::OnError(HANDLE waitEvent, int errorCode) {
-	if(errorCode == WSAENETDOWN || errorCode == WSAECONNABORTED || errorCode == WSAECONNRESET || errorCode == WSAESHUTDOWN || errorCode == WSAETIMEDOUT || errorCode == WSAENOTCONN || errorCode == WSAENETRESET) {
-		SocketInfoPtr pSocketInfo;
-		if(socketInfoCollection_.FindSocketInfo(waitEvent, pSocketInfo)) {
-			CASPAR_LOG(info) << "Client " << pSocketInfo->host_.c_str() << TEXT(" was disconnected, Errorcode ") << errorCode;
-		}
+void AsyncEventServer::implementation::stop()
+{
+	if (!work_)
+		return;
 
-		socketInfoCollection_.RemoveSocketInfo(waitEvent);
-	}
-}
+	work_.reset();
+	service_.stop();
+	threads_.join_all();
 
-//////////////////////////////
-// AsyncEventServer::DisconnectClient
-// PARAMS: ...
-// COMMENT: The client is removed from the actual client-list when an FD_CLOSE notification is recieved
-void AsyncEventServer::DisconnectClient(SocketInfo& socketInfo) {
-	int result = shutdown(socketInfo.socket_, SD_SEND);
-	if(result == SOCKET_ERROR)
-		OnError(socketInfo.event_, result);
-}
+	boost::system::error_code ec;
+	acceptor_.close(ec);
 
-//////////////////////////////
-// AsyncEventServer::LogSocketError
-void AsyncEventServer::LogSocketError(const TCHAR* pStr, int socketError) {
-	if(socketError == 0)
-		socketError = WSAGetLastError();
+	std::set<std::shared_ptr<connection>> connections;
 
-	CASPAR_LOG(error) << "Failed to " << pStr << TEXT(" Errorcode: ") << socketError;
+	{
+		tbb::mutex::scoped_lock lock(mutex_);
+		connections.swap(connections_);
+	}
+
+	BOOST_FOREACH(auto& conn, connections)
+		conn->close();
 }
 
+void AsyncEventServer::implementation::accept()
+{
+	auto conn = std::make_shared<connection>(*this);
 
-//////////////////////////////
-//  SocketInfoCollection
-//////////////////////////////
+	acceptor_.async_accept(conn->socket(), [this, conn] (const boost::system::error_code& ec)
+	{
+		if (ec == boost::asio::error::operation_aborted || !acceptor_.is_open())
+			return;
 
-AsyncEventServer::SocketInfoCollection::SocketInfoCollection() : bDirty_(false) {
-}
+		if (ec)
+			CASPAR_LOG(error) << L"Failed to Accept Errorcode: " << ec.value();
+		else
+		{
+			boost::system::error_code endpoint_ec;
+			auto ipv4_address = conn->socket().remote_endpoint(endpoint_ec).address().to_string();
+			std::vector<std::shared_ptr<void>> lifecycle_bound_items;
+			std::size_t count;
 
-AsyncEventServer::SocketInfoCollection::~SocketInfoCollection() {
-}
+			{
+				tbb::mutex::scoped_lock lock(mutex_);
 
-bool AsyncEventServer::SocketInfoCollection::AddSocketInfo(SocketInfoPtr& pSocketInfo) {
-	tbb::mutex::scoped_lock lock(mutex_);
+				BOOST_FOREACH(auto& lifecycle_factory, lifecycle_factories_)
+					lifecycle_bound_items.push_back(lifecycle_factory(ipv4_address));
 
-	waitEvents_.resize(waitEvents_.size()+1);
-	bool bSuccess = socketInfoMap_.insert(SocketInfoMap::value_type(pSocketInfo->event_, pSocketInfo)).second;
-	if(bSuccess) {
-		waitEvents_[waitEvents_.size()-1] = pSocketInfo->event_;
-		bDirty_ = true;
-	}
+				connections_.insert(conn);
+				count = connections_.size();
+			}
 
-	return bSuccess;
-}
+			conn->start(widen(ipv4_address), protocol()->GetCodepage(), lifecycle_bound_items);
 
-void AsyncEventServer::SocketInfoCollection::RemoveSocketInfo(SocketInfoPtr& pSocketInfo) {
-	if(pSocketInfo != 0) {
-		RemoveSocketInfo(pSocketInfo->event_);
-	}
-}
-void AsyncEventServer::SocketInfoCollection::RemoveSocketInfo(HANDLE waitEvent) {
-	tbb::mutex::scoped_lock lock(mutex_);
+			CASPAR_LOG(info) << L"Accepted connection from " << widen(ipv4_address) << L" " << count;
+		}
 
-	//Find instance
-	SocketInfoPtr pSocketInfo;
-	SocketInfoMap::iterator it = socketInfoMap_.find(waitEvent);
-	SocketInfoMap::iterator end = socketInfoMap_.end();
-	if(it != end)
-		pSocketInfo = it->second;
+		accept();
+	});
+}
 
-	if(pSocketInfo) {
-		pSocketInfo->pServer_ = NULL;
+void AsyncEventServer::implementation::on_closed(const std::shared_ptr<connection>& conn)
+{
+	ClientDisconnectEvent handler;
 
-		socketInfoMap_.erase(waitEvent);
+	{
+		tbb::mutex::scoped_lock lock(mutex_);
 
-		HandleVector::iterator it = std::find(waitEvents_.begin(), waitEvents_.end(), waitEvent);
-		if(it != waitEvents_.end()) {
-			std::swap((*it), waitEvents_.back());
-			waitEvents_.resize(waitEvents_.size()-1);
+		if (connections_.erase(conn) == 0)
+			return;
 
-			bDirty_ = true;
-		}
+		handler = disconnect_handler_;
 	}
-	if(onSocketInfoRemoved)
-		onSocketInfoRemoved(pSocketInfo);
+
+	if (handler)
+		handler(conn);
 }
 
-bool AsyncEventServer::SocketInfoCollection::FindSocketInfo(HANDLE key, SocketInfoPtr& pResult) {
-	tbb::mutex::scoped_lock lock(mutex_);
+AsyncEventServer::AsyncEventServer(const safe_ptr<IProtocolStrategy>& pProtocol, int port, int io_threads)
+	: impl_(new implementation(pProtocol, port, io_threads))
+{
+}
 
-	SocketInfoMap::iterator it = socketInfoMap_.find(key);
-	SocketInfoMap::iterator end = socketInfoMap_.end();
-	if(it != end)
-		pResult = it->second;
+AsyncEventServer::~AsyncEventServer()
+{
+}
 
-	return (it != end);
+bool AsyncEventServer::Start()
+{
+	return impl_->start();
 }
 
-void AsyncEventServer::SocketInfoCollection::CopyCollectionToArray(HANDLE* pDest, int maxCount) {
-	tbb::mutex::scoped_lock lock(mutex_);
+void AsyncEventServer::Stop()
+{
+	impl_->stop();
+}
 
-	memcpy(pDest, &(waitEvents_[0]), std::min( maxCount, static_cast<int>(waitEvents_.size()) ) * sizeof(HANDLE) );
+void AsyncEventServer::SetProtocolStrategy(const safe_ptr<IProtocolStrategy>& pPS)
+{
+	tbb::spin_mutex::scoped_lock lock(impl_->protocol_mutex_);
+	impl_->protocol_ = pPS;
 }
 
-void AsyncEventServer::SocketInfoCollection::Clear() {
-	tbb::mutex::scoped_lock lock(mutex_);
+void AsyncEventServer::SetClientDisconnectHandler(const ClientDisconnectEvent& handler)
+{
+	tbb::mutex::scoped_lock lock(impl_->mutex_);
+	impl_->disconnect_handler_ = handler;
+}
 
-	socketInfoMap_.clear();
-	waitEvents_.clear();
+void AsyncEventServer::add_lifecycle_factory(const lifecycle_factory_t& factory)
+{
+	tbb::mutex::scoped_lock lock(impl_->mutex_);
+	impl_->lifecycle_factories_.push_back(factory);
 }
 
-}	//namespace IO
-}	//namespace caspar
\ No newline at end of file
+}}
@@ -19,129 +19,48 @@
 * Author: Nicklas P Andersson
 */
 
- 
-// AsyncEventServer.h: interface for the AsyncServer class.
-//////////////////////////////////////////////////////////////////////
-
-#if !defined(AFX_ASYNCEVENTSERVER_H__0BFA29CB_BE4C_46A0_9CAE_E233ED27A8EC__INCLUDED_)
-#define AFX_ASYNCEVENTSERVER_H__0BFA29CB_BE4C_46A0_9CAE_E233ED27A8EC__INCLUDED_
-
-#if _MSC_VER > 1000
 #pragma once
-#endif
 
 #include <common/memory/safe_ptr.h>
 
 #include <string>
-#include <map>
-#include <vector>
 #include <functional>
 
-#include "..\util\thread.h"
-
 #include "ProtocolStrategy.h"
 
-#include <tbb\mutex.h>
+namespace caspar { namespace IO {
 
-namespace caspar {
-namespace IO {
-
-class SocketInfo;
-typedef std::shared_ptr<SocketInfo> SocketInfoPtr;
-
-typedef std::function<void(caspar::IO::SocketInfoPtr)> ClientDisconnectEvent;
+typedef std::function<void(ClientInfoPtr)> ClientDisconnectEvent;
 typedef std::function<std::shared_ptr<void> (const std::string& ipv4_address)>
 		lifecycle_factory_t;
 
-class AsyncEventServer : public IRunnable
+/**
+ * TCP server feeding the data received from each client to a protocol
+ * strategy. Built on boost::asio, connections are served by a small pool of
+ * I/O threads and the number of clients is not limited.
+ * <p>
+ * Parse() of the protocol strategy is never called concurrently, the data of
+ * each client is parsed in the order it was received.
+ */
+class AsyncEventServer
 {
-	static long instanceCount_;
-
-	AsyncEventServer();
 	AsyncEventServer(const AsyncEventServer&);
 	AsyncEventServer& operator=(const AsyncEventServer&);
-
 public:
-	explicit AsyncEventServer(const safe_ptr<IProtocolStrategy>& pProtocol, int port);
+	AsyncEventServer(const safe_ptr<IProtocolStrategy>& pProtocol, int port, int io_threads = 2);
 	~AsyncEventServer();
 
 	bool Start();
-	void SetProtocolStrategy(safe_ptr<IProtocolStrategy> pPS) {
-		pProtocolStrategy_ = pPS;
-	}
-
 	void Stop();
 
-	void SetClientDisconnectHandler(ClientDisconnectEvent handler);
-	
+	void SetProtocolStrategy(const safe_ptr<IProtocolStrategy>& pPS);
+	void SetClientDisconnectHandler(const ClientDisconnectEvent& handler);
+
 	void add_lifecycle_factory(const lifecycle_factory_t& lifecycle_factory);
 private:
-	Thread	listenThread_;
-	void Run(HANDLE stopEvent);
-	bool OnUnhandledException(const std::exception&) throw();
-
-	bool OnAccept(SocketInfoPtr&);
-	bool OnRead(SocketInfoPtr&);
-	void OnWrite(SocketInfoPtr&);
-	void OnClose(SocketInfoPtr&);
-	void OnError(HANDLE waitEvent, int errorCode);
-
-	SocketInfoPtr		pListenSocketInfo_;
-	safe_ptr<IProtocolStrategy>	pProtocolStrategy_;
-	int					port_;
-
-	friend class SocketInfo;
-	void DoSend(SocketInfo&);
-	void DisconnectClient(SocketInfo&);
-
-	void LogSocketError(const TCHAR* pStr, int socketError = 0);
-
-	class SocketInfoCollection
-	{
-		SocketInfoCollection(const SocketInfoCollection&);
-		SocketInfoCollection& operator=(const SocketInfoCollection&);
-
-		typedef std::map<HANDLE, SocketInfoPtr> SocketInfoMap;
-		typedef std::vector<HANDLE> HandleVector;
-
-	public:
-		SocketInfoCollection();
-		~SocketInfoCollection();
-
-		bool AddSocketInfo(SocketInfoPtr& pSocketInfo);
-		void RemoveSocketInfo(SocketInfoPtr& pSocketInfo);
-		void RemoveSocketInfo(HANDLE);
-		void CopyCollectionToArray(HANDLE*, int maxCount);
-
-		bool FindSocketInfo(HANDLE, SocketInfoPtr& pResult);
-
-		bool IsDirty() {
-			return bDirty_;
-		}
-		void ClearDirty() {
-			bDirty_ = false;
-		}
-
-		std::size_t Size() {
-			return waitEvents_.size();
-		}
-		void Clear();
-
-		ClientDisconnectEvent onSocketInfoRemoved;
-		
-		HandleVector waitEvents_;
-		tbb::mutex mutex_;
-	private:
-		SocketInfoMap socketInfoMap_;
-		bool bDirty_;
-	};
-	std::vector<lifecycle_factory_t> lifecycle_factories_;
-	SocketInfoCollection socketInfoCollection_;
-	tbb::mutex mutex_;
+	struct implementation;
+	safe_ptr<implementation> impl_;
 };
-typedef std::tr1::shared_ptr<AsyncEventServer> AsyncEventServerPtr;
-
-}	//namespace IO
-}	//namespace caspar
+typedef std::shared_ptr<AsyncEventServer> AsyncEventServerPtr;
 
-#endif // !defined(AFX_ASYNCEVENTSERVER_H__0BFA29CB_BE4C_46A0_9CAE_E233ED27A8EC__INCLUDED_)
+}}
@@ -25,8 +25,10 @@
 #include <memory>
 
 #include <common/env.h>
+#include <common/diagnostics/metrics.h>
 #include <common/exception/exceptions.h>
 #include <common/utility/string.h>
+#include <common/filesystem/notifying_filesystem_monitor.h>
 #include <common/filesystem/polling_filesystem_monitor.h>
 
 #include <core/mixer/gpu/ogl_device.h>
@@ -40,6 +42,7 @@
 #include <core/producer/media_info/media_info.h>
 #include <core/producer/media_info/media_info_repository.h>
 #include <core/producer/media_info/in_memory_media_info_repository.h>
+#include <core/producer/media_info/persistent_media_info_repository.h>
 #include <core/system_watcher.h>
 #include <windows.h>
 
@@ -66,6 +69,7 @@
 #include <modules/ndi/producer/ndi_producer.h>
 
 #include <protocol/amcp/AMCPProtocolStrategy.h>
+#include <protocol/amcp/AMCPCommandsImpl.h>
 #include <protocol/cii/CIIProtocolStrategy.h>
 #include <protocol/CLK/CLKProtocolStrategy.h>
 #include <protocol/util/AsyncEventServer.h>
@@ -82,6 +86,9 @@
 
 #include <tbb/atomic.h>
 
+#include <algorithm>
+#include <cctype>
+
 namespace caspar {
 
 using namespace core;
@@ -110,26 +117,66 @@ std::shared_ptr<boost::asio::io_service> create_running_io_service()
 			});
 }
 
+// Sends the diagnostics metrics as /diag/<graph>/<series> [p50 p99 max count] monitor messages.
+class monitor_metrics_exporter : public diagnostics::metrics_exporter
+{
+	const safe_ptr<core::monitor::subject> subject_;
+public:
+	explicit monitor_metrics_exporter(const safe_ptr<core::monitor::subject>& subject)
+		: subject_(subject)
+	{
+	}
+
+	virtual void export_samples(const std::vector<diagnostics::metric_sample>& samples)
+	{
+		BOOST_FOREACH(auto& sample, samples)
+		{
+			auto graph = sample.graph;
+			std::replace_if(graph.begin(), graph.end(), [](char c) { return !std::isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_'; }, '_');
+
+			std::vector<core::monitor::data_t> data;
+			data.push_back(sample.p50);
+			data.push_back(sample.p99);
+			data.push_back(sample.max);
+			data.push_back(static_cast<std::int64_t>(sample.count));
+
+			*subject_ << core::monitor::message("/diag/" + graph + "/" + sample.series, std::move(data));
+		}
+	}
+};
+
+safe_ptr<media_info_repository> create_media_info_repository(const boost::property_tree::wptree& pt)
+{
+	auto cache_file = pt.get(L"configuration.media-info.cache-file", env::data_folder() + L"media-info.cache");
+
+	if (cache_file.empty())
+		return create_in_memory_media_info_repository();
+
+	return create_persistent_media_info_repository(cache_file);
+}
+
 struct server::implementation : boost::noncopyable
 {
 	std::shared_ptr<boost::asio::io_service>	io_service_;
 	safe_ptr<core::monitor::subject>			monitor_subject_;
-	safe_ptr<ogl_device>						ogl_;
+	std::shared_ptr<ogl_device>					ogl_;
 	std::vector<safe_ptr<IO::AsyncEventServer>> async_servers_;	
 	std::shared_ptr<IO::AsyncEventServer>		primary_amcp_server_;
 	osc::client									osc_client_;
 	std::vector<std::shared_ptr<void>>			predefined_osc_subscriptions_;
+	std::vector<std::shared_ptr<void>>			metrics_exporters_;
 	std::vector<safe_ptr<video_channel>>		channels_;
 	std::vector<safe_ptr<recorder>>				recorders_;
 	safe_ptr<media_info_repository>				media_info_repo_;
+	std::shared_ptr<filesystem_monitor_factory>	monitor_factory_;
+	std::shared_ptr<amcp::media_catalog>		media_catalog_;
 	boost::thread								initial_media_info_thread_;
 	tbb::atomic<bool>							running_;
 
 	implementation()
 		: io_service_(create_running_io_service())
-		, ogl_(ogl_device::create())
 		, osc_client_(io_service_)
-		, media_info_repo_(create_in_memory_media_info_repository())
+		, media_info_repo_(create_media_info_repository(env::properties()))
 	{
 		running_ = true;
 		setup_audio(env::properties());
@@ -167,12 +214,18 @@ struct server::implementation : boost::noncopyable
 		setup_recorders(env::properties());
 		CASPAR_LOG(info) << L"Initialized recorders.";
 
+		setup_media_catalog(env::properties());
+		CASPAR_LOG(info) << L"Initialized media catalog.";
+
 		setup_controllers(env::properties());
 		CASPAR_LOG(info) << L"Initialized controllers.";
 
 		setup_osc(env::properties());
 		CASPAR_LOG(info) << L"Initialized osc.";
 
+		setup_metrics(env::properties());
+		CASPAR_LOG(info) << L"Initialized diagnostics metrics.";
+
 		/*
 		setup_system_watcher(env::properties());
 		CASPAR_LOG(info) << L"Initialized system watcher.";
@@ -188,6 +241,7 @@ struct server::implementation : boost::noncopyable
 		initial_media_info_thread_.join();
 		primary_amcp_server_.reset();
 		async_servers_.clear();
+		media_catalog_.reset();
 		destroy_producers_synchronously();
 		recorders_.clear();
 		channels_.clear();
@@ -224,7 +278,11 @@ struct server::implementation : boost::noncopyable
 			auto audio_channel_layout = default_channel_layout_repository().get_by_name(
 				boost::to_upper_copy(xml_channel.second.get(L"channel-layout", L"STEREO")));
 
-			channels_.push_back(make_safe<video_channel>(channels_.size() + 1, format_desc, ogl_, audio_channel_layout));
+			auto image_mixer = xml_channel.second.get(L"image-mixer", L"gpu");
+			if (image_mixer != L"gpu" && image_mixer != L"cpu")
+				BOOST_THROW_EXCEPTION(caspar_exception() << msg_info("Invalid image-mixer."));
+
+			channels_.push_back(make_safe<video_channel>(channels_.size() + 1, format_desc, image_mixer == L"cpu" ? std::shared_ptr<ogl_device>() : get_ogl_device(), audio_channel_layout));
 
 			channels_.back()->monitor_output().attach_parent(monitor_subject_);
 			channels_.back()->mixer()->set_straight_alpha_output(
@@ -248,7 +306,16 @@ struct server::implementation : boost::noncopyable
 
 		// Dummy diagnostics channel
 		if(env::properties().get(L"configuration.channel-grid", false))
-			channels_.push_back(make_safe<video_channel>(channels_.size()+1, core::video_format_desc::get(core::video_format::x576p2500), ogl_, default_channel_layout_repository().get_by_name(L"STEREO")));
+			channels_.push_back(make_safe<video_channel>(channels_.size()+1, core::video_format_desc::get(core::video_format::x576p2500), get_ogl_device(), default_channel_layout_repository().get_by_name(L"STEREO")));
+	}
+
+	std::shared_ptr<ogl_device> get_ogl_device()
+	{
+		// Only created when a channel needs it, so that cpu mixed channels run on hosts without a gpu.
+		if (!ogl_)
+			ogl_ = ogl_device::create();
+
+		return ogl_;
 	}
 
 	template<typename Base>
@@ -336,6 +403,18 @@ struct server::implementation : boost::noncopyable
 		}
 	}
 		
+	void setup_media_catalog(const boost::property_tree::wptree& pt)
+	{
+		auto scan_interval = pt.get(L"configuration.media-catalog.scan-interval", 5000);
+
+		if (pt.get(L"configuration.media-catalog.monitor", L"notify") == L"poll")
+			monitor_factory_ = std::make_shared<polling_filesystem_monitor_factory>(io_service_, scan_interval);
+		else
+			monitor_factory_ = std::make_shared<notifying_filesystem_monitor_factory>(io_service_, scan_interval);
+
+		media_catalog_ = amcp::create_media_catalog(*monitor_factory_, media_info_repo_);
+	}
+
 	void setup_controllers(const boost::property_tree::wptree& pt)
 	{		
 		using boost::property_tree::wptree;
@@ -349,7 +428,8 @@ struct server::implementation : boost::noncopyable
 				if(name == L"tcp")
 				{					
 					unsigned int port = xml_controller.second.get(L"port", 5250);
-					auto asyncbootstrapper = make_safe<IO::AsyncEventServer>(create_protocol(protocol), port);
+					int io_threads = xml_controller.second.get(L"io-threads", 2);
+					auto asyncbootstrapper = make_safe<IO::AsyncEventServer>(create_protocol(protocol), port, io_threads);
 					asyncbootstrapper->Start();
 					async_servers_.push_back(asyncbootstrapper);
 
@@ -407,6 +487,38 @@ struct server::implementation : boost::noncopyable
 					});
 	}
 
+	void setup_metrics(const boost::property_tree::wptree& pt)
+	{
+		diagnostics::set_metrics_interval(pt.get(L"configuration.diagnostics.metrics.interval", 1000));
+
+		auto file = pt.get(L"configuration.diagnostics.metrics.file", L"");
+
+		if (!file.empty())
+			metrics_exporters_.push_back(diagnostics::register_metrics_exporter(
+					diagnostics::create_file_metrics_exporter(file)));
+
+		auto prometheus_port = pt.get(L"configuration.diagnostics.metrics.prometheus-port", 0);
+
+		if (prometheus_port > 0)
+		{
+			try
+			{
+				metrics_exporters_.push_back(diagnostics::register_metrics_exporter(
+						diagnostics::create_prometheus_metrics_exporter(
+								io_service_,
+								static_cast<unsigned short>(prometheus_port))));
+			}
+			catch (...)
+			{
+				CASPAR_LOG_CURRENT_EXCEPTION();
+			}
+		}
+
+		if (pt.get(L"configuration.diagnostics.metrics.osc", false))
+			metrics_exporters_.push_back(diagnostics::register_metrics_exporter(
+					make_safe<monitor_metrics_exporter>(monitor_subject_)));
+	}
+
 	void setup_system_watcher(const boost::property_tree::wptree& pt)
 	{
 		init_system_watcher(pt);
@@ -441,7 +553,7 @@ struct server::implementation : boost::noncopyable
 	safe_ptr<IO::IProtocolStrategy> create_protocol(const std::wstring& name) const
 	{
 		if(boost::iequals(name, L"AMCP"))
-			return make_safe<amcp::AMCPProtocolStrategy>(channels_, recorders_, media_info_repo_);
+			return make_safe<amcp::AMCPProtocolStrategy>(channels_, recorders_, media_info_repo_, media_catalog_);
 		else if(boost::iequals(name, L"CII"))
 			return make_safe<cii::CIIProtocolStrategy>(channels_);
 		else if(boost::iequals(name, L"CLOCK"))
@@ -456,20 +568,48 @@ struct server::implementation : boost::noncopyable
 
 	void start_initial_media_info_scan()
 	{
-		initial_media_info_thread_ = boost::thread([this]
+		const int thread_count = std::max(1, env::properties().get(L"configuration.media-info.scan-threads", std::min(4, static_cast<int>(boost::thread::hardware_concurrency()))));
+
+		initial_media_info_thread_ = boost::thread([this, thread_count]
 		{
-			for (boost::filesystem::wrecursive_directory_iterator iter(env::media_folder()), end; iter != end; ++iter)
+			std::vector<std::wstring> files;
+
+			for (boost::filesystem::wrecursive_directory_iterator iter(env::media_folder()), end; iter != end && running_; ++iter)
 			{
-				if (running_)
-					media_info_repo_->get(iter->path().file_string());
-				else
+				if (boost::filesystem::is_regular_file(iter->status()))
+					files.push_back(iter->path().file_string());
+			}
+
+			// Files which are unchanged since the last run are answered from the cache, only new and modified files are opened.
+			tbb::atomic<std::size_t> next;
+			next = 0;
+
+			boost::thread_group workers;
+
+			for (int n = 0; n < thread_count; ++n)
+			{
+				workers.create_thread([&]
 				{
-					CASPAR_LOG(info) << L"Initial media information retrieval aborted.";
-					return;
-				}
+					for (std::size_t index = next++; index < files.size() && running_; index = next++)
+					{
+						try
+						{
+							media_info_repo_->get(files[index]);
+						}
+						catch (...)
+						{
+							CASPAR_LOG_CURRENT_EXCEPTION();
+						}
+					}
+				});
 			}
 
-			CASPAR_LOG(info) << L"Initial media information retrieval finished.";
+			workers.join_all();
+
+			if (running_)
+				CASPAR_LOG(info) << L"Initial media information retrieval finished.";
+			else
+				CASPAR_LOG(info) << L"Initial media information retrieval aborted.";
 		});
 	}
 };
@@ -0,0 +1,713 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+// Checks the deinterlacer kernels against libavfilter and measures them.
+//
+// Reference frames are generated, interlaced motion where each field is sampled
+// at its own time, and noise. Every plane is filtered by
+//
+//	- the kernels in modules/ffmpeg/producer/filter/deinterlacer_kernels.h,
+//	- the C code of vf_yadif.c and vf_bwdif.c, restated below,
+//	- with WITH_LIBAVFILTER defined, the libavfilter yadif and bwdif filters.
+//
+// and the outputs must be identical. The 8 bit yadif SSE2 line kernel is also
+// compared with the C line kernel on every line and on odd widths. Then the
+// time per 1080i frame of each is printed, unless --no-bench is given.
+//
+// Exits with 0 if all outputs match and 1 otherwise. See test/README.txt for how
+// to build it.
+
+#include <modules/ffmpeg/producer/filter/deinterlacer_kernels.h>
+
+#include <tbb/tick_count.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(WITH_LIBAVFILTER)
+extern "C"
+{
+	#include <libavfilter/avfilter.h>
+	#include <libavfilter/buffersink.h>
+	#include <libavfilter/buffersrc.h>
+	#include <libavutil/frame.h>
+	#include <libavutil/opt.h>
+}
+#endif
+
+using namespace caspar::ffmpeg;
+
+namespace {
+
+struct plane
+{
+	int						width;
+	int						height;
+	int						df;			// Bytes per sample.
+	int						linesize;	// In bytes.
+	std::vector<uint8_t>	data;
+
+	plane(int width, int height, int df)
+		: width(width)
+		, height(height)
+		, df(df)
+		, linesize(((width * df + 31) & ~31) + 32)
+		, data(linesize * height, 0)
+	{
+	}
+
+	uint8_t* line(int y)				{return &data[y * linesize];}
+	const uint8_t* line(int y) const	{return &data[y * linesize];}
+
+	int sample(int x, int y) const
+	{
+		return df == 2 ? reinterpret_cast<const uint16_t*>(line(y))[x] : line(y)[x];
+	}
+
+	void set_sample(int x, int y, int value)
+	{
+		if(df == 2)
+			reinterpret_cast<uint16_t*>(line(y))[x] = static_cast<uint16_t>(value);
+		else
+			line(y)[x] = static_cast<uint8_t>(value);
+	}
+};
+
+// Deterministic on every compiler, unlike rand().
+struct lcg
+{
+	uint32_t state;
+
+	explicit lcg(uint32_t seed) : state(seed){}
+
+	int next(int range)
+	{
+		state = state * 1664525u + 1013904223u;
+		return static_cast<int>((state >> 8) % static_cast<uint32_t>(range));
+	}
+};
+
+// Diagonal stripes, a gradient and a disc which move between fields, plus some noise.
+// The lines of each field are sampled at the time of that field.
+void fill_scene(plane& p, int depth, int frame, bool tff, lcg& rand)
+{
+	const int max = (1 << depth) - 1;
+
+	for(int y = 0; y < p.height; ++y)
+	{
+		const int field_time	= frame * 2 + (((y & 1) == 0) == tff ? 0 : 1);
+		const int disc_x		= p.width / 4 + 5 * field_time;
+		const int disc_y		= p.height / 2;
+		const int radius		= std::max(2, p.height / 5);
+
+		for(int x = 0; x < p.width; ++x)
+		{
+			const int xs	= x + 3 * field_time;
+			int value		= ((xs + y / 2) >> 3) & 1 ? max * 3 / 4 : max / 4;
+			value			+= (x * (max / 8)) / std::max(1, p.width);
+			if((x - disc_x) * (x - disc_x) + (y - disc_y) * (y - disc_y) < radius * radius)
+				value = max - max / 16;
+			value			+= rand.next(max / 32 + 1) - max / 64;
+			p.set_sample(x, y, std::min(max, std::max(0, value)));
+		}
+	}
+}
+
+void fill_noise(plane& p, int depth, lcg& rand)
+{
+	for(int y = 0; y < p.height; ++y)
+	{
+		for(int x = 0; x < p.width; ++x)
+			p.set_sample(x, y, rand.next(1 << depth));
+	}
+}
+
+// vf_yadif.c, filter_slice with filter_line_c and filter_edges folded together. Pixels
+// closer than 3 to the left or right edge skip the spatial interpolation.
+
+template<typename T>
+void reference_yadif(plane& dst, const plane& prev, const plane& cur, const plane& next, int parity, int tff, int yadif_mode)
+{
+	const int refs	= cur.linesize / static_cast<int>(sizeof(T));
+	const int w		= cur.width;
+	const int h		= cur.height;
+
+	for(int y = 0; y < h; ++y)
+	{
+		if(!((y ^ parity) & 1))
+		{
+			std::memcpy(dst.line(y), cur.line(y), w * sizeof(T));
+			continue;
+		}
+
+		const int prefs	= y + 1 < h ? refs : -refs;
+		const int mrefs	= y ? -refs : refs;
+		const int mode	= y == 1 || y + 2 == h ? 2 : yadif_mode;
+		const bool p	= ((parity ^ tff) & 1) != 0;
+
+		const T* prev_l	= reinterpret_cast<const T*>(prev.line(y));
+		const T* cur_l	= reinterpret_cast<const T*>(cur.line(y));
+		const T* next_l	= reinterpret_cast<const T*>(next.line(y));
+		const T* prev2	= p ? prev_l : cur_l;
+		const T* next2	= p ? cur_l  : next_l;
+		T* dst_l		= reinterpret_cast<T*>(dst.line(y));
+
+		for(int x = 0; x < w; ++x)
+		{
+			const T* c_ = cur_l + x;
+			int c = c_[mrefs];
+			int d = (prev2[x] + next2[x]) >> 1;
+			int e = c_[prefs];
+			int temporal_diff0 = std::abs(prev2[x] - next2[x]);
+			int temporal_diff1 = (std::abs(prev_l[x + mrefs] - c) + std::abs(prev_l[x + prefs] - e)) >> 1;
+			int temporal_diff2 = (std::abs(next_l[x + mrefs] - c) + std::abs(next_l[x + prefs] - e)) >> 1;
+			int diff = std::max(std::max(temporal_diff0 >> 1, temporal_diff1), temporal_diff2);
+			int spatial_pred = (c + e) >> 1;
+
+			if(x >= 3 && x < w - 3)
+			{
+				int spatial_score = std::abs(c_[mrefs - 1] - c_[prefs - 1]) + std::abs(c - e) + std::abs(c_[mrefs + 1] - c_[prefs + 1]) - 1;
+
+				// CHECK(-1) CHECK(-2) and CHECK(1) CHECK(2), the second check only runs if the first improved.
+				for(int dir = -1; dir <= 1; dir += 2)
+				{
+					for(int j = dir; j == dir || j == 2 * dir; j += dir)
+					{
+						int score = std::abs(c_[mrefs - 1 + j] - c_[prefs - 1 - j])
+								  + std::abs(c_[mrefs + j] - c_[prefs - j])
+								  + std::abs(c_[mrefs + 1 + j] - c_[prefs + 1 - j]);
+						if(!(score < spatial_score))
+							break;
+						spatial_score	= score;
+						spatial_pred	= (c_[mrefs + j] + c_[prefs - j]) >> 1;
+					}
+				}
+			}
+
+			if(!(mode & 2))
+			{
+				int b = (prev2[x + 2 * mrefs] + next2[x + 2 * mrefs]) >> 1;
+				int f = (prev2[x + 2 * prefs] + next2[x + 2 * prefs]) >> 1;
+				int max = std::max(std::max(d - e, d - c), std::min(b - c, f - e));
+				int min = std::min(std::min(d - e, d - c), std::max(b - c, f - e));
+
+				diff = std::max(std::max(diff, min), -max);
+			}
+
+			if(spatial_pred > d + diff)
+				spatial_pred = d + diff;
+			else if(spatial_pred < d - diff)
+				spatial_pred = d - diff;
+
+			dst_l[x] = static_cast<T>(spatial_pred);
+		}
+	}
+}
+
+// vf_bwdif.c, filter_slice with filter_line_c and filter_edge.
+
+template<typename T>
+void reference_bwdif(plane& dst, const plane& prev, const plane& cur, const plane& next, int parity, int tff, int depth)
+{
+	static const int coef_lf[2] = {4309, 213};
+	static const int coef_hf[3] = {5570, 3801, 1016};
+	static const int coef_sp[2] = {5077, 981};
+
+	const int df		= static_cast<int>(sizeof(T));
+	const int refs		= cur.linesize / df;
+	const int w			= cur.width;
+	const int h			= cur.height;
+	const int clip_max	= (1 << depth) - 1;
+
+	for(int y = 0; y < h; ++y)
+	{
+		if(!((y ^ parity) & 1))
+		{
+			std::memcpy(dst.line(y), cur.line(y), w * sizeof(T));
+			continue;
+		}
+
+		const bool edge	= y < 4 || y + 5 > h;
+		const int prefs	= edge ? ((y + df) < h ? refs : -refs) : refs;
+		const int mrefs	= edge ? (y > (df - 1) ? -refs : refs) : -refs;
+		const bool spat	= edge ? !(y < 2 || y + 3 > h) : true;
+		const int prefs2 = refs << 1, mrefs2 = -(refs << 1);
+		const int prefs3 = 3 * refs,  mrefs3 = -3 * refs;
+		const int prefs4 = refs << 2, mrefs4 = -(refs << 2);
+		const bool p	= ((parity ^ tff) & 1) != 0;
+
+		const T* prev_l	= reinterpret_cast<const T*>(prev.line(y));
+		const T* cur_l	= reinterpret_cast<const T*>(cur.line(y));
+		const T* next_l	= reinterpret_cast<const T*>(next.line(y));
+		const T* prev2	= p ? prev_l : cur_l;
+		const T* next2	= p ? cur_l  : next_l;
+		T* dst_l		= reinterpret_cast<T*>(dst.line(y));
+
+		for(int x = 0; x < w; ++x)
+		{
+			int c = cur_l[x + mrefs];
+			int d = (prev2[x] + next2[x]) >> 1;
+			int e = cur_l[x + prefs];
+			int temporal_diff0 = std::abs(prev2[x] - next2[x]);
+			int temporal_diff1 = (std::abs(prev_l[x + mrefs] - c) + std::abs(prev_l[x + prefs] - e)) >> 1;
+			int temporal_diff2 = (std::abs(next_l[x + mrefs] - c) + std::abs(next_l[x + prefs] - e)) >> 1;
+			int diff = std::max(std::max(temporal_diff0 >> 1, temporal_diff1), temporal_diff2);
+
+			if(!diff)
+			{
+				dst_l[x] = static_cast<T>(d);
+				continue;
+			}
+
+			if(spat)
+			{
+				int b = ((prev2[x + mrefs2] + next2[x + mrefs2]) >> 1) - c;
+				int f = ((prev2[x + prefs2] + next2[x + prefs2]) >> 1) - e;
+				int dc = d - c;
+				int de = d - e;
+				int max = std::max(std::max(de, dc), std::min(b, f));
+				int min = std::min(std::min(de, dc), std::max(b, f));
+				diff = std::max(std::max(diff, min), -max);
+			}
+
+			int interpol;
+			if(edge)
+				interpol = (c + e) >> 1;
+			else if(std::abs(c - e) > temporal_diff0)
+			{
+				interpol = (((coef_hf[0] * (prev2[x] + next2[x])
+					- coef_hf[1] * (prev2[x + mrefs2] + next2[x + mrefs2] + prev2[x + prefs2] + next2[x + prefs2])
+					+ coef_hf[2] * (prev2[x + mrefs4] + next2[x + mrefs4] + prev2[x + prefs4] + next2[x + prefs4])) >> 2)
+					+ coef_lf[0] * (c + e) - coef_lf[1] * (cur_l[x + mrefs3] + cur_l[x + prefs3])) >> 13;
+			}
+			else
+				interpol = (coef_sp[0] * (c + e) - coef_sp[1] * (cur_l[x + mrefs3] + cur_l[x + prefs3])) >> 13;
+
+			if(interpol > d + diff)
+				interpol = d + diff;
+			else if(interpol < d - diff)
+				interpol = d - diff;
+
+			dst_l[x] = static_cast<T>(std::min(std::max(interpol, 0), clip_max));
+		}
+	}
+}
+
+struct test_case
+{
+	bool	bwdif;
+	bool	spatial_check;
+	int		depth;
+	int		tff;
+
+	std::string print() const
+	{
+		char buf[64];
+		std::sprintf(buf, "%s%s %d bit %s", bwdif ? "bwdif" : "yadif", bwdif || spatial_check ? "" : " no-spatial", depth, tff ? "tff" : "bff");
+		return buf;
+	}
+};
+
+void filter_kernel(plane& dst, const plane& prev, const plane& cur, const plane& next, const test_case& test)
+{
+	detail::plane_args args;
+	args.prev			= &prev.data[0];
+	args.cur			= &cur.data[0];
+	args.next			= &next.data[0];
+	args.dst			= &dst.data[0];
+	args.src_linesize	= cur.linesize;
+	args.dst_linesize	= dst.linesize;
+	args.width			= cur.width;
+	args.height			= cur.height;
+	args.depth			= test.depth;
+
+	if(test.depth > 8)
+		detail::filter_plane<uint16_t>(args, test.bwdif, test.spatial_check, test.tff ^ 1, test.tff);
+	else
+		detail::filter_plane<uint8_t>(args, test.bwdif, test.spatial_check, test.tff ^ 1, test.tff);
+}
+
+void filter_reference(plane& dst, const plane& prev, const plane& cur, const plane& next, const test_case& test)
+{
+	const int parity = test.tff ^ 1;
+	if(test.bwdif)
+	{
+		if(test.depth > 8)
+			reference_bwdif<uint16_t>(dst, prev, cur, next, parity, test.tff, test.depth);
+		else
+			reference_bwdif<uint8_t>(dst, prev, cur, next, parity, test.tff, test.depth);
+	}
+	else
+	{
+		const int mode = test.spatial_check ? 0 : 2;
+		if(test.depth > 8)
+			reference_yadif<uint16_t>(dst, prev, cur, next, parity, test.tff, mode);
+		else
+			reference_yadif<uint8_t>(dst, prev, cur, next, parity, test.tff, mode);
+	}
+}
+
+// Returns true if the planes are equal, otherwise prints the first difference.
+bool compare(const plane& result, const plane& expected, const std::string& what)
+{
+	for(int y = 0; y < expected.height; ++y)
+	{
+		for(int x = 0; x < expected.width; ++x)
+		{
+			if(result.sample(x, y) != expected.sample(x, y))
+			{
+				std::printf("FAIL %s: %dx%d differs at %d,%d, %d instead of %d\n", what.c_str(), expected.width, expected.height, x, y, result.sample(x, y), expected.sample(x, y));
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+std::vector<plane> make_frames(int width, int height, const test_case& test, bool noise, int count, uint32_t seed)
+{
+	lcg rand(seed);
+	std::vector<plane> frames;
+	for(int n = 0; n < count; ++n)
+	{
+		frames.push_back(plane(width, height, test.depth > 8 ? 2 : 1));
+		if(noise)
+			fill_noise(frames.back(), test.depth, rand);
+		else
+			fill_scene(frames.back(), test.depth, n, test.tff != 0, rand);
+	}
+	return frames;
+}
+
+// Filters every frame with its neighbours, the first frame being its own previous frame.
+int check_kernels(const std::vector<test_case>& tests)
+{
+	static const int sizes[][2] = {{3, 4}, {4, 5}, {5, 6}, {7, 7}, {8, 8}, {11, 9}, {16, 10}, {19, 13}, {64, 16}, {723, 31}, {720, 576}, {1920, 1080}};
+
+	int failures = 0;
+	int checked = 0;
+	for(size_t t = 0; t < tests.size(); ++t)
+	{
+		for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+		{
+			for(int noise = 0; noise < 2; ++noise)
+			{
+				const int width		= sizes[s][0];
+				const int height	= sizes[s][1];
+				const auto frames	= make_frames(width, height, tests[t], noise != 0, 4, static_cast<uint32_t>(1 + t * 131 + s * 7 + noise));
+
+				for(size_t n = 0; n + 1 < frames.size(); ++n)
+				{
+					const plane& prev = frames[n > 0 ? n - 1 : n];
+					plane result(width, height, frames[n].df);
+					plane expected(width, height, frames[n].df);
+
+					filter_kernel(result, prev, frames[n], frames[n + 1], tests[t]);
+					filter_reference(expected, prev, frames[n], frames[n + 1], tests[t]);
+
+					++checked;
+					if(!compare(result, expected, tests[t].print() + (noise ? " noise" : " scene")))
+						++failures;
+				}
+			}
+		}
+	}
+
+	std::printf("kernels vs libavfilter C: %d of %d planes match\n", checked - failures, checked);
+	return failures;
+}
+
+// The SSE2 line kernel covers [3, w - 3) in steps of 8 samples, with the C kernel doing the rest.
+int check_sse2()
+{
+	lcg rand(7);
+	int failures = 0;
+	int checked = 0;
+
+	for(int n = 0; n < 20000; ++n)
+	{
+		const int w		= 1 + rand.next(100);
+		const int refs	= w + 32;
+		std::vector<uint8_t> prev(refs * 5), cur(refs * 5), next(refs * 5), dst_c(refs * 5), dst_sse2(refs * 5);
+
+		// Noise or a ramp with small noise, the ramp keeps the spatial search and clamping busy.
+		const bool ramp = rand.next(2) != 0;
+		for(int i = 0; i < refs * 5; ++i)
+		{
+			prev[i]	= static_cast<uint8_t>(ramp ? ((i % refs) * 3 + rand.next(8))  & 255 : rand.next(256));
+			cur[i]	= static_cast<uint8_t>(ramp ? ((i % refs) * 3 + rand.next(20)) & 255 : rand.next(256));
+			next[i]	= static_cast<uint8_t>(ramp ? ((i % refs) * 3 + rand.next(5))  & 255 : rand.next(256));
+		}
+
+		detail::line_refs line;
+		line.prefs	= refs;
+		line.mrefs	= -refs;
+		line.parity	= rand.next(2);
+		const bool spatial_check = rand.next(2) != 0;
+		const int y = 2 * refs;
+
+		detail::yadif_line_c<uint8_t>(&dst_c[y], &prev[y], &cur[y], &next[y], 0, w, w, line, spatial_check);
+		detail::yadif_line(&dst_sse2[y], &prev[y], &cur[y], &next[y], w, line, spatial_check);
+
+		++checked;
+		if(!std::equal(dst_c.begin() + y, dst_c.begin() + y + w, dst_sse2.begin() + y))
+		{
+			if(failures++ < 10)
+				std::printf("FAIL yadif sse2: width %d parity %d spatial %d\n", w, line.parity, spatial_check ? 1 : 0);
+		}
+	}
+
+	std::printf("yadif sse2 vs c: %d of %d lines match\n", checked - failures, checked);
+	return failures;
+}
+
+#if defined(WITH_LIBAVFILTER)
+
+// Runs the frames through "buffer,<filter>,buffersink" as single plane gray or gray10 frames.
+struct libavfilter_graph
+{
+	AVFilterGraph*		graph;
+	AVFilterContext*	source;
+	AVFilterContext*	sink;
+
+	libavfilter_graph(int width, int height, const test_case& test)
+		: graph(avfilter_graph_alloc())
+		, source(nullptr)
+		, sink(nullptr)
+	{
+		const char* pix_fmt = test.depth > 8 ? "yuv420p10le" : "yuv420p";
+		char args[256];
+		std::sprintf(args, "video_size=%dx%d:pix_fmt=%s:time_base=1/25:pixel_aspect=1/1", width, height, pix_fmt);
+
+		char filter[128];
+		if(test.bwdif)
+			std::sprintf(filter, "bwdif=mode=0:parity=%d:deint=0", test.tff ? 0 : 1);
+		else
+			std::sprintf(filter, "yadif=mode=%d:parity=%d:deint=0", test.spatial_check ? 0 : 2, test.tff ? 0 : 1);
+
+		check(avfilter_graph_create_filter(&source, avfilter_get_by_name("buffer"), "in", args, nullptr, graph), "buffer");
+		check(avfilter_graph_create_filter(&sink, avfilter_get_by_name("buffersink"), "out", nullptr, nullptr, graph), "buffersink");
+
+		AVFilterInOut* outputs	= avfilter_inout_alloc();
+		AVFilterInOut* inputs	= avfilter_inout_alloc();
+		outputs->name		= av_strdup("in");
+		outputs->filter_ctx	= source;
+		outputs->pad_idx	= 0;
+		outputs->next		= nullptr;
+		inputs->name		= av_strdup("out");
+		inputs->filter_ctx	= sink;
+		inputs->pad_idx		= 0;
+		inputs->next		= nullptr;
+
+		check(avfilter_graph_parse_ptr(graph, filter, &inputs, &outputs, nullptr), filter);
+		avfilter_inout_free(&inputs);
+		avfilter_inout_free(&outputs);
+		check(avfilter_graph_config(graph, nullptr), "config");
+	}
+
+	~libavfilter_graph()
+	{
+		avfilter_graph_free(&graph);
+	}
+
+	static void check(int ret, const char* what)
+	{
+		if(ret < 0)
+		{
+			std::printf("libavfilter error %d in %s\n", ret, what);
+			std::exit(1);
+		}
+	}
+
+	// The luma plane of every output frame.
+	std::vector<plane> run(const std::vector<plane>& frames, int tff)
+	{
+		std::vector<plane> result;
+		for(size_t n = 0; n <= frames.size(); ++n)
+		{
+			if(n < frames.size())
+			{
+				AVFrame* frame	= av_frame_alloc();
+				frame->format	= frames[n].df == 2 ? AV_PIX_FMT_YUV420P10LE : AV_PIX_FMT_YUV420P;
+				frame->width	= frames[n].width;
+				frame->height	= frames[n].height;
+				frame->pts		= static_cast<int64_t>(n);
+				frame->interlaced_frame	= 1;
+				frame->top_field_first	= tff;
+				check(av_frame_get_buffer(frame, 32), "av_frame_get_buffer");
+
+				for(int y = 0; y < frame->height; ++y)
+					std::memcpy(frame->data[0] + y * frame->linesize[0], frames[n].line(y), frames[n].width * frames[n].df);
+				for(int p = 1; p < 3; ++p)
+					std::memset(frame->data[p], 0, frame->linesize[p] * ((frame->height + 1) / 2));
+
+				check(av_buffersrc_add_frame(source, frame), "av_buffersrc_add_frame");
+				av_frame_free(&frame);
+			}
+			else
+				check(av_buffersrc_add_frame(source, nullptr), "flush");
+
+			AVFrame* out = av_frame_alloc();
+			while(av_buffersink_get_frame(sink, out) >= 0)
+			{
+				result.push_back(plane(out->width, out->height, frames[0].df));
+				for(int y = 0; y < out->height; ++y)
+					std::memcpy(result.back().line(y), out->data[0] + y * out->linesize[0], out->width * frames[0].df);
+				av_frame_unref(out);
+			}
+			av_frame_free(&out);
+		}
+		return result;
+	}
+};
+
+// Output n is frame n filtered with its neighbours. The first and the last output are
+// skipped, libavfilter filters them without a previous or next frame.
+int check_libavfilter(const std::vector<test_case>& tests)
+{
+	static const int sizes[][2] = {{64, 16}, {723, 31}, {720, 576}, {1920, 1080}};
+
+	int failures = 0;
+	int checked = 0;
+	for(size_t t = 0; t < tests.size(); ++t)
+	{
+		for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+		{
+			for(int noise = 0; noise < 2; ++noise)
+			{
+				const int width		= sizes[s][0] & ~1;
+				const int height	= sizes[s][1] & ~1;
+				const auto frames	= make_frames(width, height, tests[t], noise != 0, 6, static_cast<uint32_t>(3 + t * 17 + s + noise));
+				libavfilter_graph graph(width, height, tests[t]);
+				const auto expected	= graph.run(frames, tests[t].tff);
+
+				for(size_t n = 1; n + 1 < frames.size() && n < expected.size(); ++n)
+				{
+					plane result(width, height, frames[n].df);
+					filter_kernel(result, frames[n - 1], frames[n], frames[n + 1], tests[t]);
+
+					++checked;
+					if(!compare(result, expected[n], tests[t].print() + (noise ? " noise" : " scene") + " libavfilter"))
+						++failures;
+				}
+			}
+		}
+	}
+
+	std::printf("kernels vs libavfilter: %d of %d planes match\n", checked - failures, checked);
+	return checked > 0 ? failures : 1;
+}
+
+#endif
+
+// Milliseconds per 1080i 4:2:2 frame, one full size and two half width planes.
+void bench(const test_case& test, int iterations)
+{
+	std::vector<plane> luma		= make_frames(1920, 1080, test, false, 3, 11);
+	std::vector<plane> chroma	= make_frames(960, 1080, test, false, 3, 13);
+	plane dst_luma(1920, 1080, luma[0].df);
+	plane dst_chroma(960, 1080, luma[0].df);
+
+	auto time = [&](bool kernel) -> double
+	{
+		const auto start = tbb::tick_count::now();
+		for(int n = 0; n < iterations; ++n)
+		{
+			if(kernel)
+			{
+				filter_kernel(dst_luma, luma[0], luma[1], luma[2], test);
+				filter_kernel(dst_chroma, chroma[0], chroma[1], chroma[2], test);
+				filter_kernel(dst_chroma, chroma[0], chroma[1], chroma[2], test);
+			}
+			else
+			{
+				filter_reference(dst_luma, luma[0], luma[1], luma[2], test);
+				filter_reference(dst_chroma, chroma[0], chroma[1], chroma[2], test);
+				filter_reference(dst_chroma, chroma[0], chroma[1], chroma[2], test);
+			}
+		}
+		return (tbb::tick_count::now() - start).seconds() * 1000.0 / iterations;
+	};
+
+	time(true); // Warm up the caches and the task scheduler.
+
+	const double reference	= time(false);
+	const double kernel		= time(true);
+	std::printf("%-24s c %7.2f ms  kernels %7.2f ms  %5.1fx\n", test.print().c_str(), reference, kernel, reference / kernel);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	bool run_bench = true;
+	int iterations = 50;
+	for(int n = 1; n < argc; ++n)
+	{
+		if(std::string(argv[n]) == "--no-bench")
+			run_bench = false;
+		else if(std::string(argv[n]) == "--iterations" && n + 1 < argc)
+			iterations = std::max(1, std::atoi(argv[++n]));
+		else
+		{
+			std::printf("usage: deinterlacer_test [--no-bench] [--iterations n]\n");
+			return 2;
+		}
+	}
+
+	std::vector<test_case> tests;
+	for(int depth = 8; depth <= 10; depth += 2)
+	{
+		for(int tff = 1; tff >= 0; --tff)
+		{
+			test_case yadif		= {false, true,  depth, tff};
+			test_case no_spatial	= {false, false, depth, tff};
+			test_case bwdif		= {true,  true,  depth, tff};
+			tests.push_back(yadif);
+			tests.push_back(no_spatial);
+			tests.push_back(bwdif);
+		}
+	}
+
+	int failures = check_sse2();
+	failures += check_kernels(tests);
+#if defined(WITH_LIBAVFILTER)
+	avfilter_register_all();
+	failures += check_libavfilter(tests);
+#endif
+
+	if(run_bench)
+	{
+		for(size_t n = 0; n < tests.size(); ++n)
+		{
+			if(tests[n].tff)
+				bench(tests[n], iterations);
+		}
+	}
+
+	std::printf(failures ? "FAILED\n" : "PASSED\n");
+	return failures ? 1 : 0;
+}
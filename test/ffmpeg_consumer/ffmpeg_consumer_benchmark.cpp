@@ -0,0 +1,275 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+// Measures the frames per second the ffmpeg consumer encodes for a number of presets.
+//
+// Each preset is created as FILE would create it and is sent generated BGRA frames with stereo
+// audio faster than it can encode them, so that its encode queue stays full and the frames it
+// cannot take are dropped. The number of frames the consumer has written, which print() reports,
+// is read after a warm up and again after the measured time. The preset with a 720p rendition
+// reports the frames of its main output, the rendition drops frames on its own if it falls
+// behind.
+//
+// Exits with 0 if every preset encoded frames into a non-empty file and 1 otherwise. See
+// test/README.txt for how to build it.
+
+#include <common/env.h>
+#include <common/utility/string.h>
+
+#include <core/consumer/frame_consumer.h>
+#include <core/mixer/read_frame.h>
+#include <core/mixer/audio/audio_util.h>
+#include <core/parameters/parameters.h>
+#include <core/video_format.h>
+
+#include <modules/ffmpeg/consumer/ffmpeg_consumer.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <tbb/tick_count.h>
+
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+	#define __STDC_CONSTANT_MACROS
+	#define __STDC_LIMIT_MACROS
+	#include <libavformat/avformat.h>
+}
+
+using namespace caspar;
+using namespace boost::filesystem;
+
+namespace {
+
+const int WARM_UP_SECONDS	= 2;
+const int PICTURES			= 8; // Generated pictures, cycled through so that the encoder sees motion.
+
+struct encode_preset
+{
+	const wchar_t*	name;
+	const wchar_t*	extension;
+	const wchar_t*	params;		// Added after FILE and the file name.
+	bool			rendition;	// Adds a 720p rendition.
+};
+
+const encode_preset presets[] =
+{
+	{L"x264 ultrafast",					L".mp4", L"VCODEC libx264 OPTIONS preset=ultrafast",	false},
+	{L"x264 veryfast",					L".mp4", L"VCODEC libx264 OPTIONS preset=veryfast",		false},
+	{L"x264 medium",					L".mp4", L"VCODEC libx264 OPTIONS preset=medium",		false},
+	{L"mpeg2 mxf",						L".mxf", L"",											false},
+	{L"prores 422",						L".mov", L"VCODEC prores_ks OPTIONS profile=2",			false},
+	{L"x264 veryfast + 720p proxy",		L".mp4", L"VCODEC libx264 OPTIONS preset=veryfast RENDITION_VCODEC libx264 RENDITION_OPTIONS preset=ultrafast", true}
+};
+
+// A frame in host memory, as a channel would send it after the readback.
+class generated_frame : public core::read_frame
+{
+	const std::vector<uint8_t>&	image_;
+	const std::vector<int32_t>&	audio_;
+	const int					num_channels_;
+
+public:
+	generated_frame(const std::vector<uint8_t>& image, const std::vector<int32_t>& audio, int num_channels)
+		: image_(image)
+		, audio_(audio)
+		, num_channels_(num_channels)
+	{
+	}
+
+	virtual const boost::iterator_range<const uint8_t*> image_data() override
+	{
+		return boost::iterator_range<const uint8_t*>(image_.data(), image_.data() + image_.size());
+	}
+
+	virtual const boost::iterator_range<const int32_t*> audio_data() override
+	{
+		return boost::iterator_range<const int32_t*>(audio_.data(), audio_.data() + audio_.size());
+	}
+
+	virtual uint32_t image_size() const override
+	{
+		return static_cast<uint32_t>(image_.size());
+	}
+
+	virtual int num_channels() const override
+	{
+		return num_channels_;
+	}
+
+	virtual int64_t get_age_millis() const override
+	{
+		return 0;
+	}
+
+	virtual int get_timecode() const override
+	{
+		return std::numeric_limits<int>::max();
+	}
+};
+
+// Diagonal bars moving a few pixels per picture, with some noise.
+std::vector<std::vector<uint8_t>> generate_pictures(const core::video_format_desc& format_desc)
+{
+	std::vector<std::vector<uint8_t>> pictures(PICTURES);
+	unsigned int seed = 1;
+	for(int n = 0; n < PICTURES; ++n)
+	{
+		pictures[n].resize(format_desc.size);
+		uint8_t* pixel = pictures[n].data();
+		for(uint32_t y = 0; y < format_desc.height; ++y)
+		{
+			for(uint32_t x = 0; x < format_desc.width; ++x, pixel += 4)
+			{
+				seed = seed * 1103515245 + 12345;
+				const int bar = ((x + y + n * 8) / 64) % 4;
+				pixel[0] = static_cast<uint8_t>(bar * 60 + (seed >> 28));
+				pixel[1] = static_cast<uint8_t>((x * 255) / format_desc.width);
+				pixel[2] = static_cast<uint8_t>((y * 255) / format_desc.height);
+				pixel[3] = 255;
+			}
+		}
+	}
+	return pictures;
+}
+
+int written_frames(const safe_ptr<core::frame_consumer>& consumer)
+{
+	const std::wstring text = consumer->print();
+	const auto pos = text.rfind(L"Frame:");
+	return pos == std::wstring::npos ? 0 : boost::lexical_cast<int>(text.substr(pos + 6));
+}
+
+bool run(const encode_preset& preset, const wpath& folder, const core::video_format_desc& format_desc, const std::vector<std::vector<uint8_t>>& pictures, double seconds)
+{
+	const auto& layout	= core::default_channel_layout_repository().get_by_name(L"STEREO");
+	const wpath file	= folder / (boost::lexical_cast<std::wstring>(&preset - presets) + preset.extension);
+	const wpath proxy	= folder / (boost::lexical_cast<std::wstring>(&preset - presets) + L"_proxy.mp4");
+
+	std::vector<std::wstring> params;
+	params.push_back(L"FILE");
+	params.push_back(file.file_string());
+	if(*preset.params)
+	{
+		const std::wstring text = preset.params;
+		std::vector<std::wstring> extra;
+		boost::split(extra, text, boost::is_any_of(L" "));
+		params.insert(params.end(), extra.begin(), extra.end());
+	}
+	if(preset.rendition)
+	{
+		params.push_back(L"RENDITIONS");
+		params.push_back(L"720:" + proxy.file_string());
+	}
+
+	const std::vector<int32_t> audio(format_desc.audio_cadence[0] * layout.num_channels, 0);
+
+	int frames = 0;
+	double elapsed = 0.0;
+	{
+		auto consumer = ffmpeg::create_consumer(core::parameters(params));
+		consumer->initialize(format_desc, layout, 1);
+
+		// Offered far faster than any preset encodes, the frames the consumer is not ready for are dropped.
+		auto send_for = [&](double duration)
+		{
+			const auto start = tbb::tick_count::now();
+			for(int n = 0; (tbb::tick_count::now() - start).seconds() < duration; ++n)
+			{
+				consumer->send(make_safe<generated_frame>(pictures[n % PICTURES], audio, layout.num_channels));
+				boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+			}
+		};
+
+		send_for(WARM_UP_SECONDS);
+		const int first_frames	= written_frames(consumer);
+		const auto start		= tbb::tick_count::now();
+		send_for(seconds);
+		elapsed	= (tbb::tick_count::now() - start).seconds();
+		frames	= written_frames(consumer) - first_frames;
+	}
+
+	const bool written = exists(file) && file_size(file) > 0 && (!preset.rendition || (exists(proxy) && file_size(proxy) > 0));
+
+	std::wprintf(L"%-30ls %7.2f fps  %5.2f x real time\n", preset.name, frames / elapsed, frames / elapsed / format_desc.fps);
+	if(frames <= 0 || !written)
+		std::wprintf(L"FAIL %ls encoded %d frames\n", preset.name, frames);
+
+	return frames > 0 && written;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	std::wstring format	= L"1080i5000";
+	double seconds		= 10.0;
+	for(int n = 1; n < argc; ++n)
+	{
+		if(std::string(argv[n]) == "--format" && n + 1 < argc)
+			format = widen(std::string(argv[++n]));
+		else if(std::string(argv[n]) == "--seconds" && n + 1 < argc)
+			seconds = boost::lexical_cast<double>(argv[++n]);
+	}
+
+	{
+		std::ofstream config("ffmpeg_consumer_benchmark.config");
+		config << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+			   << "<configuration><paths><media-path>.\\</media-path><log-path>.\\</log-path>"
+			   << "<data-path>.\\</data-path><template-path>.\\</template-path></paths></configuration>\n";
+	}
+	env::configure(L"ffmpeg_consumer_benchmark.config");
+	core::register_default_channel_layouts(core::default_channel_layout_repository());
+	av_register_all();
+
+	const auto& format_desc = core::video_format_desc::get(format);
+	if(format_desc.format == core::video_format::invalid)
+	{
+		std::printf("FAIL unknown video format\n");
+		return 1;
+	}
+
+	const wpath folder = complete(wpath(L"ffmpeg_consumer_benchmark")); // In the working directory, removed afterwards.
+	remove_all(folder);
+	create_directories(folder);
+
+	const auto pictures = generate_pictures(format_desc);
+
+	std::wprintf(L"%ls, %.1f s per preset\n", format_desc.name.c_str(), seconds);
+
+	bool passed = true;
+	BOOST_FOREACH(auto& preset, presets)
+		passed = run(preset, folder, format_desc, pictures, seconds) && passed;
+
+	remove_all(folder);
+
+	std::printf(passed ? "PASSED\n" : "FAILED\n");
+	return passed ? 0 : 1;
+}
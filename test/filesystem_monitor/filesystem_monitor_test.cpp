@@ -0,0 +1,235 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+// Stress test of the notifying filesystem monitor, checked against the polling monitor.
+//
+// Both monitors watch the same temporary folder while it is changed in rounds:
+//
+//	- thousands of files are created and half of them deleted, more change notifications than
+//	  fit in the 64 KB buffer, so that the notifying monitor has to rescan after an overflow,
+//	- a folder of files is moved into the watched folder, one is moved out and one is renamed,
+//	- files are renamed and rewritten.
+//
+// After each round the files reported by each monitor, CREATED and MODIFIED adding and REMOVED
+// removing a file, must equal the files on disk within a timeout. The time each monitor took
+// is printed.
+//
+// Exits with 0 if both monitors agreed with the disk after every round and 1 otherwise. See
+// test/README.txt for how to build it.
+
+#include <common/filesystem/notifying_filesystem_monitor.h>
+#include <common/filesystem/polling_filesystem_monitor.h>
+
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <tbb/tick_count.h>
+
+#include <cstdio>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace caspar;
+using namespace boost::filesystem;
+
+namespace {
+
+const int FILES				= 5000;
+const int MOVED_FILES		= 500;
+const int TIMEOUT_SECONDS	= 60;	// Files are reported 3 seconds after they were last written, the poll interval is 1 second.
+
+// The files a monitor has reported.
+struct reported_files
+{
+	boost::mutex	mutex;
+	std::set<wpath>	files;
+	int				events;
+
+	reported_files() : events(0){}
+
+	filesystem_monitor_handler handler()
+	{
+		return [this](filesystem_event event, const wpath& file)
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			++events;
+			if(event == REMOVED)
+				files.erase(file);
+			else
+				files.insert(file);
+		};
+	}
+
+	std::set<wpath> get()
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		return files;
+	}
+};
+
+std::set<wpath> list_files(const wpath& folder)
+{
+	std::set<wpath> files;
+	for(wrecursive_directory_iterator it(folder), end; it != end; ++it)
+	{
+		if(!is_directory(it->path()))
+			files.insert(it->path());
+	}
+	return files;
+}
+
+void write_file(const wpath& file, const std::string& content)
+{
+	boost::filesystem::ofstream stream(file);
+	stream << content;
+}
+
+wpath file_name(const wpath& folder, const std::wstring& prefix, int n)
+{
+	return folder / (prefix + boost::lexical_cast<std::wstring>(n) + L".txt");
+}
+
+void print_difference(const char* monitor, const std::set<wpath>& reported, const std::set<wpath>& expected)
+{
+	int printed = 0;
+	BOOST_FOREACH(auto& file, expected)
+	{
+		if(reported.find(file) == reported.end() && printed++ < 5)
+			std::wcout << L"  " << monitor << L" missed " << file.file_string() << std::endl;
+	}
+	BOOST_FOREACH(auto& file, reported)
+	{
+		if(expected.find(file) == expected.end() && printed++ < 10)
+			std::wcout << L"  " << monitor << L" still has " << file.file_string() << std::endl;
+	}
+}
+
+// Waits until both monitors report the files on disk.
+bool wait_for(const char* round, const wpath& folder, reported_files& notifying, reported_files& polling)
+{
+	const auto expected	= list_files(folder);
+	const auto start	= tbb::tick_count::now();
+	double notifying_time	= -1.0;
+	double polling_time		= -1.0;
+
+	while((notifying_time < 0.0 || polling_time < 0.0) && (tbb::tick_count::now() - start).seconds() < TIMEOUT_SECONDS)
+	{
+		const double elapsed = (tbb::tick_count::now() - start).seconds();
+		if(notifying_time < 0.0 && notifying.get() == expected)
+			notifying_time = elapsed;
+		if(polling_time < 0.0 && polling.get() == expected)
+			polling_time = elapsed;
+
+		boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+	}
+
+	std::printf("%-32s %5d files  notifying %6.2f s  polling %6.2f s\n", round, static_cast<int>(expected.size()), notifying_time, polling_time);
+
+	if(notifying_time < 0.0)
+		print_difference("notifying", notifying.get(), expected);
+	if(polling_time < 0.0)
+		print_difference("polling", polling.get(), expected);
+
+	return notifying_time >= 0.0 && polling_time >= 0.0;
+}
+
+}
+
+int main()
+{
+	const wpath root		= complete(wpath(L"filesystem_monitor_test")); // In the working directory, removed afterwards.
+	const wpath watched		= root / L"watched";
+	const wpath outside		= root / L"outside";
+
+	remove_all(root);
+	create_directories(watched / L"initial");
+	create_directories(outside);
+
+	for(int n = 0; n < 100; ++n)
+		write_file(file_name(watched / L"initial", L"initial", n), "initial");
+
+	auto scheduler = std::make_shared<boost::asio::io_service>();
+	std::unique_ptr<boost::asio::io_service::work> work(new boost::asio::io_service::work(*scheduler));
+	boost::thread scheduler_thread([=]{scheduler->run();});
+
+	int failures = 0;
+	{
+		reported_files notifying;
+		reported_files polling;
+
+		notifying_filesystem_monitor_factory notifying_factory(scheduler);
+		polling_filesystem_monitor_factory polling_factory(scheduler, 1000);
+
+		auto notifying_monitor	= notifying_factory.create(watched, ALL, true, notifying.handler(), [](const std::set<wpath>&){});
+		auto polling_monitor	= polling_factory.create(watched, ALL, true, polling.handler(), [](const std::set<wpath>&){});
+
+		notifying_monitor->initial_files_processed().get();
+		polling_monitor->initial_files_processed().get();
+
+		failures += wait_for("initial", watched, notifying, polling) ? 0 : 1;
+
+		// More notifications than the buffer holds.
+		create_directories(watched / L"churn");
+		for(int n = 0; n < FILES; ++n)
+			write_file(file_name(watched / L"churn", L"file", n), "churn");
+		for(int n = 0; n < FILES; n += 2)
+			remove(file_name(watched / L"churn", L"file", n));
+		failures += wait_for("create and delete", watched, notifying, polling) ? 0 : 1;
+
+		// Folders moved in, out and renamed, their files are not notified one by one.
+		create_directories(outside / L"moved_in" / L"nested");
+		for(int n = 0; n < MOVED_FILES; ++n)
+			write_file(file_name(n % 2 ? outside / L"moved_in" / L"nested" : outside / L"moved_in", L"moved", n), "moved");
+		boost::this_thread::sleep(boost::posix_time::seconds(4)); // Old enough to be reported at once once moved in.
+		rename(outside / L"moved_in", watched / L"moved_in");
+		rename(watched / L"initial", outside / L"initial");
+		rename(watched / L"moved_in" / L"nested", watched / L"renamed");
+		failures += wait_for("folder moves", watched, notifying, polling) ? 0 : 1;
+
+		// Renamed and rewritten files.
+		for(int n = 1; n < FILES; n += 4)
+			rename(file_name(watched / L"churn", L"file", n), file_name(watched / L"churn", L"renamed", n));
+		for(int n = 3; n < FILES; n += 4)
+			write_file(file_name(watched / L"churn", L"file", n), "rewritten");
+		failures += wait_for("rename and rewrite", watched, notifying, polling) ? 0 : 1;
+
+		// Everything removed at once.
+		remove_all(watched / L"churn");
+		remove_all(watched / L"moved_in");
+		failures += wait_for("remove folders", watched, notifying, polling) ? 0 : 1;
+
+		std::printf("events: notifying %d, polling %d\n", notifying.events, polling.events);
+	}
+
+	work.reset();
+	scheduler->stop();
+	scheduler_thread.join();
+	remove_all(root);
+
+	std::printf(failures ? "FAILED\n" : "PASSED\n");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,169 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+// Measures folder_listing against walking the folder on every request, as CLS did before it,
+// for folders of 10 000 and 100 000 files.
+//
+// For each size the time of one walk, the time until the listing is ready, the first str() which
+// concatenates the parts, a cached str(), and the time until a changed file is listed are printed.
+// The listing must equal the walk, whose order is the order the file system lists the folders
+// in, with file names differing in case.
+//
+// Exits with 0 if the listings matched and 1 otherwise. See test/README.txt for how to build it.
+
+#include <common/filesystem/folder_listing.h>
+#include <common/filesystem/notifying_filesystem_monitor.h>
+
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <tbb/tick_count.h>
+
+#include <cstdio>
+#include <ctime>
+#include <string>
+
+using namespace caspar;
+using namespace boost::filesystem;
+
+namespace {
+
+const int FOLDERS = 100;
+
+// A line like those of CLS, reading the size and time of the file as CLS does.
+std::wstring render(const wpath& file)
+{
+	return file.file_string() + L" " + boost::lexical_cast<std::wstring>(file_size(file)) + L" " + boost::lexical_cast<std::wstring>(last_write_time(file)) + L"\r\n";
+}
+
+std::wstring walk(const wpath& folder)
+{
+	std::wstring listing;
+	for(wrecursive_directory_iterator it(folder), end; it != end; ++it)
+	{
+		if(!is_directory(it->path()))
+			listing += render(it->path());
+	}
+	return listing;
+}
+
+// Names alternate in case, "Clip" and "clip", so that a case sensitive order differs from the file system's.
+void create_files(const wpath& folder, int files)
+{
+	const std::time_t written = std::time(nullptr) - 60; // Old enough to be listed at once.
+
+	for(int n = 0; n < files; ++n)
+	{
+		const wpath sub_folder	= folder / (std::wstring((n % FOLDERS) % 3 ? L"Folder" : L"folder") + boost::lexical_cast<std::wstring>(n % FOLDERS));
+		const wpath file		= sub_folder / (std::wstring(n % 2 ? L"Clip" : L"clip") + boost::lexical_cast<std::wstring>(n) + L".mov");
+
+		if(n < FOLDERS)
+			create_directories(sub_folder);
+
+		{
+			boost::filesystem::ofstream stream(file);
+			stream << "clip";
+		}
+		last_write_time(file, written);
+	}
+}
+
+double seconds_since(const tbb::tick_count& start)
+{
+	return (tbb::tick_count::now() - start).seconds();
+}
+
+bool run(int files, const std::shared_ptr<boost::asio::io_service>& scheduler)
+{
+	const wpath folder = complete(wpath(L"folder_listing_benchmark")); // In the working directory, removed afterwards.
+	remove_all(folder);
+	create_files(folder, files);
+
+	auto start = tbb::tick_count::now();
+	const std::wstring walked = walk(folder);
+	const double walk_time = seconds_since(start);
+
+	notifying_filesystem_monitor_factory monitor_factory(scheduler);
+
+	start = tbb::tick_count::now();
+	folder_listing listing(monitor_factory, folder, render);
+	while(!listing.is_ready())
+		boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+	const double ready_time = seconds_since(start);
+
+	start = tbb::tick_count::now();
+	const std::wstring listed = listing.str();
+	const double first_str_time = seconds_since(start);
+
+	start = tbb::tick_count::now();
+	listing.str();
+	const double cached_str_time = seconds_since(start);
+
+	// A changed file is listed once it is no longer being written, three seconds after the write.
+	const wpath changed = folder / L"folder0" / L"clip0.mov";
+	{
+		boost::filesystem::ofstream stream(changed);
+		stream << "changed clip";
+	}
+	start = tbb::tick_count::now();
+	const std::wstring changed_line = render(changed);
+	while(listing.str().find(changed_line) == std::wstring::npos && seconds_since(start) < 30.0)
+		boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+	const double change_time = seconds_since(start);
+
+	std::printf("%6d files: walk %7.1f ms  ready %7.1f ms  first str %6.2f ms  cached str %6.2f ms  change listed after %5.2f s\n",
+		files, walk_time * 1000.0, ready_time * 1000.0, first_str_time * 1000.0, cached_str_time * 1000.0, change_time);
+
+	const bool matches = listed == walked;
+	if(!matches)
+	{
+		size_t n = 0;
+		while(n < listed.size() && n < walked.size() && listed[n] == walked[n])
+			++n;
+		const size_t line = walked.rfind(L'\n', n) == std::wstring::npos ? 0 : walked.rfind(L'\n', n) + 1;
+		std::wprintf(L"FAIL listing differs from the walk at\n  %ls\n", walked.substr(line, walked.find(L'\n', line) - line).c_str());
+	}
+
+	remove_all(folder);
+	return matches;
+}
+
+}
+
+int main()
+{
+	auto scheduler = std::make_shared<boost::asio::io_service>();
+	std::unique_ptr<boost::asio::io_service::work> work(new boost::asio::io_service::work(*scheduler));
+	boost::thread scheduler_thread([=]{scheduler->run();});
+
+	bool passed = run(10000, scheduler);
+	passed = run(100000, scheduler) && passed;
+
+	work.reset();
+	scheduler->stop();
+	scheduler_thread.join();
+
+	std::printf(passed ? "PASSED\n" : "FAILED\n");
+	return passed ? 0 : 1;
+}
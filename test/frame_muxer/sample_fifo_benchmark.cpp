@@ -0,0 +1,160 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+// Measures the sample_fifo of the frame muxer against the vector it replaced, which popped each
+// frame's samples with erase(begin, begin + n).
+//
+// Decoded audio is pushed in packets of 1024 samples per channel, as AAC is decoded, while the
+// samples of each frame are popped by the cadence of 50p, 25p and 29.97p, for 2, 8 and 16
+// channels and with a backlog of 2 and 30 frames of audio ahead of the video. Each frame's
+// samples are popped into a new buffer, as into the audio of a new write_frame, and into a reused
+// buffer. The time per frame of each is printed.
+//
+// Exits with 0 if the fifo popped the same samples as the vector in every case and 1 otherwise.
+// See test/README.txt for how to build it.
+
+#include <modules/ffmpeg/producer/muxer/sample_fifo.h>
+
+#include <tbb/tick_count.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+using namespace caspar;
+
+namespace {
+
+const int FRAMES		= 20000;
+const int PACKET_SIZE	= 1024;
+
+// The frame muxer's audio before the sample_fifo.
+class vector_fifo
+{
+	core::audio_buffer samples_;
+public:
+	size_t size() const
+	{
+		return samples_.size();
+	}
+
+	template<typename It>
+	void push(It begin, It end)
+	{
+		samples_.insert(samples_.end(), begin, end);
+	}
+
+	void pop(size_t count, core::audio_buffer& dest)
+	{
+		dest.assign(samples_.begin(), samples_.begin() + count);
+		samples_.erase(samples_.begin(), samples_.begin() + count);
+	}
+};
+
+struct cadence
+{
+	const char*	name;
+	int			samples[5];
+	int			size;
+};
+
+const cadence cadences[] =
+{
+	{"50p",		{960},							1},
+	{"25p",		{1920},							1},
+	{"29.97p",	{1602, 1601, 1602, 1601, 1602},	5}
+};
+
+// Pops FRAMES frames, pushing packets whenever fewer than backlog frames of samples are left.
+// Returns a checksum of the popped samples and the time per frame in microseconds.
+template<typename Fifo>
+uint64_t run(Fifo& fifo, const cadence& cadence, int channels, int backlog, bool reuse_dest, double& micros_per_frame)
+{
+	core::audio_buffer packet(PACKET_SIZE * channels, 1);
+	const size_t backlog_samples = static_cast<size_t>(backlog) * cadence.samples[0] * channels;
+
+	core::audio_buffer reused;
+	uint64_t checksum	= 0;
+	int32_t next		= 0;
+
+	const auto start = tbb::tick_count::now();
+	for(int frame = 0; frame < FRAMES; ++frame)
+	{
+		const size_t count = static_cast<size_t>(cadence.samples[frame % cadence.size]) * channels;
+
+		while(fifo.size() < count + backlog_samples)
+		{
+			packet[0] = next++; // Marks each packet so that samples popped in the wrong order change the checksum.
+			fifo.push(packet.begin(), packet.end());
+		}
+
+		core::audio_buffer fresh;
+		core::audio_buffer& dest = reuse_dest ? reused : fresh;
+		fifo.pop(count, dest);
+
+		checksum = checksum * 31 + dest[0] + dest[dest.size() / 2] + dest.back();
+	}
+	micros_per_frame = (tbb::tick_count::now() - start).seconds() * 1000000.0 / FRAMES;
+
+	return checksum;
+}
+
+}
+
+int main()
+{
+	const int channel_counts[]	= {2, 8, 16};
+	const int backlogs[]		= {2, 30};
+
+	int failures = 0;
+	for(int c = 0; c < sizeof(cadences) / sizeof(cadences[0]); ++c)
+	{
+		for(int n = 0; n < sizeof(channel_counts) / sizeof(channel_counts[0]); ++n)
+		{
+			for(int b = 0; b < sizeof(backlogs) / sizeof(backlogs[0]); ++b)
+			{
+				const int channels	= channel_counts[n];
+				const int backlog	= backlogs[b];
+
+				double vector_new, vector_reused, fifo_new, fifo_reused;
+				vector_fifo			vector1, vector2;
+				ffmpeg::sample_fifo	fifo1, fifo2;
+
+				const uint64_t expected = run(vector1, cadences[c], channels, backlog, false, vector_new);
+				run(vector2, cadences[c], channels, backlog, true, vector_reused);
+				const uint64_t fifo_checksum		= run(fifo1, cadences[c], channels, backlog, false, fifo_new);
+				const uint64_t fifo_reused_checksum	= run(fifo2, cadences[c], channels, backlog, true, fifo_reused);
+
+				std::printf("%-7s %2d channels, backlog %2d frames: vector %6.2f us (reused dest %6.2f us)  fifo %6.2f us (reused dest %6.2f us)\n",
+					cadences[c].name, channels, backlog, vector_new, vector_reused, fifo_new, fifo_reused);
+
+				if(fifo_checksum != expected || fifo_reused_checksum != expected)
+				{
+					++failures;
+					std::printf("FAIL the fifo popped other samples than the vector\n");
+				}
+			}
+		}
+	}
+
+	std::printf(failures ? "FAILED\n" : "PASSED\n");
+	return failures ? 1 : 0;
+}
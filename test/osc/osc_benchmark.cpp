@@ -0,0 +1,209 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+// Measures the monitor messages per second the OSC client takes and the allocations per frame.
+//
+// 8 channels with 20 layers each send 10 messages per layer and frame, through subjects for the
+// channel, the stage and the layer as the server does, from one thread per channel. The client
+// sends them to a socket of this process, which counts the datagrams it receives.
+//
+// Allocations are counted by replacing the global operator new, after warm up frames which let
+// the client's free list and per path entries reach their size. Buffers of the tbb allocators are
+// not counted.
+//
+// Exits with 0 if the datagrams were received and there was less than one allocation per 100
+// messages, and 1 otherwise. See test/README.txt for how to build it.
+
+#include <protocol/osc/client.h>
+
+#include <core/monitor/monitor.h>
+
+#include <boost/asio.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <tbb/atomic.h>
+#include <tbb/tick_count.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace caspar;
+using namespace boost::asio::ip;
+
+namespace {
+
+tbb::atomic<int64_t> g_allocations;
+
+}
+
+void* operator new(size_t size)
+{
+	++g_allocations;
+	void* p = std::malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p)
+{
+	std::free(p);
+}
+
+void operator delete[](void* p)
+{
+	std::free(p);
+}
+
+namespace {
+
+const int CHANNELS			= 8;
+const int LAYERS			= 20;
+const int WARM_UP_FRAMES	= 50;
+const int FRAMES			= 2000;
+
+const char* const PATHS[] =
+{
+	"/file/time", "/file/frame", "/file/fps", "/file/path", "/loop",
+	"/paused", "/file/video/width", "/file/video/height", "/file/audio/channels", "/profiler/time"
+};
+
+const int MESSAGES = sizeof(PATHS) / sizeof(PATHS[0]);
+
+// The subjects of a channel, as video_channel, stage and layer attach them.
+struct channel
+{
+	safe_ptr<core::monitor::subject>				subject;
+	safe_ptr<core::monitor::subject>				stage;
+	std::vector<safe_ptr<core::monitor::subject>>	layers;
+	std::vector<core::monitor::path_handle>			paths;
+
+	channel(int index, const safe_ptr<core::monitor::sink>& parent)
+		: subject(make_safe<core::monitor::subject>("/channel/" + boost::lexical_cast<std::string>(index)))
+		, stage(make_safe<core::monitor::subject>("/stage"))
+	{
+		subject->attach_parent(parent);
+		stage->attach_parent(subject);
+
+		for(int n = 0; n < LAYERS; ++n)
+		{
+			layers.push_back(make_safe<core::monitor::subject>("/layer/" + boost::lexical_cast<std::string>(n + 1)));
+			layers.back()->attach_parent(stage);
+		}
+
+		for(int n = 0; n < MESSAGES; ++n)
+			paths.push_back(core::monitor::path_handle(PATHS[n]));
+	}
+
+	void send_frame(int frame)
+	{
+		for(int layer = 0; layer < LAYERS; ++layer)
+		{
+			for(int n = 0; n < MESSAGES; ++n)
+				*layers[layer] << (core::monitor::message(paths[n]) % static_cast<float>(frame) % static_cast<float>(frame + n));
+		}
+	}
+};
+
+}
+
+int main()
+{
+	auto service = std::make_shared<boost::asio::io_service>();
+
+	udp::socket receiver(*service, udp::endpoint(address_v4::loopback(), 0));
+	tbb::atomic<int64_t> received;
+	received = 0;
+	boost::thread receiver_thread([&]
+	{
+		std::vector<char> datagram(65536);
+		udp::endpoint sender;
+		boost::system::error_code ec;
+		while(receiver.receive_from(boost::asio::buffer(datagram), sender, 0, ec) > 0 || !ec)
+			++received;
+	});
+
+	int64_t allocations	= 0;
+	double seconds		= 0.0;
+	{
+		protocol::osc::client client(service);
+		auto token = client.get_subscription_token(receiver.local_endpoint());
+
+		std::vector<std::shared_ptr<channel>> channels;
+		for(int n = 0; n < CHANNELS; ++n)
+			channels.push_back(std::make_shared<channel>(n + 1, client.sink()));
+
+		for(int frame = 0; frame < WARM_UP_FRAMES; ++frame)
+		{
+			for(int n = 0; n < CHANNELS; ++n)
+				channels[n]->send_frame(frame);
+			boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+		}
+		boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+
+		boost::thread_group threads;
+		const int64_t first_allocations	= g_allocations;
+		const auto start				= tbb::tick_count::now();
+
+		for(int n = 0; n < CHANNELS; ++n)
+		{
+			auto channel = channels[n];
+			threads.create_thread([=]
+			{
+				for(int frame = 0; frame < FRAMES; ++frame)
+					channel->send_frame(WARM_UP_FRAMES + frame);
+			});
+		}
+		threads.join_all();
+
+		seconds		= (tbb::tick_count::now() - start).seconds();
+		allocations	= g_allocations - first_allocations; // Including those of starting the threads.
+
+		boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+	}
+
+	receiver.close();
+	receiver_thread.join();
+
+	const int messages_per_frame	= CHANNELS * LAYERS * MESSAGES;
+	const double per_frame			= static_cast<double>(allocations) / FRAMES;
+
+	std::printf("%d messages per frame, %d frames in %.2f s: %.0f messages/s, %.2f allocations per frame, %lld datagrams received\n",
+		messages_per_frame, FRAMES, seconds, messages_per_frame * static_cast<double>(FRAMES) / seconds, per_frame, static_cast<long long>(received));
+
+	const bool passed = received > 0 && per_frame < messages_per_frame / 100.0;
+	if(received == 0)
+		std::printf("FAIL no datagrams received\n");
+	if(per_frame >= messages_per_frame / 100.0)
+		std::printf("FAIL more than one allocation per 100 messages\n");
+
+	std::printf(passed ? "PASSED\n" : "FAILED\n");
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,261 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+// Measures the cost of routing one channel to 1 to 8 other channels, as ROUTE does.
+//
+// A source channel plays a color and every destination channel plays a channel producer of the
+// source. This is run twice:
+//
+//	- shared, all channels on one ogl_device, so the destinations draw the device buffer the
+//	  source was rendered to,
+//	- copy, the destinations on a second ogl_device, so every routed frame is read back, copied
+//	  into a write_frame and uploaded again, as every route did before.
+//
+// For each number of routes the frames the destinations output per second, the process' cpu time
+// per second of wall time and the routed image bytes copied and uploaded per second are printed.
+//
+// Exits with 0 if every destination output at least half of its frames and 1 otherwise. See
+// test/README.txt for how to build it.
+
+#include <common/env.h>
+#include <common/utility/string.h>
+
+#include <core/video_channel.h>
+#include <core/video_format.h>
+#include <core/consumer/frame_consumer.h>
+#include <core/consumer/output.h>
+#include <core/mixer/mixer.h>
+#include <core/mixer/read_frame.h>
+#include <core/mixer/audio/audio_util.h>
+#include <core/mixer/gpu/ogl_device.h>
+#include <core/parameters/parameters.h>
+#include <core/producer/stage.h>
+#include <core/producer/channel/channel_producer.h>
+#include <core/producer/color/color_producer.h>
+
+#include <common/concurrency/future_util.h>
+
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <tbb/atomic.h>
+#include <tbb/tick_count.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+using namespace caspar;
+using namespace caspar::core;
+
+namespace {
+
+const int MAX_ROUTES		= 8;
+const int WARM_UP_SECONDS	= 2;
+const int SECONDS			= 10;
+
+// Counts the frames a channel outputs.
+class counting_consumer : public frame_consumer
+{
+	tbb::atomic<int>	frames_;
+	int					channel_index_;
+
+public:
+	counting_consumer()
+		: channel_index_(0)
+	{
+		frames_ = 0;
+	}
+
+	int frames() const
+	{
+		return frames_;
+	}
+
+	virtual boost::unique_future<bool> send(const safe_ptr<read_frame>& frame) override
+	{
+		++frames_;
+		return wrap_as_future(true);
+	}
+
+	virtual void initialize(const video_format_desc& format_desc, const channel_layout& audio_channel_layout, int channel_index) override
+	{
+		channel_index_ = channel_index;
+	}
+
+	virtual int64_t presentation_frame_age_millis() const override
+	{
+		return 0;
+	}
+
+	virtual std::wstring print() const override
+	{
+		return L"counting[" + boost::lexical_cast<std::wstring>(channel_index_) + L"]";
+	}
+
+	virtual boost::property_tree::wptree info() const override
+	{
+		boost::property_tree::wptree info;
+		info.add(L"type", L"counting-consumer");
+		return info;
+	}
+
+	virtual bool has_synchronization_clock() const override
+	{
+		return false;
+	}
+
+	virtual uint32_t buffer_depth() const override
+	{
+		return 1;
+	}
+
+	virtual int index() const override
+	{
+		return 99000;
+	}
+};
+
+// User and kernel time of the process.
+double cpu_seconds()
+{
+	FILETIME creation, exit, kernel, user;
+	GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+
+	ULARGE_INTEGER kernel_time, user_time;
+	kernel_time.LowPart		= kernel.dwLowDateTime;
+	kernel_time.HighPart	= kernel.dwHighDateTime;
+	user_time.LowPart		= user.dwLowDateTime;
+	user_time.HighPart		= user.dwHighDateTime;
+
+	return static_cast<double>(kernel_time.QuadPart + user_time.QuadPart) / 10000000.0;
+}
+
+bool run(const video_format_desc& format_desc, int routes, bool shared, const safe_ptr<ogl_device>& ogl, const safe_ptr<ogl_device>& other_ogl)
+{
+	const auto& layout = default_channel_layout_repository().get_by_name(L"STEREO");
+
+	auto source = make_safe<video_channel>(1, format_desc, ogl, layout);
+	std::vector<std::wstring> color;
+	color.push_back(L"#FF336699");
+	source->stage()->load(1, create_color_producer(source->mixer(), parameters(color)));
+	source->stage()->play(1);
+	source->initialize();
+
+	std::vector<safe_ptr<video_channel>>		destinations;
+	std::vector<safe_ptr<counting_consumer>>	consumers;
+	for(int n = 0; n < routes; ++n)
+	{
+		auto destination	= make_safe<video_channel>(n + 2, format_desc, shared ? ogl : other_ogl, layout);
+		auto consumer		= make_safe<counting_consumer>();
+		destination->output()->add(consumer);
+		destination->stage()->load(1, create_channel_producer(destination->mixer(), source));
+		destination->stage()->play(1);
+		destination->initialize();
+		destinations.push_back(destination);
+		consumers.push_back(consumer);
+	}
+
+	boost::this_thread::sleep(boost::posix_time::seconds(WARM_UP_SECONDS));
+
+	std::vector<int> first_frames;
+	BOOST_FOREACH(auto& consumer, consumers)
+		first_frames.push_back(consumer->frames());
+	const double first_cpu	= cpu_seconds();
+	const auto start		= tbb::tick_count::now();
+
+	boost::this_thread::sleep(boost::posix_time::seconds(SECONDS));
+
+	const double seconds	= (tbb::tick_count::now() - start).seconds();
+	const double cpu		= cpu_seconds() - first_cpu;
+
+	int frames		= 0;
+	int min_frames	= std::numeric_limits<int>::max();
+	for(size_t n = 0; n < consumers.size(); ++n)
+	{
+		const int output = consumers[n]->frames() - first_frames[n];
+		frames		+= output;
+		min_frames	= std::min(min_frames, output);
+	}
+
+	// Without a shared ogl_device every routed frame is copied into a write_frame and uploaded.
+	const double routed_bytes	= static_cast<double>(frames) * format_desc.size;
+	const double copied_mb		= shared ? 0.0 : routed_bytes / seconds / (1024.0 * 1024.0);
+
+	std::printf("%-6s %d routes: %6.2f fps per route  cpu %6.1f %%  copied %8.1f MB/s  uploaded %8.1f MB/s\n",
+		shared ? "shared" : "copy", routes, frames / seconds / routes, cpu / seconds * 100.0, copied_mb, copied_mb);
+
+	const bool passed = min_frames >= format_desc.fps * seconds / 2.0;
+	if(!passed)
+		std::printf("FAIL a destination output %d frames in %.1f s\n", min_frames, seconds);
+
+	destinations.clear();
+
+	return passed;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	std::wstring format = L"2160p2500";
+	for(int n = 1; n < argc; ++n)
+	{
+		if(std::string(argv[n]) == "--format" && n + 1 < argc)
+			format = widen(std::string(argv[++n]));
+	}
+
+	{
+		std::ofstream config("route_bandwidth_benchmark.config");
+		config << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+			   << "<configuration><paths><media-path>.\\</media-path><log-path>.\\</log-path>"
+			   << "<data-path>.\\</data-path><template-path>.\\</template-path></paths></configuration>\n";
+	}
+	env::configure(L"route_bandwidth_benchmark.config");
+	register_default_channel_layouts(default_channel_layout_repository());
+
+	const auto& format_desc = video_format_desc::get(format);
+	if(format_desc.format == video_format::invalid)
+	{
+		std::printf("FAIL unknown video format\n");
+		return 1;
+	}
+
+	auto ogl		= ogl_device::create();
+	auto other_ogl	= ogl_device::create();
+
+	std::wprintf(L"%ls, %d bytes per frame\n", format_desc.name.c_str(), static_cast<int>(format_desc.size));
+
+	bool passed = true;
+	for(int routes = 1; routes <= MAX_ROUTES; ++routes)
+		passed = run(format_desc, routes, true, ogl, other_ogl) && passed;
+	for(int routes = 1; routes <= MAX_ROUTES; ++routes)
+		passed = run(format_desc, routes, false, ogl, other_ogl) && passed;
+
+	std::printf(passed ? "PASSED\n" : "FAILED\n");
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,173 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+// Checks that the scaling context cache stays bounded while the source resolution keeps changing.
+//
+// 50 source resolutions are cycled through, scaled to 1080p BGRA, by one thread, by threads warming
+// up contexts for others, and by several threads at once which then exit. After every lookup the
+// number of allocated contexts, get_sws_context_cache_stats().contexts, must be within the
+// per-thread and shared capacities, and after the threads have exited only the shared cache may
+// hold contexts. The process' private bytes must not grow between the second and the last round.
+//
+// Exits with 0 if the cache stayed bounded and 1 otherwise. See test/README.txt for how to build it.
+
+#include <common/env.h>
+
+#include <modules/ffmpeg/producer/util/sws_context_cache.h>
+
+#include <boost/thread.hpp>
+
+#include <tbb/atomic.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+#include <psapi.h>
+
+extern "C"
+{
+	#define __STDC_CONSTANT_MACROS
+	#define __STDC_LIMIT_MACROS
+	#include <libswscale/swscale.h>
+}
+
+using namespace caspar;
+using namespace caspar::ffmpeg;
+
+namespace {
+
+const int CACHE_SIZE	= 8;
+const int ROUNDS		= 20;
+const int THREADS		= 4;
+
+const int resolutions[][2] =
+{
+	{720, 576}, {720, 486}, {720, 480}, {704, 576}, {704, 480}, {640, 480}, {640, 360}, {544, 576},
+	{480, 576}, {352, 288}, {352, 576}, {320, 240}, {176, 144}, {1280, 720}, {960, 720}, {1024, 576},
+	{1024, 768}, {1280, 1024}, {1366, 768}, {1440, 1080}, {1440, 900}, {1600, 900}, {1680, 1050}, {1920, 1080},
+	{1920, 1088}, {1920, 1200}, {2048, 1080}, {2048, 1556}, {2560, 1440}, {2560, 1600}, {3840, 2160}, {4096, 2160},
+	{1280, 1080}, {960, 1080}, {1998, 1080}, {1828, 1332}, {800, 600}, {848, 480}, {854, 480}, {426, 240},
+	{256, 144}, {160, 120}, {1152, 864}, {1400, 1050}, {2880, 1620}, {3200, 1800}, {721, 577}, {1921, 1081},
+	{1000, 1000}, {64, 64}
+};
+
+const int RESOLUTIONS = sizeof(resolutions) / sizeof(resolutions[0]);
+
+tbb::atomic<int> g_failures;
+
+sws_context_key key(int n)
+{
+	return sws_context_key(resolutions[n][0], resolutions[n][1], AV_PIX_FMT_YUV420P, 1920, 1080, AV_PIX_FMT_BGRA, SWS_BICUBIC);
+}
+
+void check_contexts(int max_contexts, const char* where)
+{
+	const int contexts = get_sws_context_cache_stats().contexts;
+	if(contexts > max_contexts)
+	{
+		if(g_failures++ < 10)
+			std::printf("FAIL %s: %d contexts allocated, at most %d expected\n", where, contexts, max_contexts);
+	}
+}
+
+size_t private_bytes()
+{
+	PROCESS_MEMORY_COUNTERS_EX counters;
+	GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters), sizeof(counters));
+	return counters.PrivateUsage;
+}
+
+// Each thread holds at most CACHE_SIZE contexts, the shared cache CACHE_SIZE more. A thread which is
+// inserting a context holds one more until it has evicted the oldest.
+void cycle(int threads, int offset, const char* where)
+{
+	for(int n = 0; n < RESOLUTIONS; ++n)
+	{
+		get_sws_context(key((n + offset) % RESOLUTIONS));
+		check_contexts(CACHE_SIZE * (threads + 1) + threads - 1, where);
+	}
+}
+
+// Contexts used while warming up go to the shared cache when released.
+void warm_up(int offset)
+{
+	sws_context_warm_up warm_up;
+	for(int n = 0; n < RESOLUTIONS; ++n)
+	{
+		auto context = get_sws_context(key((n + offset) % RESOLUTIONS));
+		check_contexts(CACHE_SIZE * 2 + 1, "warm up");
+	}
+}
+
+}
+
+int main()
+{
+	g_failures = 0;
+
+	{
+		std::ofstream config("sws_context_cache_test.config");
+		config << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+			   << "<configuration><paths><media-path>.\\</media-path><log-path>.\\</log-path>"
+			   << "<data-path>.\\</data-path><template-path>.\\</template-path></paths>"
+			   << "<ffmpeg><sws-cache-size>" << CACHE_SIZE << "</sws-cache-size></ffmpeg></configuration>\n";
+	}
+	env::configure(L"sws_context_cache_test.config");
+
+	size_t first_bytes = 0;
+	for(int round = 0; round < ROUNDS; ++round)
+	{
+		cycle(1, round, "one thread");
+		warm_up(round);
+
+		boost::thread_group threads;
+		for(int n = 0; n < THREADS; ++n)
+			threads.create_thread([=]{cycle(THREADS + 1, round + n * 7, "threads");});
+		threads.join_all();
+
+		// The exited threads have freed their caches.
+		check_contexts(CACHE_SIZE * 2, "threads exited");
+
+		if(round == 1)
+			first_bytes = private_bytes();
+	}
+
+	const size_t last_bytes	= private_bytes();
+	const auto stats		= get_sws_context_cache_stats();
+
+	std::printf("%d resolutions, %d rounds: %llu hits, %llu warm hits, %llu misses, %llu evictions, %d contexts allocated\n",
+		RESOLUTIONS, ROUNDS, stats.hits, stats.warm_hits, stats.misses, stats.evictions, stats.contexts);
+	std::printf("private bytes after round 2: %u KB, after round %d: %u KB\n",
+		static_cast<unsigned>(first_bytes / 1024), ROUNDS, static_cast<unsigned>(last_bytes / 1024));
+
+	// Some slack for the allocator and the log, a leaked 1080p context is several megabytes.
+	if(last_bytes > first_bytes + 4 * 1024 * 1024)
+	{
+		++g_failures;
+		std::printf("FAIL private bytes grew by %u KB\n", static_cast<unsigned>((last_bytes - first_bytes) / 1024));
+	}
+
+	std::printf(g_failures ? "FAILED\n" : "PASSED\n");
+	return g_failures ? 1 : 0;
+}
@@ -0,0 +1,177 @@
+/*
+* Copyright 2013 Sveriges Television AB http://casparcg.com/
+*
+* This file is part of CasparCG (www.casparcg.com).
+*
+* CasparCG is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* CasparCG is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with CasparCG. If not, see <http://www.gnu.org/licenses/>.
+*
+* Author: Robert Nagy, ronag89@gmail.com
+*/
+
+// Measures the cpu time make_write_frame spends per 10 bit yuv frame, before and after the
+// ycbcr10 and ycbcra10 pixel formats.
+//
+// For 1080 and 2160 line yuv422p10 and yuv420p10 frames three paths are timed on one thread:
+//
+//	- sws 8 bit, the previous path, sws_scale to the 8 bit format with the same subsampling,
+//	- sws bgra, the path of formats the mixer cannot take, sws_scale to BGRA,
+//	- native, the current path, the 16 bit planes copied into the upload buffers as they are,
+//	  the conversion to rgb then being done by the image shader.
+//
+// Each path uses the flags make_write_frame uses. Times are the average over a number of frames.
+//
+// Exits with 0 if the native path was faster than both sws paths for every frame size and 1
+// otherwise. See test/README.txt for how to build it.
+
+#include <tbb/tick_count.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+extern "C"
+{
+	#define __STDC_CONSTANT_MACROS
+	#define __STDC_LIMIT_MACROS
+	#include <libavutil/imgutils.h>
+	#include <libavutil/pixdesc.h>
+	#include <libswscale/swscale.h>
+}
+
+namespace {
+
+struct picture
+{
+	uint8_t*	data[4];
+	int			linesize[4];
+	int			size;
+
+	picture(int width, int height, AVPixelFormat pix_fmt)
+	{
+		size = av_image_alloc(data, linesize, width, height, pix_fmt, 32);
+	}
+
+	~picture()
+	{
+		av_freep(&data[0]);
+	}
+};
+
+// Gradients with some noise, in the 10 bit limited range.
+void fill(picture& source, int width, int height, AVPixelFormat pix_fmt)
+{
+	const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(pix_fmt);
+	unsigned int seed = 1;
+	for(int plane = 0; plane < 3; ++plane)
+	{
+		const int plane_width	= plane == 0 ? width : AV_CEIL_RSHIFT(width, desc->log2_chroma_w);
+		const int plane_height	= plane == 0 ? height : AV_CEIL_RSHIFT(height, desc->log2_chroma_h);
+		for(int y = 0; y < plane_height; ++y)
+		{
+			uint16_t* row = reinterpret_cast<uint16_t*>(source.data[plane] + y * source.linesize[plane]);
+			for(int x = 0; x < plane_width; ++x)
+			{
+				seed = seed * 1103515245 + 12345;
+				row[x] = static_cast<uint16_t>(64 + ((x + y) * 876) / (plane_width + plane_height) + (seed >> 29));
+			}
+		}
+	}
+}
+
+template<typename F>
+double millis_per_frame(int iterations, const F& func)
+{
+	func(); // Warm up.
+	const auto start = tbb::tick_count::now();
+	for(int n = 0; n < iterations; ++n)
+		func();
+	return (tbb::tick_count::now() - start).seconds() * 1000.0 / iterations;
+}
+
+double time_sws(const picture& source, int width, int height, AVPixelFormat pix_fmt, AVPixelFormat target_pix_fmt, int iterations)
+{
+	picture target(width, height, target_pix_fmt);
+	SwsContext* sws = sws_getContext(width, height, pix_fmt, width, height, target_pix_fmt, SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+
+	const double millis = millis_per_frame(iterations, [&]
+	{
+		sws_scale(sws, source.data, source.linesize, 0, height, target.data, target.linesize);
+	});
+
+	sws_freeContext(sws);
+	return millis;
+}
+
+// As make_write_frame copies the planes of formats the mixer takes.
+double time_native(const picture& source, int width, int height, AVPixelFormat pix_fmt, int iterations)
+{
+	picture target(width, height, pix_fmt);
+	const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(pix_fmt);
+
+	return millis_per_frame(iterations, [&]
+	{
+		for(int plane = 0; plane < 3; ++plane)
+		{
+			const int plane_height = plane == 0 ? height : AV_CEIL_RSHIFT(height, desc->log2_chroma_h);
+			std::memcpy(target.data[plane], source.data[plane], source.linesize[plane] * plane_height);
+		}
+	});
+}
+
+bool run(int width, int height, AVPixelFormat pix_fmt, AVPixelFormat eight_bit_pix_fmt, int iterations)
+{
+	picture source(width, height, pix_fmt);
+	if(source.size < 0)
+	{
+		std::printf("FAIL could not allocate a %dx%d frame\n", width, height);
+		return false;
+	}
+	fill(source, width, height, pix_fmt);
+
+	const double sws_8bit	= time_sws(source, width, height, pix_fmt, eight_bit_pix_fmt, iterations);
+	const double sws_bgra	= time_sws(source, width, height, pix_fmt, AV_PIX_FMT_BGRA, iterations);
+	const double native		= time_native(source, width, height, pix_fmt, iterations);
+
+	std::printf("%4dx%-4d %-10s  sws 8 bit %7.2f ms  sws bgra %7.2f ms  native %6.2f ms  (%4.1fx, %4.1fx)\n",
+		width, height, av_get_pix_fmt_name(pix_fmt), sws_8bit, sws_bgra, native, sws_8bit / native, sws_bgra / native);
+
+	const bool passed = native < sws_8bit && native < sws_bgra;
+	if(!passed)
+		std::printf("FAIL the native path is not faster than sws\n");
+	return passed;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	int iterations = 50;
+	for(int n = 1; n < argc; ++n)
+	{
+		if(std::string(argv[n]) == "--iterations" && n + 1 < argc)
+			iterations = std::max(1, std::atoi(argv[++n]));
+	}
+
+	bool passed = true;
+	passed = run(1920, 1080, AV_PIX_FMT_YUV422P10, AV_PIX_FMT_YUV422P, iterations) && passed;
+	passed = run(1920, 1080, AV_PIX_FMT_YUV420P10, AV_PIX_FMT_YUV420P, iterations) && passed;
+	passed = run(3840, 2160, AV_PIX_FMT_YUV422P10, AV_PIX_FMT_YUV422P, iterations) && passed;
+	passed = run(3840, 2160, AV_PIX_FMT_YUV420P10, AV_PIX_FMT_YUV420P, iterations) && passed;
+
+	std::printf(passed ? "PASSED\n" : "FAILED\n");
+	return passed ? 0 : 1;
+}